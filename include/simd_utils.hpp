@@ -14,4 +14,26 @@ namespace simd
     [[nodiscard]] std::optional<std::size_t> find_prev_nonzero(
         std::span<uint64_t const> words, std::size_t start_word) noexcept;
 
+    // Writes the position of every set bit in `words` to `out` in
+    // ascending order and returns how many there are. `out` must have room
+    // for words.size() * 64 entries even when fewer bits are set, since
+    // whole blocks of positions are stored at once; words.size() is at
+    // most 1024.
+    [[nodiscard]] std::size_t set_bit_positions(
+        std::span<uint64_t const> words, uint16_t *out) noexcept;
+
+    // Word-wise `dst op= src` over the first dst.size() words of `src`.
+    void or_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept;
+
+    void and_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept;
+
+    // dst &= ~src
+    void andnot_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept;
+
+    void xor_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept;
+
 } // namespace simd
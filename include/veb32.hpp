@@ -1,10 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <functional>
+#include <istream>
 #include <optional>
+#include <ostream>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include "veb_branch.hpp"
+#include "veb_iterator.hpp"
+#include "veb_snapshot.hpp"
 
 class VebTree32
 {
@@ -12,24 +21,188 @@ public:
     using Key = VebTop32::Key;
     static constexpr unsigned SUBTREE_BITS = VebTop32::SUBTREE_BITS;
     static constexpr Key MAX_KEY = VebTop32::MAX_KEY;
+    using const_iterator = VebIterator<VebTop32>;
+    using iterator = const_iterator;
 
     VebTree32() = default;
 
+    // Builds a tree from strictly ascending keys without going through
+    // insert, which is much cheaper when loading a sorted snapshot.
+    static VebTree32 from_sorted(std::span<Key const> keys)
+    {
+        assert(
+            std::adjacent_find(
+                keys.begin(), keys.end(), std::greater_equal<>()) ==
+            keys.end());
+        VebTree32 tree;
+        tree.root_.build_sorted(keys.begin(), keys.end());
+        return tree;
+    }
+
+    // Reads a tree written by save(). Throws std::runtime_error if the
+    // input is not a snapshot of a 32-bit tree or ends early.
+    static VebTree32 load(std::istream &in)
+    {
+        VebTree32 tree;
+        veb_detail::load_snapshot(tree.root_, in);
+        return tree;
+    }
+
+    // Writes the tree as a binary snapshot: node layout and leaf words,
+    // not one record per key, so load() skips the insert path entirely.
+    void save(std::ostream &out) const
+    {
+        veb_detail::save_snapshot(root_, out);
+    }
+
     bool empty() const noexcept
     {
         return root_.empty();
     }
 
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return root_.size();
+    }
+
+    // Bytes the tree holds, by what they are spent on, and its node count
+    // per level.
+    [[nodiscard]] veb_detail::MemoryUsage memory_usage() const noexcept
+    {
+        return root_.memory_usage();
+    }
+
+    // Number of keys strictly below `key`.
+    [[nodiscard]] PARVEB_ISA_CLONES std::size_t rank(Key key) const noexcept
+    {
+        return root_.rank(key);
+    }
+
+    // The key with rank `k` (0-based), if the tree holds more than `k` keys.
+    [[nodiscard]] PARVEB_ISA_CLONES std::optional<Key>
+    select(std::size_t k) const noexcept
+    {
+        return root_.select(k);
+    }
+
+    // Number of keys in [lo, hi].
+    [[nodiscard]] PARVEB_ISA_CLONES std::size_t
+    count_range(Key lo, Key hi) const noexcept
+    {
+        return root_.count_range(lo, hi);
+    }
+
     void insert(Key key)
     {
         root_.insert(key);
     }
 
+    void batch_insert(std::span<Key const> keys)
+    {
+        root_.batch_insert(keys);
+    }
+
+    // Inserts keys using up to `thread_count` threads (0 = one per hardware
+    // thread).
+    void parallel_insert(std::span<Key const> keys, unsigned thread_count)
+    {
+        root_.parallel_insert(keys, thread_count);
+    }
+
     void erase(Key key) noexcept
     {
         root_.erase(key);
     }
 
+    void batch_erase(std::span<Key const> keys)
+    {
+        root_.batch_erase(keys);
+    }
+
+    // Erases every key in [lo, hi] and returns how many were removed.
+    // Clusters wholly inside the range are released without visiting
+    // their keys.
+    std::size_t erase_range(Key lo, Key hi)
+    {
+        return root_.erase_range(lo, hi);
+    }
+
+    // Erases every key below `key`, e.g. to trim entries older than a
+    // cutoff.
+    std::size_t erase_below(Key key)
+    {
+        if (key == 0) {
+            return 0;
+        }
+        return root_.erase_range(Key{0}, static_cast<Key>(key - 1));
+    }
+
+    // Removes every key. Nodes go back to the tree's slabs in bulk rather
+    // than one at a time.
+    void clear() noexcept
+    {
+        root_.clear();
+    }
+
+    // In-place set algebra. Regions present in only one tree are adopted
+    // or released whole; shared clusters recurse down to leaf words.
+    void union_with(VebTree32 const &other)
+    {
+        root_.union_with(other.root_);
+    }
+
+    void intersect_with(VebTree32 const &other)
+    {
+        root_.intersect_with(other.root_);
+    }
+
+    void difference_with(VebTree32 const &other)
+    {
+        root_.difference_with(other.root_);
+    }
+
+    void symmetric_difference_with(VebTree32 const &other)
+    {
+        root_.symmetric_difference_with(other.root_);
+    }
+
+    // Out-of-place forms. Each copies one operand, picking the one that
+    // leaves the least work for the in-place operation.
+    [[nodiscard]] static VebTree32
+    set_union(VebTree32 const &a, VebTree32 const &b)
+    {
+        bool a_larger = a.size() >= b.size();
+        VebTree32 result = a_larger ? a : b;
+        result.union_with(a_larger ? b : a);
+        return result;
+    }
+
+    [[nodiscard]] static VebTree32
+    set_intersection(VebTree32 const &a, VebTree32 const &b)
+    {
+        bool a_smaller = a.size() <= b.size();
+        VebTree32 result = a_smaller ? a : b;
+        result.intersect_with(a_smaller ? b : a);
+        return result;
+    }
+
+    [[nodiscard]] static VebTree32
+    set_difference(VebTree32 const &a, VebTree32 const &b)
+    {
+        VebTree32 result = a;
+        result.difference_with(b);
+        return result;
+    }
+
+    [[nodiscard]] static VebTree32
+    symmetric_difference(VebTree32 const &a, VebTree32 const &b)
+    {
+        bool a_larger = a.size() >= b.size();
+        VebTree32 result = a_larger ? a : b;
+        result.symmetric_difference_with(a_larger ? b : a);
+        return result;
+    }
+
     bool contains(Key key) const noexcept
     {
         return root_.contains(key);
@@ -45,25 +218,124 @@ public:
         return root_.max();
     }
 
-    std::optional<Key> successor(Key key) const noexcept
+    PARVEB_ISA_CLONES std::optional<Key> successor(Key key) const noexcept
     {
         return root_.successor(key);
     }
 
-    std::optional<Key> predecessor(Key key) const noexcept
+    PARVEB_ISA_CLONES std::optional<Key> predecessor(Key key) const noexcept
     {
         return root_.predecessor(key);
     }
 
+    // Same queries returning `none` when there is no answer. `none` must be
+    // a value the caller can tell apart from a real answer. 0 always works
+    // for successor_or and MAX_KEY for predecessor_or, as neither can be
+    // returned as a result there. min_or and max_or can return any key and
+    // Key has no value above MAX_KEY, so check empty() before calling them.
+    Key min_or(Key none) const noexcept
+    {
+        return root_.min_or(none);
+    }
+
+    Key max_or(Key none) const noexcept
+    {
+        return root_.max_or(none);
+    }
+
+    PARVEB_ISA_CLONES Key successor_or(Key key, Key none) const noexcept
+    {
+        return root_.successor_or(key, none);
+    }
+
+    PARVEB_ISA_CLONES Key predecessor_or(Key key, Key none) const noexcept
+    {
+        return root_.predecessor_or(key, none);
+    }
+
+    void contains_batch(
+        std::span<Key const> keys, std::span<bool> out) const noexcept
+    {
+        root_.contains_batch(keys, out);
+    }
+
+    PARVEB_ISA_CLONES void successor_batch(
+        std::span<Key const> keys,
+        std::span<std::optional<Key>> out) const noexcept
+    {
+        root_.successor_batch(keys, out);
+    }
+
+    PARVEB_ISA_CLONES void predecessor_batch(
+        std::span<Key const> keys,
+        std::span<std::optional<Key>> out) const noexcept
+    {
+        root_.predecessor_batch(keys, out);
+    }
+
     template <class Fn>
     void for_each(Fn &&fn) const
     {
         root_.for_each(std::forward<Fn>(fn));
     }
 
+    // Visits the keys in [lo, hi] in ascending order.
+    template <class Fn>
+    void for_each_range(Key lo, Key hi, Fn &&fn) const
+    {
+        root_.for_each_range(lo, hi, std::forward<Fn>(fn));
+    }
+
+    // Scans contiguous cluster ranges on up to `thread_count` threads (0 =
+    // one per hardware thread). Keys within a range arrive in order on one
+    // thread; fn must be safe to call from several ranges at once.
+    template <class Fn>
+    void parallel_for_each(Fn &&fn, unsigned thread_count = 0) const
+    {
+        root_.parallel_for_each(std::forward<Fn>(fn), thread_count);
+    }
+
+    // Folds each range with fold(acc, key) and combines the range results
+    // in key order with combine(lhs, rhs).
+    template <class T, class Fold, class Combine>
+    T parallel_reduce(
+        T identity, Fold fold, Combine combine,
+        unsigned thread_count = 0) const
+    {
+        return root_.parallel_reduce(
+            std::move(identity),
+            std::move(fold),
+            std::move(combine),
+            thread_count);
+    }
+
+    // Ordered iteration; iterators are invalidated by any modification.
+    [[nodiscard]] const_iterator begin() const noexcept
+    {
+        return const_iterator::begin(root_);
+    }
+
+    [[nodiscard]] const_iterator end() const noexcept
+    {
+        return const_iterator::end(root_);
+    }
+
+    // First key not below `key`.
+    [[nodiscard]] const_iterator lower_bound(Key key) const noexcept
+    {
+        return const_iterator::lower_bound(root_, key);
+    }
+
+    // First key above `key`.
+    [[nodiscard]] const_iterator upper_bound(Key key) const noexcept
+    {
+        return const_iterator::upper_bound(root_, key);
+    }
+
     std::vector<Key> to_vector() const
     {
         std::vector<Key> out;
+        out.reserve(root_.size());
         root_.for_each([&](Key k) { out.push_back(k); });
         return out;
     }
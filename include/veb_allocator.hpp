@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace veb_detail
+{
+
+    // Per-tree store for nodes of one type, carved from slabs. The first
+    // slab is small and each new one doubles up to SLAB_BYTES, so a tree
+    // of a few keys does not pay for a full slab per node type. Freed
+    // slots go on a free list and are reused first. release() tears every
+    // node down in one pass over the slabs, so dropping a tree costs a
+    // handful of frees instead of one per node.
+    template <class T>
+    class SlabPool
+    {
+        struct Slot
+        {
+            union
+            {
+                Slot *next;
+                alignas(T) std::byte storage[sizeof(T)];
+            };
+            bool live;
+        };
+
+        static constexpr std::size_t FIRST_SLAB_BYTES = 512;
+        static constexpr std::size_t SLAB_BYTES = std::size_t{64} << 10;
+        static constexpr std::size_t FIRST_SLAB_SLOTS =
+            std::max<std::size_t>(1, FIRST_SLAB_BYTES / sizeof(Slot));
+        static constexpr std::size_t SLAB_SLOTS =
+            std::max<std::size_t>(1, SLAB_BYTES / sizeof(Slot));
+
+        // Slots in the slab allocated after one of `slots` slots.
+        static constexpr std::size_t next_slab_slots(std::size_t slots)
+        {
+            return std::min(SLAB_SLOTS, slots * 2);
+        }
+
+    public:
+        // Deleter for node handles: a node's memory belongs to the pool,
+        // so dropping a handle frees nothing.
+        struct Unowned
+        {
+            void operator()(T *) const noexcept {}
+        };
+
+        SlabPool() = default;
+        SlabPool(SlabPool const &) = delete;
+        SlabPool &operator=(SlabPool const &) = delete;
+
+        ~SlabPool()
+        {
+            release();
+        }
+
+        template <class... Args>
+        [[nodiscard]] T *make(Args &&...args)
+        {
+            Slot *slot = acquire();
+            T *node;
+            try {
+                node = ::new (static_cast<void *>(slot->storage))
+                    T(std::forward<Args>(args)...);
+            }
+            catch (...) {
+                recycle(slot);
+                throw;
+            }
+            slot->live = true;
+            return node;
+        }
+
+        // Destroys `node` and keeps its slot for reuse. Nodes it points to
+        // are not touched.
+        void destroy(T *node) noexcept
+        {
+            if (!node) {
+                return;
+            }
+            node->~T();
+            recycle(reinterpret_cast<Slot *>(node));
+        }
+
+        // Destroys every live node and returns all slabs.
+        void release() noexcept
+        {
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                std::size_t slots = FIRST_SLAB_SLOTS;
+                for (std::size_t s = 0; s < slabs_.size(); ++s) {
+                    std::size_t used = s + 1 == slabs_.size() ? bump_ : slots;
+                    for (std::size_t i = 0; i < used; ++i) {
+                        Slot &slot = slabs_[s][i];
+                        if (slot.live) {
+                            std::launder(reinterpret_cast<T *>(slot.storage))
+                                ->~T();
+                        }
+                    }
+                    slots = next_slab_slots(slots);
+                }
+            }
+            slabs_ = decltype(slabs_){};
+            free_ = nullptr;
+            bump_ = 0;
+            slab_slots_ = 0;
+            reserved_slots_ = 0;
+            live_ = 0;
+        }
+
+        [[nodiscard]] std::size_t live() const noexcept
+        {
+            return live_;
+        }
+
+        [[nodiscard]] std::size_t reserved_bytes() const noexcept
+        {
+            return reserved_slots_ * sizeof(Slot);
+        }
+
+        // Heap held beyond the live nodes themselves: free and never used
+        // slots, each slot's header and padding, and the slab list.
+        [[nodiscard]] std::size_t idle_bytes() const noexcept
+        {
+            return reserved_bytes() - live_ * sizeof(T) +
+                   slabs_.capacity() * sizeof(slabs_[0]);
+        }
+
+        // While shared, make() and destroy() may be called from several
+        // threads at once. Calls nest.
+        void share(int delta) noexcept
+        {
+            shared_.fetch_add(delta, std::memory_order_relaxed);
+        }
+
+    private:
+        Slot *acquire()
+        {
+            if (shared_.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard lock(mutex_);
+                return acquire_unlocked();
+            }
+            return acquire_unlocked();
+        }
+
+        Slot *acquire_unlocked()
+        {
+            ++live_;
+            if (free_) {
+                return std::exchange(free_, free_->next);
+            }
+            if (bump_ == slab_slots_) {
+                std::size_t slots = slab_slots_ == 0
+                                        ? FIRST_SLAB_SLOTS
+                                        : next_slab_slots(slab_slots_);
+                try {
+                    slabs_.push_back(
+                        std::make_unique_for_overwrite<Slot[]>(slots));
+                }
+                catch (...) {
+                    --live_;
+                    throw;
+                }
+                bump_ = 0;
+                slab_slots_ = slots;
+                reserved_slots_ += slots;
+            }
+            return &slabs_.back()[bump_++];
+        }
+
+        void recycle(Slot *slot) noexcept
+        {
+            auto push = [&] {
+                slot->live = false;
+                slot->next = free_;
+                free_ = slot;
+                --live_;
+            };
+            if (shared_.load(std::memory_order_relaxed) > 0) {
+                std::lock_guard lock(mutex_);
+                push();
+            }
+            else {
+                push();
+            }
+        }
+
+        std::vector<std::unique_ptr<Slot[]>> slabs_{};
+        Slot *free_ = nullptr;
+        // Slots handed out from, and the size of, the newest slab, and the
+        // slots across all slabs.
+        std::size_t bump_ = 0;
+        std::size_t slab_slots_ = 0;
+        std::size_t reserved_slots_ = 0;
+        std::size_t live_ = 0;
+        std::atomic<int> shared_{0};
+        std::mutex mutex_{};
+    };
+
+    // One heap allocation per node; handles own their nodes, so a subtree
+    // is freed by the recursive destructors.
+    template <class T>
+    class HeapPool
+    {
+    public:
+        template <class... Args>
+        [[nodiscard]] T *make(Args &&...args)
+        {
+            return new T(std::forward<Args>(args)...);
+        }
+
+        void destroy(T *node) noexcept
+        {
+            delete node;
+        }
+
+        void release() noexcept {}
+
+        [[nodiscard]] std::size_t idle_bytes() const noexcept
+        {
+            return 0;
+        }
+
+        void share(int) noexcept {}
+    };
+
+    // Node allocation policies for VebBranch. A policy names the per-tree
+    // pool for each node type and the handle a parent holds its children
+    // by. With BULK_RELEASE the handles do not own their nodes; the root
+    // frees everything through its pools instead.
+    struct SlabNodes
+    {
+        template <class T>
+        using Pool = SlabPool<T>;
+        template <class T>
+        using Ptr = std::unique_ptr<T, typename SlabPool<T>::Unowned>;
+        static constexpr bool BULK_RELEASE = true;
+    };
+
+    struct HeapNodes
+    {
+        template <class T>
+        using Pool = HeapPool<T>;
+        template <class T>
+        using Ptr = std::unique_ptr<T>;
+        static constexpr bool BULK_RELEASE = false;
+    };
+
+    // Pools below a leaf level: there is nothing to allocate.
+    struct NoPools
+    {
+        void share(int) noexcept {}
+        void release() noexcept {}
+
+        [[nodiscard]] std::size_t idle_bytes() const noexcept
+        {
+            return 0;
+        }
+    };
+
+    // Pointer from a node to the pools it allocates from. It is cleared
+    // when moved from, because the pools move with the tree.
+    template <class Pools>
+    class PoolsRef
+    {
+    public:
+        PoolsRef() = default;
+
+        explicit PoolsRef(Pools *pools) noexcept : pools_(pools) {}
+
+        PoolsRef(PoolsRef const &) = delete;
+        PoolsRef &operator=(PoolsRef const &) = delete;
+
+        PoolsRef(PoolsRef &&other) noexcept
+            : pools_(std::exchange(other.pools_, nullptr))
+        {
+        }
+
+        PoolsRef &operator=(PoolsRef &&other) noexcept
+        {
+            pools_ = std::exchange(other.pools_, nullptr);
+            return *this;
+        }
+
+        [[nodiscard]] Pools *get() const noexcept
+        {
+            return pools_;
+        }
+
+    private:
+        Pools *pools_ = nullptr;
+    };
+
+    // Marks the pools under a node as shared for the lifetime of the guard.
+    template <class Pools>
+    class SharedPools
+    {
+    public:
+        explicit SharedPools(Pools &pools) noexcept : pools_(pools)
+        {
+            pools_.share(1);
+        }
+
+        SharedPools(SharedPools const &) = delete;
+        SharedPools &operator=(SharedPools const &) = delete;
+
+        ~SharedPools()
+        {
+            pools_.share(-1);
+        }
+
+    private:
+        Pools &pools_;
+    };
+
+} // namespace veb_detail
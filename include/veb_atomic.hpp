@@ -0,0 +1,394 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "veb_branch_detail.hpp"
+
+// Outcome of an insert or erase on an atomic leaf. `transition` is set
+// when the update may have moved the leaf between empty and non-empty,
+// which is the only time a parent has to touch its summary.
+struct AtomicLeafUpdate
+{
+    bool changed = false;
+    bool transition = false;
+};
+
+// VebLeaf6 whose word is updated with fetch_or/fetch_and, so any number
+// of threads may insert and erase concurrently. Every query reads the
+// word once and is exact for that moment.
+class AtomicVebLeaf6
+{
+public:
+    using Key = uint8_t;
+    static constexpr unsigned SUBTREE_BITS = 6;
+    static constexpr Key SUBTREE_SIZE = Key(1) << SUBTREE_BITS;
+    static constexpr Key MAX_KEY = SUBTREE_SIZE - 1;
+
+    AtomicLeafUpdate insert(Key x) noexcept
+    {
+        uint64_t mask = uint64_t(1) << x;
+        uint64_t old = bits_.fetch_or(mask);
+        return {(old & mask) == 0, old == 0};
+    }
+
+    AtomicLeafUpdate erase(Key x) noexcept
+    {
+        uint64_t mask = uint64_t(1) << x;
+        uint64_t old = bits_.fetch_and(~mask);
+        return {(old & mask) != 0, old == mask};
+    }
+
+    [[nodiscard]] bool contains(Key x) const noexcept
+    {
+        return (bits_.load() >> x) & 1;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return bits_.load() == 0;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return static_cast<std::size_t>(std::popcount(bits_.load()));
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        uint64_t bits = bits_.load();
+        if (!bits) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(std::countr_zero(bits));
+    }
+
+    [[nodiscard]] std::optional<Key> max() const noexcept
+    {
+        uint64_t bits = bits_.load();
+        if (!bits) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(63 - std::countl_zero(bits));
+    }
+
+    [[nodiscard]] std::optional<Key> successor(Key x) const noexcept
+    {
+        if (x == 63) {
+            return std::nullopt;
+        }
+        uint64_t mask = bits_.load() & (~0ull << (x + 1));
+        if (!mask) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(std::countr_zero(mask));
+    }
+
+    [[nodiscard]] std::optional<Key> predecessor(Key x) const noexcept
+    {
+        if (x == 0) {
+            return std::nullopt;
+        }
+        uint64_t mask = bits_.load() & ((uint64_t(1) << x) - 1);
+        if (!mask) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(63 - std::countl_zero(mask));
+    }
+
+    template <class Out, class Fn>
+    void for_each(Out prefix, Fn &&fn) const
+    {
+        for (uint64_t bits = bits_.load(); bits != 0; bits &= bits - 1) {
+            fn(static_cast<Out>(prefix | Out(std::countr_zero(bits))));
+        }
+    }
+
+private:
+    std::atomic<uint64_t> bits_{0};
+};
+
+// VebLeaf8 with atomic words. A 256-bit leaf cannot change emptiness in
+// one atomic step, so the leaf also counts its keys. An insert raises the
+// count before setting its bit and lowers it again if the bit was already
+// set; an erase lowers it only after clearing its bit. The count thus
+// never falls below the number of keys and is zero only when the leaf is
+// empty. The transitions are the count's moves to and from zero, which
+// may come from an insert that found its key present. empty() follows
+// the count; size() and the other queries read the words. Padded to a
+// cache line so writers to neighbouring leaves do not share one.
+class alignas(veb_detail::CACHE_LINE_BYTES) AtomicVebLeaf8
+{
+public:
+    using Key = uint16_t;
+    static constexpr unsigned SUBTREE_BITS = 8;
+    static constexpr Key SUBTREE_SIZE = Key(1) << SUBTREE_BITS;
+    static constexpr Key MAX_KEY = SUBTREE_SIZE - 1;
+
+    AtomicLeafUpdate insert(Key x) noexcept
+    {
+        bool was_empty = count_.fetch_add(1) == 0;
+        uint64_t mask = uint64_t(1) << (x & 63);
+        if (words_[x >> 6].fetch_or(mask) & mask) {
+            return {false, count_.fetch_sub(1) == 1 || was_empty};
+        }
+        return {true, was_empty};
+    }
+
+    AtomicLeafUpdate erase(Key x) noexcept
+    {
+        uint64_t mask = uint64_t(1) << (x & 63);
+        if (!(words_[x >> 6].fetch_and(~mask) & mask)) {
+            return {};
+        }
+        return {true, count_.fetch_sub(1) == 1};
+    }
+
+    [[nodiscard]] bool contains(Key x) const noexcept
+    {
+        return (words_[x >> 6].load() >> (x & 63)) & 1;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return count_.load() == 0;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        std::size_t n = 0;
+        for (auto const &word : words_) {
+            n += static_cast<std::size_t>(std::popcount(word.load()));
+        }
+        return n;
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        return first_from(0, ~0ull);
+    }
+
+    [[nodiscard]] std::optional<Key> max() const noexcept
+    {
+        return last_from(WORD_COUNT - 1, ~0ull);
+    }
+
+    [[nodiscard]] std::optional<Key> successor(Key x) const noexcept
+    {
+        if (x == MAX_KEY) {
+            return std::nullopt;
+        }
+        unsigned next = x + 1u;
+        return first_from(next >> 6, ~0ull << (next & 63));
+    }
+
+    [[nodiscard]] std::optional<Key> predecessor(Key x) const noexcept
+    {
+        if (x == 0) {
+            return std::nullopt;
+        }
+        unsigned prev = x - 1u;
+        return last_from(prev >> 6, ~0ull >> (63 - (prev & 63)));
+    }
+
+    template <class Out, class Fn>
+    void for_each(Out prefix, Fn &&fn) const
+    {
+        for (unsigned i = 0; i < WORD_COUNT; ++i) {
+            for (uint64_t word = words_[i].load(); word != 0;
+                 word &= word - 1) {
+                fn(static_cast<Out>(
+                    prefix | Out(i * 64 + std::countr_zero(word))));
+            }
+        }
+    }
+
+private:
+    static constexpr unsigned WORD_COUNT = 4;
+
+    // First key in word `i` under `mask`, or in any later word.
+    [[nodiscard]] std::optional<Key>
+    first_from(unsigned i, uint64_t mask) const noexcept
+    {
+        for (; i < WORD_COUNT; ++i, mask = ~0ull) {
+            if (uint64_t word = words_[i].load() & mask) {
+                return static_cast<Key>(i * 64 + std::countr_zero(word));
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Last key in word `i` under `mask`, or in any earlier word.
+    [[nodiscard]] std::optional<Key>
+    last_from(unsigned i, uint64_t mask) const noexcept
+    {
+        for (unsigned w = i + 1; w-- > 0; mask = ~0ull) {
+            if (uint64_t word = words_[w].load() & mask) {
+                return static_cast<Key>(w * 64 + 63 - std::countl_zero(word));
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::array<std::atomic<uint64_t>, WORD_COUNT> words_{};
+    std::atomic<uint32_t> count_{0};
+};
+
+// Two-level tree of atomic leaves (12 bits over AtomicVebLeaf6, 16 over
+// AtomicVebLeaf8) with no locks: writers to different leaves never
+// touch the same word, and the summary is written only on a leaf's
+// empty/non-empty transitions.
+//
+// Updates are linearizable, and so are contains and queries answered
+// inside one leaf. After a transition the writer syncs the summary bit
+// with the leaf, and a cleared bit is always re-checked, so a leaf that
+// was refilled meanwhile gets its bit back. The summary may name an
+// empty leaf, which queries skip; a query that moves between leaves while
+// a bit is briefly cleared can miss the refilled leaf.
+template <class Leaf>
+class AtomicVebBranch
+{
+public:
+    static constexpr unsigned CLUSTER_BITS = Leaf::SUBTREE_BITS;
+    static constexpr unsigned SUBTREE_BITS = 2 * CLUSTER_BITS;
+    using Key = typename veb_detail::key_type_for_bits<SUBTREE_BITS>::type;
+    static constexpr Key MAX_KEY = Key((1u << SUBTREE_BITS) - 1);
+
+    // Returns true when `key` was not present before.
+    bool insert(Key key) noexcept
+    {
+        auto [hi, lo] = split(key);
+        AtomicLeafUpdate update = clusters_[hi].insert(lo);
+        if (update.transition) {
+            sync_summary(hi);
+        }
+        return update.changed;
+    }
+
+    // Returns true when `key` was present before.
+    bool erase(Key key) noexcept
+    {
+        auto [hi, lo] = split(key);
+        AtomicLeafUpdate update = clusters_[hi].erase(lo);
+        if (update.transition) {
+            sync_summary(hi);
+        }
+        return update.changed;
+    }
+
+    [[nodiscard]] bool contains(Key key) const noexcept
+    {
+        auto [hi, lo] = split(key);
+        return clusters_[hi].contains(lo);
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return !min().has_value();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        std::size_t n = 0;
+        summary_.for_each(
+            ChildKey{0}, [&](ChildKey hi) { n += clusters_[hi].size(); });
+        return n;
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        for (auto hi = summary_.min(); hi; hi = summary_.successor(*hi)) {
+            if (auto lo = clusters_[*hi].min()) {
+                return combine(*hi, *lo);
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key> max() const noexcept
+    {
+        for (auto hi = summary_.max(); hi; hi = summary_.predecessor(*hi)) {
+            if (auto lo = clusters_[*hi].max()) {
+                return combine(*hi, *lo);
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key> successor(Key key) const noexcept
+    {
+        auto [hi, lo] = split(key);
+        if (auto next = clusters_[hi].successor(lo)) {
+            return combine(hi, *next);
+        }
+        for (auto h = summary_.successor(hi); h; h = summary_.successor(*h)) {
+            if (auto next = clusters_[*h].min()) {
+                return combine(*h, *next);
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key> predecessor(Key key) const noexcept
+    {
+        auto [hi, lo] = split(key);
+        if (auto prev = clusters_[hi].predecessor(lo)) {
+            return combine(hi, *prev);
+        }
+        for (auto h = summary_.predecessor(hi); h;
+             h = summary_.predecessor(*h)) {
+            if (auto prev = clusters_[*h].max()) {
+                return combine(*h, *prev);
+            }
+        }
+        return std::nullopt;
+    }
+
+    template <class Fn>
+    void for_each(Fn &&fn) const
+    {
+        summary_.for_each(ChildKey{0}, [&](ChildKey hi) {
+            clusters_[hi].for_each(Key(Key(hi) << CLUSTER_BITS), fn);
+        });
+    }
+
+private:
+    using ChildKey = typename Leaf::Key;
+
+    [[nodiscard]] static std::pair<ChildKey, ChildKey> split(Key key) noexcept
+    {
+        return {
+            static_cast<ChildKey>(key >> CLUSTER_BITS),
+            static_cast<ChildKey>(key & Leaf::MAX_KEY)};
+    }
+
+    [[nodiscard]] static Key combine(ChildKey hi, ChildKey lo) noexcept
+    {
+        return static_cast<Key>((Key(hi) << CLUSTER_BITS) | lo);
+    }
+
+    // Brings the summary bit for leaf `hi` in line with the leaf. Syncs
+    // can race; the re-check after a clear keeps a late clear from hiding
+    // a non-empty leaf.
+    void sync_summary(ChildKey hi) noexcept
+    {
+        if (clusters_[hi].empty()) {
+            summary_.erase(hi);
+            if (clusters_[hi].empty()) {
+                return;
+            }
+        }
+        summary_.insert(hi);
+    }
+
+    Leaf summary_;
+    std::array<Leaf, Leaf::SUBTREE_SIZE> clusters_;
+};
+
+using AtomicVebBranch12 = AtomicVebBranch<AtomicVebLeaf6>;
+using AtomicVebBranch16 = AtomicVebBranch<AtomicVebLeaf8>;
@@ -17,3 +17,15 @@ using VebBranch48 = VebBranch<48>;
 using VebTop48 = VebBranch48;
 using VebBranch64 = VebBranch<64>;
 using VebTop64 = VebBranch64;
+// 48/64-bit trees whose inner sparse levels find clusters by rank rather
+// than by hash (see veb_cluster_map.hpp)
+using VebTop48Ranked = VebBranch<
+    48, true, veb_detail::SlabNodes, veb_detail::RankedClusters>;
+using VebTop64Ranked = VebBranch<
+    64, true, veb_detail::SlabNodes, veb_detail::RankedClusters>;
+// Dense roots whose cluster summary is one bitmap instead of a VebBranch12
+// or VebBranch16 (see veb_flat_summary.hpp)
+using VebTop24Flat = VebBranch<
+    24, false, veb_detail::SlabNodes, veb_detail::FlatSummaries<16>>;
+using VebTop32Flat = VebBranch<
+    32, false, veb_detail::SlabNodes, veb_detail::FlatSummaries<16>>;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <bit>
 #include <cassert>
@@ -7,25 +8,46 @@
 #include <cstdint>
 #include <limits>
 #include <memory>
+#include <iterator>
 #include <optional>
+#include <span>
 #include <utility>
+#include <vector>
 
 #include "veb_branch_detail.hpp"
+#include "veb_flat_summary.hpp"
 
-template <unsigned Bits, bool Sparse>
+template <unsigned Bits, bool Sparse, class Alloc, class Layout>
 class VebBranch;
 
 // Dense specialization (array-backed clusters).
-template <unsigned Bits>
-class VebBranch<Bits, false>
+template <unsigned Bits, class Alloc, class Layout>
+class VebBranch<Bits, false, Alloc, Layout>
 {
+    template <unsigned, bool, class, class>
+    friend class VebBranch;
+
     static_assert(Bits >= 8 && Bits % 2 == 0);
     static constexpr unsigned CLUSTER_BITS = Bits / 2;
-    using Child = typename veb_detail::ChildSelector<Bits, false>::type;
-    using Summary = Child;
+    using Child =
+        typename veb_detail::ChildSelector<Bits, false, Alloc, Layout>::type;
     using DenseMask = veb_detail::DenseBitset<CLUSTER_BITS>;
-    using ChildPtr = std::unique_ptr<Child>;
+    using ChildPools = veb_detail::child_pools_t<Child>;
+    using ChildPtr = typename Alloc::template Ptr<Child>;
     static constexpr bool INLINE_CHILDREN = (Bits <= 16);
+    static constexpr bool CHILD_IS_BRANCH =
+        !std::is_same_v<ChildPools, veb_detail::NoPools>;
+    // The summary is a Child unless the layout swaps a branch-sized one
+    // for a bitmap (see veb_flat_summary.hpp).
+    static constexpr bool FLAT_SUMMARY =
+        CHILD_IS_BRANCH &&
+        CLUSTER_BITS <= veb_detail::flat_summary_bits<Layout>();
+    using Summary = std::conditional_t<
+        FLAT_SUMMARY, veb_detail::FlatSummary<CLUSTER_BITS>, Child>;
+    using SummaryPtr = typename Alloc::template Ptr<Summary>;
+    using SummaryPool = std::conditional_t<
+        FLAT_SUMMARY, typename Alloc::template Pool<Summary>,
+        veb_detail::NoPools>;
 
 public:
     using Key = typename veb_detail::key_type_for_bits<Bits>::type;
@@ -40,68 +62,538 @@ public:
     }();
     static constexpr Key MAX = MAX_KEY;
     static constexpr unsigned FANOUT_BITS = CLUSTER_BITS;
+    // Node encoding in snapshots: bit i is set when the branches i levels
+    // down write their summary as a flat bitmap.
+    static constexpr uint64_t SNAPSHOT_LAYOUT = [] {
+        uint64_t own = FLAT_SUMMARY ? uint64_t{1} : uint64_t{0};
+        if constexpr (CHILD_IS_BRANCH) {
+            return own | Child::SNAPSHOT_LAYOUT << 1;
+        }
+        else {
+            return own;
+        }
+    }();
+
+    // Node pools shared by every node of one tree: `nodes` holds this
+    // level's children and summaries, `below` the levels under them, and
+    // `flat` this level's summaries when they are flat. The root owns
+    // them; every other node points at its level's share.
+    struct Pools
+    {
+        typename Alloc::template Pool<Child> nodes;
+        ChildPools below;
+        SummaryPool flat;
+
+        void share(int delta) noexcept
+        {
+            nodes.share(delta);
+            below.share(delta);
+            flat.share(delta);
+        }
+
+        void release() noexcept
+        {
+            nodes.release();
+            below.release();
+            flat.release();
+        }
+
+        [[nodiscard]] std::size_t idle_bytes() const noexcept
+        {
+            return nodes.idle_bytes() + below.idle_bytes() +
+                   flat.idle_bytes();
+        }
+    };
 
     VebBranch() = default;
 
+    // Node inside a tree, allocating from `pools`.
+    explicit VebBranch(Pools *pools) noexcept : pools_(pools) {}
+
+    // Deep copy: every cluster is cloned.
+    VebBranch(VebBranch const &other)
+    {
+        copy_from(other);
+    }
+
+    VebBranch(VebBranch const &other, Pools *pools) : pools_(pools)
+    {
+        copy_from(other);
+    }
+
+    VebBranch(VebBranch &&) noexcept = default;
+
+    VebBranch &operator=(VebBranch const &other)
+    {
+        if (this != &other) {
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    VebBranch &operator=(VebBranch &&) noexcept = default;
+
     bool empty() const noexcept
     {
         return !summary_;
     }
 
-    void insert(Key key)
+    // Removes every key. A root under a bulk-release policy hands its slabs
+    // back at once instead of walking the clusters.
+    void clear() noexcept
+    {
+        if constexpr (Alloc::BULK_RELEASE) {
+            if (own_pools_) {
+                forget_nodes();
+                own_pools_->release();
+                return;
+            }
+        }
+        release_nodes();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // Memory held by this branch and everything under it.
+    [[nodiscard]] veb_detail::MemoryUsage memory_usage() const noexcept
+    {
+        veb_detail::MemoryUsage usage;
+        add_memory_usage(usage, 0);
+        return usage;
+    }
+
+    // Adds this branch to `usage` as a node at `level`; a parent calls it
+    // for its clusters and summary.
+    void add_memory_usage(
+        veb_detail::MemoryUsage &usage, std::size_t level) const noexcept
+    {
+        ++usage.nodes[level];
+        if (own_pools_) {
+            usage.reserved_bytes += sizeof(Pools) + own_pools_->idle_bytes();
+        }
+        usage.branch_bytes +=
+            sizeof(*this) - sizeof(inline_value_) - sizeof(clusters_);
+        usage.inline_value_bytes +=
+            sizeof(inline_value_) + inline_value_.allocated_bytes();
+        if (index_) {
+            usage.index_bytes += sizeof(Index);
+        }
+        if constexpr (INLINE_CHILDREN) {
+            // Leaf children are part of the node whether in use or not.
+            usage.leaf_bytes += sizeof(clusters_);
+            cluster_mask_.for_each_set(
+                [&](unsigned) { ++usage.nodes[level + 1]; });
+        }
+        else {
+            usage.branch_bytes +=
+                sizeof(clusters_) + clusters_.allocated_bytes();
+            cluster_mask_.for_each_set([&](unsigned idx) {
+                veb_detail::add_memory_usage(
+                    *clusters_[idx], usage, level + 1);
+            });
+        }
+        if (summary_) {
+            veb_detail::MemoryUsage summary;
+            veb_detail::add_memory_usage(*summary_, summary, level + 1);
+            usage.add_summary(summary);
+        }
+    }
+
+    // Returns true when `key` was not present before.
+    bool insert(Key key)
     {
         unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
         ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
 
         if (!cluster_active(hi)) {
+            inline_value_.touch(hi) = lo;
             summary_insert(hi);
             inline_mask_.set(hi);
-            inline_value_[hi] = lo;
-            return;
+            count_keys(hi, 1);
+            index_if_large();
+            return true;
         }
 
         if (inline_mask_.test(hi)) {
             if (inline_value_[hi] == lo) {
-                return;
+                return false;
             }
             Child &child = ensure_cluster(hi);
             child.insert(inline_value_[hi]);
             inline_mask_.reset(hi);
             child.insert(lo);
+            count_keys(hi, 1);
+            return true;
+        }
+
+        if (!ensure_cluster(hi).insert(lo)) {
+            return false;
+        }
+        count_keys(hi, 1);
+        return true;
+    }
+
+    void batch_insert(std::span<Key const> keys)
+    {
+        std::vector<Key> sorted(keys.begin(), keys.end());
+        veb_detail::radix_sort_unique(sorted);
+        batch_insert_sorted(sorted.begin(), sorted.end());
+    }
+
+    // Inserts keys given in ascending order. Each cluster is resolved once
+    // per run of keys sharing it, and the run is handed to the child as a
+    // single batch.
+    template <class It>
+    void batch_insert_sorted(It first, It last)
+    {
+        insert_runs(
+            first, last, [this](unsigned hi, bool activated, std::size_t n) {
+                if (activated) {
+                    summary_insert(hi);
+                }
+                count_keys(hi, static_cast<std::ptrdiff_t>(n));
+            });
+        index_if_large();
+    }
+
+    // Fills an empty branch from strictly ascending keys. Clusters are
+    // created without existence checks or promotion, and the summary is
+    // built from the cluster list in one sweep.
+    template <class It>
+    void build_sorted(It first, It last)
+    {
+        assert(empty());
+        std::vector<SummaryKey> active;
+        while (first != last) {
+            It run_end =
+                veb_detail::cluster_run_end<CLUSTER_BITS>(first, last);
+            unsigned hi = static_cast<unsigned>(Key(*first) >> CLUSTER_BITS);
+            if (std::next(first) == run_end) {
+                inline_value_.touch(hi) =
+                    static_cast<ChildKey>(Key(*first) & CHILD_MASK);
+                inline_mask_.set(hi);
+            }
+            else {
+                auto lows =
+                    veb_detail::low_parts<ChildKey>(first, run_end, CHILD_MASK);
+                ensure_cluster(hi).build_sorted(lows.begin(), lows.end());
+            }
+            active.push_back(static_cast<SummaryKey>(hi));
+            size_ += static_cast<std::size_t>(std::distance(first, run_end));
+            first = run_end;
+        }
+        if (!active.empty()) {
+            ensure_summary().build_sorted(active.begin(), active.end());
+        }
+        index_if_large();
+    }
+
+    // Snapshot form (see veb_snapshot.hpp): the summary, then one entry
+    // per active cluster in ascending order. Only non-empty branches are
+    // written.
+    template <class Writer>
+    void save(Writer &out) const
+    {
+        summary_->save(out);
+        summary_->for_each([&](SummaryKey cluster_idx) {
+            unsigned hi = static_cast<unsigned>(cluster_idx);
+            if (inline_mask_.test(hi)) {
+                out.write(veb_detail::INLINE_ENTRY | inline_value_[hi]);
+            }
+            else {
+                out.write(veb_detail::CHILD_ENTRY);
+                cluster_ptr(hi)->save(out);
+            }
+        });
+    }
+
+    // Fills an empty branch from its snapshot form. Nodes are rebuilt from
+    // their stored words, so no key goes through insert.
+    template <class Reader>
+    void load(Reader &in)
+    {
+        assert(empty());
+        Summary &summary = ensure_summary();
+        summary.load(in);
+        if (summary.empty()) {
+            veb_detail::snapshot_error("empty summary");
+        }
+        summary.for_each([&](SummaryKey cluster_idx) {
+            unsigned hi = static_cast<unsigned>(cluster_idx);
+            uint64_t entry = in.read();
+            if (entry & veb_detail::INLINE_ENTRY) {
+                uint64_t value = entry & ~veb_detail::INLINE_ENTRY;
+                if (value > CHILD_MASK) {
+                    veb_detail::snapshot_error("inline key out of range");
+                }
+                inline_value_.touch(hi) = static_cast<ChildKey>(value);
+                inline_mask_.set(hi);
+                ++size_;
+            }
+            else if (entry == veb_detail::CHILD_ENTRY) {
+                Child &child = ensure_cluster(hi);
+                child.load(in);
+                if (child.empty()) {
+                    veb_detail::snapshot_error("empty cluster");
+                }
+                size_ += child.size();
+            }
+            else {
+                veb_detail::snapshot_error("bad cluster entry");
+            }
+        });
+        index_if_large();
+    }
+
+    // Inserts keys using up to `thread_count` threads (0 = one per hardware
+    // thread).
+    void parallel_insert(std::span<Key const> keys, unsigned thread_count)
+    {
+        std::vector<Key> sorted(keys.begin(), keys.end());
+        veb_detail::radix_sort_unique(sorted, thread_count);
+        parallel_insert_sorted(sorted.begin(), sorted.end(), thread_count);
+    }
+
+    // Parallel form of batch_insert_sorted. Each thread owns a contiguous
+    // range of clusters aligned to whole mask words, so the cluster arrays
+    // and bitsets are written without synchronization. The summary is
+    // updated once every thread has joined.
+    template <class It>
+    void parallel_insert_sorted(It first, It last, unsigned thread_count)
+    {
+        constexpr std::size_t MASK_WORD = 64;
+        thread_count = veb_detail::useful_threads(
+            static_cast<std::size_t>(last - first), thread_count);
+        if (CLUSTER_COUNT <= MASK_WORD || thread_count <= 1) {
+            batch_insert_sorted(first, last);
             return;
         }
 
-        ensure_cluster(hi).insert(lo);
+        auto bounds = veb_detail::split_runs<CLUSTER_BITS, MASK_WORD>(
+            first, last, thread_count);
+        touch_clusters(
+            static_cast<unsigned>(Key(*first) >> CLUSTER_BITS),
+            static_cast<unsigned>(Key(*(last - 1)) >> CLUSTER_BITS));
+        veb_detail::SharedPools shared(pools());
+        std::vector<std::vector<SummaryKey>> fresh(thread_count);
+        std::vector<std::vector<std::pair<unsigned, std::size_t>>> added(
+            thread_count);
+        veb_detail::parallel_for(thread_count, [&](unsigned t) {
+            insert_runs(
+                bounds[t],
+                bounds[t + 1],
+                [&](unsigned hi, bool activated, std::size_t n) {
+                    if (activated) {
+                        fresh[t].push_back(static_cast<SummaryKey>(hi));
+                    }
+                    added[t].emplace_back(hi, n);
+                });
+        });
+        for (auto const &part : fresh) {
+            if (!part.empty()) {
+                ensure_summary().batch_insert_sorted(part.begin(), part.end());
+            }
+        }
+        for (auto const &part : added) {
+            for (auto [hi, n] : part) {
+                count_keys(hi, static_cast<std::ptrdiff_t>(n));
+            }
+        }
+        index_if_large();
     }
 
-    void erase(Key key) noexcept
+    // Returns true when `key` was present.
+    bool erase(Key key) noexcept
     {
         if (key > MAX_KEY) {
-            return;
+            return false;
         }
         unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
         ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
         if (!cluster_active(hi)) {
-            return;
+            return false;
         }
         if (inline_mask_.test(hi)) {
             if (inline_value_[hi] != lo) {
-                return;
+                return false;
             }
             inline_mask_.reset(hi);
+            count_keys(hi, -1);
+            summary_erase(hi);
+            return true;
+        }
+        auto *ptr = cluster_ptr(hi);
+        if (!ptr || !ptr->erase(lo)) {
+            return false;
+        }
+        count_keys(hi, -1);
+        if (ptr->empty()) {
+            if constexpr (!INLINE_CHILDREN) {
+                free_node(clusters_.at(hi));
+            }
+            cluster_mask_.reset(hi);
             summary_erase(hi);
+        }
+        return true;
+    }
+
+    void batch_erase(std::span<Key const> keys)
+    {
+        std::vector<Key> sorted(keys.begin(), keys.end());
+        veb_detail::radix_sort_unique(sorted);
+        auto last = std::upper_bound(sorted.begin(), sorted.end(), MAX_KEY);
+        batch_erase_sorted(sorted.begin(), last);
+    }
+
+    // Erases keys given in ascending order. Emptied clusters are released
+    // as they are found, and their summary bits are cleared in one batch
+    // once every run has been applied.
+    template <class It>
+    void batch_erase_sorted(It first, It last)
+    {
+        std::vector<SummaryKey> emptied;
+        while (first != last) {
+            It run_end =
+                veb_detail::cluster_run_end<CLUSTER_BITS>(first, last);
+            unsigned hi = static_cast<unsigned>(Key(*first) >> CLUSTER_BITS);
+            std::size_t removed = erase_run(hi, first, run_end);
+            count_keys(hi, -static_cast<std::ptrdiff_t>(removed));
+            if (removed != 0 && !cluster_active(hi)) {
+                emptied.push_back(static_cast<SummaryKey>(hi));
+            }
+            first = run_end;
+        }
+        if (emptied.empty()) {
             return;
         }
-        if (auto *ptr = cluster_ptr(hi)) {
-            ptr->erase(lo);
-            if (ptr->empty()) {
-                if constexpr (!INLINE_CHILDREN) {
-                    clusters_[hi].reset();
-                }
-                cluster_mask_.reset(hi);
-                summary_erase(hi);
+        summary_->batch_erase_sorted(emptied.begin(), emptied.end());
+        if (summary_->empty()) {
+            free_summary();
+            index_.reset();
+        }
+    }
+
+    // Erases every key in [lo, hi] and returns how many were present. Only
+    // the two boundary clusters are trimmed; the clusters between them are
+    // released whole and their summary bits cleared as one range.
+    std::size_t erase_range(Key lo, Key hi)
+    {
+        if (lo > hi || lo > MAX_KEY || !summary_) {
+            return 0;
+        }
+        hi = std::min(hi, MAX_KEY);
+        unsigned first = static_cast<unsigned>(lo >> CLUSTER_BITS);
+        unsigned last = static_cast<unsigned>(hi >> CLUSTER_BITS);
+        auto lo_low = static_cast<ChildKey>(lo & CHILD_MASK);
+        auto hi_low = static_cast<ChildKey>(hi & CHILD_MASK);
+        if (first == last) {
+            return trim_cluster(first, lo_low, hi_low);
+        }
+        std::size_t removed =
+            trim_cluster(first, lo_low, static_cast<ChildKey>(CHILD_MASK));
+        removed += trim_cluster(last, ChildKey{0}, hi_low);
+        if (!summary_ || last - first < 2) {
+            return removed;
+        }
+        auto inner_first = static_cast<SummaryKey>(first + 1);
+        auto inner_last = static_cast<SummaryKey>(last - 1);
+        summary_->for_each_range(
+            inner_first, inner_last, [&](SummaryKey cluster_idx) {
+                removed += drop_cluster(static_cast<unsigned>(cluster_idx));
+            });
+        summary_->erase_range(inner_first, inner_last);
+        if (summary_->empty()) {
+            free_summary();
+            index_.reset();
+        }
+        return removed;
+    }
+
+    // In-place set algebra with another branch. Summaries are combined
+    // first and the active-cluster masks are intersected word-wise, so
+    // clusters present on one side only are adopted or released without
+    // visiting their keys; shared clusters recurse down to the leaves.
+    void union_with(VebBranch const &other)
+    {
+        if (this == &other || !other.summary_) {
+            return;
+        }
+        ensure_summary().union_with(*other.summary_);
+        other.active_clusters().for_each_set([&](unsigned hi) {
+            merge_cluster<veb_detail::SetOp::Union>(hi, other);
+        });
+        index_if_large();
+    }
+
+    void intersect_with(VebBranch const &other)
+    {
+        if (this == &other || !summary_) {
+            return;
+        }
+        if (!other.summary_) {
+            erase_range(Key{0}, MAX_KEY);
+            return;
+        }
+        summary_->intersect_with(*other.summary_);
+        DenseMask theirs = other.active_clusters();
+        DenseMask disjoint = active_clusters();
+        DenseMask shared = disjoint;
+        disjoint.subtract(theirs);
+        shared &= theirs;
+        disjoint.for_each_set([&](unsigned hi) { drop_cluster(hi); });
+        std::vector<SummaryKey> emptied;
+        shared.for_each_set([&](unsigned hi) {
+            merge_cluster<veb_detail::SetOp::Intersection>(hi, other);
+            if (!cluster_active(hi)) {
+                emptied.push_back(static_cast<SummaryKey>(hi));
+            }
+        });
+        forget_clusters(emptied);
+    }
+
+    void difference_with(VebBranch const &other)
+    {
+        if (!summary_ || !other.summary_) {
+            return;
+        }
+        if (this == &other) {
+            erase_range(Key{0}, MAX_KEY);
+            return;
+        }
+        DenseMask shared = active_clusters();
+        shared &= other.active_clusters();
+        std::vector<SummaryKey> emptied;
+        shared.for_each_set([&](unsigned hi) {
+            merge_cluster<veb_detail::SetOp::Difference>(hi, other);
+            if (!cluster_active(hi)) {
+                emptied.push_back(static_cast<SummaryKey>(hi));
             }
+        });
+        forget_clusters(emptied);
+    }
+
+    void symmetric_difference_with(VebBranch const &other)
+    {
+        if (this == &other) {
+            erase_range(Key{0}, MAX_KEY);
+            return;
+        }
+        if (!other.summary_) {
+            return;
         }
+        ensure_summary().union_with(*other.summary_);
+        std::vector<SummaryKey> emptied;
+        other.active_clusters().for_each_set([&](unsigned hi) {
+            merge_cluster<veb_detail::SetOp::SymmetricDifference>(hi, other);
+            if (!cluster_active(hi)) {
+                emptied.push_back(static_cast<SummaryKey>(hi));
+            }
+        });
+        forget_clusters(emptied);
+        index_if_large();
     }
 
     [[nodiscard]] bool contains(Key key) const noexcept
@@ -120,61 +612,176 @@ public:
         return false;
     }
 
-    [[nodiscard]] std::optional<Key> min() const noexcept
+    // Number of keys strictly below `key`.
+    [[nodiscard]] std::size_t rank(Key key) const noexcept
     {
-        if (!summary_) {
+        if (key > MAX_KEY) {
+            return size_;
+        }
+        unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+        ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+        std::size_t n = keys_below_cluster(hi);
+        if (inline_mask_.test(hi)) {
+            n += inline_value_[hi] < lo ? 1 : 0;
+        }
+        else if (auto const *ptr = cluster_ptr(hi)) {
+            n += ptr->rank(lo);
+        }
+        return n;
+    }
+
+    // Rank of `key` split at its cluster: the active clusters before its
+    // own, and the keys before it inside that cluster. Null when `key` is
+    // absent. With leaf children both parts are popcounts over leaf words,
+    // which is how RankedClusterMap places entries that mirror this
+    // branch's keys.
+    [[nodiscard]] std::optional<std::pair<std::size_t, std::size_t>>
+    cluster_rank(Key key) const noexcept
+    {
+        if (key > MAX_KEY) {
             return std::nullopt;
         }
-        auto hi = summary_->min();
-        if (!hi) {
+        unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+        ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+        std::size_t inside = 0;
+        if (inline_mask_.test(hi)) {
+            if (inline_value_[hi] != lo) {
+                return std::nullopt;
+            }
+        }
+        else if (auto const *ptr = cluster_ptr(hi);
+                 ptr && ptr->contains(lo)) {
+            inside = ptr->rank(lo);
+        }
+        else {
             return std::nullopt;
         }
-        unsigned idx = static_cast<unsigned>(*hi);
-        if (inline_mask_.test(idx)) {
-            return combine(idx, inline_value_[idx]);
+        return std::pair{
+            summary_->rank(static_cast<SummaryKey>(hi)), inside};
+    }
+
+    // Node a lookup of `key` reads after this one, or null when the
+    // branch answers it from its own masks.
+    [[nodiscard]] void const *probe_address(Key key) const noexcept
+    {
+        if (key > MAX_KEY) {
+            return nullptr;
         }
-        auto const *ptr = cluster_ptr(idx);
-        if (!ptr) {
+        unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+        return inline_mask_.test(hi) ? nullptr : cluster_ptr(hi);
+    }
+
+    // The key with rank `k`, if there are more than `k` keys.
+    [[nodiscard]] std::optional<Key> select(std::size_t k) const noexcept
+    {
+        if (k >= size_) {
             return std::nullopt;
         }
-        auto lo = ptr->min();
-        if (!lo) {
+        SummaryKey first = 0;
+        if constexpr (INDEXED) {
+            if (index_) {
+                // The index names the block, and leaves `k` counting from
+                // the block's first key.
+                first = static_cast<SummaryKey>(index_->find(k) << BLOCK_SHIFT);
+            }
+        }
+        // Step cluster by cluster and stop at the one holding rank `k`.
+        // It exists because k < size_, so the walk never runs out.
+        SummaryKey idx = summary_->contains(first)
+                             ? first
+                             : summary_->successor_or(first, 0);
+        for (;; idx = summary_->successor_or(idx, 0)) {
+            unsigned hi = static_cast<unsigned>(idx);
+            std::size_t n = cluster_size(hi);
+            if (k < n) {
+                if (inline_mask_.test(hi)) {
+                    return combine(hi, inline_value_[hi]);
+                }
+                return combine(hi, *cluster_ptr(hi)->select(k));
+            }
+            k -= n;
+        }
+    }
+
+    // Number of keys in [lo, hi].
+    [[nodiscard]] std::size_t count_range(Key lo, Key hi) const noexcept
+    {
+        if (lo > hi) {
+            return 0;
+        }
+        return rank(hi) + (contains(hi) ? 1 : 0) - rank(lo);
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        if (empty()) {
             return std::nullopt;
         }
-        return combine(idx, static_cast<ChildKey>(*lo));
+        return min_or(0);
     }
 
     [[nodiscard]] std::optional<Key> max() const noexcept
     {
-        if (!summary_) {
+        if (empty()) {
             return std::nullopt;
         }
-        auto hi = summary_->max();
-        if (!hi) {
-            return std::nullopt;
+        return max_or(0);
+    }
+
+    [[nodiscard]] std::optional<Key> successor(Key key) const noexcept
+    {
+        // 0 is never a successor, so it can mark a miss.
+        if (Key s = successor_or(key, 0)) {
+            return s;
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key> predecessor(Key key) const noexcept
+    {
+        // Nor is MAX_KEY ever a predecessor.
+        if (Key p = predecessor_or(key, MAX_KEY); p != MAX_KEY) {
+            return p;
         }
-        unsigned idx = static_cast<unsigned>(*hi);
+        return std::nullopt;
+    }
+
+    // Forms of the queries above that return `none` instead of an empty
+    // optional. Levels pass raw keys to each other, so nothing is wrapped
+    // on the way up: 0 marks a missing successor and MAX_KEY a missing
+    // predecessor, and min_or and max_or are only called on non-empty
+    // children, where `none` is never returned.
+    [[nodiscard]] Key min_or(Key none) const noexcept
+    {
+        if (empty()) {
+            return none;
+        }
+        unsigned idx = static_cast<unsigned>(summary_->min_or(0));
         if (inline_mask_.test(idx)) {
             return combine(idx, inline_value_[idx]);
         }
-        auto const *ptr = cluster_ptr(idx);
-        if (!ptr) {
-            return std::nullopt;
+        return combine(idx, cluster_ptr(idx)->min_or(0));
+    }
+
+    [[nodiscard]] Key max_or(Key none) const noexcept
+    {
+        if (empty()) {
+            return none;
         }
-        auto lo = ptr->max();
-        if (!lo) {
-            return std::nullopt;
+        unsigned idx = static_cast<unsigned>(summary_->max_or(0));
+        if (inline_mask_.test(idx)) {
+            return combine(idx, inline_value_[idx]);
         }
-        return combine(idx, static_cast<ChildKey>(*lo));
+        return combine(idx, cluster_ptr(idx)->max_or(0));
     }
 
-    [[nodiscard]] std::optional<Key> successor(Key key) const noexcept
+    [[nodiscard]] Key successor_or(Key key, Key none) const noexcept
     {
         if (!summary_) {
-            return std::nullopt;
+            return none;
         }
         if (key >= MAX_KEY) {
-            return std::nullopt;
+            return none;
         }
         unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
         ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
@@ -185,33 +792,30 @@ public:
                 }
             }
             else if (auto const *ptr = cluster_ptr(hi)) {
-                if (auto s = ptr->successor(lo)) {
-                    return combine(hi, static_cast<ChildKey>(*s));
+                if (ChildKey s = ptr->successor_or(lo, 0)) {
+                    return combine(hi, s);
                 }
             }
         }
-        auto next = summary_successor(hi);
+        SummaryKey next =
+            summary_->successor_or(static_cast<SummaryKey>(hi), 0);
         if (!next) {
-            return std::nullopt;
+            return none;
         }
-        unsigned idx = *next;
+        unsigned idx = static_cast<unsigned>(next);
         if (inline_mask_.test(idx)) {
             return combine(idx, inline_value_[idx]);
         }
-        auto lo_min = cluster_ptr(idx)->min();
-        if (!lo_min) {
-            return std::nullopt;
-        }
-        return combine(idx, static_cast<ChildKey>(*lo_min));
+        return combine(idx, cluster_ptr(idx)->min_or(0));
     }
 
-    [[nodiscard]] std::optional<Key> predecessor(Key key) const noexcept
+    [[nodiscard]] Key predecessor_or(Key key, Key none) const noexcept
     {
         if (!summary_) {
-            return std::nullopt;
+            return none;
         }
         if (key == 0 || key > MAX_KEY) {
-            return std::nullopt;
+            return none;
         }
         unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
         ChildKey limit = static_cast<ChildKey>(key & CHILD_MASK);
@@ -223,54 +827,462 @@ public:
                 }
             }
             else if (auto const *ptr = cluster_ptr(hi)) {
-                if (auto p = ptr->predecessor(limit)) {
-                    return combine(hi, static_cast<ChildKey>(*p));
+                ChildKey p = ptr->predecessor_or(limit, Child::MAX_KEY);
+                if (p != Child::MAX_KEY) {
+                    return combine(hi, p);
                 }
             }
         }
 
-        auto prev = summary_predecessor(hi);
-        if (!prev) {
-            return std::nullopt;
+        SummaryKey prev = summary_->predecessor_or(
+            static_cast<SummaryKey>(hi), Summary::MAX_KEY);
+        if (prev == Summary::MAX_KEY) {
+            return none;
         }
-        unsigned idx = *prev;
+        unsigned idx = static_cast<unsigned>(prev);
         if (inline_mask_.test(idx)) {
             return combine(idx, inline_value_[idx]);
         }
-        auto lo_max = cluster_ptr(idx)->max();
-        if (!lo_max) {
-            return std::nullopt;
-        }
-        return combine(idx, static_cast<ChildKey>(*lo_max));
+        return combine(idx, cluster_ptr(idx)->max_or(0));
     }
 
-    template <class Fn>
-    void for_each(Key prefix, Fn &&fn) const
+    // Batched lookups: out[i] receives the answer for keys[i]. Queries are
+    // processed in groups of veb_detail::QUERY_GROUP whose cluster loads
+    // are issued together at every level.
+    void contains_batch(
+        std::span<Key const> keys, std::span<bool> out) const noexcept
     {
-        if (!summary_) {
-            return;
-        }
-        summary_->for_each([&](typename Summary::Key cluster_idx) {
-            unsigned hi = static_cast<unsigned>(cluster_idx);
-            Key child_prefix = prefix | (Key(hi) << CLUSTER_BITS);
-            if (inline_mask_.test(hi)) {
-                fn(child_prefix | inline_value_[hi]);
-            }
-            else if (auto const *ptr = cluster_ptr(hi)) {
-                ptr->for_each(child_prefix, fn);
-            }
+        assert(out.size() >= keys.size());
+        for_each_group(keys, [&](auto nodes, std::size_t i, std::size_t n) {
+            contains_group(nodes, keys.data() + i, out.data() + i, n);
         });
     }
 
-    template <class Fn>
-    void for_each(Fn &&fn) const
+    void successor_batch(
+        std::span<Key const> keys,
+        std::span<std::optional<Key>> out) const noexcept
     {
-        for_each(0, std::forward<Fn>(fn));
+        assert(out.size() >= keys.size());
+        for_each_group(keys, [&](auto nodes, std::size_t i, std::size_t n) {
+            successor_group(nodes, keys.data() + i, out.data() + i, n);
+        });
     }
 
-private:
-    using ChildKey = typename Child::Key;
-    static constexpr std::size_t CLUSTER_COUNT =
+    void predecessor_batch(
+        std::span<Key const> keys,
+        std::span<std::optional<Key>> out) const noexcept
+    {
+        assert(out.size() >= keys.size());
+        for_each_group(keys, [&](auto nodes, std::size_t i, std::size_t n) {
+            predecessor_group(nodes, keys.data() + i, out.data() + i, n);
+        });
+    }
+
+    static void contains_group(
+        VebBranch const *const *nodes, Key const *keys, bool *out,
+        std::size_t n) noexcept
+    {
+        std::array<Child const *, GROUP> sub_nodes{};
+        std::array<ChildKey, GROUP> sub_keys{};
+        std::array<bool, GROUP> sub_out{};
+        std::array<std::size_t, GROUP> sub_idx{};
+        std::size_t m = 0;
+
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = false;
+            VebBranch const &node = *nodes[i];
+            Key key = keys[i];
+            if (key > MAX_KEY) {
+                continue;
+            }
+            unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+            ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+            if (node.inline_mask_.test(hi)) {
+                out[i] = node.inline_value_[hi] == lo;
+            }
+            else if (auto const *ptr = node.cluster_ptr(hi)) {
+                veb_detail::prefetch(ptr);
+                sub_nodes[m] = ptr;
+                sub_keys[m] = lo;
+                sub_idx[m++] = i;
+            }
+        }
+
+        Child::contains_group(
+            sub_nodes.data(), sub_keys.data(), sub_out.data(), m);
+        for (std::size_t j = 0; j < m; ++j) {
+            out[sub_idx[j]] = sub_out[j];
+        }
+    }
+
+    static void successor_group(
+        VebBranch const *const *nodes, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        std::array<Child const *, GROUP> sub_nodes{};
+        std::array<ChildKey, GROUP> sub_keys{};
+        std::array<std::optional<ChildKey>, GROUP> sub_out{};
+        std::array<std::size_t, GROUP> sub_idx{};
+        std::size_t m = 0;
+        std::array<Summary const *, GROUP> sum_nodes{};
+        std::array<ChildKey, GROUP> sum_keys{};
+        std::array<std::optional<ChildKey>, GROUP> sum_out{};
+        std::array<std::size_t, GROUP> sum_idx{};
+        std::size_t s = 0;
+
+        auto defer_to_summary = [&](std::size_t i, unsigned hi) {
+            sum_nodes[s] = nodes[i]->summary_.get();
+            sum_keys[s] = static_cast<ChildKey>(hi);
+            sum_idx[s++] = i;
+        };
+
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i].reset();
+            VebBranch const &node = *nodes[i];
+            Key key = keys[i];
+            if (!node.summary_ || key >= MAX_KEY) {
+                continue;
+            }
+            unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+            ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+            veb_detail::prefetch(node.summary_.get());
+            if (node.inline_mask_.test(hi)) {
+                if (node.inline_value_[hi] > lo) {
+                    out[i] = combine(hi, node.inline_value_[hi]);
+                    continue;
+                }
+            }
+            else if (auto const *ptr = node.cluster_ptr(hi)) {
+                veb_detail::prefetch(ptr);
+                sub_nodes[m] = ptr;
+                sub_keys[m] = lo;
+                sub_idx[m++] = i;
+                continue;
+            }
+            defer_to_summary(i, hi);
+        }
+
+        Child::successor_group(
+            sub_nodes.data(), sub_keys.data(), sub_out.data(), m);
+        for (std::size_t j = 0; j < m; ++j) {
+            std::size_t i = sub_idx[j];
+            unsigned hi = static_cast<unsigned>(keys[i] >> CLUSTER_BITS);
+            if (sub_out[j]) {
+                out[i] = combine(hi, *sub_out[j]);
+            }
+            else {
+                defer_to_summary(i, hi);
+            }
+        }
+
+        Summary::successor_group(
+            sum_nodes.data(), sum_keys.data(), sum_out.data(), s);
+        std::array<Child const *, GROUP> next{};
+        for (std::size_t j = 0; j < s; ++j) {
+            if (!sum_out[j]) {
+                continue;
+            }
+            VebBranch const &node = *nodes[sum_idx[j]];
+            unsigned idx = static_cast<unsigned>(*sum_out[j]);
+            if (node.inline_mask_.test(idx)) {
+                out[sum_idx[j]] = combine(idx, node.inline_value_[idx]);
+            }
+            else {
+                next[j] = node.cluster_ptr(idx);
+                veb_detail::prefetch(next[j]);
+            }
+        }
+        for (std::size_t j = 0; j < s; ++j) {
+            if (!next[j]) {
+                continue;
+            }
+            if (auto lo_min = next[j]->min()) {
+                out[sum_idx[j]] = combine(
+                    static_cast<unsigned>(*sum_out[j]),
+                    static_cast<ChildKey>(*lo_min));
+            }
+        }
+    }
+
+    static void predecessor_group(
+        VebBranch const *const *nodes, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        std::array<Child const *, GROUP> sub_nodes{};
+        std::array<ChildKey, GROUP> sub_keys{};
+        std::array<std::optional<ChildKey>, GROUP> sub_out{};
+        std::array<std::size_t, GROUP> sub_idx{};
+        std::size_t m = 0;
+        std::array<Summary const *, GROUP> sum_nodes{};
+        std::array<ChildKey, GROUP> sum_keys{};
+        std::array<std::optional<ChildKey>, GROUP> sum_out{};
+        std::array<std::size_t, GROUP> sum_idx{};
+        std::size_t s = 0;
+
+        auto defer_to_summary = [&](std::size_t i, unsigned hi) {
+            sum_nodes[s] = nodes[i]->summary_.get();
+            sum_keys[s] = static_cast<ChildKey>(hi);
+            sum_idx[s++] = i;
+        };
+
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i].reset();
+            VebBranch const &node = *nodes[i];
+            Key key = keys[i];
+            if (!node.summary_ || key == 0 || key > MAX_KEY) {
+                continue;
+            }
+            unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+            ChildKey limit = static_cast<ChildKey>(key & CHILD_MASK);
+            veb_detail::prefetch(node.summary_.get());
+            if (node.inline_mask_.test(hi)) {
+                if (node.inline_value_[hi] < limit) {
+                    out[i] = combine(hi, node.inline_value_[hi]);
+                    continue;
+                }
+            }
+            else if (auto const *ptr = node.cluster_ptr(hi)) {
+                veb_detail::prefetch(ptr);
+                sub_nodes[m] = ptr;
+                sub_keys[m] = limit;
+                sub_idx[m++] = i;
+                continue;
+            }
+            defer_to_summary(i, hi);
+        }
+
+        Child::predecessor_group(
+            sub_nodes.data(), sub_keys.data(), sub_out.data(), m);
+        for (std::size_t j = 0; j < m; ++j) {
+            std::size_t i = sub_idx[j];
+            unsigned hi = static_cast<unsigned>(keys[i] >> CLUSTER_BITS);
+            if (sub_out[j]) {
+                out[i] = combine(hi, *sub_out[j]);
+            }
+            else {
+                defer_to_summary(i, hi);
+            }
+        }
+
+        Summary::predecessor_group(
+            sum_nodes.data(), sum_keys.data(), sum_out.data(), s);
+        std::array<Child const *, GROUP> prev{};
+        for (std::size_t j = 0; j < s; ++j) {
+            if (!sum_out[j]) {
+                continue;
+            }
+            VebBranch const &node = *nodes[sum_idx[j]];
+            unsigned idx = static_cast<unsigned>(*sum_out[j]);
+            if (node.inline_mask_.test(idx)) {
+                out[sum_idx[j]] = combine(idx, node.inline_value_[idx]);
+            }
+            else {
+                prev[j] = node.cluster_ptr(idx);
+                veb_detail::prefetch(prev[j]);
+            }
+        }
+        for (std::size_t j = 0; j < s; ++j) {
+            if (!prev[j]) {
+                continue;
+            }
+            if (auto lo_max = prev[j]->max()) {
+                out[sum_idx[j]] = combine(
+                    static_cast<unsigned>(*sum_out[j]),
+                    static_cast<ChildKey>(*lo_max));
+            }
+        }
+    }
+
+    // `prefix` carries the caller's key type so that nested branches report
+    // full keys rather than keys truncated to their own width.
+    template <class Out, class Fn>
+    void for_each(Out prefix, Fn &&fn) const
+    {
+        if (!summary_) {
+            return;
+        }
+        summary_->for_each([&](SummaryKey cluster_idx) {
+            unsigned hi = static_cast<unsigned>(cluster_idx);
+            Out child_prefix = prefix | (Out(hi) << CLUSTER_BITS);
+            if (inline_mask_.test(hi)) {
+                fn(child_prefix | Out(inline_value_[hi]));
+            }
+            else if (auto const *ptr = cluster_ptr(hi)) {
+                ptr->for_each(child_prefix, fn);
+            }
+        });
+    }
+
+    template <class Fn>
+    void for_each(Fn &&fn) const
+    {
+        for_each(Key{0}, std::forward<Fn>(fn));
+    }
+
+    // Visits the keys in [lo, hi] in ascending order. Only the two boundary
+    // clusters are masked; clusters in between are walked whole.
+    template <class Out, class Fn>
+    void for_each_range(Out prefix, Key lo, Key hi, Fn &&fn) const
+    {
+        if (!summary_ || lo > hi || lo > MAX_KEY) {
+            return;
+        }
+        hi = std::min(hi, MAX_KEY);
+        auto first = static_cast<SummaryKey>(lo >> CLUSTER_BITS);
+        auto last = static_cast<SummaryKey>(hi >> CLUSTER_BITS);
+        summary_->for_each_range(first, last, [&](SummaryKey cluster_idx) {
+            unsigned c = static_cast<unsigned>(cluster_idx);
+            Out child_prefix = prefix | (Out(c) << CLUSTER_BITS);
+            auto from = static_cast<ChildKey>(
+                cluster_idx == first ? lo & CHILD_MASK : 0);
+            auto to = static_cast<ChildKey>(
+                cluster_idx == last ? hi & CHILD_MASK : CHILD_MASK);
+            if (inline_mask_.test(c)) {
+                ChildKey value = inline_value_[c];
+                if (value >= from && value <= to) {
+                    fn(child_prefix | Out(value));
+                }
+            }
+            else if (auto const *ptr = cluster_ptr(c)) {
+                ptr->for_each_range(child_prefix, from, to, fn);
+            }
+        });
+    }
+
+    template <class Fn>
+    void for_each_range(Key lo, Key hi, Fn &&fn) const
+    {
+        for_each_range(Key{0}, lo, hi, std::forward<Fn>(fn));
+    }
+
+    // Calls fn(key) for every key using up to `thread_count` threads (0 =
+    // one per hardware thread). The key space is split at the summary into
+    // contiguous cluster ranges; each range is visited in ascending order
+    // by a single thread, so fn only needs to be safe across ranges.
+    template <class Fn>
+    void parallel_for_each(Fn &&fn, unsigned thread_count = 0) const
+    {
+        auto plan = scan_plan(thread_count);
+        veb_detail::run_scan(plan, [&](std::size_t, auto first, auto last) {
+            for_each_clusters(first, last, fn);
+        });
+    }
+
+    // Folds every cluster range from `identity` with fold(acc, key), then
+    // combines the range results left to right. The ranges depend only on
+    // the thread count, so a given count always gives the same result.
+    template <class T, class Fold, class Combine>
+    T parallel_reduce(
+        T identity, Fold fold, Combine combine,
+        unsigned thread_count = 0) const
+    {
+        auto plan = scan_plan(thread_count);
+        std::vector<std::optional<T>> partial(plan.parts);
+        veb_detail::run_scan(plan, [&](std::size_t p, auto first, auto last) {
+            T acc = identity;
+            for_each_clusters(
+                first, last, [&](Key key) { acc = fold(std::move(acc), key); });
+            partial[p] = std::move(acc);
+        });
+        T result = std::move(identity);
+        for (auto &part : partial) {
+            result = combine(std::move(result), std::move(*part));
+        }
+        return result;
+    }
+
+    // Position inside a branch for the ordered iterators. The summary
+    // cursor names the current cluster and, unless that cluster holds a
+    // single inline key, the child cursor continues inside it, so a step
+    // only climbs when the current cluster runs out.
+    class Cursor
+    {
+    public:
+        bool first(VebBranch const &node) noexcept
+        {
+            node_ = &node;
+            return node.summary_ && cluster_.first(*node.summary_) &&
+                   enter_first();
+        }
+
+        bool last(VebBranch const &node) noexcept
+        {
+            node_ = &node;
+            return node.summary_ && cluster_.last(*node.summary_) &&
+                   enter_last();
+        }
+
+        // Moves to the smallest key not below `key`.
+        bool seek(VebBranch const &node, Key key) noexcept
+        {
+            node_ = &node;
+            if (!node.summary_ || key > MAX_KEY) {
+                return false;
+            }
+            unsigned hi = static_cast<unsigned>(key >> CLUSTER_BITS);
+            ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+            if (!cluster_.seek(*node.summary_, static_cast<SummaryKey>(hi))) {
+                return false;
+            }
+            if (cluster_.key() != hi) {
+                return enter_first();
+            }
+            inline_ = node.inline_mask_.test(hi);
+            if (inline_ ? node.inline_value_[hi] >= lo
+                        : child_.seek(*node.cluster_ptr(hi), lo)) {
+                return true;
+            }
+            return cluster_.next() && enter_first();
+        }
+
+        bool next() noexcept
+        {
+            if (!inline_ && child_.next()) {
+                return true;
+            }
+            return cluster_.next() && enter_first();
+        }
+
+        bool prev() noexcept
+        {
+            if (!inline_ && child_.prev()) {
+                return true;
+            }
+            return cluster_.prev() && enter_last();
+        }
+
+        [[nodiscard]] Key key() const noexcept
+        {
+            unsigned hi = static_cast<unsigned>(cluster_.key());
+            return combine(
+                hi, inline_ ? node_->inline_value_[hi] : child_.key());
+        }
+
+    private:
+        bool enter_first() noexcept
+        {
+            unsigned hi = static_cast<unsigned>(cluster_.key());
+            inline_ = node_->inline_mask_.test(hi);
+            return inline_ || child_.first(*node_->cluster_ptr(hi));
+        }
+
+        bool enter_last() noexcept
+        {
+            unsigned hi = static_cast<unsigned>(cluster_.key());
+            inline_ = node_->inline_mask_.test(hi);
+            return inline_ || child_.last(*node_->cluster_ptr(hi));
+        }
+
+        VebBranch const *node_ = nullptr;
+        typename Summary::Cursor cluster_{};
+        typename Child::Cursor child_{};
+        bool inline_ = false;
+    };
+
+private:
+    using ChildKey = typename Child::Key;
+    using SummaryKey = typename Summary::Key;
+    static constexpr std::size_t CLUSTER_COUNT =
         static_cast<std::size_t>(uint64_t{1} << CLUSTER_BITS);
     static constexpr Key CHILD_MASK = (Key(1) << CLUSTER_BITS) - 1;
 
@@ -279,56 +1291,578 @@ private:
         return (Key(hi) << CLUSTER_BITS) | Key(lo);
     }
 
-    [[nodiscard]] Summary &ensure_summary()
+    static constexpr std::size_t GROUP = veb_detail::QUERY_GROUP;
+
+    // Branches with many clusters keep key counts per block of clusters,
+    // built once the summary holds more than INDEX_MIN_CLUSTERS entries.
+    // Rank and select then walk a single block instead of every cluster.
+    static constexpr std::size_t INDEX_MIN_CLUSTERS = 256;
+    static constexpr bool INDEXED = CLUSTER_COUNT > INDEX_MIN_CLUSTERS;
+    static constexpr unsigned BLOCK_SHIFT =
+        CLUSTER_BITS > 22 ? CLUSTER_BITS - 16 : 6;
+    static constexpr unsigned BLOCK_CLUSTERS = 1u << BLOCK_SHIFT;
+    using Index = veb_detail::BlockCounts<
+        (CLUSTER_BITS > BLOCK_SHIFT ? CLUSTER_BITS - BLOCK_SHIFT : 0)>;
+
+    void count_keys(unsigned hi, std::ptrdiff_t delta) noexcept
+    {
+        size_ += static_cast<std::size_t>(delta);
+        if constexpr (INDEXED) {
+            if (index_) {
+                index_->add(hi >> BLOCK_SHIFT, delta);
+            }
+        }
+    }
+
+    void index_if_large()
+    {
+        if constexpr (INDEXED) {
+            if (index_ || !summary_ ||
+                summary_->size() <= INDEX_MIN_CLUSTERS) {
+                return;
+            }
+            index_ = std::make_unique<Index>();
+            summary_->for_each([&](SummaryKey cluster_idx) {
+                unsigned hi = static_cast<unsigned>(cluster_idx);
+                index_->add(
+                    hi >> BLOCK_SHIFT,
+                    static_cast<std::ptrdiff_t>(cluster_size(hi)));
+            });
+        }
+    }
+
+    [[nodiscard]] std::size_t cluster_size(unsigned hi) const noexcept
+    {
+        if (inline_mask_.test(hi)) {
+            return 1;
+        }
+        auto const *ptr = cluster_ptr(hi);
+        return ptr ? ptr->size() : 0;
+    }
+
+    // Keys in clusters [first, last].
+    [[nodiscard]] std::size_t
+    cluster_keys(unsigned first, unsigned last) const noexcept
+    {
+        std::size_t n = 0;
+        summary_->for_each_range(
+            static_cast<SummaryKey>(first),
+            static_cast<SummaryKey>(last),
+            [&](SummaryKey cluster_idx) {
+                n += cluster_size(static_cast<unsigned>(cluster_idx));
+            });
+        return n;
+    }
+
+    // Keys in clusters below `hi`. Only the block holding `hi` is walked
+    // (the whole branch without an index), from whichever end is closer.
+    [[nodiscard]] std::size_t keys_below_cluster(unsigned hi) const noexcept
     {
         if (!summary_) {
-            summary_ = std::make_unique<Summary>();
+            return 0;
         }
-        return *summary_;
+        unsigned first = 0;
+        unsigned last = static_cast<unsigned>(CLUSTER_COUNT - 1);
+        std::size_t base = 0;
+        std::size_t total = size_;
+        if constexpr (INDEXED) {
+            if (index_) {
+                std::size_t block = hi >> BLOCK_SHIFT;
+                first = static_cast<unsigned>(block << BLOCK_SHIFT);
+                last = first + BLOCK_CLUSTERS - 1;
+                base = index_->before(block);
+                total = index_->at(block);
+            }
+        }
+        if (hi - first <= last - hi) {
+            return base + (hi == first ? 0 : cluster_keys(first, hi - 1));
+        }
+        return base + total - cluster_keys(hi, last);
     }
 
-    void summary_insert(unsigned idx)
+    [[nodiscard]] veb_detail::ScanPlan<SummaryKey>
+    scan_plan(unsigned thread_count) const
     {
-        ensure_summary().insert(static_cast<typename Summary::Key>(idx));
+        if (!summary_) {
+            return {};
+        }
+        return veb_detail::make_scan_plan(
+            summary_->min(), summary_->max(), thread_count);
     }
 
-    void summary_erase(unsigned idx)
+    template <class Fn>
+    void for_each_clusters(SummaryKey first, SummaryKey last, Fn &&fn) const
+    {
+        for_each_range(
+            Key(first) << CLUSTER_BITS,
+            (Key(last) << CLUSTER_BITS) | CHILD_MASK,
+            fn);
+    }
+
+    // Runs `fn(nodes, offset, count)` over consecutive query groups, where
+    // every entry of `nodes` points at this branch.
+    template <class Fn>
+    void for_each_group(std::span<Key const> keys, Fn &&fn) const
+    {
+        std::array<VebBranch const *, GROUP> nodes;
+        nodes.fill(this);
+        for (std::size_t i = 0; i < keys.size(); i += GROUP) {
+            fn(nodes.data(), i, std::min(GROUP, keys.size() - i));
+        }
+    }
+
+    // Applies every cluster run in [first, last) and reports each one
+    // through `on_run(hi, activated, added)` instead of touching the
+    // summary or the key counts directly. `activated` marks clusters that
+    // were inactive before the run.
+    template <class It, class OnRun>
+    void insert_runs(It first, It last, OnRun &&on_run)
+    {
+        while (first != last) {
+            It run_end =
+                veb_detail::cluster_run_end<CLUSTER_BITS>(first, last);
+            unsigned hi = static_cast<unsigned>(Key(*first) >> CLUSTER_BITS);
+            bool activated = !cluster_active(hi);
+            std::size_t added = insert_run(hi, first, run_end);
+            on_run(hi, activated, added);
+            first = run_end;
+        }
+    }
+
+    // Returns the number of keys the run added to cluster `hi`.
+    template <class It>
+    std::size_t insert_run(unsigned hi, It first, It last)
+    {
+        if (std::next(first) == last) {
+            ChildKey lo = static_cast<ChildKey>(Key(*first) & CHILD_MASK);
+            if (!cluster_active(hi)) {
+                inline_value_.touch(hi) = lo;
+                inline_mask_.set(hi);
+                return 1;
+            }
+            if (inline_mask_.test(hi) && inline_value_[hi] == lo) {
+                return 0;
+            }
+        }
+        std::size_t before = cluster_size(hi);
+        Child &child = ensure_cluster(hi);
+        if (inline_mask_.test(hi)) {
+            child.insert(inline_value_[hi]);
+            inline_mask_.reset(hi);
+        }
+        auto lows = veb_detail::low_parts<ChildKey>(first, last, CHILD_MASK);
+        child.batch_insert_sorted(lows.begin(), lows.end());
+        return child.size() - before;
+    }
+
+    // Returns the number of keys the run removed from cluster `hi`; the
+    // cluster is released when that leaves it empty.
+    template <class It>
+    std::size_t erase_run(unsigned hi, It first, It last)
+    {
+        auto lows = veb_detail::low_parts<ChildKey>(first, last, CHILD_MASK);
+        if (inline_mask_.test(hi)) {
+            if (std::ranges::find(lows, inline_value_[hi]) == lows.end()) {
+                return 0;
+            }
+            inline_mask_.reset(hi);
+            return 1;
+        }
+        auto *ptr = cluster_ptr(hi);
+        if (!ptr) {
+            return 0;
+        }
+        std::size_t before = ptr->size();
+        ptr->batch_erase_sorted(lows.begin(), lows.end());
+        std::size_t removed = before - ptr->size();
+        if (ptr->empty()) {
+            if constexpr (!INLINE_CHILDREN) {
+                free_node(clusters_.at(hi));
+            }
+            cluster_mask_.reset(hi);
+        }
+        return removed;
+    }
+
+    // Erases [lo, hi] from cluster `hi_idx`, clearing its summary bit when
+    // that empties it. A range covering the cluster releases it outright.
+    std::size_t trim_cluster(unsigned hi_idx, ChildKey lo, ChildKey hi)
+    {
+        std::size_t removed = 0;
+        if (inline_mask_.test(hi_idx)) {
+            ChildKey value = inline_value_[hi_idx];
+            if (value < lo || value > hi) {
+                return 0;
+            }
+            inline_mask_.reset(hi_idx);
+            removed = 1;
+        }
+        else if (auto *ptr = cluster_ptr(hi_idx)) {
+            if (lo == 0 && hi == CHILD_MASK) {
+                removed = ptr->size();
+                release_cluster(hi_idx);
+            }
+            else {
+                removed = ptr->erase_range(lo, hi);
+                if (ptr->empty()) {
+                    release_cluster(hi_idx);
+                }
+            }
+        }
+        if (removed == 0) {
+            return 0;
+        }
+        count_keys(hi_idx, -static_cast<std::ptrdiff_t>(removed));
+        if (!cluster_active(hi_idx)) {
+            summary_erase(hi_idx);
+        }
+        return removed;
+    }
+
+    // Releases an active cluster without touching the summary, returning
+    // the number of keys it held.
+    std::size_t drop_cluster(unsigned idx) noexcept
+    {
+        std::size_t removed = cluster_size(idx);
+        clear_cluster(idx);
+        count_keys(idx, -static_cast<std::ptrdiff_t>(removed));
+        return removed;
+    }
+
+    void clear_cluster(unsigned idx) noexcept
+    {
+        if (inline_mask_.test(idx)) {
+            inline_mask_.reset(idx);
+        }
+        else if (cluster_mask_.test(idx)) {
+            release_cluster(idx);
+        }
+    }
+
+    [[nodiscard]] DenseMask active_clusters() const noexcept
+    {
+        DenseMask active = inline_mask_;
+        active |= cluster_mask_;
+        return active;
+    }
+
+    // Clears the summary bits of clusters a set operation emptied.
+    void forget_clusters(std::vector<SummaryKey> const &emptied)
     {
         if (!summary_) {
             return;
         }
-        summary_->erase(static_cast<typename Summary::Key>(idx));
+        summary_->batch_erase_sorted(emptied.begin(), emptied.end());
         if (summary_->empty()) {
-            summary_.reset();
+            free_summary();
+            index_.reset();
+        }
+    }
+
+    // Applies `Op` to cluster `hi` and the same, active, cluster of
+    // `other`. Size and the index are kept current; the summary is left to
+    // the caller.
+    template <veb_detail::SetOp Op>
+    void merge_cluster(unsigned hi, VebBranch const &other)
+    {
+        auto before = static_cast<std::ptrdiff_t>(cluster_size(hi));
+        if (other.inline_mask_.test(hi)) {
+            merge_key<Op>(hi, other.inline_value_[hi]);
+        }
+        else {
+            merge_child<Op>(hi, *other.cluster_ptr(hi));
+        }
+        count_keys(
+            hi, static_cast<std::ptrdiff_t>(cluster_size(hi)) - before);
+    }
+
+    template <veb_detail::SetOp Op>
+    void merge_key(unsigned hi, ChildKey lo)
+    {
+        using veb_detail::SetOp;
+        bool present = cluster_contains(hi, lo);
+        if constexpr (Op == SetOp::Intersection) {
+            clear_cluster(hi);
+            if (present) {
+                inline_value_.touch(hi) = lo;
+                inline_mask_.set(hi);
+            }
+        }
+        else if (present && Op != SetOp::Union) {
+            cluster_erase(hi, lo);
+        }
+        else if (!present && Op != SetOp::Difference) {
+            cluster_insert(hi, lo);
+        }
+    }
+
+    template <veb_detail::SetOp Op>
+    void merge_child(unsigned hi, Child const &theirs)
+    {
+        using veb_detail::SetOp;
+        if (cluster_mask_.test(hi)) {
+            Child &mine = *cluster_ptr(hi);
+            veb_detail::apply_set_op<Op>(mine, theirs);
+            if (mine.empty()) {
+                release_cluster(hi);
+            }
+            return;
+        }
+        bool had_value = inline_mask_.test(hi);
+        ChildKey value = inline_value_[hi];
+        if constexpr (
+            Op == SetOp::Intersection || Op == SetOp::Difference) {
+            if (had_value &&
+                theirs.contains(value) == (Op == SetOp::Difference)) {
+                inline_mask_.reset(hi);
+            }
+        }
+        else {
+            // Adopt a copy of their cluster and fold our value back in.
+            inline_mask_.reset(hi);
+            Child &mine = adopt_cluster(hi, theirs);
+            if (!had_value) {
+                return;
+            }
+            if (Op == SetOp::SymmetricDifference && mine.contains(value)) {
+                mine.erase(value);
+            }
+            else {
+                mine.insert(value);
+            }
+            if (mine.empty()) {
+                release_cluster(hi);
+            }
+        }
+    }
+
+    [[nodiscard]] bool
+    cluster_contains(unsigned hi, ChildKey lo) const noexcept
+    {
+        if (inline_mask_.test(hi)) {
+            return inline_value_[hi] == lo;
+        }
+        auto const *ptr = cluster_ptr(hi);
+        return ptr && ptr->contains(lo);
+    }
+
+    // Adds `lo`, which must be absent, to cluster `hi` without touching
+    // the summary.
+    void cluster_insert(unsigned hi, ChildKey lo)
+    {
+        if (inline_mask_.test(hi)) {
+            Child &child = ensure_cluster(hi);
+            child.insert(inline_value_[hi]);
+            inline_mask_.reset(hi);
+            child.insert(lo);
+        }
+        else if (cluster_mask_.test(hi)) {
+            cluster_ptr(hi)->insert(lo);
+        }
+        else {
+            inline_value_.touch(hi) = lo;
+            inline_mask_.set(hi);
+        }
+    }
+
+    // Removes `lo`, which must be present, from cluster `hi` without
+    // touching the summary.
+    void cluster_erase(unsigned hi, ChildKey lo) noexcept
+    {
+        if (inline_mask_.test(hi)) {
+            inline_mask_.reset(hi);
+            return;
+        }
+        auto *ptr = cluster_ptr(hi);
+        ptr->erase(lo);
+        if (ptr->empty()) {
+            release_cluster(hi);
+        }
+    }
+
+    Child &adopt_cluster(unsigned idx, Child const &theirs)
+    {
+        cluster_mask_.set(idx);
+        if constexpr (INLINE_CHILDREN) {
+            clusters_[idx] = theirs;
+            return clusters_[idx];
+        }
+        else {
+            auto &ptr = clusters_.touch(idx);
+            ptr = clone_node(theirs);
+            return *ptr;
+        }
+    }
+
+    void copy_from(VebBranch const &other)
+    {
+        release_nodes();
+        if constexpr (INLINE_CHILDREN) {
+            clusters_ = other.clusters_;
+        }
+        else {
+            other.cluster_mask_.for_each_set([&](unsigned idx) {
+                clusters_.touch(idx) = clone_node(*other.clusters_[idx]);
+            });
+        }
+        inline_mask_ = other.inline_mask_;
+        cluster_mask_ = other.cluster_mask_;
+        inline_value_ = other.inline_value_;
+        if (other.summary_) {
+            summary_ = clone_summary(*other.summary_);
+        }
+        size_ = other.size_;
+        index_ = other.index_ ? std::make_unique<Index>(*other.index_)
+                              : nullptr;
+    }
+
+    void release_cluster(unsigned idx) noexcept
+    {
+        if constexpr (INLINE_CHILDREN) {
+            clusters_[idx] = Child{};
+        }
+        else {
+            free_node(clusters_.at(idx));
+        }
+        cluster_mask_.reset(idx);
+    }
+
+    // The pools this node allocates from; a root creates its own on first
+    // use.
+    [[nodiscard]] Pools &pools()
+    {
+        if (!pools_.get()) {
+            own_pools_ = std::make_unique<Pools>();
+            pools_ = veb_detail::PoolsRef<Pools>(own_pools_.get());
+        }
+        return *pools_.get();
+    }
+
+    // Used to attach a root's summary to the pools created for the root.
+    void attach(Pools *pools) noexcept
+    {
+        pools_ = veb_detail::PoolsRef<Pools>(pools);
+    }
+
+    [[nodiscard]] ChildPtr new_node()
+    {
+        Pools &pools = this->pools();
+        if constexpr (CHILD_IS_BRANCH) {
+            return ChildPtr(pools.nodes.make(&pools.below));
+        }
+        else {
+            return ChildPtr(pools.nodes.make());
+        }
+    }
+
+    [[nodiscard]] ChildPtr clone_node(Child const &other)
+    {
+        Pools &pools = this->pools();
+        if constexpr (CHILD_IS_BRANCH) {
+            return ChildPtr(pools.nodes.make(other, &pools.below));
+        }
+        else {
+            return ChildPtr(pools.nodes.make(other));
+        }
+    }
+
+    // Returns a cluster or summary node, and everything under it, to the
+    // pools.
+    void free_node(ChildPtr &node) noexcept
+    {
+        if (!node) {
+            return;
+        }
+        if constexpr (Alloc::BULK_RELEASE && CHILD_IS_BRANCH) {
+            node->release_nodes();
         }
+        pools_.get()->nodes.destroy(node.release());
     }
 
-    [[nodiscard]] std::optional<unsigned>
-    summary_successor(unsigned idx) const noexcept
+    // Frees every node under this one and leaves the branch empty.
+    void release_nodes() noexcept
+    {
+        if constexpr (!INLINE_CHILDREN) {
+            cluster_mask_.for_each_set(
+                [&](unsigned idx) { free_node(clusters_.at(idx)); });
+        }
+        free_summary();
+        forget_nodes();
+    }
+
+    // Empties the branch without freeing its nodes: they have been freed
+    // already or go with the pools.
+    void forget_nodes() noexcept
+    {
+        cluster_mask_.for_each_set([&](unsigned idx) {
+            if constexpr (INLINE_CHILDREN) {
+                clusters_[idx] = Child{};
+            }
+            else {
+                (void)clusters_.at(idx).release();
+            }
+        });
+        if constexpr (!INLINE_CHILDREN) {
+            clusters_.release();
+        }
+        inline_value_.release();
+        inline_mask_ = DenseMask{};
+        cluster_mask_ = DenseMask{};
+        (void)summary_.release();
+        size_ = 0;
+        index_.reset();
+    }
+
+    [[nodiscard]] Summary &ensure_summary()
     {
         if (!summary_) {
-            return std::nullopt;
+            if constexpr (FLAT_SUMMARY) {
+                summary_ = SummaryPtr(pools().flat.make());
+            }
+            else {
+                summary_ = new_node();
+            }
         }
-        auto next =
-            summary_->successor(static_cast<typename Summary::Key>(idx));
-        if (!next) {
-            return std::nullopt;
+        return *summary_;
+    }
+
+    [[nodiscard]] SummaryPtr clone_summary(Summary const &other)
+    {
+        if constexpr (FLAT_SUMMARY) {
+            return SummaryPtr(pools().flat.make(other));
+        }
+        else {
+            return clone_node(other);
         }
-        return static_cast<unsigned>(*next);
     }
 
-    [[nodiscard]] std::optional<unsigned>
-    summary_predecessor(unsigned idx) const noexcept
+    void free_summary() noexcept
+    {
+        if constexpr (FLAT_SUMMARY) {
+            if (summary_) {
+                pools_.get()->flat.destroy(summary_.release());
+            }
+        }
+        else {
+            free_node(summary_);
+        }
+    }
+
+    void summary_insert(unsigned idx)
+    {
+        ensure_summary().insert(static_cast<typename Summary::Key>(idx));
+    }
+
+    void summary_erase(unsigned idx)
     {
         if (!summary_) {
-            return std::nullopt;
+            return;
         }
-        auto prev =
-            summary_->predecessor(static_cast<typename Summary::Key>(idx));
-        if (!prev) {
-            return std::nullopt;
+        summary_->erase(static_cast<typename Summary::Key>(idx));
+        if (summary_->empty()) {
+            free_summary();
+            index_.reset();
         }
-        return static_cast<unsigned>(*prev);
     }
 
     [[nodiscard]] bool cluster_active(unsigned idx) const noexcept
@@ -336,6 +1870,15 @@ private:
         return inline_mask_.test(idx) || cluster_mask_.test(idx);
     }
 
+    // Allocates the array pages for clusters [first, last] up front.
+    void touch_clusters(unsigned first, unsigned last)
+    {
+        inline_value_.touch_range(first, last);
+        if constexpr (!INLINE_CHILDREN) {
+            clusters_.touch_range(first, last);
+        }
+    }
+
     [[nodiscard]] Child &ensure_cluster(unsigned idx)
     {
         if constexpr (INLINE_CHILDREN) {
@@ -343,9 +1886,9 @@ private:
             return clusters_[idx];
         }
         else {
-            auto &ptr = clusters_[idx];
+            auto &ptr = clusters_.touch(idx);
             if (!ptr) {
-                ptr = std::make_unique<Child>();
+                ptr = new_node();
                 cluster_mask_.set(idx);
             }
             return *ptr;
@@ -372,12 +1915,16 @@ private:
         }
     }
 
+    std::unique_ptr<Pools> own_pools_{};
+    veb_detail::PoolsRef<Pools> pools_{};
     DenseMask inline_mask_{};
     DenseMask cluster_mask_{};
-    std::array<ChildKey, CLUSTER_COUNT> inline_value_{};
+    veb_detail::PagedArray<ChildKey, CLUSTER_COUNT> inline_value_{};
     std::conditional_t<
         INLINE_CHILDREN, std::array<Child, CLUSTER_COUNT>,
-        std::array<ChildPtr, CLUSTER_COUNT>>
+        veb_detail::PagedArray<ChildPtr, CLUSTER_COUNT>>
         clusters_{};
-    std::unique_ptr<Summary> summary_{};
+    SummaryPtr summary_{};
+    std::size_t size_ = 0;
+    std::unique_ptr<Index> index_{};
 };
@@ -1,19 +1,81 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "simd_utils.hpp"
+#include "veb_allocator.hpp"
+#include "veb_cluster_map.hpp"
 #include "veb_leaf6.hpp"
 #include "veb_leaf8.hpp"
+#include "veb_snapshot.hpp"
 
-template <unsigned Bits, bool Sparse>
+// With PARVEB_MULTIVERSION=1, the VebTreeNN search queries (successor,
+// predecessor, rank, select and their batch forms) are compiled once per
+// x86-64 level (baseline, v3 with BMI/LZCNT/AVX2, v4 with AVX-512)
+// and the dynamic loader picks one through an ifunc. Each clone inlines
+// the whole tree below it, so the bit scans in the branches and leaves
+// use tzcnt/lzcnt where the host has them while the binary still runs on
+// baseline ones. Needs GCC and an ELF target; builds that already target
+// a level gain nothing from it. contains, min, max and the updates stay
+// inline: the indirect call costs them more than the clones save.
+#if PARVEB_MULTIVERSION && defined(__GNUC__) && !defined(__clang__) &&         \
+    defined(__x86_64__) && defined(__ELF__)
+    #define PARVEB_ISA_CLONES                                                  \
+        __attribute__((                                                        \
+            target_clones("default", "arch=x86-64-v3", "arch=x86-64-v4"),      \
+            flatten))
+#else
+    #define PARVEB_ISA_CLONES
+#endif
+
+template <unsigned Bits, bool Sparse, class Alloc, class Layout>
 class VebBranch;
 
 namespace veb_detail
 {
 
+    // Set operations applied cluster by cluster between two nodes.
+    enum class SetOp
+    {
+        Union,
+        Intersection,
+        Difference,
+        SymmetricDifference
+    };
+
+    template <SetOp Op, class Node>
+    void apply_set_op(Node &node, Node const &other)
+    {
+        if constexpr (Op == SetOp::Union) {
+            node.union_with(other);
+        }
+        else if constexpr (Op == SetOp::Intersection) {
+            node.intersect_with(other);
+        }
+        else if constexpr (Op == SetOp::Difference) {
+            node.difference_with(other);
+        }
+        else {
+            node.symmetric_difference_with(other);
+        }
+    }
+
     template <unsigned FanBits, bool Small = (FanBits <= 6)>
     class DenseBitset;
 
@@ -55,6 +117,34 @@ namespace veb_detail
             bits_ &= ~(word_t{1} << idx);
         }
 
+        DenseBitset &operator|=(DenseBitset const &other) noexcept
+        {
+            bits_ |= other.bits_;
+            return *this;
+        }
+
+        DenseBitset &operator&=(DenseBitset const &other) noexcept
+        {
+            bits_ &= other.bits_;
+            return *this;
+        }
+
+        // Clears every bit that is set in `other`.
+        DenseBitset &subtract(DenseBitset const &other) noexcept
+        {
+            bits_ &= static_cast<word_t>(~other.bits_);
+            return *this;
+        }
+
+        // Calls `fn(idx)` for every set bit in ascending order.
+        template <class Fn>
+        void for_each_set(Fn &&fn) const
+        {
+            for (word_t bits = bits_; bits != 0; bits &= (bits - 1)) {
+                fn(static_cast<unsigned>(std::countr_zero(bits)));
+            }
+        }
+
     private:
         word_t bits_{0};
     };
@@ -89,6 +179,38 @@ namespace veb_detail
             words_[word_idx] &= ~mask;
         }
 
+        DenseBitset &operator|=(DenseBitset const &other) noexcept
+        {
+            simd::or_words(words_, other.words_);
+            return *this;
+        }
+
+        DenseBitset &operator&=(DenseBitset const &other) noexcept
+        {
+            simd::and_words(words_, other.words_);
+            return *this;
+        }
+
+        // Clears every bit that is set in `other`.
+        DenseBitset &subtract(DenseBitset const &other) noexcept
+        {
+            simd::andnot_words(words_, other.words_);
+            return *this;
+        }
+
+        // Calls `fn(idx)` for every set bit in ascending order.
+        template <class Fn>
+        void for_each_set(Fn &&fn) const
+        {
+            for (unsigned i = 0; i < WORD_COUNT; ++i) {
+                for (uint64_t bits = words_[i]; bits != 0;
+                     bits &= (bits - 1)) {
+                    fn(i * WORD_BITS +
+                       static_cast<unsigned>(std::countr_zero(bits)));
+                }
+            }
+        }
+
     private:
         static constexpr std::pair<unsigned, uint64_t>
         locate(unsigned idx) noexcept
@@ -99,6 +221,217 @@ namespace veb_detail
         std::array<uint64_t, WORD_COUNT> words_{};
     };
 
+    inline constexpr std::size_t PAGE_BYTES = 4096;
+
+    template <
+        class T,
+        std::size_t N,
+        bool Paged = (N * sizeof(T) > PAGE_BYTES)>
+    class PagedArray;
+
+    // Arrays up to a page are stored inline, with the paged interface.
+    template <class T, std::size_t N>
+    class PagedArray<T, N, false>
+    {
+    public:
+        [[nodiscard]] T const &operator[](std::size_t idx) const noexcept
+        {
+            return items_[idx];
+        }
+
+        [[nodiscard]] T &at(std::size_t idx) noexcept
+        {
+            return items_[idx];
+        }
+
+        [[nodiscard]] T &touch(std::size_t idx) noexcept
+        {
+            return items_[idx];
+        }
+
+        void touch_range(std::size_t, std::size_t) noexcept {}
+
+        // Nothing to free; old entries keep their values.
+        void release() noexcept {}
+
+        [[nodiscard]] std::size_t allocated_bytes() const noexcept
+        {
+            return 0;
+        }
+
+    private:
+        std::array<T, N> items_{};
+    };
+
+    // Array of N entries whose storage is allocated a page at a time, on
+    // first write, so an empty top-level node costs one pointer per page
+    // instead of the whole array. Entries on pages never written read as
+    // T{}; lookups stay a direct index plus one pointer hop.
+    template <class T, std::size_t N>
+    class PagedArray<T, N, true>
+    {
+        static constexpr std::size_t PAGE_ITEMS =
+            std::bit_floor(std::max<std::size_t>(1, PAGE_BYTES / sizeof(T)));
+        static constexpr unsigned PAGE_SHIFT =
+            static_cast<unsigned>(std::countr_zero(PAGE_ITEMS));
+        static constexpr std::size_t PAGE_COUNT =
+            (N + PAGE_ITEMS - 1) / PAGE_ITEMS;
+        using Page = std::array<T, PAGE_ITEMS>;
+
+    public:
+        PagedArray() = default;
+
+        PagedArray(PagedArray const &other)
+            requires std::copyable<T>
+        {
+            copy_pages(other);
+        }
+
+        PagedArray &operator=(PagedArray const &other)
+            requires std::copyable<T>
+        {
+            if (this != &other) {
+                copy_pages(other);
+            }
+            return *this;
+        }
+
+        PagedArray(PagedArray &&) noexcept = default;
+        PagedArray &operator=(PagedArray &&) noexcept = default;
+
+        [[nodiscard]] T const &operator[](std::size_t idx) const noexcept
+        {
+            assert(idx < N);
+            Page const *page = pages_[idx >> PAGE_SHIFT].get();
+            return page ? (*page)[idx & (PAGE_ITEMS - 1)] : EMPTY;
+        }
+
+        // Entry on a page that has been written before.
+        [[nodiscard]] T &at(std::size_t idx) noexcept
+        {
+            assert(pages_[idx >> PAGE_SHIFT]);
+            return (*pages_[idx >> PAGE_SHIFT])[idx & (PAGE_ITEMS - 1)];
+        }
+
+        // Entry for writing; allocates its page on first use.
+        [[nodiscard]] T &touch(std::size_t idx)
+        {
+            assert(idx < N);
+            auto &page = pages_[idx >> PAGE_SHIFT];
+            if (!page) {
+                page = std::make_unique<Page>();
+            }
+            return (*page)[idx & (PAGE_ITEMS - 1)];
+        }
+
+        // Allocates every page holding an entry in [first, last], so that
+        // threads writing disjoint entries need not allocate concurrently.
+        void touch_range(std::size_t first, std::size_t last)
+        {
+            for (std::size_t p = first >> PAGE_SHIFT; p <= last >> PAGE_SHIFT;
+                 ++p) {
+                if (!pages_[p]) {
+                    pages_[p] = std::make_unique<Page>();
+                }
+            }
+        }
+
+        // Frees every page; all entries read as T{} again.
+        void release() noexcept
+        {
+            pages_ = {};
+        }
+
+        // Heap bytes held by the pages allocated so far.
+        [[nodiscard]] std::size_t allocated_bytes() const noexcept
+        {
+            return static_cast<std::size_t>(std::ranges::count_if(
+                       pages_, [](auto const &page) { return !!page; })) *
+                   sizeof(Page);
+        }
+
+    private:
+        void copy_pages(PagedArray const &other)
+        {
+            for (std::size_t p = 0; p < PAGE_COUNT; ++p) {
+                pages_[p] = other.pages_[p]
+                                ? std::make_unique<Page>(*other.pages_[p])
+                                : nullptr;
+            }
+        }
+
+        static inline T const EMPTY{};
+
+        std::array<std::unique_ptr<Page>, PAGE_COUNT> pages_{};
+    };
+
+    // Memory held by a tree, split by what it is spent on. Byte counts are
+    // the sizes of the objects themselves, plus what the node pools hold
+    // around them; malloc's own overhead is not included.
+    struct MemoryUsage
+    {
+        // Levels below the root, which is level 0. A 64-bit tree has a
+        // branch at 64, 32 and 16 bits, then leaves.
+        static constexpr std::size_t MAX_LEVELS = 4;
+
+        // VebLeaf6/VebLeaf8 nodes outside summaries.
+        std::size_t leaf_bytes = 0;
+        // Everything under the summaries, at every level.
+        std::size_t summary_bytes = 0;
+        // Branch nodes themselves: masks, pointer arrays and counters.
+        std::size_t branch_bytes = 0;
+        // Dense branches' arrays of single-key cluster values.
+        std::size_t inline_value_bytes = 0;
+        // Sparse branches' cluster maps: buckets and entry storage.
+        std::size_t cluster_map_bytes = 0;
+        // Entries held by the cluster maps, and how many their current
+        // allocations have room for.
+        std::size_t cluster_map_size = 0;
+        std::size_t cluster_map_capacity = 0;
+        // Per-block key counts kept for rank and select.
+        std::size_t index_bytes = 0;
+        // Node pool memory not holding a live node: free and not yet used
+        // slab slots, slot headers and the pools' own bookkeeping.
+        std::size_t reserved_bytes = 0;
+        // Nodes at each level, summaries included.
+        std::array<std::size_t, MAX_LEVELS> nodes{};
+
+        [[nodiscard]] std::size_t total_bytes() const noexcept
+        {
+            return leaf_bytes + summary_bytes + branch_bytes +
+                   inline_value_bytes + cluster_map_bytes + index_bytes +
+                   reserved_bytes;
+        }
+
+        // Folds in the usage of a summary subtree: its bytes all count as
+        // summary bytes, except pool reserve, and its nodes still count at
+        // their own levels.
+        void add_summary(MemoryUsage const &summary) noexcept
+        {
+            summary_bytes += summary.total_bytes() - summary.reserved_bytes;
+            reserved_bytes += summary.reserved_bytes;
+            cluster_map_size += summary.cluster_map_size;
+            cluster_map_capacity += summary.cluster_map_capacity;
+            for (std::size_t level = 0; level < MAX_LEVELS; ++level) {
+                nodes[level] += summary.nodes[level];
+            }
+        }
+    };
+
+    // Adds `node`, and everything it owns, to `usage` as a node at `level`.
+    template <class Node>
+    void add_memory_usage(
+        Node const &node, MemoryUsage &usage, std::size_t level) noexcept
+    {
+        if constexpr (requires { node.add_memory_usage(usage, level); }) {
+            node.add_memory_usage(usage, level);
+        }
+        else {
+            usage.leaf_bytes += sizeof(Node);
+            ++usage.nodes[level];
+        }
+    }
+
     template <unsigned Bits>
     constexpr bool default_sparse_storage() noexcept
     {
@@ -132,30 +465,598 @@ namespace veb_detail
         using type = typename decltype(select_key<Bits>())::type;
     };
 
-    template <unsigned Bits, bool Sparse>
+    // Number of lookups the *_batch queries keep in flight. Every level
+    // walks the whole group before descending, so the cache misses of
+    // independent lookups overlap instead of serializing.
+    inline constexpr std::size_t QUERY_GROUP = 16;
+
+    // Padding unit that keeps independently written state (locks, counters)
+    // off each other's cache lines.
+    inline constexpr std::size_t CACHE_LINE_BYTES = 64;
+
+    inline void prefetch(void const *ptr) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(ptr);
+#else
+        (void)ptr;
+#endif
+    }
+
+    // Minimum number of keys worth handing to a separate thread.
+    inline constexpr std::size_t PARALLEL_GRAIN = std::size_t{1} << 14;
+
+    // Maps a requested thread count (0 = one per hardware thread) to the
+    // number of threads worth using for `n` keys.
+    [[nodiscard]] inline unsigned
+    useful_threads(std::size_t n, unsigned requested) noexcept
+    {
+        if (requested == 0) {
+            requested = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::size_t cap = std::max<std::size_t>(1, n / PARALLEL_GRAIN);
+        return static_cast<unsigned>(std::min<std::size_t>(requested, cap));
+    }
+
+    // Key counts per block of clusters, used by rank and select. Totals are
+    // also kept per group of blocks, so a prefix sum reads at most two
+    // short runs of counters while an update stays at two increments.
+    template <unsigned BlockBits>
+    class BlockCounts
+    {
+    public:
+        static constexpr std::size_t BLOCKS = std::size_t{1} << BlockBits;
+
+        void add(std::size_t block, std::ptrdiff_t delta) noexcept
+        {
+            blocks_[block] += static_cast<std::size_t>(delta);
+            groups_[block / GROUP_BLOCKS] += static_cast<std::size_t>(delta);
+        }
+
+        [[nodiscard]] std::size_t at(std::size_t block) const noexcept
+        {
+            return blocks_[block];
+        }
+
+        // Keys in all blocks below `block`.
+        [[nodiscard]] std::size_t before(std::size_t block) const noexcept
+        {
+            std::size_t group = block / GROUP_BLOCKS;
+            std::size_t n = 0;
+            for (std::size_t g = 0; g < group; ++g) {
+                n += groups_[g];
+            }
+            for (std::size_t b = group * GROUP_BLOCKS; b < block; ++b) {
+                n += blocks_[b];
+            }
+            return n;
+        }
+
+        // Returns the block holding the key of rank `k` and reduces `k` to
+        // a rank within that block. `k` must be below the total count.
+        [[nodiscard]] std::size_t find(std::size_t &k) const noexcept
+        {
+            std::size_t group = 0;
+            while (k >= groups_[group]) {
+                k -= groups_[group++];
+            }
+            std::size_t block = group * GROUP_BLOCKS;
+            while (k >= blocks_[block]) {
+                k -= blocks_[block++];
+            }
+            return block;
+        }
+
+    private:
+        static constexpr std::size_t GROUP_BLOCKS =
+            std::min<std::size_t>(BLOCKS, 256);
+
+        std::array<std::size_t, BLOCKS> blocks_{};
+        std::array<std::size_t, BLOCKS / GROUP_BLOCKS> groups_{};
+    };
+
+    // Key counts per occupied cluster, used by rank and select in sparse
+    // branches, whose fanout is too wide for BlockCounts. Counters are kept
+    // in ascending cluster order in groups of at most GROUP_MAX, and a
+    // Fenwick tree over the group totals sums whole groups. Storage follows
+    // the occupied clusters, and a prefix sum is a binary search and a
+    // Fenwick walk over the groups plus one pass over a group's counters.
+    template <class ClusterKey>
+    class ClusterCounts
+    {
+    public:
+        ClusterCounts() = default;
+
+        ClusterCounts(ClusterCounts const &other)
+            : firsts_(other.firsts_), totals_(other.totals_),
+              tree_(other.tree_)
+        {
+            groups_.reserve(other.groups_.size());
+            for (auto const &group : other.groups_) {
+                groups_.push_back(std::make_unique<Group>(*group));
+            }
+        }
+
+        // Fills an empty index from (cluster, count) pairs in ascending
+        // cluster order.
+        void assign(std::span<std::pair<ClusterKey, std::size_t> const> counts)
+        {
+            assert(groups_.empty());
+            for (std::size_t i = 0; i < counts.size(); i += GROUP_MAX / 2) {
+                auto &group = groups_.emplace_back(std::make_unique<Group>());
+                std::size_t end = std::min(counts.size(), i + GROUP_MAX / 2);
+                std::size_t total = 0;
+                for (std::size_t j = i; j < end; ++j) {
+                    group->keys[group->size] = counts[j].first;
+                    group->counts[group->size++] = counts[j].second;
+                    total += counts[j].second;
+                }
+                firsts_.push_back(counts[i].first);
+                totals_.push_back(total);
+            }
+            rebuild();
+        }
+
+        // Adds `delta` keys to `cluster`. A counter is created on first use
+        // and dropped when its count returns to zero.
+        void add(ClusterKey cluster, std::ptrdiff_t delta)
+        {
+            if (delta == 0) {
+                return;
+            }
+            if (groups_.empty()) {
+                groups_.push_back(std::make_unique<Group>());
+                firsts_.push_back(cluster);
+                totals_.push_back(0);
+                tree_.push_back(0);
+            }
+            std::size_t g = group_of(cluster);
+            Group &group = *groups_[g];
+            std::size_t i = group.lower_bound(cluster);
+            if (i == group.size || group.keys[i] != cluster) {
+                group.insert(i, cluster);
+                firsts_[g] = group.keys[0];
+            }
+            group.counts[i] += static_cast<std::size_t>(delta);
+            totals_[g] += static_cast<std::size_t>(delta);
+            if (group.counts[i] == 0 && drop(g, i)) {
+                return;
+            }
+            if (group.size == GROUP_MAX) {
+                split(g);
+                return;
+            }
+            for (std::size_t t = g; t < tree_.size(); t |= t + 1) {
+                tree_[t] += static_cast<std::size_t>(delta);
+            }
+        }
+
+        // Keys in all clusters below `cluster`.
+        [[nodiscard]] std::size_t before(ClusterKey cluster) const noexcept
+        {
+            if (groups_.empty()) {
+                return 0;
+            }
+            std::size_t g = group_of(cluster);
+            Group const &group = *groups_[g];
+            std::size_t used = group.lower_bound(cluster);
+            std::size_t n = 0;
+            for (std::size_t t = g; t > 0; t &= t - 1) {
+                n += tree_[t - 1];
+            }
+            for (std::size_t i = 0; i < used; ++i) {
+                n += group.counts[i];
+            }
+            return n;
+        }
+
+        // Returns the cluster holding the key of rank `k` and reduces `k` to
+        // a rank within that cluster. `k` must be below the total count.
+        [[nodiscard]] ClusterKey find(std::size_t &k) const noexcept
+        {
+            std::size_t g = 0;
+            for (std::size_t step = std::bit_floor(tree_.size()); step != 0;
+                 step >>= 1) {
+                if (g + step <= tree_.size() && tree_[g + step - 1] <= k) {
+                    k -= tree_[g + step - 1];
+                    g += step;
+                }
+            }
+            Group const &group = *groups_[g];
+            std::size_t i = 0;
+            while (k >= group.counts[i]) {
+                k -= group.counts[i++];
+            }
+            return group.keys[i];
+        }
+
+        // Heap bytes held by the groups and the tables over them.
+        [[nodiscard]] std::size_t allocated_bytes() const noexcept
+        {
+            return groups_.size() * sizeof(Group) +
+                   groups_.capacity() * sizeof(std::unique_ptr<Group>) +
+                   firsts_.capacity() * sizeof(ClusterKey) +
+                   (totals_.capacity() + tree_.capacity()) *
+                       sizeof(std::size_t);
+        }
+
+    private:
+        // Splits rebuild the Fenwick tree, so groups are sized to make that
+        // cheap against the clusters inserted between two splits.
+        static constexpr std::size_t GROUP_MAX = 256;
+
+        // One allocation per group, so an update touches the counters and
+        // keys it needs without going through vector headers first.
+        struct Group
+        {
+            std::size_t size = 0;
+            std::array<ClusterKey, GROUP_MAX> keys;
+            std::array<std::size_t, GROUP_MAX> counts;
+
+            [[nodiscard]] std::size_t lower_bound(ClusterKey key) const noexcept
+            {
+                return static_cast<std::size_t>(
+                    std::lower_bound(keys.begin(), keys.begin() + size, key) -
+                    keys.begin());
+            }
+
+            void insert(std::size_t i, ClusterKey key) noexcept
+            {
+                std::copy_backward(
+                    keys.begin() + i, keys.begin() + size,
+                    keys.begin() + size + 1);
+                std::copy_backward(
+                    counts.begin() + i, counts.begin() + size,
+                    counts.begin() + size + 1);
+                keys[i] = key;
+                counts[i] = 0;
+                ++size;
+            }
+
+            void erase(std::size_t i) noexcept
+            {
+                std::copy(keys.begin() + i + 1, keys.begin() + size,
+                          keys.begin() + i);
+                std::copy(counts.begin() + i + 1, counts.begin() + size,
+                          counts.begin() + i);
+                --size;
+            }
+        };
+
+        // Last group starting at or below `cluster`, or the first group.
+        [[nodiscard]] std::size_t group_of(ClusterKey cluster) const noexcept
+        {
+            auto it = std::ranges::upper_bound(firsts_, cluster);
+            return it == firsts_.begin()
+                ? 0
+                : static_cast<std::size_t>(it - firsts_.begin()) - 1;
+        }
+
+        // Removes counter `i` of group `g`. Returns true when that emptied
+        // the group, which is then removed and the tree rebuilt.
+        bool drop(std::size_t g, std::size_t i)
+        {
+            Group &group = *groups_[g];
+            group.erase(i);
+            if (group.size != 0) {
+                firsts_[g] = group.keys[0];
+                return false;
+            }
+            auto at = static_cast<std::ptrdiff_t>(g);
+            groups_.erase(groups_.begin() + at);
+            firsts_.erase(firsts_.begin() + at);
+            totals_.erase(totals_.begin() + at);
+            rebuild();
+            return true;
+        }
+
+        // Moves the upper half of a full group into a new group after it.
+        void split(std::size_t g)
+        {
+            Group &low = *groups_[g];
+            auto high = std::make_unique<Group>();
+            std::size_t half = low.size / 2;
+            high->size = low.size - half;
+            std::copy(low.keys.begin() + half, low.keys.begin() + low.size,
+                      high->keys.begin());
+            std::copy(low.counts.begin() + half, low.counts.begin() + low.size,
+                      high->counts.begin());
+            low.size = half;
+            std::size_t high_total = 0;
+            for (std::size_t i = 0; i < high->size; ++i) {
+                high_total += high->counts[i];
+            }
+            totals_[g] -= high_total;
+            auto at = static_cast<std::ptrdiff_t>(g) + 1;
+            firsts_.insert(firsts_.begin() + at, high->keys[0]);
+            totals_.insert(totals_.begin() + at, high_total);
+            groups_.insert(groups_.begin() + at, std::move(high));
+            rebuild();
+        }
+
+        // Rebuilds the Fenwick tree from the group totals in linear time.
+        void rebuild()
+        {
+            tree_ = totals_;
+            for (std::size_t t = 0; t < tree_.size(); ++t) {
+                std::size_t parent = t | (t + 1);
+                if (parent < tree_.size()) {
+                    tree_[parent] += tree_[t];
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<Group>> groups_{};
+        std::vector<ClusterKey> firsts_{};
+        std::vector<std::size_t> totals_{};
+        std::vector<std::size_t> tree_{};
+    };
+
+    // Contiguous cluster ranges for a parallel scan. Each part covers
+    // clusters [first(p), last(p)]; parts are ascending and disjoint.
+    template <class ClusterKey>
+    struct ScanPlan
+    {
+        ClusterKey lo{};
+        uint64_t span = 0;
+        std::size_t parts = 0;
+        unsigned threads = 1;
+
+        [[nodiscard]] ClusterKey first(std::size_t p) const noexcept
+        {
+            return static_cast<ClusterKey>(lo + span * p / parts);
+        }
+
+        [[nodiscard]] ClusterKey last(std::size_t p) const noexcept
+        {
+            return static_cast<ClusterKey>(lo + span * (p + 1) / parts - 1);
+        }
+    };
+
+    // Parts handed out per scan thread. Splitting finer than the thread
+    // count lets threads that drew sparse ranges pick up more work.
+    inline constexpr std::size_t SCAN_PARTS_PER_THREAD = 8;
+
+    // Plans a scan over the occupied clusters [lo, hi] (both empty for an
+    // empty node) with `requested` threads (0 = one per hardware thread).
+    template <class ClusterKey>
+    [[nodiscard]] ScanPlan<ClusterKey> make_scan_plan(
+        std::optional<ClusterKey> lo, std::optional<ClusterKey> hi,
+        unsigned requested)
+    {
+        static_assert(sizeof(ClusterKey) <= 4);
+        ScanPlan<ClusterKey> plan;
+        if (!lo || !hi) {
+            return plan;
+        }
+        if (requested == 0) {
+            requested = std::max(1u, std::thread::hardware_concurrency());
+        }
+        plan.lo = *lo;
+        plan.span = uint64_t(*hi) - uint64_t(*lo) + 1;
+        plan.parts = requested == 1
+            ? 1
+            : static_cast<std::size_t>(std::min<uint64_t>(
+                  plan.span, requested * SCAN_PARTS_PER_THREAD));
+        plan.threads =
+            static_cast<unsigned>(std::min<std::size_t>(requested, plan.parts));
+        return plan;
+    }
+
+    // Runs fn(t) for every t in [0, threads); the calling thread takes the
+    // last index and the rest run on their own threads.
+    template <class Fn>
+    void parallel_for(unsigned threads, Fn &&fn)
+    {
+        std::vector<std::jthread> workers;
+        workers.reserve(threads > 0 ? threads - 1 : 0);
+        for (unsigned t = 0; t + 1 < threads; ++t) {
+            workers.emplace_back([&fn, t] { fn(t); });
+        }
+        if (threads > 0) {
+            fn(threads - 1);
+        }
+    }
+
+    // Runs fn(part, first, last) once per part of `plan`. Parts are taken
+    // in ascending order by whichever thread is free, so every part is
+    // scanned start to finish by a single thread.
+    template <class ClusterKey, class Fn>
+    void run_scan(ScanPlan<ClusterKey> const &plan, Fn &&fn)
+    {
+        std::atomic<std::size_t> next{0};
+        parallel_for(plan.threads, [&](unsigned) {
+            auto take = [&] {
+                return next.fetch_add(1, std::memory_order_relaxed);
+            };
+            for (std::size_t p = take(); p < plan.parts; p = take()) {
+                fn(p, plan.first(p), plan.last(p));
+            }
+        });
+    }
+
+    // Sorts keys with an LSD radix sort over 8-bit digits and drops
+    // duplicates. Digits on which every key agrees are skipped, so narrow or
+    // clustered key sets only pay for the bytes that actually vary. With
+    // more than one thread, every pass histograms and scatters per chunk.
+    template <class Key>
+    void radix_sort_unique(std::vector<Key> &keys, unsigned threads = 1)
+    {
+        constexpr std::size_t SMALL_SORT = 256;
+        constexpr unsigned DIGIT_BITS = 8;
+        constexpr std::size_t RADIX = std::size_t{1} << DIGIT_BITS;
+        constexpr unsigned DIGITS = sizeof(Key) * 8 / DIGIT_BITS;
+        using Histogram = std::array<std::size_t, RADIX>;
+
+        std::size_t const n = keys.size();
+        if (n <= SMALL_SORT) {
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            return;
+        }
+
+        threads = std::max(1u, useful_threads(n, threads));
+        auto chunk_begin = [&](unsigned t) { return n * t / threads; };
+        auto digit = [](Key key, unsigned d) {
+            return static_cast<std::size_t>(key >> (d * DIGIT_BITS)) &
+                   (RADIX - 1);
+        };
+
+        // Digit totals do not depend on key order, so one pass over the
+        // input decides which digits need sorting at all.
+        std::vector<std::array<Histogram, DIGITS>> counts(threads);
+        parallel_for(threads, [&](unsigned t) {
+            auto &local = counts[t];
+            for (std::size_t i = chunk_begin(t); i < chunk_begin(t + 1);
+                 ++i) {
+                for (unsigned d = 0; d < DIGITS; ++d) {
+                    ++local[d][digit(keys[i], d)];
+                }
+            }
+        });
+
+        std::vector<Key> scratch(n);
+        std::vector<Histogram> offsets(threads);
+        bool permuted = false;
+        for (unsigned d = 0; d < DIGITS; ++d) {
+            Histogram total{};
+            for (auto const &local : counts) {
+                for (std::size_t b = 0; b < RADIX; ++b) {
+                    total[b] += local[d][b];
+                }
+            }
+            if (std::ranges::find(total, n) != total.end()) {
+                continue;
+            }
+            if (permuted && threads > 1) {
+                parallel_for(threads, [&](unsigned t) {
+                    Histogram &local = counts[t][d];
+                    local.fill(0);
+                    for (std::size_t i = chunk_begin(t);
+                         i < chunk_begin(t + 1);
+                         ++i) {
+                        ++local[digit(keys[i], d)];
+                    }
+                });
+            }
+            std::size_t offset = 0;
+            for (std::size_t b = 0; b < RADIX; ++b) {
+                for (unsigned t = 0; t < threads; ++t) {
+                    offsets[t][b] = offset;
+                    offset += counts[t][d][b];
+                }
+            }
+            parallel_for(threads, [&](unsigned t) {
+                Histogram &next = offsets[t];
+                for (std::size_t i = chunk_begin(t); i < chunk_begin(t + 1);
+                     ++i) {
+                    scratch[next[digit(keys[i], d)]++] = keys[i];
+                }
+            });
+            keys.swap(scratch);
+            permuted = true;
+        }
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    }
+
+    // Returns the end of the run starting at `first` whose keys share the
+    // cluster index `key >> ClusterBits`.
+    template <unsigned ClusterBits, class It>
+    [[nodiscard]] It cluster_run_end(It first, It last)
+    {
+        auto const hi = *first >> ClusterBits;
+        for (++first; first != last && (*first >> ClusterBits) == hi;
+             ++first) {
+        }
+        return first;
+    }
+
+    template <unsigned ClusterBits, class It>
+    [[nodiscard]] std::size_t count_runs(It first, It last)
+    {
+        std::size_t runs = 0;
+        while (first != last) {
+            first = cluster_run_end<ClusterBits>(first, last);
+            ++runs;
+        }
+        return runs;
+    }
+
+    // View over [first, last) that yields the low `ChildKey` part of each
+    // key, so a cluster run can be handed to the child without copying.
+    template <class ChildKey, class Key, class It>
+    [[nodiscard]] auto low_parts(It first, It last, Key mask)
+    {
+        return std::ranges::subrange(first, last) |
+               std::views::transform([mask](auto key) {
+                   return static_cast<ChildKey>(key & mask);
+               });
+    }
+
+    // Splits the sorted range [first, last) into `parts` contiguous pieces
+    // of roughly equal size. Every boundary falls on a cluster index that is
+    // a multiple of `Align`, so no cluster (or group of `Align` clusters)
+    // straddles two pieces.
+    template <unsigned ClusterBits, std::size_t Align, class It>
+    [[nodiscard]] std::vector<It> split_runs(It first, It last, unsigned parts)
+    {
+        using Key = std::remove_cvref_t<decltype(*first)>;
+        auto const n = static_cast<std::size_t>(last - first);
+        std::vector<It> bounds{first};
+        for (unsigned t = 1; t < parts; ++t) {
+            Key key = first[static_cast<std::ptrdiff_t>(n * t / parts)];
+            Key hi = static_cast<Key>((key >> ClusterBits) / Align * Align);
+            Key split = static_cast<Key>(Key(hi) << ClusterBits);
+            bounds.push_back(std::lower_bound(bounds.back(), last, split));
+        }
+        bounds.push_back(last);
+        return bounds;
+    }
+
+    template <unsigned Bits, bool Sparse, class Alloc, class Layout>
     struct ChildSelector
     {
         static constexpr unsigned CHILD_BITS = Bits / 2;
         static constexpr bool CHILD_SPARSE =
             default_sparse_storage<CHILD_BITS>();
 
-        using type = VebBranch<CHILD_BITS, CHILD_SPARSE>;
+        using type = VebBranch<CHILD_BITS, CHILD_SPARSE, Alloc, Layout>;
     };
 
-    template <bool Sparse>
-    struct ChildSelector<12, Sparse>
+    template <bool Sparse, class Alloc, class Layout>
+    struct ChildSelector<12, Sparse, Alloc, Layout>
     {
         using type = VebLeaf6;
     };
 
-    template <bool Sparse>
-    struct ChildSelector<16, Sparse>
+    template <bool Sparse, class Alloc, class Layout>
+    struct ChildSelector<16, Sparse, Alloc, Layout>
     {
         using type = VebLeaf8;
     };
 
+    // Node pools a child type allocates from: a branch's own Pools, or
+    // nothing for a leaf.
+    template <class Child>
+    struct ChildPools
+    {
+        using type = NoPools;
+    };
+
+    template <class Child>
+        requires requires { typename Child::Pools; }
+    struct ChildPools<Child>
+    {
+        using type = typename Child::Pools;
+    };
+
+    template <class Child>
+    using child_pools_t = typename ChildPools<Child>::type;
+
 } // namespace veb_detail
 
 template <
-    unsigned Bits, bool Sparse = veb_detail::default_sparse_storage<Bits>()>
+    unsigned Bits, bool Sparse = veb_detail::default_sparse_storage<Bits>(),
+    class Alloc = veb_detail::SlabNodes,
+    class Layout = veb_detail::HashedClusters>
 class VebBranch;
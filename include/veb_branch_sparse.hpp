@@ -1,38 +1,54 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <optional>
+#include <span>
 #include <utility>
-
-#include <ankerl/unordered_dense.h>
+#include <vector>
 
 #include "veb_branch_detail.hpp"
 
-template <unsigned Bits, bool Sparse>
+template <unsigned Bits, bool Sparse, class Alloc, class Layout>
 class VebBranch;
 
 // Sparse specialization (hash-map-backed clusters).
-template <unsigned Bits>
-class VebBranch<Bits, true>
+template <unsigned Bits, class Alloc, class Layout>
+class VebBranch<Bits, true, Alloc, Layout>
 {
+    template <unsigned, bool, class, class>
+    friend class VebBranch;
+
     static_assert(Bits >= 8 && Bits % 2 == 0);
     static constexpr unsigned CLUSTER_BITS = Bits / 2;
-    using Child = typename veb_detail::ChildSelector<Bits, true>::type;
+    using Child =
+        typename veb_detail::ChildSelector<Bits, true, Alloc, Layout>::type;
     using Summary = Child;
     using ChildKey = typename Child::Key;
     using ClusterKey = typename Summary::Key;
+    using ChildPools = veb_detail::child_pools_t<Child>;
+    using ChildPtr = typename Alloc::template Ptr<Child>;
+    static constexpr bool CHILD_IS_BRANCH =
+        !std::is_same_v<ChildPools, veb_detail::NoPools>;
 
     struct ClusterEntry
     {
         bool inline_only = true;
         ChildKey inline_value = 0;
-        std::unique_ptr<Child> child{};
+        ChildPtr child{};
     };
 
-    using ClusterMap = ankerl::unordered_dense::map<ClusterKey, ClusterEntry>;
+    using ClusterMap = typename Layout::template Map<
+        CLUSTER_BITS, ClusterKey, ClusterEntry>;
+    // Ordered layouts are walked directly instead of through the summary.
+    static constexpr bool ORDERED_CLUSTERS =
+        veb_detail::OrderedClusterMap<ClusterMap>;
 
 public:
     using Key = typename veb_detail::key_type_for_bits<Bits>::type;
@@ -47,64 +63,602 @@ public:
     }();
     static constexpr Key MAX = MAX_KEY;
     static constexpr unsigned FANOUT_BITS = CLUSTER_BITS;
+    // Node encoding in snapshots; see the dense branch. Sparse summaries
+    // are never flat.
+    static constexpr uint64_t SNAPSHOT_LAYOUT = [] {
+        if constexpr (CHILD_IS_BRANCH) {
+            return Child::SNAPSHOT_LAYOUT << 1;
+        }
+        else {
+            return uint64_t{0};
+        }
+    }();
+
+    // Node pools shared by every node of one tree: `nodes` holds this
+    // level's children, `below` the levels under them (including the
+    // summary's). The root owns them; every other node points at its
+    // level's share.
+    struct Pools
+    {
+        typename Alloc::template Pool<Child> nodes;
+        ChildPools below;
+
+        void share(int delta) noexcept
+        {
+            nodes.share(delta);
+            below.share(delta);
+        }
+
+        void release() noexcept
+        {
+            nodes.release();
+            below.release();
+        }
+
+        [[nodiscard]] std::size_t idle_bytes() const noexcept
+        {
+            return nodes.idle_bytes() + below.idle_bytes();
+        }
+    };
 
     VebBranch() = default;
 
+    // Node inside a tree, allocating from `pools`.
+    explicit VebBranch(Pools *pools) noexcept
+        : pools_(pools), summary_(make_summary(pools))
+    {
+    }
+
+    // Deep copy: every cluster is cloned.
+    VebBranch(VebBranch const &other)
+    {
+        copy_from(other);
+    }
+
+    VebBranch(VebBranch const &other, Pools *pools)
+        : pools_(pools), summary_(make_summary(pools))
+    {
+        copy_from(other);
+    }
+
+    VebBranch(VebBranch &&) noexcept = default;
+
+    VebBranch &operator=(VebBranch const &other)
+    {
+        if (this != &other) {
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    VebBranch &operator=(VebBranch &&) noexcept = default;
+
     bool empty() const noexcept
     {
         return summary_.empty();
     }
 
-    void insert(Key key)
+    // Removes every key. A root under a bulk-release policy hands its slabs
+    // back at once instead of walking the clusters.
+    void clear() noexcept
+    {
+        if constexpr (Alloc::BULK_RELEASE) {
+            if (own_pools_) {
+                forget_nodes();
+                own_pools_->release();
+                return;
+            }
+        }
+        release_nodes();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // Memory held by this branch and everything under it.
+    [[nodiscard]] veb_detail::MemoryUsage memory_usage() const noexcept
+    {
+        veb_detail::MemoryUsage usage;
+        add_memory_usage(usage, 0);
+        return usage;
+    }
+
+    // Adds this branch to `usage` as a node at `level`; a parent calls it
+    // for its clusters and summary.
+    void add_memory_usage(
+        veb_detail::MemoryUsage &usage, std::size_t level) const noexcept
+    {
+        ++usage.nodes[level];
+        if (own_pools_) {
+            usage.reserved_bytes += sizeof(Pools) + own_pools_->idle_bytes();
+        }
+        usage.branch_bytes +=
+            sizeof(*this) - sizeof(summary_) - sizeof(clusters_);
+        auto map = veb_detail::cluster_map_usage(clusters_);
+        usage.cluster_map_bytes += sizeof(clusters_) + map.bytes;
+        usage.cluster_map_size += clusters_.size();
+        usage.cluster_map_capacity += map.capacity;
+        if (index_) {
+            usage.index_bytes += sizeof(Index) + index_->allocated_bytes();
+        }
+        for (auto const &[hi, entry] : clusters_) {
+            if (entry.child) {
+                veb_detail::add_memory_usage(*entry.child, usage, level + 1);
+            }
+        }
+        veb_detail::MemoryUsage summary;
+        veb_detail::add_memory_usage(summary_, summary, level + 1);
+        usage.add_summary(summary);
+    }
+
+    // Returns true when `key` was not present before.
+    bool insert(Key key)
     {
         ClusterKey hi = hi_part(key);
         ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
         auto [it, inserted] = clusters_.try_emplace(hi);
         ClusterEntry &entry = it->second;
         if (inserted) {
-            summary_.insert(hi);
+            writable_summary().insert(hi);
             entry.inline_only = true;
             entry.inline_value = lo;
-            return;
+            count_keys(hi, 1);
+            index_if_large();
+            return true;
         }
 
         if (entry.inline_only) {
             if (entry.inline_value == lo) {
-                return;
+                return false;
             }
             Child &child = ensure_child(entry);
             child.insert(entry.inline_value);
             child.insert(lo);
             entry.inline_only = false;
+            count_keys(hi, 1);
+            return true;
+        }
+
+        if (!ensure_child(entry).insert(lo)) {
+            return false;
+        }
+        count_keys(hi, 1);
+        return true;
+    }
+
+    void batch_insert(std::span<Key const> keys)
+    {
+        std::vector<Key> sorted(keys.begin(), keys.end());
+        veb_detail::radix_sort_unique(sorted);
+        batch_insert_sorted(sorted.begin(), sorted.end());
+    }
+
+    // Inserts keys given in ascending order. The map is probed once per
+    // cluster run, and newly created clusters are added to the summary as
+    // one sorted batch at the end.
+    template <class It>
+    void batch_insert_sorted(It first, It last)
+    {
+        reserve_clusters(first, last);
+        std::vector<ClusterKey> fresh;
+        while (first != last) {
+            It run_end =
+                veb_detail::cluster_run_end<CLUSTER_BITS>(first, last);
+            ClusterKey hi = hi_part(static_cast<Key>(*first));
+            auto [it, inserted] = clusters_.try_emplace(hi);
+            if (inserted) {
+                fresh.push_back(hi);
+            }
+            std::size_t added =
+                insert_run(it->second, inserted, first, run_end);
+            count_keys(hi, static_cast<std::ptrdiff_t>(added));
+            first = run_end;
+        }
+        writable_summary().batch_insert_sorted(fresh.begin(), fresh.end());
+        index_if_large();
+    }
+
+    // Fills an empty branch from strictly ascending keys. The map is sized
+    // once for the exact cluster count, entries are created without
+    // promotion, and the summary is built from the cluster list in one
+    // sweep.
+    template <class It>
+    void build_sorted(It first, It last)
+    {
+        assert(empty());
+        std::vector<ClusterKey> active;
+        active.reserve(veb_detail::count_runs<CLUSTER_BITS>(first, last));
+        clusters_.reserve(active.capacity());
+        while (first != last) {
+            It run_end =
+                veb_detail::cluster_run_end<CLUSTER_BITS>(first, last);
+            ClusterKey hi = hi_part(static_cast<Key>(*first));
+            ClusterEntry &entry = clusters_.try_emplace(hi).first->second;
+            if (std::next(first) == run_end) {
+                entry.inline_value =
+                    static_cast<ChildKey>(Key(*first) & CHILD_MASK);
+            }
+            else {
+                auto lows =
+                    veb_detail::low_parts<ChildKey>(first, run_end, CHILD_MASK);
+                entry.inline_only = false;
+                entry.child = new_node();
+                entry.child->build_sorted(lows.begin(), lows.end());
+            }
+            active.push_back(hi);
+            size_ += static_cast<std::size_t>(std::distance(first, run_end));
+            first = run_end;
+        }
+        writable_summary().build_sorted(active.begin(), active.end());
+        index_if_large();
+    }
+
+    // Snapshot form (see veb_snapshot.hpp): the summary, then one entry
+    // per cluster in ascending order. Only non-empty branches are written.
+    template <class Writer>
+    void save(Writer &out) const
+    {
+        summary_.save(out);
+        for_each_entry([&](ClusterKey, ClusterEntry const &entry) {
+            if (entry.inline_only) {
+                out.write(veb_detail::INLINE_ENTRY | entry.inline_value);
+            }
+            else {
+                out.write(veb_detail::CHILD_ENTRY);
+                entry.child->save(out);
+            }
+        });
+    }
+
+    // Fills an empty branch from its snapshot form. The map is sized once
+    // from the summary and nodes are rebuilt from their stored words, so
+    // no key goes through insert.
+    template <class Reader>
+    void load(Reader &in)
+    {
+        assert(empty());
+        Summary &summary = writable_summary();
+        summary.load(in);
+        if (summary.empty()) {
+            veb_detail::snapshot_error("empty summary");
+        }
+        clusters_.reserve(summary.size());
+        summary.for_each([&](ClusterKey hi) {
+            ClusterEntry &entry = clusters_.try_emplace(hi).first->second;
+            uint64_t word = in.read();
+            if (word & veb_detail::INLINE_ENTRY) {
+                uint64_t value = word & ~veb_detail::INLINE_ENTRY;
+                if (value > CHILD_MASK) {
+                    veb_detail::snapshot_error("inline key out of range");
+                }
+                entry.inline_value = static_cast<ChildKey>(value);
+                ++size_;
+            }
+            else if (word == veb_detail::CHILD_ENTRY) {
+                entry.inline_only = false;
+                entry.child = new_node();
+                entry.child->load(in);
+                if (entry.child->empty()) {
+                    veb_detail::snapshot_error("empty cluster");
+                }
+                size_ += entry.child->size();
+            }
+            else {
+                veb_detail::snapshot_error("bad cluster entry");
+            }
+        });
+        index_if_large();
+    }
+
+    // Inserts keys using up to `thread_count` threads (0 = one per hardware
+    // thread).
+    void parallel_insert(std::span<Key const> keys, unsigned thread_count)
+    {
+        std::vector<Key> sorted(keys.begin(), keys.end());
+        veb_detail::radix_sort_unique(sorted, thread_count);
+        parallel_insert_sorted(sorted.begin(), sorted.end(), thread_count);
+    }
+
+    // Parallel form of batch_insert_sorted. The map is not thread-safe, so
+    // every cluster entry is created up front; threads then fill the
+    // subtrees of disjoint cluster ranges with lookups only, and the summary
+    // is built with the same parallel insert once they have joined.
+    template <class It>
+    void parallel_insert_sorted(It first, It last, unsigned thread_count)
+    {
+        auto const n = static_cast<std::size_t>(last - first);
+        thread_count = veb_detail::useful_threads(n, thread_count);
+        if (thread_count <= 1) {
+            batch_insert_sorted(first, last);
             return;
         }
 
-        ensure_child(entry).insert(lo);
+        // A fresh single-key cluster is finished here. A fresh multi-key
+        // cluster is left non-inline and childless for its owning thread.
+        reserve_clusters(first, last);
+        auto const big_run = static_cast<std::ptrdiff_t>(n / thread_count);
+        std::vector<ClusterKey> fresh;
+        std::vector<std::pair<It, It>> big_runs;
+        for (It it = first; it != last;) {
+            It run_end = veb_detail::cluster_run_end<CLUSTER_BITS>(it, last);
+            ClusterKey hi = hi_part(static_cast<Key>(*it));
+            auto [pos, inserted] = clusters_.try_emplace(hi);
+            if (inserted) {
+                fresh.push_back(hi);
+                pos->second.inline_only = std::next(it) == run_end;
+                pos->second.inline_value =
+                    static_cast<ChildKey>(Key(*it) & CHILD_MASK);
+                if (pos->second.inline_only) {
+                    count_keys(hi, 1);
+                }
+            }
+            if (run_end - it > big_run) {
+                big_runs.emplace_back(it, run_end);
+            }
+            it = run_end;
+        }
+
+        // Threads record what each run added; the counts are applied once
+        // they have joined.
+        auto bounds =
+            veb_detail::split_runs<CLUSTER_BITS, 1>(first, last, thread_count);
+        std::vector<std::vector<std::pair<ClusterKey, std::size_t>>> added(
+            thread_count);
+        veb_detail::SharedPools shared(pools());
+        veb_detail::parallel_for(thread_count, [&](unsigned t) {
+            for (It it = bounds[t]; it != bounds[t + 1];) {
+                It run_end =
+                    veb_detail::cluster_run_end<CLUSTER_BITS>(it, last);
+                if (run_end - it <= big_run) {
+                    ClusterKey hi = hi_part(static_cast<Key>(*it));
+                    auto pos = clusters_.find(hi);
+                    added[t].emplace_back(
+                        hi, insert_run(pos->second, false, it, run_end));
+                }
+                it = run_end;
+            }
+        });
+        for (auto const &part : added) {
+            for (auto [hi, count] : part) {
+                count_keys(hi, static_cast<std::ptrdiff_t>(count));
+            }
+        }
+
+        // Clusters big enough to occupy every thread on their own are split
+        // again inside the child.
+        for (auto [run_first, run_last] : big_runs) {
+            ClusterKey hi = hi_part(static_cast<Key>(*run_first));
+            ClusterEntry &entry = clusters_.find(hi)->second;
+            std::size_t before = entry_size(entry);
+            Child &child = promote(entry, false);
+            auto lows = veb_detail::low_parts<ChildKey>(
+                run_first, run_last, CHILD_MASK);
+            child.parallel_insert_sorted(
+                lows.begin(), lows.end(), thread_count);
+            count_keys(hi, static_cast<std::ptrdiff_t>(child.size() - before));
+        }
+        writable_summary().parallel_insert_sorted(
+            fresh.begin(), fresh.end(), thread_count);
+        index_if_large();
     }
 
-    void erase(Key key) noexcept
+    // Returns true when `key` was present.
+    bool erase(Key key) noexcept
     {
         ClusterKey hi = hi_part(key);
         ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
-        auto it = clusters_.find(hi);
+        auto it = veb_detail::cluster_find(clusters_, summary_, hi);
         if (it == clusters_.end()) {
-            return;
+            return false;
         }
         ClusterEntry &entry = it->second;
         if (entry.inline_only) {
             if (entry.inline_value != lo) {
-                return;
+                return false;
             }
+            count_keys(hi, -1);
             remove_cluster(it);
-            return;
+            return true;
         }
-        if (!entry.child) {
-            return;
+        if (!entry.child || !entry.child->erase(lo)) {
+            return false;
         }
-        entry.child->erase(lo);
+        count_keys(hi, -1);
         if (entry.child->empty()) {
             remove_cluster(it);
         }
+        return true;
+    }
+
+    void batch_erase(std::span<Key const> keys)
+    {
+        std::vector<Key> sorted(keys.begin(), keys.end());
+        veb_detail::radix_sort_unique(sorted);
+        auto last = std::upper_bound(sorted.begin(), sorted.end(), MAX_KEY);
+        batch_erase_sorted(sorted.begin(), last);
+    }
+
+    // Erases keys given in ascending order. Emptied clusters are dropped
+    // from the map as they are found, and their summary bits are cleared in
+    // one batch once every run has been applied.
+    template <class It>
+    void batch_erase_sorted(It first, It last)
+    {
+        std::vector<ClusterKey> emptied;
+        while (first != last) {
+            It run_end =
+                veb_detail::cluster_run_end<CLUSTER_BITS>(first, last);
+            ClusterKey hi = hi_part(static_cast<Key>(*first));
+            auto it = clusters_.find(hi);
+            if (it != clusters_.end()) {
+                std::size_t removed = erase_run(it->second, first, run_end);
+                count_keys(hi, -static_cast<std::ptrdiff_t>(removed));
+                if (entry_size(it->second) == 0) {
+                    erase_entry(it);
+                    emptied.push_back(hi);
+                }
+            }
+            first = run_end;
+        }
+        summary_.batch_erase_sorted(emptied.begin(), emptied.end());
+        if (summary_.empty()) {
+            index_.reset();
+        }
+    }
+
+    // Erases every key in [lo, hi] and returns how many were present. Only
+    // the two boundary clusters are trimmed; the entries between them are
+    // dropped from the map whole and their summary bits cleared as one
+    // range.
+    std::size_t erase_range(Key lo, Key hi)
+    {
+        if (lo > hi || lo > MAX_KEY || summary_.empty()) {
+            return 0;
+        }
+        hi = std::min(hi, MAX_KEY);
+        ClusterKey first = hi_part(lo);
+        ClusterKey last = hi_part(hi);
+        auto lo_low = static_cast<ChildKey>(lo & CHILD_MASK);
+        auto hi_low = static_cast<ChildKey>(hi & CHILD_MASK);
+        if (first == last) {
+            return trim_cluster(first, lo_low, hi_low);
+        }
+        std::size_t removed =
+            trim_cluster(first, lo_low, static_cast<ChildKey>(CHILD_MASK));
+        removed += trim_cluster(last, ChildKey{0}, hi_low);
+        if (summary_.empty() || last - first < 2) {
+            return removed;
+        }
+        auto inner_first = static_cast<ClusterKey>(first + 1);
+        auto inner_last = static_cast<ClusterKey>(last - 1);
+        summary_.for_each_range(
+            inner_first, inner_last, [&](ClusterKey cluster_idx) {
+                auto it = clusters_.find(cluster_idx);
+                std::size_t n = entry_size(it->second);
+                count_keys(cluster_idx, -static_cast<std::ptrdiff_t>(n));
+                erase_entry(it);
+                removed += n;
+            });
+        summary_.erase_range(inner_first, inner_last);
+        if (summary_.empty()) {
+            index_.reset();
+        }
+        return removed;
+    }
+
+    // In-place set algebra with another branch. Summaries are combined
+    // first; entries present on one side only are cloned or dropped whole,
+    // and shared entries recurse down to the leaves.
+    void union_with(VebBranch const &other)
+    {
+        if (this == &other || other.empty()) {
+            return;
+        }
+        writable_summary().union_with(other.summary_);
+        for (auto const &[hi, theirs] : other.clusters_) {
+            auto [it, inserted] = clusters_.try_emplace(hi);
+            if (inserted) {
+                it->second = clone_entry(theirs);
+                count_keys(hi, static_cast<std::ptrdiff_t>(entry_size(theirs)));
+            }
+            else {
+                merge_entry<veb_detail::SetOp::Union>(hi, it->second, theirs);
+            }
+        }
+        index_if_large();
+    }
+
+    void intersect_with(VebBranch const &other)
+    {
+        if (this == &other || empty()) {
+            return;
+        }
+        writable_summary().intersect_with(other.summary_);
+        // The summary intersection already cleared the disjoint clusters.
+        std::vector<ClusterKey> disjoint;
+        std::vector<ClusterKey> emptied;
+        for (auto &[hi, mine] : clusters_) {
+            auto const *theirs = other.find_cluster(hi);
+            if (!theirs) {
+                count_keys(hi, -static_cast<std::ptrdiff_t>(entry_size(mine)));
+                disjoint.push_back(hi);
+                continue;
+            }
+            merge_entry<veb_detail::SetOp::Intersection>(hi, mine, *theirs);
+            if (entry_size(mine) == 0) {
+                emptied.push_back(hi);
+            }
+        }
+        for (ClusterKey hi : disjoint) {
+            erase_entry(clusters_.find(hi));
+        }
+        forget_clusters(emptied);
+    }
+
+    // Walks whichever side has fewer clusters.
+    void difference_with(VebBranch const &other)
+    {
+        if (empty() || other.empty()) {
+            return;
+        }
+        if (this == &other) {
+            erase_range(Key{0}, MAX_KEY);
+            return;
+        }
+        std::vector<ClusterKey> emptied;
+        auto visit = [&](ClusterKey hi, ClusterEntry &mine,
+                         ClusterEntry const &theirs) {
+            merge_entry<veb_detail::SetOp::Difference>(hi, mine, theirs);
+            if (entry_size(mine) == 0) {
+                emptied.push_back(hi);
+            }
+        };
+        if (clusters_.size() <= other.clusters_.size()) {
+            for (auto &[hi, mine] : clusters_) {
+                if (auto const *theirs = other.find_cluster(hi)) {
+                    visit(hi, mine, *theirs);
+                }
+            }
+        }
+        else {
+            for (auto const &[hi, theirs] : other.clusters_) {
+                auto it = clusters_.find(hi);
+                if (it != clusters_.end()) {
+                    visit(hi, it->second, theirs);
+                }
+            }
+        }
+        forget_clusters(emptied);
+    }
+
+    void symmetric_difference_with(VebBranch const &other)
+    {
+        if (this == &other) {
+            erase_range(Key{0}, MAX_KEY);
+            return;
+        }
+        if (other.empty()) {
+            return;
+        }
+        writable_summary().union_with(other.summary_);
+        std::vector<ClusterKey> emptied;
+        for (auto const &[hi, theirs] : other.clusters_) {
+            auto [it, inserted] = clusters_.try_emplace(hi);
+            if (inserted) {
+                it->second = clone_entry(theirs);
+                count_keys(hi, static_cast<std::ptrdiff_t>(entry_size(theirs)));
+                continue;
+            }
+            merge_entry<veb_detail::SetOp::SymmetricDifference>(
+                hi, it->second, theirs);
+            if (entry_size(it->second) == 0) {
+                emptied.push_back(hi);
+            }
+        }
+        forget_clusters(emptied);
+        index_if_large();
     }
 
     [[nodiscard]] bool contains(Key key) const noexcept
@@ -120,59 +674,136 @@ public:
         return false;
     }
 
-    [[nodiscard]] std::optional<Key> min() const noexcept
+    // Number of keys strictly below `key`.
+    [[nodiscard]] std::size_t rank(Key key) const noexcept
     {
-        auto hi = summary_.min();
-        if (!hi) {
-            return std::nullopt;
+        if (key > MAX_KEY) {
+            return size_;
+        }
+        ClusterKey hi = hi_part(key);
+        ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+        std::size_t n = keys_below_cluster(hi);
+        if (auto const *entry = find_cluster(hi)) {
+            if (entry->inline_only) {
+                n += entry->inline_value < lo ? 1 : 0;
+            }
+            else if (entry->child) {
+                n += entry->child->rank(lo);
+            }
         }
-        auto const *entry = find_cluster(*hi);
-        if (!entry) {
+        return n;
+    }
+
+    // The key with rank `k`, if there are more than `k` keys.
+    [[nodiscard]] std::optional<Key> select(std::size_t k) const noexcept
+    {
+        if (k >= size_) {
             return std::nullopt;
         }
-        if (entry->inline_only) {
-            return combine(*hi, entry->inline_value);
+        auto select_in = [&](ClusterKey hi, ClusterEntry const &entry) {
+            if (entry.inline_only) {
+                return combine(hi, entry.inline_value);
+            }
+            return combine(hi, *entry.child->select(k));
+        };
+        if constexpr (INDEXED) {
+            if (index_) {
+                ClusterKey cluster_idx = index_->find(k);
+                return select_in(cluster_idx, *find_cluster(cluster_idx));
+            }
         }
-        if (!entry->child) {
-            return std::nullopt;
+        // Walk clusters in order and stop at the one holding rank `k`.
+        if constexpr (ORDERED_CLUSTERS) {
+            for (auto const &[cluster_idx, entry] : clusters_) {
+                std::size_t n = entry_size(entry);
+                if (k < n) {
+                    return select_in(cluster_idx, entry);
+                }
+                k -= n;
+            }
+        }
+        else {
+            ClusterKey hi = summary_.min_or(0);
+            for (;; hi = summary_.successor_or(hi, 0)) {
+                ClusterEntry const &entry = *find_cluster(hi);
+                std::size_t n = entry_size(entry);
+                if (k < n) {
+                    return select_in(hi, entry);
+                }
+                k -= n;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Number of keys in [lo, hi].
+    [[nodiscard]] std::size_t count_range(Key lo, Key hi) const noexcept
+    {
+        if (lo > hi) {
+            return 0;
         }
-        auto lo = entry->child->min();
-        if (!lo) {
+        return rank(hi) + (contains(hi) ? 1 : 0) - rank(lo);
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        if (summary_.empty()) {
             return std::nullopt;
         }
-        return combine(*hi, static_cast<ChildKey>(*lo));
+        return min_or(0);
     }
 
     [[nodiscard]] std::optional<Key> max() const noexcept
     {
-        auto hi = summary_.max();
-        if (!hi) {
+        if (summary_.empty()) {
             return std::nullopt;
         }
-        auto const *entry = find_cluster(*hi);
-        if (!entry) {
-            return std::nullopt;
+        return max_or(0);
+    }
+
+    [[nodiscard]] std::optional<Key> successor(Key key) const noexcept
+    {
+        // 0 is never a successor, so it can mark a miss.
+        if (Key s = successor_or(key, 0)) {
+            return s;
         }
-        if (entry->inline_only) {
-            return combine(*hi, entry->inline_value);
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key> predecessor(Key key) const noexcept
+    {
+        // Nor is MAX_KEY ever a predecessor.
+        if (Key p = predecessor_or(key, MAX_KEY); p != MAX_KEY) {
+            return p;
         }
-        if (!entry->child) {
-            return std::nullopt;
+        return std::nullopt;
+    }
+
+    // Forms of the queries above that return `none` instead of an empty
+    // optional; see VebBranch in veb_branch_dense.hpp.
+    [[nodiscard]] Key min_or(Key none) const noexcept
+    {
+        if (summary_.empty()) {
+            return none;
         }
-        auto lo = entry->child->max();
-        if (!lo) {
-            return std::nullopt;
+        return first_in(summary_.min_or(0));
+    }
+
+    [[nodiscard]] Key max_or(Key none) const noexcept
+    {
+        if (summary_.empty()) {
+            return none;
         }
-        return combine(*hi, static_cast<ChildKey>(*lo));
+        return last_in(summary_.max_or(0));
     }
 
-    [[nodiscard]] std::optional<Key> successor(Key key) const noexcept
+    [[nodiscard]] Key successor_or(Key key, Key none) const noexcept
     {
         if (summary_.empty()) {
-            return std::nullopt;
+            return none;
         }
         if (key >= MAX_KEY) {
-            return std::nullopt;
+            return none;
         }
         ClusterKey hi = hi_part(key);
         ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
@@ -184,40 +815,26 @@ public:
                 }
             }
             else if (entry->child) {
-                if (auto s = entry->child->successor(lo)) {
-                    return combine(hi, static_cast<ChildKey>(*s));
+                if (ChildKey s = entry->child->successor_or(lo, 0)) {
+                    return combine(hi, s);
                 }
             }
         }
 
-        auto next_hi = summary_.successor(hi);
+        ClusterKey next_hi = summary_.successor_or(hi, 0);
         if (!next_hi) {
-            return std::nullopt;
-        }
-        auto const *entry = find_cluster(*next_hi);
-        if (!entry) {
-            return std::nullopt;
-        }
-        if (entry->inline_only) {
-            return combine(*next_hi, entry->inline_value);
-        }
-        if (!entry->child) {
-            return std::nullopt;
-        }
-        auto lo_min = entry->child->min();
-        if (!lo_min) {
-            return std::nullopt;
+            return none;
         }
-        return combine(*next_hi, static_cast<ChildKey>(*lo_min));
+        return first_in(next_hi);
     }
 
-    [[nodiscard]] std::optional<Key> predecessor(Key key) const noexcept
+    [[nodiscard]] Key predecessor_or(Key key, Key none) const noexcept
     {
         if (summary_.empty()) {
-            return std::nullopt;
+            return none;
         }
         if (key == 0 || key > MAX_KEY) {
-            return std::nullopt;
+            return none;
         }
         ClusterKey hi = hi_part(key);
         ChildKey limit = static_cast<ChildKey>(key & CHILD_MASK);
@@ -229,61 +846,516 @@ public:
                 }
             }
             else if (entry->child) {
-                if (auto p = entry->child->predecessor(limit)) {
-                    return combine(hi, static_cast<ChildKey>(*p));
+                ChildKey p =
+                    entry->child->predecessor_or(limit, Child::MAX_KEY);
+                if (p != Child::MAX_KEY) {
+                    return combine(hi, p);
                 }
             }
         }
 
-        auto prev_hi = summary_.predecessor(hi);
-        if (!prev_hi) {
-            return std::nullopt;
-        }
-        auto const *entry = find_cluster(*prev_hi);
-        if (!entry) {
-            return std::nullopt;
-        }
-        if (entry->inline_only) {
-            return combine(*prev_hi, entry->inline_value);
-        }
-        if (!entry->child) {
-            return std::nullopt;
-        }
-        auto lo_max = entry->child->max();
-        if (!lo_max) {
-            return std::nullopt;
+        ClusterKey prev_hi = summary_.predecessor_or(hi, Summary::MAX_KEY);
+        if (prev_hi == Summary::MAX_KEY) {
+            return none;
         }
-        return combine(*prev_hi, static_cast<ChildKey>(*lo_max));
+        return last_in(prev_hi);
     }
 
-    template <class Fn>
-    void for_each(Key prefix, Fn &&fn) const
+    // Batched lookups: out[i] receives the answer for keys[i]. Queries are
+    // processed in groups of veb_detail::QUERY_GROUP. At every level the
+    // whole group's cluster probes are issued back to back before any
+    // result is used, then the entries are resolved and the children
+    // prefetched, so the probes' misses overlap; see find_clusters.
+    void contains_batch(
+        std::span<Key const> keys, std::span<bool> out) const noexcept
     {
-        summary_.for_each([&](ClusterKey cluster_idx) {
-            auto it = clusters_.find(cluster_idx);
-            if (it == clusters_.end()) {
-                return;
-            }
-            ClusterEntry const &entry = it->second;
-            Key child_prefix = prefix | (Key(cluster_idx) << CLUSTER_BITS);
-            if (entry.inline_only) {
-                fn(child_prefix | entry.inline_value);
-            }
-            else if (entry.child) {
-                entry.child->for_each(child_prefix, fn);
-            }
+        assert(out.size() >= keys.size());
+        for_each_group(keys, [&](auto nodes, std::size_t i, std::size_t n) {
+            contains_group(nodes, keys.data() + i, out.data() + i, n);
         });
     }
 
-    template <class Fn>
-    void for_each(Fn &&fn) const
+    void successor_batch(
+        std::span<Key const> keys,
+        std::span<std::optional<Key>> out) const noexcept
     {
-        for_each(0, std::forward<Fn>(fn));
+        assert(out.size() >= keys.size());
+        for_each_group(keys, [&](auto nodes, std::size_t i, std::size_t n) {
+            successor_group(nodes, keys.data() + i, out.data() + i, n);
+        });
+    }
+
+    void predecessor_batch(
+        std::span<Key const> keys,
+        std::span<std::optional<Key>> out) const noexcept
+    {
+        assert(out.size() >= keys.size());
+        for_each_group(keys, [&](auto nodes, std::size_t i, std::size_t n) {
+            predecessor_group(nodes, keys.data() + i, out.data() + i, n);
+        });
+    }
+
+    static void contains_group(
+        VebBranch const *const *nodes, Key const *keys, bool *out,
+        std::size_t n) noexcept
+    {
+        std::array<Child const *, GROUP> sub_nodes{};
+        std::array<ChildKey, GROUP> sub_keys{};
+        std::array<bool, GROUP> sub_out{};
+        std::array<std::size_t, GROUP> sub_idx{};
+        std::size_t m = 0;
+        std::array<ClusterKey, GROUP> his{};
+        std::array<ClusterEntry const *, GROUP> entries{};
+
+        for (std::size_t i = 0; i < n; ++i) {
+            his[i] = hi_part(keys[i]);
+        }
+        find_clusters(nodes, his.data(), entries.data(), n);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = false;
+            ChildKey lo = static_cast<ChildKey>(keys[i] & CHILD_MASK);
+            auto const *entry = entries[i];
+            if (!entry) {
+                continue;
+            }
+            if (entry->inline_only) {
+                out[i] = entry->inline_value == lo;
+            }
+            else if (entry->child) {
+                veb_detail::prefetch(entry->child.get());
+                sub_nodes[m] = entry->child.get();
+                sub_keys[m] = lo;
+                sub_idx[m++] = i;
+            }
+        }
+
+        Child::contains_group(
+            sub_nodes.data(), sub_keys.data(), sub_out.data(), m);
+        for (std::size_t j = 0; j < m; ++j) {
+            out[sub_idx[j]] = sub_out[j];
+        }
+    }
+
+    static void successor_group(
+        VebBranch const *const *nodes, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        std::array<Child const *, GROUP> sub_nodes{};
+        std::array<ChildKey, GROUP> sub_keys{};
+        std::array<std::optional<ChildKey>, GROUP> sub_out{};
+        std::array<std::size_t, GROUP> sub_idx{};
+        std::size_t m = 0;
+        std::array<Summary const *, GROUP> sum_nodes{};
+        std::array<ClusterKey, GROUP> sum_keys{};
+        std::array<std::optional<ClusterKey>, GROUP> sum_out{};
+        std::array<std::size_t, GROUP> sum_idx{};
+        std::size_t s = 0;
+
+        std::array<VebBranch const *, GROUP> probes{};
+        std::array<ClusterKey, GROUP> his{};
+        std::array<ClusterEntry const *, GROUP> entries{};
+
+        auto defer_to_summary = [&](std::size_t i) {
+            sum_nodes[s] = &nodes[i]->summary_;
+            sum_keys[s] = hi_part(keys[i]);
+            sum_idx[s++] = i;
+        };
+
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i].reset();
+            Key key = keys[i];
+            probes[i] = nullptr;
+            if (!nodes[i]->summary_.empty() && key < MAX_KEY) {
+                probes[i] = nodes[i];
+                his[i] = hi_part(key);
+            }
+        }
+        find_clusters(probes.data(), his.data(), entries.data(), n);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!probes[i]) {
+                continue;
+            }
+            ClusterKey hi = his[i];
+            ChildKey lo = static_cast<ChildKey>(keys[i] & CHILD_MASK);
+            if (auto const *entry = entries[i]) {
+                if (entry->inline_only) {
+                    if (entry->inline_value > lo) {
+                        out[i] = combine(hi, entry->inline_value);
+                        continue;
+                    }
+                }
+                else if (entry->child) {
+                    veb_detail::prefetch(entry->child.get());
+                    sub_nodes[m] = entry->child.get();
+                    sub_keys[m] = lo;
+                    sub_idx[m++] = i;
+                    continue;
+                }
+            }
+            defer_to_summary(i);
+        }
+
+        Child::successor_group(
+            sub_nodes.data(), sub_keys.data(), sub_out.data(), m);
+        for (std::size_t j = 0; j < m; ++j) {
+            std::size_t i = sub_idx[j];
+            if (sub_out[j]) {
+                out[i] = combine(hi_part(keys[i]), *sub_out[j]);
+            }
+            else {
+                defer_to_summary(i);
+            }
+        }
+
+        Summary::successor_group(
+            sum_nodes.data(), sum_keys.data(), sum_out.data(), s);
+        for (std::size_t j = 0; j < s; ++j) {
+            probes[j] = sum_out[j] ? nodes[sum_idx[j]] : nullptr;
+            his[j] = sum_out[j].value_or(0);
+        }
+        find_clusters(probes.data(), his.data(), entries.data(), s);
+        std::array<Child const *, GROUP> next{};
+        for (std::size_t j = 0; j < s; ++j) {
+            auto const *entry = entries[j];
+            if (!entry) {
+                continue;
+            }
+            if (entry->inline_only) {
+                out[sum_idx[j]] = combine(*sum_out[j], entry->inline_value);
+            }
+            else {
+                next[j] = entry->child.get();
+                veb_detail::prefetch(next[j]);
+            }
+        }
+        for (std::size_t j = 0; j < s; ++j) {
+            if (!next[j]) {
+                continue;
+            }
+            if (auto lo_min = next[j]->min()) {
+                out[sum_idx[j]] =
+                    combine(*sum_out[j], static_cast<ChildKey>(*lo_min));
+            }
+        }
     }
 
+    static void predecessor_group(
+        VebBranch const *const *nodes, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        std::array<Child const *, GROUP> sub_nodes{};
+        std::array<ChildKey, GROUP> sub_keys{};
+        std::array<std::optional<ChildKey>, GROUP> sub_out{};
+        std::array<std::size_t, GROUP> sub_idx{};
+        std::size_t m = 0;
+        std::array<Summary const *, GROUP> sum_nodes{};
+        std::array<ClusterKey, GROUP> sum_keys{};
+        std::array<std::optional<ClusterKey>, GROUP> sum_out{};
+        std::array<std::size_t, GROUP> sum_idx{};
+        std::size_t s = 0;
+
+        std::array<VebBranch const *, GROUP> probes{};
+        std::array<ClusterKey, GROUP> his{};
+        std::array<ClusterEntry const *, GROUP> entries{};
+
+        auto defer_to_summary = [&](std::size_t i) {
+            sum_nodes[s] = &nodes[i]->summary_;
+            sum_keys[s] = hi_part(keys[i]);
+            sum_idx[s++] = i;
+        };
+
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i].reset();
+            Key key = keys[i];
+            probes[i] = nullptr;
+            if (!nodes[i]->summary_.empty() && key != 0 && key <= MAX_KEY) {
+                probes[i] = nodes[i];
+                his[i] = hi_part(key);
+            }
+        }
+        find_clusters(probes.data(), his.data(), entries.data(), n);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!probes[i]) {
+                continue;
+            }
+            ClusterKey hi = his[i];
+            ChildKey limit = static_cast<ChildKey>(keys[i] & CHILD_MASK);
+            if (auto const *entry = entries[i]) {
+                if (entry->inline_only) {
+                    if (entry->inline_value < limit) {
+                        out[i] = combine(hi, entry->inline_value);
+                        continue;
+                    }
+                }
+                else if (entry->child) {
+                    veb_detail::prefetch(entry->child.get());
+                    sub_nodes[m] = entry->child.get();
+                    sub_keys[m] = limit;
+                    sub_idx[m++] = i;
+                    continue;
+                }
+            }
+            defer_to_summary(i);
+        }
+
+        Child::predecessor_group(
+            sub_nodes.data(), sub_keys.data(), sub_out.data(), m);
+        for (std::size_t j = 0; j < m; ++j) {
+            std::size_t i = sub_idx[j];
+            if (sub_out[j]) {
+                out[i] = combine(hi_part(keys[i]), *sub_out[j]);
+            }
+            else {
+                defer_to_summary(i);
+            }
+        }
+
+        Summary::predecessor_group(
+            sum_nodes.data(), sum_keys.data(), sum_out.data(), s);
+        for (std::size_t j = 0; j < s; ++j) {
+            probes[j] = sum_out[j] ? nodes[sum_idx[j]] : nullptr;
+            his[j] = sum_out[j].value_or(0);
+        }
+        find_clusters(probes.data(), his.data(), entries.data(), s);
+        std::array<Child const *, GROUP> prev{};
+        for (std::size_t j = 0; j < s; ++j) {
+            auto const *entry = entries[j];
+            if (!entry) {
+                continue;
+            }
+            if (entry->inline_only) {
+                out[sum_idx[j]] = combine(*sum_out[j], entry->inline_value);
+            }
+            else {
+                prev[j] = entry->child.get();
+                veb_detail::prefetch(prev[j]);
+            }
+        }
+        for (std::size_t j = 0; j < s; ++j) {
+            if (!prev[j]) {
+                continue;
+            }
+            if (auto lo_max = prev[j]->max()) {
+                out[sum_idx[j]] =
+                    combine(*sum_out[j], static_cast<ChildKey>(*lo_max));
+            }
+        }
+    }
+
+    // `prefix` carries the caller's key type so that nested branches report
+    // full keys rather than keys truncated to their own width.
+    template <class Out, class Fn>
+    void for_each(Out prefix, Fn &&fn) const
+    {
+        for_each_entry(
+            [&](ClusterKey cluster_idx, ClusterEntry const &entry) {
+                Out child_prefix =
+                    prefix | (Out(cluster_idx) << CLUSTER_BITS);
+                if (entry.inline_only) {
+                    fn(child_prefix | Out(entry.inline_value));
+                }
+                else if (entry.child) {
+                    entry.child->for_each(child_prefix, fn);
+                }
+            });
+    }
+
+    template <class Fn>
+    void for_each(Fn &&fn) const
+    {
+        for_each(Key{0}, std::forward<Fn>(fn));
+    }
+
+    // Visits the keys in [lo, hi] in ascending order. Only the two boundary
+    // clusters are masked; clusters in between are walked whole.
+    template <class Out, class Fn>
+    void for_each_range(Out prefix, Key lo, Key hi, Fn &&fn) const
+    {
+        if (lo > hi || lo > MAX_KEY) {
+            return;
+        }
+        hi = std::min(hi, MAX_KEY);
+        ClusterKey first = hi_part(lo);
+        ClusterKey last = hi_part(hi);
+        auto visit = [&](ClusterKey cluster_idx, ClusterEntry const &entry) {
+            Out child_prefix = prefix | (Out(cluster_idx) << CLUSTER_BITS);
+            auto from = static_cast<ChildKey>(
+                cluster_idx == first ? lo & CHILD_MASK : 0);
+            auto to = static_cast<ChildKey>(
+                cluster_idx == last ? hi & CHILD_MASK : CHILD_MASK);
+            if (entry.inline_only) {
+                if (entry.inline_value >= from && entry.inline_value <= to) {
+                    fn(child_prefix | Out(entry.inline_value));
+                }
+            }
+            else if (entry.child) {
+                entry.child->for_each_range(child_prefix, from, to, fn);
+            }
+        };
+        if constexpr (ORDERED_CLUSTERS) {
+            for (auto it = clusters_.lower_bound(first);
+                 it != clusters_.end() && it->first <= last;
+                 ++it) {
+                visit(it->first, it->second);
+            }
+        }
+        else {
+            summary_.for_each_range(first, last, [&](ClusterKey cluster_idx) {
+                if (auto const *entry = find_cluster(cluster_idx)) {
+                    visit(cluster_idx, *entry);
+                }
+            });
+        }
+    }
+
+    template <class Fn>
+    void for_each_range(Key lo, Key hi, Fn &&fn) const
+    {
+        for_each_range(Key{0}, lo, hi, std::forward<Fn>(fn));
+    }
+
+    // Calls fn(key) for every key using up to `thread_count` threads (0 =
+    // one per hardware thread). The key space is split at the summary into
+    // contiguous cluster ranges; each range is visited in ascending order
+    // by a single thread, so fn only needs to be safe across ranges.
+    template <class Fn>
+    void parallel_for_each(Fn &&fn, unsigned thread_count = 0) const
+    {
+        auto plan = scan_plan(thread_count);
+        veb_detail::run_scan(plan, [&](std::size_t, auto first, auto last) {
+            for_each_clusters(first, last, fn);
+        });
+    }
+
+    // Folds every cluster range from `identity` with fold(acc, key), then
+    // combines the range results left to right. The ranges depend only on
+    // the thread count, so a given count always gives the same result.
+    template <class T, class Fold, class Combine>
+    T parallel_reduce(
+        T identity, Fold fold, Combine combine,
+        unsigned thread_count = 0) const
+    {
+        auto plan = scan_plan(thread_count);
+        std::vector<std::optional<T>> partial(plan.parts);
+        veb_detail::run_scan(plan, [&](std::size_t p, auto first, auto last) {
+            T acc = identity;
+            for_each_clusters(
+                first, last, [&](Key key) { acc = fold(std::move(acc), key); });
+            partial[p] = std::move(acc);
+        });
+        T result = std::move(identity);
+        for (auto &part : partial) {
+            result = combine(std::move(result), std::move(*part));
+        }
+        return result;
+    }
+
+    // Position inside a branch for the ordered iterators. The summary
+    // cursor names the current cluster and, unless that cluster holds a
+    // single inline key, the child cursor continues inside it, so a step
+    // only climbs (and probes the map) when the current cluster runs out.
+    class Cursor
+    {
+    public:
+        bool first(VebBranch const &node) noexcept
+        {
+            node_ = &node;
+            return cluster_.first(node.summary_) && enter_first();
+        }
+
+        bool last(VebBranch const &node) noexcept
+        {
+            node_ = &node;
+            return cluster_.last(node.summary_) && enter_last();
+        }
+
+        // Moves to the smallest key not below `key`.
+        bool seek(VebBranch const &node, Key key) noexcept
+        {
+            node_ = &node;
+            if (key > MAX_KEY) {
+                return false;
+            }
+            ClusterKey hi = hi_part(key);
+            ChildKey lo = static_cast<ChildKey>(key & CHILD_MASK);
+            if (!cluster_.seek(node.summary_, hi)) {
+                return false;
+            }
+            if (cluster_.key() != hi) {
+                return enter_first();
+            }
+            entry_ = node.find_cluster(hi);
+            if (entry_->inline_only ? entry_->inline_value >= lo
+                                    : child_.seek(*entry_->child, lo)) {
+                return true;
+            }
+            return cluster_.next() && enter_first();
+        }
+
+        bool next() noexcept
+        {
+            if (!entry_->inline_only && child_.next()) {
+                return true;
+            }
+            return cluster_.next() && enter_first();
+        }
+
+        bool prev() noexcept
+        {
+            if (!entry_->inline_only && child_.prev()) {
+                return true;
+            }
+            return cluster_.prev() && enter_last();
+        }
+
+        [[nodiscard]] Key key() const noexcept
+        {
+            return combine(
+                cluster_.key(),
+                entry_->inline_only ? entry_->inline_value : child_.key());
+        }
+
+    private:
+        bool enter_first() noexcept
+        {
+            entry_ = node_->find_cluster(cluster_.key());
+            return entry_->inline_only || child_.first(*entry_->child);
+        }
+
+        bool enter_last() noexcept
+        {
+            entry_ = node_->find_cluster(cluster_.key());
+            return entry_->inline_only || child_.last(*entry_->child);
+        }
+
+        VebBranch const *node_ = nullptr;
+        ClusterEntry const *entry_ = nullptr;
+        typename Summary::Cursor cluster_{};
+        typename Child::Cursor child_{};
+    };
+
 private:
     static constexpr Key CHILD_MASK = (Key(1) << CLUSTER_BITS) - 1;
 
+    [[nodiscard]] veb_detail::ScanPlan<ClusterKey>
+    scan_plan(unsigned thread_count) const
+    {
+        return veb_detail::make_scan_plan(
+            summary_.min(), summary_.max(), thread_count);
+    }
+
+    template <class Fn>
+    void for_each_clusters(ClusterKey first, ClusterKey last, Fn &&fn) const
+    {
+        for_each_range(
+            Key(first) << CLUSTER_BITS,
+            (Key(last) << CLUSTER_BITS) | CHILD_MASK,
+            fn);
+    }
+
     [[nodiscard]] static ClusterKey hi_part(Key key) noexcept
     {
         return static_cast<ClusterKey>(key >> CLUSTER_BITS);
@@ -294,26 +1366,499 @@ private:
         return (Key(hi) << CLUSTER_BITS) | Key(lo);
     }
 
+    // Smallest and largest key of cluster `hi`, which must be active.
+    [[nodiscard]] Key first_in(ClusterKey hi) const noexcept
+    {
+        auto const *entry = find_cluster(hi);
+        if (entry->inline_only) {
+            return combine(hi, entry->inline_value);
+        }
+        return combine(hi, entry->child->min_or(0));
+    }
+
+    [[nodiscard]] Key last_in(ClusterKey hi) const noexcept
+    {
+        auto const *entry = find_cluster(hi);
+        if (entry->inline_only) {
+            return combine(hi, entry->inline_value);
+        }
+        return combine(hi, entry->child->max_or(0));
+    }
+
+    static constexpr std::size_t GROUP = veb_detail::QUERY_GROUP;
+
+    // Runs `fn(nodes, offset, count)` over consecutive query groups, where
+    // every entry of `nodes` points at this branch.
+    template <class Fn>
+    void for_each_group(std::span<Key const> keys, Fn &&fn) const
+    {
+        std::array<VebBranch const *, GROUP> nodes;
+        nodes.fill(this);
+        for (std::size_t i = 0; i < keys.size(); i += GROUP) {
+            fn(nodes.data(), i, std::min(GROUP, keys.size() - i));
+        }
+    }
+
+    // Calls fn(hi, entry) for every cluster in ascending order.
+    template <class Fn>
+    void for_each_entry(Fn &&fn) const
+    {
+        if constexpr (ORDERED_CLUSTERS) {
+            for (auto const &[cluster_idx, entry] : clusters_) {
+                fn(cluster_idx, entry);
+            }
+        }
+        else {
+            summary_.for_each([&](ClusterKey cluster_idx) {
+                if (auto const *entry = find_cluster(cluster_idx)) {
+                    fn(cluster_idx, *entry);
+                }
+            });
+        }
+    }
+
+    // Lookups between updates, when the summary holds exactly the map's
+    // keys. Batch updates go through clusters_.find.
     ClusterEntry const *find_cluster(ClusterKey hi) const noexcept
     {
-        auto it = clusters_.find(hi);
+        auto it = veb_detail::cluster_find(clusters_, summary_, hi);
         return it == clusters_.end() ? nullptr : &it->second;
     }
 
+    // Looks up his[i] in nodes[i] for a whole group, skipping null nodes.
+    // The first pass prefetches whatever the layout can name ahead of the
+    // probe; the second issues the probes back to back with nothing
+    // depending on their results, so their misses overlap.
+    static void find_clusters(
+        VebBranch const *const *nodes, ClusterKey const *his,
+        ClusterEntry const **entries, std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!nodes[i]) {
+                continue;
+            }
+            if (void const *addr = veb_detail::cluster_probe_address(
+                    nodes[i]->clusters_, nodes[i]->summary_, his[i])) {
+                veb_detail::prefetch(addr);
+            }
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            entries[i] = nodes[i] ? nodes[i]->find_cluster(his[i]) : nullptr;
+        }
+    }
+
     void remove_cluster(typename ClusterMap::iterator it) noexcept
     {
         summary_.erase(it->first);
-        clusters_.erase(it);
+        erase_entry(it);
+        if (summary_.empty()) {
+            index_.reset();
+        }
+    }
+
+    // Erases [lo, hi] from cluster `hi_idx`, dropping the entry when that
+    // empties it. A range covering the cluster drops it outright.
+    std::size_t trim_cluster(ClusterKey hi_idx, ChildKey lo, ChildKey hi)
+    {
+        auto it = clusters_.find(hi_idx);
+        if (it == clusters_.end()) {
+            return 0;
+        }
+        ClusterEntry &entry = it->second;
+        std::size_t removed = entry_size(entry);
+        if (entry.inline_only) {
+            if (entry.inline_value < lo || entry.inline_value > hi) {
+                return 0;
+            }
+        }
+        else if (entry.child && (lo != 0 || hi != CHILD_MASK)) {
+            removed = entry.child->erase_range(lo, hi);
+            if (removed == 0) {
+                return 0;
+            }
+        }
+        count_keys(hi_idx, -static_cast<std::ptrdiff_t>(removed));
+        if (entry.inline_only || !entry.child || entry.child->empty() ||
+            (lo == 0 && hi == CHILD_MASK)) {
+            remove_cluster(it);
+        }
+        return removed;
+    }
+
+    // Returns the number of keys the run added to the cluster behind
+    // `entry`.
+    template <class It>
+    std::size_t
+    insert_run(ClusterEntry &entry, bool inserted, It first, It last)
+    {
+        ChildKey lo = static_cast<ChildKey>(Key(*first) & CHILD_MASK);
+        if (std::next(first) == last) {
+            if (inserted) {
+                entry.inline_only = true;
+                entry.inline_value = lo;
+                return 1;
+            }
+            if (entry.inline_only && entry.inline_value == lo) {
+                return 0;
+            }
+        }
+        std::size_t before = inserted ? 0 : entry_size(entry);
+        Child &child = promote(entry, inserted);
+        auto lows = veb_detail::low_parts<ChildKey>(first, last, CHILD_MASK);
+        child.batch_insert_sorted(lows.begin(), lows.end());
+        return child.size() - before;
+    }
+
+    // Returns the child of `entry`, moving an existing inline value into it.
+    Child &promote(ClusterEntry &entry, bool inserted)
+    {
+        Child &child = ensure_child(entry);
+        if (!inserted && entry.inline_only) {
+            child.insert(entry.inline_value);
+        }
+        entry.inline_only = false;
+        return child;
+    }
+
+    template <class It>
+    void reserve_clusters(It first, It last)
+    {
+        clusters_.reserve(
+            clusters_.size() +
+            veb_detail::count_runs<CLUSTER_BITS>(first, last));
+    }
+
+    // Returns the number of keys the run removed from the cluster behind
+    // `entry`. An inline value that is hit leaves the entry with no keys.
+    template <class It>
+    static std::size_t erase_run(ClusterEntry &entry, It first, It last)
+    {
+        auto lows = veb_detail::low_parts<ChildKey>(first, last, CHILD_MASK);
+        if (entry.inline_only) {
+            if (std::ranges::find(lows, entry.inline_value) == lows.end()) {
+                return 0;
+            }
+            entry.inline_only = false;
+            return 1;
+        }
+        if (!entry.child) {
+            return 0;
+        }
+        std::size_t before = entry.child->size();
+        entry.child->batch_erase_sorted(lows.begin(), lows.end());
+        return before - entry.child->size();
+    }
+
+    [[nodiscard]] static std::size_t
+    entry_size(ClusterEntry const &entry) noexcept
+    {
+        if (entry.inline_only) {
+            return 1;
+        }
+        return entry.child ? entry.child->size() : 0;
+    }
+
+    // Branches with many clusters keep a key count per occupied cluster,
+    // built once the summary holds more than INDEX_MIN_CLUSTERS entries.
+    // Rank and select then read the index instead of walking clusters.
+    static constexpr std::size_t INDEX_MIN_CLUSTERS = 256;
+    static constexpr bool INDEXED = CLUSTER_BITS > 8;
+    using Index = veb_detail::ClusterCounts<ClusterKey>;
+
+    // Only a new cluster's counter allocates, so the noexcept erase paths
+    // that pass negative deltas stay non-throwing.
+    void count_keys(ClusterKey hi, std::ptrdiff_t delta)
+    {
+        size_ += static_cast<std::size_t>(delta);
+        if constexpr (INDEXED) {
+            if (index_) {
+                index_->add(hi, delta);
+            }
+        }
+    }
+
+    void index_if_large()
+    {
+        if constexpr (INDEXED) {
+            if (index_ || summary_.size() <= INDEX_MIN_CLUSTERS) {
+                return;
+            }
+            std::vector<std::pair<ClusterKey, std::size_t>> counts;
+            counts.reserve(clusters_.size());
+            for (auto const &[hi, entry] : clusters_) {
+                counts.emplace_back(hi, entry_size(entry));
+            }
+            if constexpr (!ORDERED_CLUSTERS) {
+                std::ranges::sort(counts);
+            }
+            index_ = std::make_unique<Index>();
+            index_->assign(counts);
+        }
+    }
+
+    // Keys in clusters [first, last].
+    [[nodiscard]] std::size_t
+    cluster_keys(ClusterKey first, ClusterKey last) const noexcept
+    {
+        std::size_t n = 0;
+        summary_.for_each_range(first, last, [&](ClusterKey cluster_idx) {
+            n += entry_size(*find_cluster(cluster_idx));
+        });
+        return n;
+    }
+
+    // Keys in clusters below `hi`. Without an index the branch is walked
+    // from whichever end is closer.
+    [[nodiscard]] std::size_t keys_below_cluster(ClusterKey hi) const noexcept
+    {
+        if (summary_.empty()) {
+            return 0;
+        }
+        if constexpr (INDEXED) {
+            if (index_) {
+                return index_->before(hi);
+            }
+        }
+        constexpr auto last = static_cast<ClusterKey>(MAX_KEY >> CLUSTER_BITS);
+        if (hi <= last - hi) {
+            return hi == 0 ? 0 : cluster_keys(0, hi - 1);
+        }
+        return size_ - cluster_keys(hi, last);
+    }
+
+    // Removes the entries a set operation emptied, clearing their summary
+    // bits in one batch.
+    void forget_clusters(std::vector<ClusterKey> &emptied)
+    {
+        for (ClusterKey hi : emptied) {
+            erase_entry(clusters_.find(hi));
+        }
+        std::ranges::sort(emptied);
+        summary_.batch_erase_sorted(emptied.begin(), emptied.end());
+        if (summary_.empty()) {
+            index_.reset();
+        }
+    }
+
+    // Applies `Op` to `mine` and `theirs`, the entries of cluster `hi` on
+    // both sides. Size and the index are kept current; an entry left
+    // without keys is for the caller to remove.
+    template <veb_detail::SetOp Op>
+    void merge_entry(
+        ClusterKey hi, ClusterEntry &mine, ClusterEntry const &theirs)
+    {
+        auto before = static_cast<std::ptrdiff_t>(entry_size(mine));
+        if (theirs.inline_only) {
+            merge_key<Op>(mine, theirs.inline_value);
+        }
+        else if (theirs.child) {
+            merge_child<Op>(mine, *theirs.child);
+        }
+        count_keys(hi, static_cast<std::ptrdiff_t>(entry_size(mine)) - before);
+    }
+
+    template <veb_detail::SetOp Op>
+    void merge_key(ClusterEntry &entry, ChildKey lo)
+    {
+        using veb_detail::SetOp;
+        bool present = entry.inline_only
+                           ? entry.inline_value == lo
+                           : entry.child && entry.child->contains(lo);
+        if constexpr (Op == SetOp::Intersection) {
+            free_node(entry.child);
+            entry.inline_only = present;
+            entry.inline_value = lo;
+        }
+        else if (present && Op != SetOp::Union) {
+            if (entry.inline_only) {
+                entry.inline_only = false;
+            }
+            else {
+                entry.child->erase(lo);
+            }
+        }
+        else if (!present && Op != SetOp::Difference) {
+            promote(entry, false).insert(lo);
+        }
     }
 
-    [[nodiscard]] static Child &ensure_child(ClusterEntry &entry)
+    template <veb_detail::SetOp Op>
+    void merge_child(ClusterEntry &entry, Child const &theirs)
+    {
+        using veb_detail::SetOp;
+        if (!entry.inline_only) {
+            veb_detail::apply_set_op<Op>(ensure_child(entry), theirs);
+            return;
+        }
+        ChildKey value = entry.inline_value;
+        if constexpr (
+            Op == SetOp::Intersection || Op == SetOp::Difference) {
+            if (theirs.contains(value) == (Op == SetOp::Difference)) {
+                entry.inline_only = false;
+            }
+        }
+        else {
+            // Adopt a copy of their cluster and fold our value back in.
+            free_node(entry.child);
+            entry.child = clone_node(theirs);
+            entry.inline_only = false;
+            if (Op == SetOp::SymmetricDifference &&
+                entry.child->contains(value)) {
+                entry.child->erase(value);
+            }
+            else {
+                entry.child->insert(value);
+            }
+        }
+    }
+
+    [[nodiscard]] ClusterEntry clone_entry(ClusterEntry const &entry)
+    {
+        ClusterEntry copy;
+        copy.inline_only = entry.inline_only;
+        copy.inline_value = entry.inline_value;
+        if (entry.child) {
+            copy.child = clone_node(*entry.child);
+        }
+        return copy;
+    }
+
+    void copy_from(VebBranch const &other)
+    {
+        release_nodes();
+        writable_summary() = other.summary_;
+        clusters_.reserve(other.clusters_.size());
+        for (auto const &[hi, entry] : other.clusters_) {
+            clusters_.try_emplace(hi, clone_entry(entry));
+        }
+        size_ = other.size_;
+        index_ = other.index_ ? std::make_unique<Index>(*other.index_)
+                              : nullptr;
+    }
+
+    [[nodiscard]] Child &ensure_child(ClusterEntry &entry)
     {
         if (!entry.child) {
-            entry.child = std::make_unique<Child>();
+            entry.child = new_node();
         }
         return *entry.child;
     }
 
+    [[nodiscard]] static Summary make_summary(Pools *pools) noexcept
+    {
+        if constexpr (CHILD_IS_BRANCH) {
+            return Summary(&pools->below);
+        }
+        else {
+            return Summary{};
+        }
+    }
+
+    // The pools this node allocates from; a root creates its own on first
+    // use and hands the summary its share.
+    [[nodiscard]] Pools &pools()
+    {
+        if (!pools_.get()) {
+            own_pools_ = std::make_unique<Pools>();
+            pools_ = veb_detail::PoolsRef<Pools>(own_pools_.get());
+            if constexpr (CHILD_IS_BRANCH) {
+                summary_.attach(&own_pools_->below);
+            }
+        }
+        return *pools_.get();
+    }
+
+    // Used to attach a root's summary to the pools created for the root.
+    void attach(Pools *pools) noexcept
+    {
+        pools_ = veb_detail::PoolsRef<Pools>(pools);
+        if constexpr (CHILD_IS_BRANCH) {
+            summary_.attach(&pools->below);
+        }
+    }
+
+    // Any update that may allocate in the summary goes through here, so
+    // the summary never creates pools of its own.
+    [[nodiscard]] Summary &writable_summary()
+    {
+        (void)pools();
+        return summary_;
+    }
+
+    [[nodiscard]] ChildPtr new_node()
+    {
+        Pools &pools = this->pools();
+        if constexpr (CHILD_IS_BRANCH) {
+            return ChildPtr(pools.nodes.make(&pools.below));
+        }
+        else {
+            return ChildPtr(pools.nodes.make());
+        }
+    }
+
+    [[nodiscard]] ChildPtr clone_node(Child const &other)
+    {
+        Pools &pools = this->pools();
+        if constexpr (CHILD_IS_BRANCH) {
+            return ChildPtr(pools.nodes.make(other, &pools.below));
+        }
+        else {
+            return ChildPtr(pools.nodes.make(other));
+        }
+    }
+
+    // Returns a child, and everything under it, to the pools.
+    void free_node(ChildPtr &node) noexcept
+    {
+        if (!node) {
+            return;
+        }
+        if constexpr (Alloc::BULK_RELEASE && CHILD_IS_BRANCH) {
+            node->release_nodes();
+        }
+        pools_.get()->nodes.destroy(node.release());
+    }
+
+    void erase_entry(typename ClusterMap::iterator it) noexcept
+    {
+        free_node(it->second.child);
+        clusters_.erase(it);
+    }
+
+    // Frees every node under this one and leaves the branch empty.
+    void release_nodes() noexcept
+    {
+        for (auto &[hi, entry] : clusters_) {
+            free_node(entry.child);
+        }
+        if constexpr (CHILD_IS_BRANCH) {
+            summary_.release_nodes();
+        }
+        forget_nodes();
+    }
+
+    // Empties the branch without freeing its nodes: they have been freed
+    // already or go with the pools.
+    void forget_nodes() noexcept
+    {
+        for (auto &[hi, entry] : clusters_) {
+            (void)entry.child.release();
+        }
+        if constexpr (CHILD_IS_BRANCH) {
+            summary_.forget_nodes();
+        }
+        else {
+            summary_ = Summary{};
+        }
+        clusters_.clear();
+        size_ = 0;
+        index_.reset();
+    }
+
+    std::unique_ptr<Pools> own_pools_{};
+    veb_detail::PoolsRef<Pools> pools_{};
     Summary summary_{};
     ClusterMap clusters_{};
+    std::size_t size_ = 0;
+    std::unique_ptr<Index> index_{};
 };
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <ankerl/unordered_dense.h>
+
+namespace veb_detail
+{
+
+    // Cluster storage for sparse branches that keeps entries in key order
+    // and finds them by rank instead of by hash, HAMT style. The ranks are
+    // the summary's: it is a dense branch over leaves, so entries are kept
+    // in one block per summary leaf, and Summary::cluster_rank gives both a
+    // block's position and an entry's place in it as popcounts over the
+    // leaf words. The map holds no bitmap of its own, and iteration is a
+    // linear walk in ascending key order.
+    //
+    // Batch updates let the summary run ahead of or behind the map until
+    // they finish, so updates place entries by binary search over the keys
+    // the map holds, and only lookups given the summary use its ranks.
+    template <unsigned ClusterBits, class Key, class Entry>
+    class RankedClusterMap
+    {
+        static_assert(ClusterBits <= 16, "summary ranks need leaf children");
+
+        // Cluster keys per block: those of one summary leaf.
+        static constexpr unsigned BLOCK_SHIFT = ClusterBits / 2;
+
+    public:
+        using key_type = Key;
+        using mapped_type = Entry;
+        using value_type = std::pair<Key, Entry>;
+
+        static constexpr bool ORDERED = true;
+
+    private:
+        struct Block
+        {
+            uint32_t id = 0;
+            std::vector<value_type> slots{};
+        };
+
+        template <bool Const>
+        class Iter
+        {
+            using Map = std::conditional_t<
+                Const, RankedClusterMap const, RankedClusterMap>;
+
+        public:
+            using value_type = RankedClusterMap::value_type;
+            using difference_type = std::ptrdiff_t;
+            using reference =
+                std::conditional_t<Const, value_type const &, value_type &>;
+            using pointer =
+                std::conditional_t<Const, value_type const *, value_type *>;
+            using iterator_category = std::forward_iterator_tag;
+
+            Iter() = default;
+
+            Iter(Map *map, std::size_t block, std::size_t slot) noexcept
+                : map_(map), block_(block), slot_(slot)
+            {
+            }
+
+            operator Iter<true>() const noexcept
+                requires(!Const)
+            {
+                return {map_, block_, slot_};
+            }
+
+            [[nodiscard]] reference operator*() const noexcept
+            {
+                return map_->blocks_[block_].slots[slot_];
+            }
+
+            [[nodiscard]] pointer operator->() const noexcept
+            {
+                return &**this;
+            }
+
+            Iter &operator++() noexcept
+            {
+                if (++slot_ == map_->blocks_[block_].slots.size()) {
+                    ++block_;
+                    slot_ = 0;
+                }
+                return *this;
+            }
+
+            Iter operator++(int) noexcept
+            {
+                Iter old = *this;
+                ++*this;
+                return old;
+            }
+
+            [[nodiscard]] bool operator==(Iter const &other) const noexcept
+            {
+                return block_ == other.block_ && slot_ == other.slot_;
+            }
+
+        private:
+            friend class RankedClusterMap;
+
+            Map *map_ = nullptr;
+            std::size_t block_ = 0;
+            std::size_t slot_ = 0;
+        };
+
+    public:
+        using iterator = Iter<false>;
+        using const_iterator = Iter<true>;
+
+        [[nodiscard]] iterator begin() noexcept
+        {
+            return {this, 0, 0};
+        }
+
+        [[nodiscard]] iterator end() noexcept
+        {
+            return {this, blocks_.size(), 0};
+        }
+
+        [[nodiscard]] const_iterator begin() const noexcept
+        {
+            return {this, 0, 0};
+        }
+
+        [[nodiscard]] const_iterator end() const noexcept
+        {
+            return {this, blocks_.size(), 0};
+        }
+
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            return size_;
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return size_ == 0;
+        }
+
+        // Entries live in per-block vectors, so there is nothing to size up
+        // front.
+        void reserve(std::size_t) noexcept {}
+
+        void clear() noexcept
+        {
+            blocks_.clear();
+            size_ = 0;
+        }
+
+        [[nodiscard]] iterator find(Key key) noexcept
+        {
+            auto [block, slot] = locate(key);
+            return block == NONE ? end() : iterator(this, block, slot);
+        }
+
+        [[nodiscard]] const_iterator find(Key key) const noexcept
+        {
+            auto [block, slot] = locate(key);
+            return block == NONE ? end() : const_iterator(this, block, slot);
+        }
+
+        // Lookup by popcount. `summary` belongs to the branch that owns the
+        // map and must hold exactly the map's keys.
+        template <class Summary>
+        [[nodiscard]] iterator find(Key key, Summary const &summary) noexcept
+        {
+            auto [block, slot] = rank_in(key, summary);
+            return block == NONE ? end() : iterator(this, block, slot);
+        }
+
+        template <class Summary>
+        [[nodiscard]] const_iterator
+        find(Key key, Summary const &summary) const noexcept
+        {
+            auto [block, slot] = rank_in(key, summary);
+            return block == NONE ? end() : const_iterator(this, block, slot);
+        }
+
+        // First entry whose key is not below `key`.
+        [[nodiscard]] const_iterator lower_bound(Key key) const noexcept
+        {
+            auto id = static_cast<uint32_t>(key >> BLOCK_SHIFT);
+            auto it = std::ranges::lower_bound(blocks_, id, {}, &Block::id);
+            auto block = static_cast<std::size_t>(it - blocks_.begin());
+            if (it == blocks_.end() || it->id != id) {
+                return {this, block, 0};
+            }
+            auto slot = static_cast<std::size_t>(
+                slot_bound(it->slots, key) - it->slots.begin());
+            if (slot == it->slots.size()) {
+                return {this, block + 1, 0};
+            }
+            return {this, block, slot};
+        }
+
+        template <class... Args>
+        std::pair<iterator, bool> try_emplace(Key key, Args &&...args)
+        {
+            auto id = static_cast<uint32_t>(key >> BLOCK_SHIFT);
+            auto it = std::ranges::lower_bound(blocks_, id, {}, &Block::id);
+            if (it == blocks_.end() || it->id != id) {
+                it = blocks_.insert(it, Block{id, {}});
+            }
+            auto block = static_cast<std::size_t>(it - blocks_.begin());
+            auto &slots = it->slots;
+            auto at = slot_bound(slots, key);
+            auto slot = static_cast<std::size_t>(at - slots.begin());
+            if (at != slots.end() && at->first == key) {
+                return {iterator(this, block, slot), false};
+            }
+            slots.emplace(
+                at,
+                std::piecewise_construct,
+                std::forward_as_tuple(key),
+                std::forward_as_tuple(std::forward<Args>(args)...));
+            ++size_;
+            return {iterator(this, block, slot), true};
+        }
+
+        void erase(const_iterator pos) noexcept
+        {
+            auto &slots = blocks_[pos.block_].slots;
+            slots.erase(
+                slots.begin() + static_cast<std::ptrdiff_t>(pos.slot_));
+            --size_;
+            if (slots.empty()) {
+                blocks_.erase(
+                    blocks_.begin() + static_cast<std::ptrdiff_t>(pos.block_));
+            }
+        }
+
+        void erase(Key key) noexcept
+        {
+            auto it = find(key);
+            if (it != end()) {
+                erase(it);
+            }
+        }
+
+        // Node a lookup of `key` through `summary` reads first: the summary
+        // leaf its rank comes from, or the block list when the summary
+        // keeps the key inline.
+        template <class Summary>
+        [[nodiscard]] void const *
+        probe_address(Key key, Summary const &summary) const noexcept
+        {
+            if (void const *leaf = summary.probe_address(key)) {
+                return leaf;
+            }
+            return blocks_.empty() ? nullptr : blocks_.data();
+        }
+
+        // Entries the blocks' current allocations have room for.
+        [[nodiscard]] std::size_t capacity() const noexcept
+        {
+            std::size_t n = 0;
+            for (Block const &block : blocks_) {
+                n += block.slots.capacity();
+            }
+            return n;
+        }
+
+        // Heap bytes held by the block list and the blocks' entries.
+        [[nodiscard]] std::size_t allocated_bytes() const noexcept
+        {
+            return blocks_.capacity() * sizeof(Block) +
+                   capacity() * sizeof(value_type);
+        }
+
+    private:
+        static constexpr std::size_t NONE = ~std::size_t{0};
+
+        template <class Slots>
+        [[nodiscard]] static auto slot_bound(Slots &slots, Key key) noexcept
+        {
+            return std::ranges::lower_bound(
+                slots, key, {}, &value_type::first);
+        }
+
+        template <class Summary>
+        [[nodiscard]] std::pair<std::size_t, std::size_t>
+        rank_in(Key key, Summary const &summary) const noexcept
+        {
+            static_assert(Summary::FANOUT_BITS == BLOCK_SHIFT);
+            // Most maps of a sparse tree hold one entry; its key answers
+            // without reading the summary's nodes.
+            if (size_ == 1) {
+                return {blocks_[0].slots[0].first == key ? 0 : NONE, 0};
+            }
+            auto pos = summary.cluster_rank(key);
+            if (!pos) {
+                return {NONE, 0};
+            }
+            assert(blocks_[pos->first].slots[pos->second].first == key);
+            return *pos;
+        }
+
+        [[nodiscard]] std::pair<std::size_t, std::size_t>
+        locate(Key key) const noexcept
+        {
+            auto id = static_cast<uint32_t>(key >> BLOCK_SHIFT);
+            auto it = std::ranges::lower_bound(blocks_, id, {}, &Block::id);
+            if (it == blocks_.end() || it->id != id) {
+                return {NONE, 0};
+            }
+            auto at = slot_bound(it->slots, key);
+            if (at == it->slots.end() || at->first != key) {
+                return {NONE, 0};
+            }
+            return {
+                static_cast<std::size_t>(it - blocks_.begin()),
+                static_cast<std::size_t>(at - it->slots.begin())};
+        }
+
+        std::vector<Block> blocks_{};
+        std::size_t size_ = 0;
+    };
+
+    // Cluster layouts for sparse branches. Each provides Map<ClusterBits,
+    // Key, Entry>, the container a sparse branch keeps its clusters in.
+    struct HashedClusters
+    {
+        template <unsigned ClusterBits, class Key, class Entry>
+        using Map = ankerl::unordered_dense::map<Key, Entry>;
+    };
+
+    // Rank-indexed storage where the summary's children are leaves (up to
+    // 16 cluster bits, the inner sparse levels of 48- and 64-bit trees);
+    // wider levels keep the hash map.
+    struct RankedClusters
+    {
+        template <unsigned ClusterBits, class Key, class Entry>
+        using Map = std::conditional_t<
+            (ClusterBits <= 16),
+            RankedClusterMap<ClusterBits, Key, Entry>,
+            ankerl::unordered_dense::map<Key, Entry>>;
+    };
+
+    // Cluster maps that iterate in ascending key order.
+    template <class Map>
+    concept OrderedClusterMap = requires { requires Map::ORDERED; };
+
+    // Entry of `key` in `map`, or end(). `summary` belongs to the branch
+    // that owns the map and must hold exactly its keys; ordered maps rank
+    // through it instead of searching.
+    template <class Map, class Summary>
+    [[nodiscard]] auto cluster_find(
+        Map &map, Summary const &summary, typename Map::key_type key) noexcept
+    {
+        if constexpr (OrderedClusterMap<Map>) {
+            return map.find(key, summary);
+        }
+        else {
+            (void)summary;
+            return map.find(key);
+        }
+    }
+
+    // First heap address a lookup of `key` in `map` depends on, for
+    // prefetching ahead of the probe; null when there is nothing to fetch.
+    // ankerl maps keep their bucket array private, so hashed probes return
+    // null and are overlapped only by issuing them back to back.
+    template <class Map, class Summary>
+    [[nodiscard]] void const *cluster_probe_address(
+        Map const &map, Summary const &summary,
+        typename Map::key_type key) noexcept
+    {
+        if constexpr (OrderedClusterMap<Map>) {
+            return map.probe_address(key, summary);
+        }
+        else {
+            (void)map;
+            (void)summary;
+            (void)key;
+            return nullptr;
+        }
+    }
+
+    struct ClusterMapUsage
+    {
+        std::size_t bytes = 0;
+        std::size_t capacity = 0;
+    };
+
+    // Heap bytes and entry capacity of a cluster map.
+    template <class Map>
+    [[nodiscard]] ClusterMapUsage cluster_map_usage(Map const &map) noexcept
+    {
+        if constexpr (OrderedClusterMap<Map>) {
+            return {map.allocated_bytes(), map.capacity()};
+        }
+        else {
+            // ankerl maps keep their entries in a vector, found through a
+            // separate bucket array.
+            auto const &values = map.values();
+            return {
+                values.capacity() * sizeof(typename Map::value_type) +
+                    map.bucket_count() * sizeof(typename Map::bucket_type),
+                values.capacity()};
+        }
+    }
+
+} // namespace veb_detail
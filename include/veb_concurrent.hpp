@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
+
+#include "veb_branch.hpp"
+
+namespace veb_detail
+{
+
+    // Shards use the same storage as the VebTreeNN root of that width.
+    template <unsigned Bits>
+    using ShardTree = VebBranch<Bits, (Bits > 32)>;
+
+} // namespace veb_detail
+
+// Thread-safe `Bits`-bit tree. Keys are sharded by their top
+// `shard_bits` bits into independent trees, each behind its own
+// reader/writer lock on its own cache line, so writers to different
+// shards never contend. A lock-free occupancy bitmap lets successor,
+// predecessor, min and max skip empty shards without locking them.
+//
+// Shard s allocates its nodes from pool set s mod MAX_POOL_SETS. With
+// up to that many shards each set belongs to one shard and is only used
+// under its write lock. With more, a set serves several shards and takes
+// its own mutex per allocation, so writers contend only when they hit
+// shards of one set at once, while thousands of shards do not each keep
+// partly filled slabs.
+//
+// Operations on a single key are linearizable. Queries that move across
+// shards lock one shard at a time, so under concurrent writes they see
+// each shard at a possibly different moment.
+template <unsigned Bits>
+class ConcurrentVebTree
+{
+    using Tree = veb_detail::ShardTree<Bits>;
+    using Pools = typename Tree::Pools;
+
+public:
+    using Key = typename Tree::Key;
+    static constexpr unsigned SUBTREE_BITS = Bits;
+    static constexpr Key MAX_KEY = Tree::MAX_KEY;
+    static constexpr unsigned DEFAULT_SHARD_BITS = 6;
+    static constexpr unsigned MAX_SHARD_BITS = 16;
+    static constexpr std::size_t MAX_POOL_SETS = 64;
+
+    // `shard_bits` is clamped to [1, MAX_SHARD_BITS].
+    explicit ConcurrentVebTree(unsigned shard_bits = DEFAULT_SHARD_BITS)
+        : shard_bits_(std::clamp(shard_bits, 1u, MAX_SHARD_BITS)),
+          pool_sets_(std::make_unique<PoolSet[]>(pool_set_count())),
+          shards_(std::make_unique<Shard[]>(shard_count())),
+          occupancy_(std::make_unique<std::atomic<uint64_t>[]>(
+              (shard_count() + 63) / 64))
+    {
+        if (shard_count() > pool_set_count()) {
+            for (std::size_t p = 0; p < pool_set_count(); ++p) {
+                pool_sets_[p].pools.share(1);
+            }
+        }
+        for (std::size_t s = 0; s < shard_count(); ++s) {
+            Pools &pools = pool_sets_[s % pool_set_count()].pools;
+            shards_[s].tree = Tree(&pools);
+        }
+    }
+
+    ConcurrentVebTree(ConcurrentVebTree const &) = delete;
+    ConcurrentVebTree &operator=(ConcurrentVebTree const &) = delete;
+
+    [[nodiscard]] unsigned shard_bits() const noexcept
+    {
+        return shard_bits_;
+    }
+
+    [[nodiscard]] std::size_t shard_count() const noexcept
+    {
+        return std::size_t{1} << shard_bits_;
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return !next_occupied(0).has_value();
+    }
+
+    // Sum of the shard sizes, each read under its lock.
+    [[nodiscard]] std::size_t size() const
+    {
+        std::size_t total = 0;
+        for (auto s = next_occupied(0); s; s = next_occupied(*s + 1)) {
+            std::shared_lock lock(shards_[*s].lock);
+            total += shards_[*s].tree.size();
+        }
+        return total;
+    }
+
+    // Returns true when `key` was not present before.
+    bool insert(Key key)
+    {
+        std::size_t s = shard_of(key);
+        Shard &shard = shards_[s];
+        std::unique_lock lock(shard.lock);
+        if (!shard.tree.insert(key)) {
+            return false;
+        }
+        if (shard.tree.size() == 1) {
+            occupancy_[s / 64].fetch_or(
+                uint64_t{1} << (s % 64), std::memory_order_release);
+        }
+        return true;
+    }
+
+    // Returns true when `key` was present before.
+    bool erase(Key key)
+    {
+        std::size_t s = shard_of(key);
+        Shard &shard = shards_[s];
+        std::unique_lock lock(shard.lock);
+        if (!shard.tree.erase(key)) {
+            return false;
+        }
+        if (shard.tree.empty()) {
+            occupancy_[s / 64].fetch_and(
+                ~(uint64_t{1} << (s % 64)), std::memory_order_release);
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        for (std::size_t s = 0; s < shard_count(); ++s) {
+            std::unique_lock lock(shards_[s].lock);
+            shards_[s].tree.clear();
+            occupancy_[s / 64].fetch_and(
+                ~(uint64_t{1} << (s % 64)), std::memory_order_release);
+        }
+    }
+
+    [[nodiscard]] bool contains(Key key) const
+    {
+        std::size_t s = shard_of(key);
+        if (!occupied(s)) {
+            return false;
+        }
+        std::shared_lock lock(shards_[s].lock);
+        return shards_[s].tree.contains(key);
+    }
+
+    [[nodiscard]] std::optional<Key> min() const
+    {
+        return first_from(0);
+    }
+
+    [[nodiscard]] std::optional<Key> max() const
+    {
+        return last_from(shard_count() - 1);
+    }
+
+    // Smallest key strictly greater than `key`.
+    [[nodiscard]] std::optional<Key> successor(Key key) const
+    {
+        std::size_t s = shard_of(key);
+        if (occupied(s)) {
+            std::shared_lock lock(shards_[s].lock);
+            if (auto next = shards_[s].tree.successor(key)) {
+                return next;
+            }
+        }
+        if (s + 1 == shard_count()) {
+            return std::nullopt;
+        }
+        return first_from(s + 1);
+    }
+
+    // Largest key strictly less than `key`.
+    [[nodiscard]] std::optional<Key> predecessor(Key key) const
+    {
+        std::size_t s = shard_of(key);
+        if (occupied(s)) {
+            std::shared_lock lock(shards_[s].lock);
+            if (auto prev = shards_[s].tree.predecessor(key)) {
+                return prev;
+            }
+        }
+        if (s == 0) {
+            return std::nullopt;
+        }
+        return last_from(s - 1);
+    }
+
+    // Calls fn(key) in ascending order, holding one shard's shared lock
+    // at a time. `fn` must not write to this tree.
+    template <class Fn>
+    void for_each(Fn &&fn) const
+    {
+        for (auto s = next_occupied(0); s; s = next_occupied(*s + 1)) {
+            std::shared_lock lock(shards_[*s].lock);
+            shards_[*s].tree.for_each(fn);
+        }
+    }
+
+    [[nodiscard]] std::vector<Key> to_vector() const
+    {
+        std::vector<Key> out;
+        for_each([&](Key k) { out.push_back(k); });
+        return out;
+    }
+
+private:
+    // Padded to a cache line so locking one shard does not bounce its
+    // neighbours' lines.
+    struct alignas(veb_detail::CACHE_LINE_BYTES) Shard
+    {
+        mutable std::shared_mutex lock;
+        Tree tree;
+    };
+
+    // Padded like the shards, so writers on different sets do not share
+    // a line.
+    struct alignas(veb_detail::CACHE_LINE_BYTES) PoolSet
+    {
+        Pools pools;
+    };
+
+    [[nodiscard]] std::size_t pool_set_count() const noexcept
+    {
+        return std::min(shard_count(), MAX_POOL_SETS);
+    }
+
+    [[nodiscard]] std::size_t shard_of(Key key) const noexcept
+    {
+        assert(key <= MAX_KEY);
+        return static_cast<std::size_t>(
+            uint64_t{key} >> (Bits - shard_bits_));
+    }
+
+    [[nodiscard]] bool occupied(std::size_t s) const noexcept
+    {
+        return (occupancy_[s / 64].load(std::memory_order_acquire) >>
+                (s % 64)) &
+               1;
+    }
+
+    // First occupied shard at or after `from`.
+    [[nodiscard]] std::optional<std::size_t>
+    next_occupied(std::size_t from) const noexcept
+    {
+        for (std::size_t s = from; s < shard_count(); s = (s | 63) + 1) {
+            uint64_t word =
+                occupancy_[s / 64].load(std::memory_order_acquire) >>
+                (s % 64);
+            if (word != 0) {
+                return s + static_cast<std::size_t>(std::countr_zero(word));
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Last occupied shard at or before `from`.
+    [[nodiscard]] std::optional<std::size_t>
+    prev_occupied(std::size_t from) const noexcept
+    {
+        for (std::size_t s = from + 1; s-- > 0; s &= ~std::size_t{63}) {
+            uint64_t word =
+                occupancy_[s / 64].load(std::memory_order_acquire) <<
+                (63 - s % 64);
+            if (word != 0) {
+                return s - static_cast<std::size_t>(std::countl_zero(word));
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Min of the first non-empty shard at or after `from`. A shard can
+    // empty out between the bitmap read and the lock; the scan then
+    // moves on.
+    [[nodiscard]] std::optional<Key> first_from(std::size_t from) const
+    {
+        for (auto s = next_occupied(from); s; s = next_occupied(*s + 1)) {
+            std::shared_lock lock(shards_[*s].lock);
+            if (auto key = shards_[*s].tree.min()) {
+                return key;
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key> last_from(std::size_t from) const
+    {
+        for (auto s = prev_occupied(from); s;
+             s = *s > 0 ? prev_occupied(*s - 1) : std::nullopt) {
+            std::shared_lock lock(shards_[*s].lock);
+            if (auto key = shards_[*s].tree.max()) {
+                return key;
+            }
+        }
+        return std::nullopt;
+    }
+
+    unsigned shard_bits_;
+    // Declared before the shards, whose nodes live in them.
+    std::unique_ptr<PoolSet[]> pool_sets_;
+    std::unique_ptr<Shard[]> shards_;
+    std::unique_ptr<std::atomic<uint64_t>[]> occupancy_;
+};
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "veb_branch_detail.hpp"
+
+namespace veb_detail
+{
+
+    // Epoch-based reclamation for nodes that optimistic readers may still
+    // hold after a writer unlinked them. Readers pin the current epoch
+    // for the length of a query by writing it to a record owned by their
+    // thread; nothing else they do writes memory another thread reads.
+    // A node retired in epoch E may be reused once every pinned reader is
+    // at a later epoch, since any reader that could have reached it pinned
+    // before it was unlinked.
+    class EpochDomain
+    {
+        struct alignas(CACHE_LINE_BYTES) Participant
+        {
+            // Pinned epoch, or 0 when the owner is not reading.
+            std::atomic<uint64_t> epoch{0};
+            std::atomic<bool> owned{false};
+            // Guard nesting; touched only by the owning thread.
+            unsigned depth = 0;
+            Participant *next = nullptr;
+        };
+
+        // Participant records of one domain. Thread caches share
+        // ownership, so a record can be handed back after the domain is
+        // gone.
+        struct Registry
+        {
+            std::atomic<Participant *> head{nullptr};
+
+            Registry() = default;
+            Registry(Registry const &) = delete;
+            Registry &operator=(Registry const &) = delete;
+
+            ~Registry()
+            {
+                for (Participant *p = head.load(); p;) {
+                    delete std::exchange(p, p->next);
+                }
+            }
+
+            // A record no thread owns, reused when one is free.
+            Participant *claim()
+            {
+                for (Participant *p = head.load(); p; p = p->next) {
+                    bool expected = false;
+                    if (!p->owned.load(std::memory_order_relaxed) &&
+                        p->owned.compare_exchange_strong(expected, true)) {
+                        return p;
+                    }
+                }
+                auto *p = new Participant();
+                p->owned.store(true, std::memory_order_relaxed);
+                p->next = head.load();
+                while (!head.compare_exchange_weak(p->next, p)) {
+                }
+                return p;
+            }
+        };
+
+        // The records the calling thread holds in recently used domains.
+        // Records go back to their domain when evicted or at thread exit.
+        class ThreadCache
+        {
+        public:
+            ThreadCache() = default;
+            ThreadCache(ThreadCache const &) = delete;
+            ThreadCache &operator=(ThreadCache const &) = delete;
+
+            ~ThreadCache()
+            {
+                for (Entry &entry : entries_) {
+                    if (entry.participant) {
+                        entry.participant->owned.store(false);
+                    }
+                }
+            }
+
+            Participant &get(std::shared_ptr<Registry> const &registry)
+            {
+                for (Entry &entry : entries_) {
+                    if (entry.registry == registry) {
+                        return *entry.participant;
+                    }
+                }
+                Entry *victim = nullptr;
+                for (std::size_t i = 0; i < entries_.size() && !victim;
+                     ++i) {
+                    Entry &entry = entries_[(next_ + i) % entries_.size()];
+                    if (!entry.participant || entry.participant->depth == 0) {
+                        victim = &entry;
+                    }
+                }
+                assert(victim && "too many domains pinned at once");
+                next_ = static_cast<std::size_t>(victim - entries_.data()) +
+                        1;
+                if (victim->participant) {
+                    victim->participant->owned.store(false);
+                }
+                victim->participant = registry->claim();
+                victim->registry = registry;
+                return *victim->participant;
+            }
+
+        private:
+            struct Entry
+            {
+                std::shared_ptr<Registry> registry;
+                Participant *participant = nullptr;
+            };
+
+            std::array<Entry, 8> entries_{};
+            std::size_t next_ = 0;
+        };
+
+    public:
+        // Pins the calling thread for the guard's lifetime. Guards nest.
+        class Guard
+        {
+        public:
+            explicit Guard(EpochDomain const &domain)
+                : participant_(domain.participant())
+            {
+                if (participant_.depth++ == 0) {
+                    // Release so a writer that sees this pin also sees
+                    // the end of the reads made under the previous one.
+                    participant_.epoch.store(
+                        domain.epoch_.load(), std::memory_order_release);
+                    // The pin must be visible before the reader loads any
+                    // node pointer.
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+            }
+
+            Guard(Guard const &) = delete;
+            Guard &operator=(Guard const &) = delete;
+
+            ~Guard()
+            {
+                if (--participant_.depth == 0) {
+                    participant_.epoch.store(0, std::memory_order_release);
+                }
+            }
+
+        private:
+            Participant &participant_;
+        };
+
+        EpochDomain() = default;
+        EpochDomain(EpochDomain const &) = delete;
+        EpochDomain &operator=(EpochDomain const &) = delete;
+
+        // Epoch to stamp a node with once it is unlinked.
+        [[nodiscard]] uint64_t retire_epoch() const noexcept
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return epoch_.load();
+        }
+
+        // Smallest epoch a reader is pinned at, or the maximum value when
+        // none is reading. Nodes retired before it are unreachable.
+        [[nodiscard]] uint64_t min_pinned() const noexcept
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t min = std::numeric_limits<uint64_t>::max();
+            for (Participant *p = registry_->head.load(); p; p = p->next) {
+                uint64_t e = p->epoch.load(std::memory_order_acquire);
+                if (e != 0) {
+                    min = std::min(min, e);
+                }
+            }
+            return min;
+        }
+
+        // Moves to the next epoch if every pinned reader has reached the
+        // current one. Returns the smallest pinned epoch seen.
+        uint64_t try_advance() noexcept
+        {
+            uint64_t current = epoch_.load();
+            uint64_t min = min_pinned();
+            if (min >= current) {
+                epoch_.compare_exchange_strong(current, current + 1);
+            }
+            return min;
+        }
+
+    private:
+        Participant &participant() const
+        {
+            thread_local ThreadCache cache;
+            return cache.get(registry_);
+        }
+
+        std::atomic<uint64_t> epoch_{1};
+        std::shared_ptr<Registry> registry_ = std::make_shared<Registry>();
+    };
+
+    using EpochGuard = EpochDomain::Guard;
+
+    // Node store for a structure read under EpochDomain guards. Writers
+    // retire() nodes they have unlinked; acquire() reuses retired nodes
+    // once no reader can see them, moving them over in one batch per
+    // call, and allocates only when none are ready. Up to `keep` idle
+    // nodes are held for reuse; the rest are freed.
+    template <class T>
+    class EpochPool
+    {
+    public:
+        explicit EpochPool(EpochDomain &domain, std::size_t keep = 64)
+            : domain_(domain), keep_(keep)
+        {
+        }
+
+        EpochPool(EpochPool const &) = delete;
+        EpochPool &operator=(EpochPool const &) = delete;
+
+        ~EpochPool()
+        {
+            for (auto &[epoch, node] : retired_) {
+                delete node;
+            }
+            for (T *node : free_) {
+                delete node;
+            }
+        }
+
+        // A node in its just-constructed state, reused if one is ready.
+        [[nodiscard]] T *acquire()
+        {
+            {
+                std::lock_guard lock(mutex_);
+                if (free_.empty() && !retired_.empty()) {
+                    collect();
+                }
+                if (!free_.empty()) {
+                    T *node = free_.back();
+                    free_.pop_back();
+                    return node;
+                }
+            }
+            return new T();
+        }
+
+        // Hands over a node that is already unlinked and back in its
+        // just-constructed state.
+        void retire(T *node)
+        {
+            std::lock_guard lock(mutex_);
+            // Stamped under the lock, so stamps rise along retired_. A
+            // stamp taken after the unlink is only later than needed.
+            retired_.emplace_back(domain_.retire_epoch(), node);
+            if (retired_.size() >= keep_) {
+                collect();
+            }
+        }
+
+        // Nodes waiting for readers to move on, and nodes ready for reuse.
+        [[nodiscard]] std::pair<std::size_t, std::size_t> counts()
+        {
+            std::lock_guard lock(mutex_);
+            return {retired_.size(), free_.size()};
+        }
+
+    private:
+        // Moves every node no reader can see to the free list. The global
+        // epoch never decreases and nodes are stamped in order under the
+        // lock, so the safe nodes are a prefix.
+        void collect()
+        {
+            uint64_t min = domain_.try_advance();
+            auto safe = std::find_if(
+                retired_.begin(), retired_.end(),
+                [&](auto const &entry) { return entry.first >= min; });
+            for (auto it = retired_.begin(); it != safe; ++it) {
+                if (free_.size() < keep_) {
+                    free_.push_back(it->second);
+                }
+                else {
+                    delete it->second;
+                }
+            }
+            retired_.erase(retired_.begin(), safe);
+        }
+
+        EpochDomain &domain_;
+        std::size_t keep_;
+        std::mutex mutex_;
+        std::vector<std::pair<uint64_t, T *>> retired_;
+        std::vector<T *> free_;
+    };
+
+} // namespace veb_detail
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "veb_branch_detail.hpp"
+
+namespace veb_detail
+{
+
+    // Summary of a dense branch kept as one bitmap over its clusters.
+    // Marking a cluster active or empty is a single bit write rather than
+    // a walk down a recursive summary; successor and predecessor finish
+    // inside the starting word or hand the rest of the scan to
+    // simd::find_next_nonzero / find_prev_nonzero. Scans are linear in
+    // the fanout, so this only pays off for fanouts of a few thousand
+    // clusters (see --mode=summary in veb_benchmark).
+    template <unsigned Bits>
+    class FlatSummary
+    {
+        static_assert(Bits >= 6 && Bits <= 16);
+        static constexpr unsigned WORD_BITS = 64;
+        static constexpr std::size_t WORD_COUNT =
+            (std::size_t{1} << Bits) / WORD_BITS;
+        // Position the scans report when no key qualifies.
+        static constexpr unsigned NONE = 1u << Bits;
+
+    public:
+        using Key = typename key_type_for_bits<Bits>::type;
+        static constexpr unsigned SUBTREE_BITS = Bits;
+        static constexpr Key MAX_KEY = static_cast<Key>((1u << Bits) - 1);
+
+        bool insert(Key x) noexcept
+        {
+            auto [word_idx, mask] = locate(x);
+            if (words_[word_idx] & mask) {
+                return false;
+            }
+            words_[word_idx] |= mask;
+            ++size_;
+            return true;
+        }
+
+        bool erase(Key x) noexcept
+        {
+            auto [word_idx, mask] = locate(x);
+            if (!(words_[word_idx] & mask)) {
+                return false;
+            }
+            words_[word_idx] &= ~mask;
+            --size_;
+            return true;
+        }
+
+        template <class It>
+        void batch_insert_sorted(It first, It last) noexcept
+        {
+            for (; first != last; ++first) {
+                insert(static_cast<Key>(*first));
+            }
+        }
+
+        template <class It>
+        void batch_erase_sorted(It first, It last) noexcept
+        {
+            for (; first != last; ++first) {
+                erase(static_cast<Key>(*first));
+            }
+        }
+
+        template <class It>
+        void build_sorted(It first, It last) noexcept
+        {
+            batch_insert_sorted(first, last);
+        }
+
+        // Clears [lo, hi] and returns how many keys were removed.
+        std::size_t erase_range(Key lo, Key hi) noexcept
+        {
+            std::size_t removed = 0;
+            for_each_word(lo, hi, [&](std::size_t i, uint64_t mask) {
+                removed +=
+                    static_cast<std::size_t>(std::popcount(words_[i] & mask));
+                words_[i] &= ~mask;
+            });
+            size_ -= removed;
+            return removed;
+        }
+
+        void union_with(FlatSummary const &other) noexcept
+        {
+            simd::or_words(words_, other.words_);
+            recount();
+        }
+
+        void intersect_with(FlatSummary const &other) noexcept
+        {
+            simd::and_words(words_, other.words_);
+            recount();
+        }
+
+        [[nodiscard]] bool contains(Key x) const noexcept
+        {
+            auto [word_idx, mask] = locate(x);
+            return (words_[word_idx] & mask) != 0;
+        }
+
+        // Snapshot form: the raw bitmap words.
+        template <class Writer>
+        void save(Writer &out) const
+        {
+            out.write_words(words_);
+        }
+
+        template <class Reader>
+        void load(Reader &in)
+        {
+            in.read_words(words_);
+            recount();
+        }
+
+        [[nodiscard]] bool empty() const noexcept
+        {
+            return size_ == 0;
+        }
+
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            return size_;
+        }
+
+        [[nodiscard]] std::optional<Key> min() const noexcept
+        {
+            return found(first_from(0));
+        }
+
+        [[nodiscard]] std::optional<Key> max() const noexcept
+        {
+            return found(last_through(MAX_KEY));
+        }
+
+        [[nodiscard]] std::optional<Key> successor(Key x) const noexcept
+        {
+            if (x >= MAX_KEY) {
+                return std::nullopt;
+            }
+            return found(first_from(static_cast<unsigned>(x) + 1));
+        }
+
+        [[nodiscard]] std::optional<Key> predecessor(Key x) const noexcept
+        {
+            if (x == 0) {
+                return std::nullopt;
+            }
+            return found(last_through(static_cast<unsigned>(x) - 1));
+        }
+
+        // The same queries with `none` standing in for an empty result.
+        [[nodiscard]] Key min_or(Key none) const noexcept
+        {
+            return found_or(first_from(0), none);
+        }
+
+        [[nodiscard]] Key max_or(Key none) const noexcept
+        {
+            return found_or(last_through(MAX_KEY), none);
+        }
+
+        [[nodiscard]] Key successor_or(Key x, Key none) const noexcept
+        {
+            if (x >= MAX_KEY) {
+                return none;
+            }
+            return found_or(first_from(static_cast<unsigned>(x) + 1), none);
+        }
+
+        [[nodiscard]] Key predecessor_or(Key x, Key none) const noexcept
+        {
+            if (x == 0) {
+                return none;
+            }
+            return found_or(last_through(static_cast<unsigned>(x) - 1), none);
+        }
+
+        // Position inside the summary for the ordered iterators.
+        class Cursor
+        {
+        public:
+            bool first(FlatSummary const &summary) noexcept
+            {
+                summary_ = &summary;
+                return settle(summary.min());
+            }
+
+            bool last(FlatSummary const &summary) noexcept
+            {
+                summary_ = &summary;
+                return settle(summary.max());
+            }
+
+            // Moves to the smallest key not below `x`.
+            bool seek(FlatSummary const &summary, Key x) noexcept
+            {
+                summary_ = &summary;
+                return settle(found(summary.first_from(x)));
+            }
+
+            bool next() noexcept
+            {
+                return settle(summary_->successor(pos_));
+            }
+
+            bool prev() noexcept
+            {
+                return settle(summary_->predecessor(pos_));
+            }
+
+            [[nodiscard]] Key key() const noexcept
+            {
+                return pos_;
+            }
+
+        private:
+            bool settle(std::optional<Key> pos) noexcept
+            {
+                if (!pos) {
+                    return false;
+                }
+                pos_ = *pos;
+                return true;
+            }
+
+            FlatSummary const *summary_ = nullptr;
+            Key pos_ = 0;
+        };
+
+        // Group kernels for the branch *_batch lookups.
+        static void successor_group(
+            FlatSummary const *const *nodes, Key const *keys,
+            std::optional<Key> *out, std::size_t n) noexcept
+        {
+            for (std::size_t i = 0; i < n; ++i) {
+                out[i] = nodes[i]->successor(keys[i]);
+            }
+        }
+
+        static void predecessor_group(
+            FlatSummary const *const *nodes, Key const *keys,
+            std::optional<Key> *out, std::size_t n) noexcept
+        {
+            for (std::size_t i = 0; i < n; ++i) {
+                out[i] = nodes[i]->predecessor(keys[i]);
+            }
+        }
+
+        template <class Fn>
+        void for_each(Fn &&fn) const
+        {
+            for_each_range(0, MAX_KEY, fn);
+        }
+
+        template <class Fn>
+        void for_each_range(Key lo, Key hi, Fn &&fn) const
+        {
+            for_each_word(lo, hi, [&](std::size_t i, uint64_t mask) {
+                for (uint64_t bits = words_[i] & mask; bits != 0;
+                     bits &= bits - 1) {
+                    fn(static_cast<Key>(
+                        i * WORD_BITS +
+                        static_cast<unsigned>(std::countr_zero(bits))));
+                }
+            });
+        }
+
+    private:
+        [[nodiscard]] static constexpr std::pair<std::size_t, uint64_t>
+        locate(Key x) noexcept
+        {
+            return {std::size_t{x} >> 6, uint64_t{1} << (x & 63)};
+        }
+
+        // Calls `fn(word, mask)` for each word overlapping [lo, hi], with
+        // `mask` selecting the bits inside the range.
+        template <class Fn>
+        static void for_each_word(Key lo, Key hi, Fn &&fn)
+        {
+            if (lo > hi) {
+                return;
+            }
+            std::size_t first = std::size_t{lo} >> 6;
+            std::size_t last = std::size_t{hi} >> 6;
+            for (std::size_t i = first; i <= last; ++i) {
+                uint64_t mask = ~uint64_t{0};
+                if (i == first) {
+                    mask &= ~uint64_t{0} << (lo & 63);
+                }
+                if (i == last) {
+                    mask &= ~uint64_t{0} >> (63 - (hi & 63));
+                }
+                fn(i, mask);
+            }
+        }
+
+        [[nodiscard]] static std::optional<Key> found(unsigned pos) noexcept
+        {
+            if (pos == NONE) {
+                return std::nullopt;
+            }
+            return static_cast<Key>(pos);
+        }
+
+        [[nodiscard]] static Key found_or(unsigned pos, Key none) noexcept
+        {
+            return pos == NONE ? none : static_cast<Key>(pos);
+        }
+
+        // Smallest key >= `from`, or NONE past the end.
+        [[nodiscard]] unsigned first_from(unsigned from) const noexcept
+        {
+            std::size_t i = from >> 6;
+            if (i >= WORD_COUNT) {
+                return NONE;
+            }
+            uint64_t word = words_[i] & (~uint64_t{0} << (from & 63));
+            if (!word) {
+                auto next = simd::find_next_nonzero(words_, i + 1);
+                if (!next) {
+                    return NONE;
+                }
+                i = *next;
+                word = words_[i];
+            }
+            return static_cast<unsigned>(i * WORD_BITS) +
+                   static_cast<unsigned>(std::countr_zero(word));
+        }
+
+        // Largest key <= `through`, or NONE.
+        [[nodiscard]] unsigned last_through(unsigned through) const noexcept
+        {
+            std::size_t i = through >> 6;
+            uint64_t word = words_[i] & (~uint64_t{0} >> (63 - (through & 63)));
+            if (!word) {
+                if (i == 0) {
+                    return NONE;
+                }
+                auto prev = simd::find_prev_nonzero(words_, i - 1);
+                if (!prev) {
+                    return NONE;
+                }
+                i = *prev;
+                word = words_[i];
+            }
+            return static_cast<unsigned>(i * WORD_BITS) +
+                   static_cast<unsigned>(std::bit_width(word)) - 1;
+        }
+
+        void recount() noexcept
+        {
+            size_ = 0;
+            for (uint64_t word : words_) {
+                size_ += static_cast<std::size_t>(std::popcount(word));
+            }
+        }
+
+        std::array<uint64_t, WORD_COUNT> words_{};
+        std::size_t size_ = 0;
+    };
+
+    // Layout policy giving dense branches a FlatSummary instead of a
+    // recursive one wherever the fanout is at most 2^MaxBits clusters and
+    // the recursive summary would be a branch. Sparse branches keep the
+    // cluster storage of `Base`.
+    template <unsigned MaxBits, class Base = HashedClusters>
+    struct FlatSummaries : Base
+    {
+        static constexpr unsigned FLAT_SUMMARY_BITS = MaxBits;
+    };
+
+    // Widest fanout, in bits, that `Layout` gives a flat summary.
+    template <class Layout>
+    constexpr unsigned flat_summary_bits() noexcept
+    {
+        if constexpr (requires { Layout::FLAT_SUMMARY_BITS; }) {
+            return Layout::FLAT_SUMMARY_BITS;
+        }
+        else {
+            return 0;
+        }
+    }
+
+} // namespace veb_detail
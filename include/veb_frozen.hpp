@@ -0,0 +1,627 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "veb_branch_detail.hpp"
+
+namespace veb_detail
+{
+
+    // A frozen image is an array of 64-bit words in native byte order,
+    // queried in place, so it is position independent and can be mapped
+    // straight from a file:
+    //
+    //   header: FROZEN_MAGIC, FROZEN_VERSION, tree bits, key count, root
+    //           offset, image length in words, two zero words
+    //   branch: cluster count n, min, max, n sorted cluster indices, then
+    //           n cluster references
+    //   ref:    FROZEN_INLINE | value for a single-key cluster, otherwise
+    //           the word offset of the child branch or leaf
+    //   leaf:   raw bitmap words; each branch's leaves start on a 64-byte
+    //           boundary and never straddle a cache line
+    //
+    // Branches split their bits in half exactly as VebBranch does, ending
+    // in 8-bit (four-word) or 6-bit (one-word) leaves. Offsets are counted
+    // from the start of the image, which is itself 64-byte aligned.
+
+    // "PARVEBFZ" read as a little-endian word.
+    inline constexpr uint64_t FROZEN_MAGIC = 0x5A46424556524150;
+    inline constexpr uint64_t FROZEN_VERSION = 1;
+    inline constexpr uint64_t FROZEN_INLINE = uint64_t{1} << 63;
+    inline constexpr std::size_t FROZEN_HEADER_WORDS = 8;
+    inline constexpr std::size_t FROZEN_LINE_WORDS = 8;
+    inline constexpr std::size_t FROZEN_ALIGNMENT = 64;
+
+    [[noreturn]] inline void frozen_error(char const *what)
+    {
+        throw std::runtime_error(std::string("veb frozen: ") + what);
+    }
+
+    [[nodiscard]] constexpr bool frozen_leaf(unsigned bits) noexcept
+    {
+        return bits == 6 || bits == 8;
+    }
+
+    [[nodiscard]] constexpr unsigned frozen_leaf_words(unsigned bits) noexcept
+    {
+        return bits == 8 ? 4 : 1;
+    }
+
+    [[nodiscard]] constexpr uint64_t frozen_mask(unsigned bits) noexcept
+    {
+        return bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1;
+    }
+
+    // Queries over a leaf's bitmap words; only the downward scan for the
+    // max needs their count `W`. Callers guarantee a key exists on the
+    // side they ask for.
+    [[nodiscard]] inline bool
+    frozen_leaf_contains(uint64_t const *words, uint64_t x) noexcept
+    {
+        return (words[x >> 6] >> (x & 63)) & 1;
+    }
+
+    [[nodiscard]] inline uint64_t
+    frozen_leaf_min(uint64_t const *words) noexcept
+    {
+        unsigned i = 0;
+        while (words[i] == 0) {
+            ++i;
+        }
+        return i * 64 + static_cast<unsigned>(std::countr_zero(words[i]));
+    }
+
+    template <unsigned W>
+    [[nodiscard]] inline uint64_t
+    frozen_leaf_max(uint64_t const *words) noexcept
+    {
+        unsigned i = W - 1;
+        while (words[i] == 0) {
+            --i;
+        }
+        return i * 64 + 63 - static_cast<unsigned>(std::countl_zero(words[i]));
+    }
+
+    // Smallest key above `x`.
+    [[nodiscard]] inline uint64_t
+    frozen_leaf_successor(uint64_t const *words, uint64_t x) noexcept
+    {
+        unsigned i = static_cast<unsigned>(x >> 6);
+        unsigned shift = static_cast<unsigned>(x & 63);
+        uint64_t word =
+            shift == 63 ? 0 : words[i] & (~uint64_t{0} << (shift + 1));
+        while (word == 0) {
+            word = words[++i];
+        }
+        return i * 64 + static_cast<unsigned>(std::countr_zero(word));
+    }
+
+    // Largest key below `x`.
+    [[nodiscard]] inline uint64_t
+    frozen_leaf_predecessor(uint64_t const *words, uint64_t x) noexcept
+    {
+        unsigned i = static_cast<unsigned>(x >> 6);
+        uint64_t word = words[i] & ((uint64_t{1} << (x & 63)) - 1);
+        while (word == 0) {
+            word = words[--i];
+        }
+        return i * 64 + 63 - static_cast<unsigned>(std::countl_zero(word));
+    }
+
+    // Lays out sorted keys as a frozen image.
+    template <unsigned Bits>
+    class FrozenBuilder
+    {
+    public:
+        [[nodiscard]] std::vector<uint64_t>
+        build(std::span<uint64_t const> keys)
+        {
+            words_.assign(FROZEN_HEADER_WORDS, 0);
+            words_[0] = FROZEN_MAGIC;
+            words_[1] = FROZEN_VERSION;
+            words_[2] = Bits;
+            words_[3] = keys.size();
+            if (!keys.empty()) {
+                words_[4] = build_branch<Bits>(keys);
+            }
+            align_to_line();
+            words_[5] = words_.size();
+            return std::move(words_);
+        }
+
+    private:
+        void align_to_line()
+        {
+            words_.resize(
+                (words_.size() + FROZEN_LINE_WORDS - 1) / FROZEN_LINE_WORDS *
+                FROZEN_LINE_WORDS);
+        }
+
+        // `keys` are full tree keys; this branch sees their low `B` bits.
+        template <unsigned B>
+        uint64_t build_branch(std::span<uint64_t const> keys)
+        {
+            constexpr unsigned C = B / 2;
+            auto high = [](uint64_t key) {
+                return (key & frozen_mask(B)) >> C;
+            };
+
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < keys.size(); ++i) {
+                n += i == 0 || high(keys[i]) != high(keys[i - 1]);
+            }
+            uint64_t offset = words_.size();
+            words_.push_back(n);
+            words_.push_back(keys.front() & frozen_mask(B));
+            words_.push_back(keys.back() & frozen_mask(B));
+            std::size_t clusters = words_.size();
+            std::size_t refs = clusters + n;
+            words_.resize(refs + n);
+            if constexpr (frozen_leaf(C)) {
+                align_to_line();
+            }
+
+            std::size_t c = 0;
+            for (std::size_t i = 0; i < keys.size(); ++c) {
+                uint64_t hi = high(keys[i]);
+                std::size_t j = i + 1;
+                while (j < keys.size() && high(keys[j]) == hi) {
+                    ++j;
+                }
+                uint64_t ref;
+                if (j - i == 1) {
+                    ref = FROZEN_INLINE | (keys[i] & frozen_mask(C));
+                }
+                else if constexpr (frozen_leaf(C)) {
+                    ref = words_.size();
+                    words_.resize(ref + frozen_leaf_words(C));
+                    for (std::size_t k = i; k < j; ++k) {
+                        uint64_t lo = keys[k] & frozen_mask(C);
+                        words_[ref + (lo >> 6)] |= uint64_t{1} << (lo & 63);
+                    }
+                }
+                else {
+                    ref = build_branch<C>(keys.subspan(i, j - i));
+                }
+                words_[clusters + c] = hi;
+                words_[refs + c] = ref;
+                i = j;
+            }
+            return offset;
+        }
+
+        std::vector<uint64_t> words_;
+    };
+
+} // namespace veb_detail
+
+// Bytes of a frozen image, either built in memory (64-byte aligned heap
+// storage) or mapped read-only from a file. Mapped images are shared
+// through the page cache by every process that maps the same file.
+class FrozenImage
+{
+public:
+    FrozenImage() = default;
+
+    explicit FrozenImage(std::span<uint64_t const> words)
+        : size_(words.size_bytes())
+    {
+        if (size_ != 0) {
+            data_ = ::operator new(
+                size_, std::align_val_t{veb_detail::FROZEN_ALIGNMENT});
+            std::memcpy(data_, words.data(), size_);
+        }
+    }
+
+    FrozenImage(FrozenImage &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          mapped_(std::exchange(other.mapped_, false))
+    {
+    }
+
+    FrozenImage &operator=(FrozenImage &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            mapped_ = std::exchange(other.mapped_, false);
+        }
+        return *this;
+    }
+
+    FrozenImage(FrozenImage const &) = delete;
+    FrozenImage &operator=(FrozenImage const &) = delete;
+
+    ~FrozenImage()
+    {
+        release();
+    }
+
+    // Maps the image file at `path` read-only. Nothing is read until a
+    // query touches it. Throws std::system_error if the file cannot be
+    // opened or mapped.
+    static FrozenImage map(char const *path)
+    {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        FrozenImage image;
+        image.size_ = static_cast<std::size_t>(st.st_size);
+        if (image.size_ != 0) {
+            void *data =
+                ::mmap(nullptr, image.size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), path);
+            }
+            image.data_ = data;
+            image.mapped_ = true;
+        }
+        ::close(fd);
+        return image;
+    }
+
+    [[nodiscard]] std::span<std::byte const> bytes() const noexcept
+    {
+        return {static_cast<std::byte const *>(data_), size_};
+    }
+
+    // Writes the image, e.g. to the file later passed to map().
+    void write(std::ostream &out) const
+    {
+        out.write(
+            static_cast<char const *>(data_),
+            static_cast<std::streamsize>(size_));
+        if (!out) {
+            veb_detail::frozen_error("write failed");
+        }
+    }
+
+private:
+    void release() noexcept
+    {
+        if (data_ == nullptr) {
+            return;
+        }
+        if (mapped_) {
+            ::munmap(data_, size_);
+        }
+        else {
+            ::operator delete(
+                data_, std::align_val_t{veb_detail::FROZEN_ALIGNMENT});
+        }
+        data_ = nullptr;
+    }
+
+    void *data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
+};
+
+// Read-only view of a frozen `Bits`-bit tree. Queries run directly on
+// the image bytes: children are word offsets, clusters are found by
+// binary search over each branch's sorted index array, and nothing is
+// allocated. The bytes must outlive the view.
+template <unsigned Bits>
+class FrozenVeb
+{
+public:
+    using Key = typename veb_detail::key_type_for_bits<Bits>::type;
+    static constexpr unsigned SUBTREE_BITS = Bits;
+    static constexpr Key MAX_KEY =
+        static_cast<Key>(veb_detail::frozen_mask(Bits));
+
+    // Lays out the keys of `tree` (any VebTreeNN of the same width) as a
+    // frozen image.
+    template <class Tree>
+    [[nodiscard]] static FrozenImage freeze(Tree const &tree)
+    {
+        static_assert(Tree::SUBTREE_BITS == Bits);
+        std::vector<uint64_t> keys;
+        keys.reserve(tree.size());
+        tree.for_each([&](auto key) { keys.push_back(key); });
+        return FrozenImage(veb_detail::FrozenBuilder<Bits>().build(keys));
+    }
+
+    // Checks the header of `image` and views it. Only the header is
+    // validated; the rest is trusted to come from freeze(). Throws
+    // std::runtime_error on a bad header or misaligned bytes.
+    explicit FrozenVeb(std::span<std::byte const> image)
+    {
+        using namespace veb_detail;
+        if (reinterpret_cast<std::uintptr_t>(image.data()) %
+                FROZEN_ALIGNMENT !=
+            0) {
+            frozen_error("image is not 64-byte aligned");
+        }
+        if (image.size() < FROZEN_HEADER_WORDS * sizeof(uint64_t) ||
+            image.size() % sizeof(uint64_t) != 0) {
+            frozen_error("image has a bad length");
+        }
+        words_ = reinterpret_cast<uint64_t const *>(image.data());
+        if (words_[0] != FROZEN_MAGIC) {
+            frozen_error("not a frozen image");
+        }
+        if (words_[1] != FROZEN_VERSION) {
+            frozen_error("unsupported version");
+        }
+        if (words_[2] != Bits) {
+            frozen_error("built for a different tree width");
+        }
+        if (words_[5] != image.size() / sizeof(uint64_t) ||
+            words_[4] >= words_[5] ||
+            (words_[3] != 0) != (words_[4] != 0)) {
+            frozen_error("corrupt header");
+        }
+        size_ = static_cast<std::size_t>(words_[3]);
+        root_ = words_[4];
+    }
+
+    explicit FrozenVeb(FrozenImage const &image) : FrozenVeb(image.bytes()) {}
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        if (empty()) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(words_[root_ + 1]);
+    }
+
+    [[nodiscard]] std::optional<Key> max() const noexcept
+    {
+        if (empty()) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(words_[root_ + 2]);
+    }
+
+    [[nodiscard]] bool contains(Key x) const noexcept
+    {
+        return !empty() && contains_in<Bits>(root_, x);
+    }
+
+    // Smallest key strictly greater than `x`.
+    [[nodiscard]] std::optional<Key> successor(Key x) const noexcept
+    {
+        if (empty() || x >= words_[root_ + 2]) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(successor_in<Bits>(root_, x));
+    }
+
+    // Largest key strictly less than `x`.
+    [[nodiscard]] std::optional<Key> predecessor(Key x) const noexcept
+    {
+        if (empty() || x <= words_[root_ + 1]) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(predecessor_in<Bits>(root_, x));
+    }
+
+    // Calls fn(key) for every key in ascending order.
+    template <class Fn>
+    void for_each(Fn &&fn) const
+    {
+        if (!empty()) {
+            for_each_in<Bits>(root_, 0, fn);
+        }
+    }
+
+    [[nodiscard]] std::vector<Key> to_vector() const
+    {
+        std::vector<Key> out;
+        out.reserve(size_);
+        for_each([&](Key k) { out.push_back(k); });
+        return out;
+    }
+
+private:
+    // Branch layout helpers; `off` is a branch's word offset.
+    [[nodiscard]] std::size_t cluster_count(uint64_t off) const noexcept
+    {
+        return static_cast<std::size_t>(words_[off]);
+    }
+
+    [[nodiscard]] uint64_t const *cluster_index(uint64_t off) const noexcept
+    {
+        return words_ + off + 3;
+    }
+
+    [[nodiscard]] uint64_t const *cluster_refs(uint64_t off) const noexcept
+    {
+        return cluster_index(off) + cluster_count(off);
+    }
+
+    // Position of the first cluster at or above `hi`.
+    [[nodiscard]] std::size_t
+    lower_cluster(uint64_t off, uint64_t hi) const noexcept
+    {
+        uint64_t const *index = cluster_index(off);
+        return static_cast<std::size_t>(
+            std::lower_bound(index, index + cluster_count(off), hi) - index);
+    }
+
+    template <unsigned B>
+    [[nodiscard]] uint64_t child_min(uint64_t ref) const noexcept
+    {
+        if (ref & veb_detail::FROZEN_INLINE) {
+            return ref & ~veb_detail::FROZEN_INLINE;
+        }
+        if constexpr (veb_detail::frozen_leaf(B)) {
+            return veb_detail::frozen_leaf_min(words_ + ref);
+        }
+        else {
+            return words_[ref + 1];
+        }
+    }
+
+    template <unsigned B>
+    [[nodiscard]] uint64_t child_max(uint64_t ref) const noexcept
+    {
+        if (ref & veb_detail::FROZEN_INLINE) {
+            return ref & ~veb_detail::FROZEN_INLINE;
+        }
+        if constexpr (veb_detail::frozen_leaf(B)) {
+            return veb_detail::frozen_leaf_max<veb_detail::frozen_leaf_words(
+                B)>(words_ + ref);
+        }
+        else {
+            return words_[ref + 2];
+        }
+    }
+
+    template <unsigned B>
+    [[nodiscard]] bool contains_in(uint64_t off, uint64_t x) const noexcept
+    {
+        constexpr unsigned C = B / 2;
+        uint64_t hi = x >> C;
+        uint64_t lo = x & veb_detail::frozen_mask(C);
+        std::size_t i = lower_cluster(off, hi);
+        if (i == cluster_count(off) || cluster_index(off)[i] != hi) {
+            return false;
+        }
+        uint64_t ref = cluster_refs(off)[i];
+        if (ref & veb_detail::FROZEN_INLINE) {
+            return (ref & ~veb_detail::FROZEN_INLINE) == lo;
+        }
+        if constexpr (veb_detail::frozen_leaf(C)) {
+            return veb_detail::frozen_leaf_contains(words_ + ref, lo);
+        }
+        else {
+            return contains_in<C>(ref, lo);
+        }
+    }
+
+    // Requires `x` below the branch's max, so a successor exists.
+    template <unsigned B>
+    [[nodiscard]] uint64_t successor_in(uint64_t off, uint64_t x) const noexcept
+    {
+        constexpr unsigned C = B / 2;
+        uint64_t hi = x >> C;
+        uint64_t lo = x & veb_detail::frozen_mask(C);
+        uint64_t const *index = cluster_index(off);
+        uint64_t const *refs = cluster_refs(off);
+        std::size_t i = lower_cluster(off, hi);
+        if (i < cluster_count(off) && index[i] == hi) {
+            uint64_t ref = refs[i];
+            if (lo < child_max<C>(ref)) {
+                uint64_t next;
+                if (ref & veb_detail::FROZEN_INLINE) {
+                    next = ref & ~veb_detail::FROZEN_INLINE;
+                }
+                else if constexpr (veb_detail::frozen_leaf(C)) {
+                    next =
+                        veb_detail::frozen_leaf_successor(words_ + ref, lo);
+                }
+                else {
+                    next = successor_in<C>(ref, lo);
+                }
+                return (hi << C) | next;
+            }
+            ++i;
+        }
+        return (index[i] << C) | child_min<C>(refs[i]);
+    }
+
+    // Requires `x` above the branch's min, so a predecessor exists.
+    template <unsigned B>
+    [[nodiscard]] uint64_t
+    predecessor_in(uint64_t off, uint64_t x) const noexcept
+    {
+        constexpr unsigned C = B / 2;
+        uint64_t hi = x >> C;
+        uint64_t lo = x & veb_detail::frozen_mask(C);
+        uint64_t const *index = cluster_index(off);
+        uint64_t const *refs = cluster_refs(off);
+        std::size_t i = lower_cluster(off, hi);
+        if (i < cluster_count(off) && index[i] == hi) {
+            uint64_t ref = refs[i];
+            if (lo > child_min<C>(ref)) {
+                uint64_t prev;
+                if (ref & veb_detail::FROZEN_INLINE) {
+                    prev = ref & ~veb_detail::FROZEN_INLINE;
+                }
+                else if constexpr (veb_detail::frozen_leaf(C)) {
+                    prev =
+                        veb_detail::frozen_leaf_predecessor(words_ + ref, lo);
+                }
+                else {
+                    prev = predecessor_in<C>(ref, lo);
+                }
+                return (hi << C) | prev;
+            }
+        }
+        return (index[i - 1] << C) | child_max<C>(refs[i - 1]);
+    }
+
+    template <unsigned B, class Fn>
+    void for_each_in(uint64_t off, uint64_t prefix, Fn &fn) const
+    {
+        constexpr unsigned C = B / 2;
+        uint64_t const *index = cluster_index(off);
+        uint64_t const *refs = cluster_refs(off);
+        for (std::size_t i = 0, n = cluster_count(off); i < n; ++i) {
+            uint64_t base = prefix | (index[i] << C);
+            uint64_t ref = refs[i];
+            if (ref & veb_detail::FROZEN_INLINE) {
+                fn(static_cast<Key>(base | (ref & ~veb_detail::FROZEN_INLINE)));
+            }
+            else if constexpr (veb_detail::frozen_leaf(C)) {
+                for (unsigned w = 0; w < veb_detail::frozen_leaf_words(C);
+                     ++w) {
+                    for (uint64_t word = words_[ref + w]; word != 0;
+                         word &= word - 1) {
+                        fn(static_cast<Key>(
+                            base | (w * 64 + std::countr_zero(word))));
+                    }
+                }
+            }
+            else {
+                for_each_in<C>(ref, base, fn);
+            }
+        }
+    }
+
+    uint64_t const *words_ = nullptr;
+    std::size_t size_ = 0;
+    uint64_t root_ = 0;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+// Bidirectional iterator over the keys of a vEB node in ascending order.
+// It wraps the node's Cursor, which keeps one position per level, so
+// stepping resumes at the current leaf instead of descending from the root.
+// Any modification of the tree invalidates its iterators.
+template <class Node>
+class VebIterator
+{
+public:
+    using Key = typename Node::Key;
+    using value_type = Key;
+    using difference_type = std::ptrdiff_t;
+    using reference = Key;
+    using pointer = void;
+    using iterator_concept = std::bidirectional_iterator_tag;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    VebIterator() = default;
+
+    [[nodiscard]] static VebIterator begin(Node const &node) noexcept
+    {
+        VebIterator it(node);
+        it.at_end_ = !it.cursor_.first(node);
+        return it;
+    }
+
+    [[nodiscard]] static VebIterator end(Node const &node) noexcept
+    {
+        return VebIterator(node);
+    }
+
+    // First key not below `key`.
+    [[nodiscard]] static VebIterator
+    lower_bound(Node const &node, Key key) noexcept
+    {
+        VebIterator it(node);
+        it.at_end_ = !it.cursor_.seek(node, key);
+        return it;
+    }
+
+    // First key above `key`.
+    [[nodiscard]] static VebIterator
+    upper_bound(Node const &node, Key key) noexcept
+    {
+        if (key >= Node::MAX_KEY) {
+            return end(node);
+        }
+        return lower_bound(node, static_cast<Key>(key + 1));
+    }
+
+    [[nodiscard]] Key operator*() const noexcept
+    {
+        return cursor_.key();
+    }
+
+    VebIterator &operator++() noexcept
+    {
+        at_end_ = !cursor_.next();
+        return *this;
+    }
+
+    VebIterator operator++(int) noexcept
+    {
+        VebIterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    // Decrementing end() moves to the largest key.
+    VebIterator &operator--() noexcept
+    {
+        if (at_end_) {
+            at_end_ = !cursor_.last(*node_);
+        }
+        else {
+            cursor_.prev();
+        }
+        return *this;
+    }
+
+    VebIterator operator--(int) noexcept
+    {
+        VebIterator old = *this;
+        --*this;
+        return old;
+    }
+
+    [[nodiscard]] bool operator==(VebIterator const &other) const noexcept
+    {
+        if (at_end_ || other.at_end_) {
+            return at_end_ == other.at_end_;
+        }
+        return cursor_.key() == other.cursor_.key();
+    }
+
+private:
+    explicit VebIterator(Node const &node) noexcept : node_(&node) {}
+
+    Node const *node_ = nullptr;
+    typename Node::Cursor cursor_{};
+    bool at_end_ = true;
+};
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <bit>
+#include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <span>
@@ -20,14 +21,22 @@ private:
     uint64_t bits{0};
 
 public:
-    inline void insert(Key x) noexcept
+    // Returns true when `x` was not present before.
+    inline bool insert(Key x) noexcept
     {
-        bits |= (uint64_t(1) << x);
+        uint64_t mask = uint64_t(1) << x;
+        bool added = !(bits & mask);
+        bits |= mask;
+        return added;
     }
 
-    inline void erase(Key x) noexcept
+    // Returns true when `x` was present before.
+    inline bool erase(Key x) noexcept
     {
-        bits &= ~(uint64_t(1) << x);
+        uint64_t mask = uint64_t(1) << x;
+        bool removed = bits & mask;
+        bits &= ~mask;
+        return removed;
     }
 
     template <class It>
@@ -60,16 +69,123 @@ public:
         batch_erase(keys.begin(), keys.end());
     }
 
+    // Leaves do not depend on key order; this lets branches hand sorted
+    // runs to leaf and branch children through the same call.
+    template <class It>
+    inline void batch_insert_sorted(It first, It last) noexcept
+    {
+        batch_insert(first, last);
+    }
+
+    template <class It>
+    inline void batch_erase_sorted(It first, It last) noexcept
+    {
+        batch_erase(first, last);
+    }
+
+    // Erases every key in [lo, hi] and returns how many were present.
+    inline std::size_t erase_range(Key lo, Key hi) noexcept
+    {
+        if (lo > hi) {
+            return 0;
+        }
+        uint64_t mask = (~0ull << lo) & (~0ull >> (63 - hi));
+        auto removed = static_cast<std::size_t>(std::popcount(bits & mask));
+        bits &= ~mask;
+        return removed;
+    }
+
+    // Set algebra with another leaf: one word operation each.
+    inline void union_with(VebLeaf6 const &other) noexcept
+    {
+        bits |= other.bits;
+    }
+
+    inline void intersect_with(VebLeaf6 const &other) noexcept
+    {
+        bits &= other.bits;
+    }
+
+    inline void difference_with(VebLeaf6 const &other) noexcept
+    {
+        bits &= ~other.bits;
+    }
+
+    inline void symmetric_difference_with(VebLeaf6 const &other) noexcept
+    {
+        bits ^= other.bits;
+    }
+
+    // Fills an empty leaf by writing the word instead of OR-ing bits.
+    template <class It>
+    inline void build_sorted(It first, It last) noexcept
+    {
+        uint64_t mask = 0;
+        for (; first != last; ++first) {
+            mask |= (uint64_t(1) << *first);
+        }
+        bits = mask;
+    }
+
     inline bool contains(Key x) const noexcept
     {
         return bits >> x & 1;
     }
 
+    // Snapshot form: the raw bitmap words.
+    template <class Writer>
+    void save(Writer &out) const
+    {
+        out.write(bits);
+    }
+
+    template <class Reader>
+    void load(Reader &in)
+    {
+        bits = in.read();
+    }
+
     inline bool empty() const noexcept
     {
         return bits == 0;
     }
 
+    [[nodiscard]] inline std::size_t size() const noexcept
+    {
+        return static_cast<std::size_t>(std::popcount(bits));
+    }
+
+    // Number of keys strictly below `x`.
+    [[nodiscard]] inline std::size_t rank(Key x) const noexcept
+    {
+        return static_cast<std::size_t>(
+            std::popcount(bits & ((uint64_t(1) << x) - 1)));
+    }
+
+    // The key with rank `k`, if there are more than `k` keys.
+    [[nodiscard]] inline std::optional<Key> select(std::size_t k) const noexcept
+    {
+        if (k >= size()) {
+            return std::nullopt;
+        }
+        uint64_t x = bits;
+        for (; k > 0; --k) {
+            x &= (x - 1);
+        }
+        return static_cast<Key>(std::countr_zero(x));
+    }
+
+    // Number of keys in [lo, hi].
+    [[nodiscard]] inline std::size_t
+    count_range(Key lo, Key hi) const noexcept
+    {
+        if (lo > hi) {
+            return 0;
+        }
+        uint64_t mask = (~0ull << lo) & (~0ull >> (63 - hi));
+        return static_cast<std::size_t>(std::popcount(bits & mask));
+    }
+
     [[nodiscard]] inline std::optional<Key> min() const noexcept
     {
         if (!bits) {
@@ -110,13 +226,125 @@ public:
         return static_cast<Key>(63 - std::countl_zero(mask));
     }
 
-    template <class Fn>
-    void for_each(Key prefix, Fn &&fn) const
+    // Forms of the queries above that return `none` instead of an empty
+    // optional. Branches pass 0 to successor_or and MAX_KEY to
+    // predecessor_or, which neither can return as an answer, and call
+    // min_or and max_or only on a leaf they know is non-empty.
+    [[nodiscard]] inline Key min_or(Key none) const noexcept
+    {
+        return bits ? static_cast<Key>(std::countr_zero(bits)) : none;
+    }
+
+    [[nodiscard]] inline Key max_or(Key none) const noexcept
+    {
+        return bits ? static_cast<Key>(63 - std::countl_zero(bits)) : none;
+    }
+
+    [[nodiscard]] inline Key successor_or(Key x, Key none) const noexcept
+    {
+        // Shifting in two steps keeps x == 63 defined and yields no bits.
+        uint64_t mask = bits & ((~0ull << x) << 1);
+        return mask ? static_cast<Key>(std::countr_zero(mask)) : none;
+    }
+
+    [[nodiscard]] inline Key predecessor_or(Key x, Key none) const noexcept
+    {
+        uint64_t mask = bits & ((uint64_t(1) << x) - 1);
+        return mask ? static_cast<Key>(63 - std::countl_zero(mask)) : none;
+    }
+
+    // Position inside a leaf for the ordered iterators. Stepping looks at
+    // the word holding the current key before moving on to later words.
+    class Cursor
+    {
+    public:
+        bool first(VebLeaf6 const &leaf) noexcept
+        {
+            leaf_ = &leaf;
+            return settle(leaf.min());
+        }
+
+        bool last(VebLeaf6 const &leaf) noexcept
+        {
+            leaf_ = &leaf;
+            return settle(leaf.max());
+        }
+
+        // Moves to the smallest key not below `x`.
+        bool seek(VebLeaf6 const &leaf, Key x) noexcept
+        {
+            leaf_ = &leaf;
+            return settle(
+                leaf.contains(x) ? std::optional<Key>(x) : leaf.successor(x));
+        }
+
+        bool next() noexcept
+        {
+            return settle(leaf_->successor(pos_));
+        }
+
+        bool prev() noexcept
+        {
+            return settle(leaf_->predecessor(pos_));
+        }
+
+        [[nodiscard]] Key key() const noexcept
+        {
+            return pos_;
+        }
+
+    private:
+        bool settle(std::optional<Key> pos) noexcept
+        {
+            if (!pos) {
+                return false;
+            }
+            pos_ = *pos;
+            return true;
+        }
+
+        VebLeaf6 const *leaf_ = nullptr;
+        Key pos_ = 0;
+    };
+
+    // Group query kernels used by the branch *_batch lookups; the parent
+    // has already prefetched every leaf in the group.
+    static void contains_group(
+        VebLeaf6 const *const *leaves, Key const *keys, bool *out,
+        std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = leaves[i]->contains(keys[i]);
+        }
+    }
+
+    static void successor_group(
+        VebLeaf6 const *const *leaves, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = leaves[i]->successor(keys[i]);
+        }
+    }
+
+    static void predecessor_group(
+        VebLeaf6 const *const *leaves, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = leaves[i]->predecessor(keys[i]);
+        }
+    }
+
+    // `prefix` carries the caller's key type so parents can report full
+    // keys without truncating them to this leaf's width.
+    template <class Out, class Fn>
+    void for_each(Out prefix, Fn &&fn) const
     {
         uint64_t x = bits;
         while (x) {
             unsigned bit = std::countr_zero(x);
-            fn(prefix | Key(bit));
+            fn(prefix | Out(bit));
             x &= (x - 1);
         }
     }
@@ -131,6 +359,24 @@ public:
             x &= (x - 1);
         }
     }
+
+    // Visits the keys in [lo, hi] in ascending order.
+    template <class Out, class Fn>
+    void for_each_range(Out prefix, Key lo, Key hi, Fn &&fn) const
+    {
+        uint64_t x = bits & (~0ull << lo) & (~0ull >> (63 - hi));
+        while (x) {
+            unsigned bit = std::countr_zero(x);
+            fn(prefix | Out(bit));
+            x &= (x - 1);
+        }
+    }
+
+    template <class Fn>
+    void for_each_range(Key lo, Key hi, Fn &&fn) const
+    {
+        for_each_range(Key{0}, lo, hi, std::forward<Fn>(fn));
+    }
 };
 
 static_assert(sizeof(VebLeaf6) == 8, "VebLeaf6 must be 8 bytes");
@@ -2,10 +2,140 @@
 
 #include <array>
 #include <bit>
+#include <cstddef>
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <utility>
 
+#include "simd_utils.hpp"
+
+// VebLeaf8's ordered scans test its four words as one 256-bit register
+// where the CPU has AVX2. The kernels are inlined into every query, so
+// they are chosen when the including code is compiled; an out-of-line
+// call through the runtime dispatch in simd_utils.cpp costs more than the
+// scan saves. They carry target("avx2") and are compiled whenever the
+// compiler can emit AVX2: builds that target AVX2 always use them, and
+// PARVEB_MULTIVERSION builds check the host first, which lets the
+// x86-64-v3/v4 clones of the tree queries inline them.
+#if (!defined(PARVEB_ENABLE_SIMD) || PARVEB_ENABLE_SIMD) &&                   \
+    (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    #define PARVEB_LEAF8_AVX2_KERNELS 1
+    #define PARVEB_LEAF8_TARGET_AVX2 __attribute__((target("avx2")))
+    #include <immintrin.h>
+#else
+    #define PARVEB_LEAF8_AVX2_KERNELS 0
+#endif
+
+#if PARVEB_LEAF8_AVX2_KERNELS && defined(__AVX2__)
+    #define PARVEB_LEAF8_AVX2 1
+#else
+    #define PARVEB_LEAF8_AVX2 0
+#endif
+
+namespace veb_detail
+{
+
+    // Position the leaf scans report when no key qualifies.
+    inline constexpr unsigned LEAF8_NONE = 256;
+
+    // Smallest set bit at or after `from` in a leaf's four words, or
+    // LEAF8_NONE, looking at the word holding it before moving on to
+    // later words.
+    [[nodiscard]] inline unsigned
+    leaf8_first_from_scalar(uint64_t const *words, unsigned from) noexcept
+    {
+        uint64_t mask = ~0ull << (from & 63);
+        for (unsigned i = from >> 6; i < 4; ++i, mask = ~0ull) {
+            if (uint64_t word = words[i] & mask) {
+                return i * 64 + static_cast<unsigned>(std::countr_zero(word));
+            }
+        }
+        return LEAF8_NONE;
+    }
+
+    // Largest set bit at or before `through`, or LEAF8_NONE.
+    [[nodiscard]] inline unsigned
+    leaf8_last_through_scalar(uint64_t const *words, unsigned through) noexcept
+    {
+        uint64_t mask = ~0ull >> (63 - (through & 63));
+        for (unsigned i = (through >> 6) + 1; i-- > 0; mask = ~0ull) {
+            if (uint64_t word = words[i] & mask) {
+                return i * 64 + static_cast<unsigned>(
+                                    63 - std::countl_zero(word));
+            }
+        }
+        return LEAF8_NONE;
+    }
+
+#if PARVEB_LEAF8_AVX2_KERNELS
+    // Stores the words under `lane_mask` to `out` and returns a mask
+    // whose bit i is set when word i is non-zero there.
+    [[nodiscard]] PARVEB_LEAF8_TARGET_AVX2 inline unsigned leaf8_masked_lanes(
+        uint64_t const *words, __m256i lane_mask, uint64_t *out) noexcept
+    {
+        __m256i block = _mm256_and_si256(
+            _mm256_loadu_si256(reinterpret_cast<__m256i const *>(words)),
+            lane_mask);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(out), block);
+        __m256i zero = _mm256_cmpeq_epi64(block, _mm256_setzero_si256());
+        return ~static_cast<unsigned>(
+                   _mm256_movemask_pd(_mm256_castsi256_pd(zero))) &
+               0xF;
+    }
+
+    // The scans above with all four words in one register. A per-lane
+    // shift builds the mask: lanes before the start word shift every bit
+    // out, and lanes past it are forced to all ones. Compare and movemask
+    // then give the non-empty lanes, and tzcnt/lzcnt pick the word and
+    // the bit, with no branch per word.
+    [[nodiscard]] PARVEB_LEAF8_TARGET_AVX2 inline unsigned
+    leaf8_first_from_avx2(uint64_t const *words, unsigned from) noexcept
+    {
+        __m256i const lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+        __m256i shift = _mm256_sub_epi64(
+            _mm256_set1_epi64x(from), _mm256_slli_epi64(lanes, 6));
+        __m256i after =
+            _mm256_cmpgt_epi64(lanes, _mm256_set1_epi64x(from >> 6));
+        alignas(32) uint64_t masked[4];
+        auto live = leaf8_masked_lanes(
+            words,
+            _mm256_or_si256(
+                _mm256_sllv_epi64(_mm256_set1_epi64x(-1), shift), after),
+            masked);
+        if (!live) {
+            return LEAF8_NONE;
+        }
+        auto i = static_cast<unsigned>(std::countr_zero(live));
+        return i * 64 + static_cast<unsigned>(std::countr_zero(masked[i]));
+    }
+
+    [[nodiscard]] PARVEB_LEAF8_TARGET_AVX2 inline unsigned
+    leaf8_last_through_avx2(uint64_t const *words, unsigned through) noexcept
+    {
+        __m256i const lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+        __m256i shift = _mm256_sub_epi64(
+            _mm256_slli_epi64(lanes, 6),
+            _mm256_set1_epi64x(static_cast<long long>(through) - 63));
+        __m256i before =
+            _mm256_cmpgt_epi64(_mm256_set1_epi64x(through >> 6), lanes);
+        alignas(32) uint64_t masked[4];
+        auto live = leaf8_masked_lanes(
+            words,
+            _mm256_or_si256(
+                _mm256_srlv_epi64(_mm256_set1_epi64x(-1), shift), before),
+            masked);
+        if (!live) {
+            return LEAF8_NONE;
+        }
+        auto i = static_cast<unsigned>(std::bit_width(live) - 1);
+        return i * 64 +
+               static_cast<unsigned>(63 - std::countl_zero(masked[i]));
+    }
+#endif
+
+} // namespace veb_detail
+
 class VebLeaf8
 {
 public:
@@ -17,25 +147,77 @@ public:
 private:
     static constexpr unsigned WORD_BITS = 64;
     static constexpr unsigned WORD_COUNT = 4;
+    // Position the scans report when no key qualifies.
+    static constexpr unsigned NONE = veb_detail::LEAF8_NONE;
     std::array<uint64_t, WORD_COUNT> words_{};
 
+    [[nodiscard]] static std::optional<Key> found(unsigned pos) noexcept
+    {
+        if (pos == NONE) {
+            return std::nullopt;
+        }
+        return static_cast<Key>(pos);
+    }
+
+    [[nodiscard]] static Key found_or(unsigned pos, Key none) noexcept
+    {
+        return pos == NONE ? none : static_cast<Key>(pos);
+    }
+
     [[nodiscard]] static constexpr std::pair<unsigned, uint64_t>
     locate(Key x) noexcept
     {
         return {static_cast<unsigned>(x >> 6), uint64_t(1) << (x & 63)};
     }
 
+    // Smallest key at or after `from`, or NONE.
+    [[nodiscard]] unsigned first_from(unsigned from) const noexcept
+    {
+#if PARVEB_LEAF8_AVX2
+        return veb_detail::leaf8_first_from_avx2(words_.data(), from);
+#else
+    #if PARVEB_LEAF8_AVX2_KERNELS && PARVEB_MULTIVERSION
+        if (__builtin_cpu_supports("avx2")) {
+            return veb_detail::leaf8_first_from_avx2(words_.data(), from);
+        }
+    #endif
+        return veb_detail::leaf8_first_from_scalar(words_.data(), from);
+#endif
+    }
+
+    // Largest key at or before `through`, or NONE.
+    [[nodiscard]] unsigned last_through(unsigned through) const noexcept
+    {
+#if PARVEB_LEAF8_AVX2
+        return veb_detail::leaf8_last_through_avx2(words_.data(), through);
+#else
+    #if PARVEB_LEAF8_AVX2_KERNELS && PARVEB_MULTIVERSION
+        if (__builtin_cpu_supports("avx2")) {
+            return veb_detail::leaf8_last_through_avx2(
+                words_.data(), through);
+        }
+    #endif
+        return veb_detail::leaf8_last_through_scalar(words_.data(), through);
+#endif
+    }
+
 public:
-    inline void insert(Key x) noexcept
+    // Returns true when `x` was not present before.
+    inline bool insert(Key x) noexcept
     {
         auto [word_idx, mask] = locate(x);
+        bool added = !(words_[word_idx] & mask);
         words_[word_idx] |= mask;
+        return added;
     }
 
-    inline void erase(Key x) noexcept
+    // Returns true when `x` was present before.
+    inline bool erase(Key x) noexcept
     {
         auto [word_idx, mask] = locate(x);
+        bool removed = words_[word_idx] & mask;
         words_[word_idx] &= ~mask;
+        return removed;
     }
 
     template <class It>
@@ -74,38 +256,167 @@ public:
         batch_erase(keys.begin(), keys.end());
     }
 
+    // Leaves do not depend on key order; this lets branches hand sorted
+    // runs to leaf and branch children through the same call.
+    template <class It>
+    inline void batch_insert_sorted(It first, It last) noexcept
+    {
+        batch_insert(first, last);
+    }
+
+    template <class It>
+    inline void batch_erase_sorted(It first, It last) noexcept
+    {
+        batch_erase(first, last);
+    }
+
+    // Erases every key in [lo, hi] and returns how many were present.
+    inline std::size_t erase_range(Key lo, Key hi) noexcept
+    {
+        if (lo > hi) {
+            return 0;
+        }
+        unsigned first = static_cast<unsigned>(lo >> 6);
+        unsigned last = static_cast<unsigned>(hi >> 6);
+        std::size_t removed = 0;
+        for (unsigned i = first; i <= last; ++i) {
+            uint64_t mask = ~0ull;
+            if (i == first) {
+                mask &= ~0ull << (lo & 63);
+            }
+            if (i == last) {
+                mask &= ~0ull >> (63 - (hi & 63));
+            }
+            removed +=
+                static_cast<std::size_t>(std::popcount(words_[i] & mask));
+            words_[i] &= ~mask;
+        }
+        return removed;
+    }
+
+    // Set algebra with another leaf. The four-word loops compile to one
+    // 256-bit operation when AVX2 code generation is enabled.
+    inline void union_with(VebLeaf8 const &other) noexcept
+    {
+        for (unsigned i = 0; i < WORD_COUNT; ++i) {
+            words_[i] |= other.words_[i];
+        }
+    }
+
+    inline void intersect_with(VebLeaf8 const &other) noexcept
+    {
+        for (unsigned i = 0; i < WORD_COUNT; ++i) {
+            words_[i] &= other.words_[i];
+        }
+    }
+
+    inline void difference_with(VebLeaf8 const &other) noexcept
+    {
+        for (unsigned i = 0; i < WORD_COUNT; ++i) {
+            words_[i] &= ~other.words_[i];
+        }
+    }
+
+    inline void symmetric_difference_with(VebLeaf8 const &other) noexcept
+    {
+        for (unsigned i = 0; i < WORD_COUNT; ++i) {
+            words_[i] ^= other.words_[i];
+        }
+    }
+
+    // Fills an empty leaf by writing whole words instead of OR-ing bits.
+    template <class It>
+    inline void build_sorted(It first, It last) noexcept
+    {
+        std::array<uint64_t, WORD_COUNT> words{};
+        for (; first != last; ++first) {
+            auto [idx, mask] = locate(*first);
+            words[idx] |= mask;
+        }
+        words_ = words;
+    }
+
     [[nodiscard]] inline bool contains(Key x) const noexcept
     {
         auto [word_idx, mask] = locate(x);
         return (words_[word_idx] & mask) != 0;
     }
 
+    // Snapshot form: the raw bitmap words.
+    template <class Writer>
+    void save(Writer &out) const
+    {
+        out.write_words(words_);
+    }
+
+    template <class Reader>
+    void load(Reader &in)
+    {
+        in.read_words(words_);
+    }
+
     [[nodiscard]] inline bool empty() const noexcept
     {
         return (words_[0] | words_[1] | words_[2] | words_[3]) == 0;
     }
 
-    [[nodiscard]] inline std::optional<Key> min() const noexcept
+    [[nodiscard]] inline std::size_t size() const noexcept
+    {
+        std::size_t n = 0;
+        for (uint64_t word : words_) {
+            n += static_cast<std::size_t>(std::popcount(word));
+        }
+        return n;
+    }
+
+    // Number of keys strictly below `x`.
+    [[nodiscard]] inline std::size_t rank(Key x) const noexcept
+    {
+        auto [word_idx, mask] = locate(x);
+        std::size_t n = static_cast<std::size_t>(
+            std::popcount(words_[word_idx] & (mask - 1)));
+        for (unsigned i = 0; i < word_idx; ++i) {
+            n += static_cast<std::size_t>(std::popcount(words_[i]));
+        }
+        return n;
+    }
+
+    // The key with rank `k`, if there are more than `k` keys.
+    [[nodiscard]] inline std::optional<Key> select(std::size_t k) const noexcept
     {
         for (unsigned i = 0; i < WORD_COUNT; ++i) {
             uint64_t word = words_[i];
-            if (word) {
-                return static_cast<Key>(i * WORD_BITS + std::countr_zero(word));
+            auto n = static_cast<std::size_t>(std::popcount(word));
+            if (k >= n) {
+                k -= n;
+                continue;
             }
+            for (; k > 0; --k) {
+                word &= (word - 1);
+            }
+            return static_cast<Key>(i * WORD_BITS + std::countr_zero(word));
         }
         return std::nullopt;
     }
 
-    [[nodiscard]] inline std::optional<Key> max() const noexcept
+    // Number of keys in [lo, hi].
+    [[nodiscard]] inline std::size_t
+    count_range(Key lo, Key hi) const noexcept
     {
-        for (int i = WORD_COUNT - 1; i >= 0; --i) {
-            uint64_t word = words_[static_cast<std::size_t>(i)];
-            if (word) {
-                return static_cast<Key>(
-                    i * WORD_BITS + (63 - std::countl_zero(word)));
-            }
+        if (lo > hi) {
+            return 0;
         }
-        return std::nullopt;
+        return rank(hi) + (contains(hi) ? 1 : 0) - rank(lo);
+    }
+
+    [[nodiscard]] inline std::optional<Key> min() const noexcept
+    {
+        return found(first_from(0));
+    }
+
+    [[nodiscard]] inline std::optional<Key> max() const noexcept
+    {
+        return found(last_through(MAX_KEY));
     }
 
     [[nodiscard]] inline std::optional<Key> successor(Key x) const noexcept
@@ -113,70 +424,177 @@ public:
         if (x == MAX_KEY) {
             return std::nullopt;
         }
-        unsigned word_idx = static_cast<unsigned>(x >> 6);
-        unsigned offset = static_cast<unsigned>(x & 63);
+        return found(first_from(x + 1u));
+    }
 
-        uint64_t word = words_[word_idx];
-        uint64_t mask = offset == 63 ? 0 : (~0ull << (offset + 1));
-        uint64_t candidate = word & mask;
-        if (candidate) {
-            return static_cast<Key>(
-                word_idx * WORD_BITS + std::countr_zero(candidate));
+    [[nodiscard]] inline std::optional<Key> predecessor(Key x) const noexcept
+    {
+        if (x == 0) {
+            return std::nullopt;
         }
+        return found(last_through(x - 1u));
+    }
 
-        for (unsigned i = word_idx + 1; i < WORD_COUNT; ++i) {
-            uint64_t next_word = words_[i];
-            if (next_word) {
-                return static_cast<Key>(
-                    i * WORD_BITS + std::countr_zero(next_word));
-            }
+    // Forms of the queries above that return `none` instead of an empty
+    // optional. Branches pass 0 to successor_or and MAX_KEY to
+    // predecessor_or, which neither can return as an answer, and call
+    // min_or and max_or only on a leaf they know is non-empty.
+    [[nodiscard]] inline Key min_or(Key none) const noexcept
+    {
+        return found_or(first_from(0), none);
+    }
+
+    [[nodiscard]] inline Key max_or(Key none) const noexcept
+    {
+        return found_or(last_through(MAX_KEY), none);
+    }
+
+    [[nodiscard]] inline Key successor_or(Key x, Key none) const noexcept
+    {
+        if (x == MAX_KEY) {
+            return none;
         }
-        return std::nullopt;
+        return found_or(first_from(x + 1u), none);
     }
 
-    [[nodiscard]] inline std::optional<Key> predecessor(Key x) const noexcept
+    [[nodiscard]] inline Key predecessor_or(Key x, Key none) const noexcept
     {
         if (x == 0) {
-            return std::nullopt;
+            return none;
+        }
+        return found_or(last_through(x - 1u), none);
+    }
+
+    // Position inside a leaf for the ordered iterators. Stepping looks at
+    // the word holding the current key before moving on to later words.
+    class Cursor
+    {
+    public:
+        bool first(VebLeaf8 const &leaf) noexcept
+        {
+            leaf_ = &leaf;
+            return settle(leaf.min());
+        }
+
+        bool last(VebLeaf8 const &leaf) noexcept
+        {
+            leaf_ = &leaf;
+            return settle(leaf.max());
         }
-        unsigned word_idx = static_cast<unsigned>(x >> 6);
-        unsigned offset = static_cast<unsigned>(x & 63);
 
-        uint64_t word = words_[word_idx];
-        uint64_t mask = offset == 0 ? 0 : ((uint64_t(1) << offset) - 1);
-        uint64_t candidate = word & mask;
-        if (candidate) {
-            return static_cast<Key>(
-                word_idx * WORD_BITS + (63 - std::countl_zero(candidate)));
+        // Moves to the smallest key not below `x`.
+        bool seek(VebLeaf8 const &leaf, Key x) noexcept
+        {
+            leaf_ = &leaf;
+            return settle(
+                leaf.contains(x) ? std::optional<Key>(x) : leaf.successor(x));
         }
 
-        while (word_idx-- > 0) {
-            uint64_t prev_word = words_[word_idx];
-            if (prev_word) {
-                return static_cast<Key>(
-                    word_idx * WORD_BITS + (63 - std::countl_zero(prev_word)));
+        bool next() noexcept
+        {
+            return settle(leaf_->successor(pos_));
+        }
+
+        bool prev() noexcept
+        {
+            return settle(leaf_->predecessor(pos_));
+        }
+
+        [[nodiscard]] Key key() const noexcept
+        {
+            return pos_;
+        }
+
+    private:
+        bool settle(std::optional<Key> pos) noexcept
+        {
+            if (!pos) {
+                return false;
             }
+            pos_ = *pos;
+            return true;
+        }
+
+        VebLeaf8 const *leaf_ = nullptr;
+        Key pos_ = 0;
+    };
+
+    // Group query kernels used by the branch *_batch lookups; the parent
+    // has already prefetched every leaf in the group.
+    static void contains_group(
+        VebLeaf8 const *const *leaves, Key const *keys, bool *out,
+        std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = leaves[i]->contains(keys[i]);
+        }
+    }
+
+    static void successor_group(
+        VebLeaf8 const *const *leaves, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = leaves[i]->successor(keys[i]);
+        }
+    }
+
+    static void predecessor_group(
+        VebLeaf8 const *const *leaves, Key const *keys, std::optional<Key> *out,
+        std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = leaves[i]->predecessor(keys[i]);
+        }
+    }
+
+    // `prefix` carries the caller's key type so parents can report full
+    // keys without truncating them to this leaf's width. The set bits are
+    // expanded into positions in bulk first (AVX-512 compress where the
+    // host has it), which also beats a countr_zero loop on sparse leaves
+    // by not mispredicting its exit.
+    template <class Out, class Fn>
+    void for_each(Out prefix, Fn &&fn) const
+    {
+        std::array<uint16_t, SUBTREE_SIZE> positions;
+        std::size_t n = simd::set_bit_positions(words_, positions.data());
+        for (std::size_t i = 0; i < n; ++i) {
+            fn(prefix | static_cast<Out>(positions[i]));
         }
-        return std::nullopt;
     }
 
     template <class Fn>
-    void for_each(Key prefix, Fn &&fn) const
+    void for_each(Fn &&fn) const
     {
-        for (unsigned i = 0; i < WORD_COUNT; ++i) {
+        for_each(Key{0}, std::forward<Fn>(fn));
+    }
+
+    // Visits the keys in [lo, hi] in ascending order.
+    template <class Out, class Fn>
+    void for_each_range(Out prefix, Key lo, Key hi, Fn &&fn) const
+    {
+        unsigned first = static_cast<unsigned>(lo >> 6);
+        unsigned last = static_cast<unsigned>(hi >> 6);
+        for (unsigned i = first; i <= last; ++i) {
             uint64_t word = words_[i];
+            if (i == first) {
+                word &= ~0ull << (lo & 63);
+            }
+            if (i == last) {
+                word &= ~0ull >> (63 - (hi & 63));
+            }
             while (word) {
                 unsigned bit = std::countr_zero(word);
-                fn(prefix | static_cast<Key>(i * WORD_BITS + bit));
+                fn(prefix | static_cast<Out>(i * WORD_BITS + bit));
                 word &= (word - 1);
             }
         }
     }
 
     template <class Fn>
-    void for_each(Fn &&fn) const
+    void for_each_range(Key lo, Key hi, Fn &&fn) const
     {
-        for_each(0, std::forward<Fn>(fn));
+        for_each_range(Key{0}, lo, hi, std::forward<Fn>(fn));
     }
 };
 
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "veb_atomic.hpp"
+#include "veb_epoch.hpp"
+
+namespace veb_detail
+{
+
+    inline void spin_pause() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    // Version counter for optimistic reads. Writers hold it odd while they
+    // change what it guards; readers note an even version, read, and keep
+    // what they read only if the version has not moved. Readers never
+    // write to it.
+    class SeqVersion
+    {
+    public:
+        // Waits out any writer and returns the version to validate.
+        [[nodiscard]] uint64_t read_begin() const noexcept
+        {
+            for (;;) {
+                uint64_t v = version_.load(std::memory_order_acquire);
+                if ((v & 1) == 0) {
+                    return v;
+                }
+                spin_pause();
+            }
+        }
+
+        // True when no writer ran since read_begin() returned `v`.
+        [[nodiscard]] bool read_validate(uint64_t v) const noexcept
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return version_.load(std::memory_order_relaxed) == v;
+        }
+
+        // Excludes other writers and fails every read in progress.
+        void write_lock() noexcept
+        {
+            for (;;) {
+                uint64_t v = version_.load(std::memory_order_relaxed);
+                if ((v & 1) == 0 &&
+                    version_.compare_exchange_weak(
+                        v, v + 1, std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                    break;
+                }
+                spin_pause();
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void write_unlock() noexcept
+        {
+            version_.fetch_add(1, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<uint64_t> version_{0};
+    };
+
+    class SeqWriteGuard
+    {
+    public:
+        explicit SeqWriteGuard(SeqVersion &version) noexcept
+            : version_(version)
+        {
+            version_.write_lock();
+        }
+
+        SeqWriteGuard(SeqWriteGuard const &) = delete;
+        SeqWriteGuard &operator=(SeqWriteGuard const &) = delete;
+
+        ~SeqWriteGuard()
+        {
+            version_.write_unlock();
+        }
+
+    private:
+        SeqVersion &version_;
+    };
+
+} // namespace veb_detail
+
+// Concurrent `Bits`-bit tree for read-mostly workloads. Keys split into
+// a top-level cluster index and a low part kept in an AtomicVebBranch per
+// cluster. Each cluster has its own version counter, and so does the
+// summary of non-empty clusters.
+//
+// contains, successor, predecessor, min and max read optimistically:
+// they note the versions of what they look at, read without locking,
+// and retry only if a writer touched it meanwhile. Apart from pinning an
+// epoch in a record owned by their thread, readers never write memory,
+// so they do not bounce a lock's cache line between cores. Writers lock
+// one cluster's version; the summary is locked only when a cluster goes
+// empty or non-empty. All operations are linearizable.
+//
+// A cluster is unlinked when its last key is erased and retired to an
+// EpochPool, which hands it to a later insert once no reader pinned
+// before the unlink is still running. Only 24- and 32-bit trees are
+// provided: a flat cluster array over the top half of a 48- or 64-bit
+// key would be too large.
+template <unsigned Bits>
+class OptimisticVebTree
+{
+    static_assert(
+        Bits == 24 || Bits == 32, "optimistic trees are 24 or 32 bits");
+    using Cluster =
+        std::conditional_t<Bits == 24, AtomicVebBranch12, AtomicVebBranch16>;
+    using ClusterKey = typename Cluster::Key;
+
+public:
+    using Key = typename veb_detail::key_type_for_bits<Bits>::type;
+    static constexpr unsigned SUBTREE_BITS = Bits;
+    static constexpr Key MAX_KEY = Key((uint64_t{1} << Bits) - 1);
+
+    OptimisticVebTree() : slots_(std::make_unique<Slot[]>(CLUSTER_COUNT)) {}
+
+    OptimisticVebTree(OptimisticVebTree const &) = delete;
+    OptimisticVebTree &operator=(OptimisticVebTree const &) = delete;
+
+    ~OptimisticVebTree()
+    {
+        for (std::size_t c = 0; c < CLUSTER_COUNT; ++c) {
+            delete slots_[c].cluster.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Returns true when `key` was not present before.
+    bool insert(Key key)
+    {
+        auto [hi, lo] = split(key);
+        Slot &slot = slots_[hi];
+        veb_detail::SeqWriteGuard guard(slot.version);
+        Cluster *cluster = slot.cluster.load(std::memory_order_relaxed);
+        if (!cluster) {
+            cluster = pool_.acquire();
+            slot.cluster.store(cluster, std::memory_order_release);
+        }
+        if (!cluster->insert(lo)) {
+            return false;
+        }
+        if (!summary_.contains(hi)) {
+            veb_detail::SeqWriteGuard summary_guard(summary_version_);
+            summary_.insert(hi);
+        }
+        return true;
+    }
+
+    // Returns true when `key` was present before.
+    bool erase(Key key) noexcept
+    {
+        auto [hi, lo] = split(key);
+        Slot &slot = slots_[hi];
+        veb_detail::SeqWriteGuard guard(slot.version);
+        Cluster *cluster = slot.cluster.load(std::memory_order_relaxed);
+        if (!cluster || !cluster->erase(lo)) {
+            return false;
+        }
+        if (cluster->empty()) {
+            {
+                veb_detail::SeqWriteGuard summary_guard(summary_version_);
+                summary_.erase(hi);
+            }
+            slot.cluster.store(nullptr, std::memory_order_relaxed);
+            pool_.retire(cluster);
+        }
+        return true;
+    }
+
+    [[nodiscard]] bool contains(Key key) const noexcept
+    {
+        auto [hi, lo] = split(key);
+        veb_detail::EpochGuard pin(epochs_);
+        return read_cluster(
+            slots_[hi], [&](Cluster const &c) { return c.contains(lo); });
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        for (;;) {
+            uint64_t v = summary_version_.read_begin();
+            bool none = summary_.empty();
+            if (summary_version_.read_validate(v)) {
+                return none;
+            }
+        }
+    }
+
+    // Sum of the cluster sizes; exact when no writer runs alongside.
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        std::size_t n = 0;
+        veb_detail::EpochGuard pin(epochs_);
+        summary_.for_each([&](ClusterKey hi) {
+            n += read_cluster(
+                slots_[hi], [](Cluster const &c) { return c.size(); });
+        });
+        return n;
+    }
+
+    [[nodiscard]] std::optional<Key> min() const noexcept
+    {
+        veb_detail::EpochGuard pin(epochs_);
+        for (;;) {
+            uint64_t v = summary_version_.read_begin();
+            auto found = first_after(summary_.min());
+            if (summary_version_.read_validate(v)) {
+                return found;
+            }
+        }
+    }
+
+    [[nodiscard]] std::optional<Key> max() const noexcept
+    {
+        veb_detail::EpochGuard pin(epochs_);
+        for (;;) {
+            uint64_t v = summary_version_.read_begin();
+            auto found = last_before(summary_.max());
+            if (summary_version_.read_validate(v)) {
+                return found;
+            }
+        }
+    }
+
+    // Smallest key strictly greater than `key`.
+    [[nodiscard]] std::optional<Key> successor(Key key) const noexcept
+    {
+        auto [hi, lo] = split(key);
+        Slot const &start = slots_[hi];
+        veb_detail::EpochGuard pin(epochs_);
+        for (;;) {
+            uint64_t start_v = start.version.read_begin();
+            Cluster const *cluster =
+                start.cluster.load(std::memory_order_acquire);
+            auto next = cluster ? cluster->successor(lo) : std::nullopt;
+            if (next) {
+                if (start.version.read_validate(start_v)) {
+                    return combine(hi, *next);
+                }
+                continue;
+            }
+            uint64_t summary_v = summary_version_.read_begin();
+            auto found = first_after(summary_.successor(hi));
+            if (summary_version_.read_validate(summary_v) &&
+                start.version.read_validate(start_v)) {
+                return found;
+            }
+        }
+    }
+
+    // Largest key strictly less than `key`.
+    [[nodiscard]] std::optional<Key> predecessor(Key key) const noexcept
+    {
+        auto [hi, lo] = split(key);
+        Slot const &start = slots_[hi];
+        veb_detail::EpochGuard pin(epochs_);
+        for (;;) {
+            uint64_t start_v = start.version.read_begin();
+            Cluster const *cluster =
+                start.cluster.load(std::memory_order_acquire);
+            auto prev = cluster ? cluster->predecessor(lo) : std::nullopt;
+            if (prev) {
+                if (start.version.read_validate(start_v)) {
+                    return combine(hi, *prev);
+                }
+                continue;
+            }
+            uint64_t summary_v = summary_version_.read_begin();
+            auto found = last_before(summary_.predecessor(hi));
+            if (summary_version_.read_validate(summary_v) &&
+                start.version.read_validate(start_v)) {
+                return found;
+            }
+        }
+    }
+
+private:
+    static constexpr unsigned CLUSTER_BITS = Bits / 2;
+    static constexpr std::size_t CLUSTER_COUNT = std::size_t{1}
+                                                 << CLUSTER_BITS;
+
+    // One cache line per slot: a writer bumping a cluster's version then
+    // invalidates only that cluster's readers, not its neighbours'. The
+    // array costs 64 bytes per cluster, 4 MiB for a 32-bit tree.
+    struct alignas(veb_detail::CACHE_LINE_BYTES) Slot
+    {
+        veb_detail::SeqVersion version;
+        std::atomic<Cluster *> cluster{nullptr};
+    };
+
+    [[nodiscard]] static std::pair<ClusterKey, ClusterKey>
+    split(Key key) noexcept
+    {
+        return {
+            static_cast<ClusterKey>(key >> CLUSTER_BITS),
+            static_cast<ClusterKey>(key & Cluster::MAX_KEY)};
+    }
+
+    [[nodiscard]] static Key combine(ClusterKey hi, ClusterKey lo) noexcept
+    {
+        return static_cast<Key>((Key(hi) << CLUSTER_BITS) | lo);
+    }
+
+    // Runs `read` on the slot's cluster until no writer interferes. A
+    // missing cluster reads as a default result.
+    template <class Read>
+    [[nodiscard]] auto read_cluster(Slot const &slot, Read &&read) const
+        noexcept -> std::invoke_result_t<Read &, Cluster const &>
+    {
+        for (;;) {
+            uint64_t v = slot.version.read_begin();
+            Cluster const *cluster =
+                slot.cluster.load(std::memory_order_acquire);
+            auto result = cluster
+                              ? read(*cluster)
+                              : std::invoke_result_t<Read &, Cluster const &>{};
+            if (slot.version.read_validate(v)) {
+                return result;
+            }
+        }
+    }
+
+    // Min of the first non-empty cluster from `hi` up, following the
+    // summary. The caller validates the summary version.
+    [[nodiscard]] std::optional<Key>
+    first_after(std::optional<ClusterKey> hi) const noexcept
+    {
+        for (; hi; hi = summary_.successor(*hi)) {
+            auto lo = read_cluster(
+                slots_[*hi], [](Cluster const &c) { return c.min(); });
+            if (lo) {
+                return combine(*hi, *lo);
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<Key>
+    last_before(std::optional<ClusterKey> hi) const noexcept
+    {
+        for (; hi; hi = summary_.predecessor(*hi)) {
+            auto lo = read_cluster(
+                slots_[*hi], [](Cluster const &c) { return c.max(); });
+            if (lo) {
+                return combine(*hi, *lo);
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::unique_ptr<Slot[]> slots_;
+    veb_detail::SeqVersion summary_version_;
+    Cluster summary_;
+    veb_detail::EpochDomain epochs_;
+    veb_detail::EpochPool<Cluster> pool_{epochs_};
+};
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+namespace veb_detail
+{
+
+    // Snapshots store a tree structurally as a stream of 64-bit words in
+    // native byte order, so they are meant to be read back on the machine
+    // type that wrote them:
+    //
+    //   header: SNAPSHOT_MAGIC, SNAPSHOT_VERSION, tree bits, layout tag,
+    //           key count
+    //   node:   its summary, then one entry per cluster in ascending order
+    //   entry:  INLINE_ENTRY | value for a single-key cluster, otherwise
+    //           CHILD_ENTRY followed by the child node
+    //   leaf:   its raw bitmap words
+    //
+    // An empty tree is a header alone; every node below the root holds at
+    // least one key. The layout tag is the root's SNAPSHOT_LAYOUT: trees
+    // of one width whose nodes encode differently (flat summaries) must
+    // not read each other's snapshots.
+
+    // "PARVEB01" read as a little-endian word.
+    inline constexpr uint64_t SNAPSHOT_MAGIC = 0x3130424556524150;
+    inline constexpr uint64_t SNAPSHOT_VERSION = 2;
+    inline constexpr uint64_t INLINE_ENTRY = uint64_t{1} << 63;
+    inline constexpr uint64_t CHILD_ENTRY = 0;
+
+    [[noreturn]] inline void snapshot_error(char const *what)
+    {
+        throw std::runtime_error(std::string("veb snapshot: ") + what);
+    }
+
+    // Buffered word output over a std::ostream. Words reach the stream on
+    // flush() or when the buffer fills.
+    class WordWriter
+    {
+    public:
+        explicit WordWriter(std::ostream &out) noexcept : out_(out) {}
+
+        WordWriter(WordWriter const &) = delete;
+        WordWriter &operator=(WordWriter const &) = delete;
+
+        void write(uint64_t word)
+        {
+            if (used_ == buffer_.size()) {
+                flush();
+            }
+            buffer_[used_++] = word;
+        }
+
+        void write_words(std::span<uint64_t const> words)
+        {
+            for (uint64_t word : words) {
+                write(word);
+            }
+        }
+
+        void flush()
+        {
+            out_.write(
+                reinterpret_cast<char const *>(buffer_.data()),
+                static_cast<std::streamsize>(used_ * sizeof(uint64_t)));
+            used_ = 0;
+            if (!out_) {
+                snapshot_error("write failed");
+            }
+        }
+
+    private:
+        std::ostream &out_;
+        std::array<uint64_t, 4096> buffer_;
+        std::size_t used_ = 0;
+    };
+
+    // Buffered word input over a std::istream. Running out of words is an
+    // error: a snapshot's structure says exactly how many follow. Each
+    // refill copies only what the stream's own buffer already holds, so
+    // finish() can hand the unused words back with sungetc() and a
+    // snapshot can sit inside a longer stream, even one that cannot seek.
+    class WordReader
+    {
+    public:
+        explicit WordReader(std::istream &in) noexcept
+            : in_(in), buf_(in.rdbuf())
+        {
+        }
+
+        WordReader(WordReader const &) = delete;
+        WordReader &operator=(WordReader const &) = delete;
+
+        [[nodiscard]] uint64_t read()
+        {
+            if (next_ == used_) {
+                refill();
+            }
+            return buffer_[next_++];
+        }
+
+        void read_words(std::span<uint64_t> words)
+        {
+            for (uint64_t &word : words) {
+                word = read();
+            }
+        }
+
+        // Returns the words read ahead but not used to the stream.
+        void finish()
+        {
+            std::size_t unread = (used_ - next_) * sizeof(uint64_t);
+            used_ = next_ = 0;
+            for (; unread != 0; --unread) {
+                if (buf_->sungetc() == std::char_traits<char>::eof()) {
+                    break;
+                }
+            }
+            if (unread != 0) {
+                // A stream without a get area; seeking is the only way.
+                in_.clear();
+                in_.seekg(-static_cast<std::streamoff>(unread), std::ios::cur);
+                if (!in_) {
+                    snapshot_error("cannot return unread input");
+                }
+            }
+        }
+
+    private:
+        void refill()
+        {
+            using Traits = std::char_traits<char>;
+            // sgetc() fills the stream's buffer if it is empty, after which
+            // in_avail() is the number of bytes in it.
+            if (!buf_ || buf_->sgetc() == Traits::eof()) {
+                fail();
+            }
+            auto bytes = std::min(
+                static_cast<std::size_t>(
+                    std::max<std::streamsize>(0, buf_->in_avail())),
+                sizeof(buffer_));
+            bytes -= bytes % sizeof(uint64_t);
+            if (bytes == 0) {
+                // A word split across two of the stream's blocks; it is
+                // used at once, so nothing read past it needs handing back.
+                bytes = sizeof(uint64_t);
+            }
+            auto got = static_cast<std::size_t>(buf_->sgetn(
+                reinterpret_cast<char *>(buffer_.data()),
+                static_cast<std::streamsize>(bytes)));
+            if (got != bytes) {
+                fail();
+            }
+            used_ = bytes / sizeof(uint64_t);
+            next_ = 0;
+        }
+
+        [[noreturn]] void fail()
+        {
+            in_.setstate(std::ios::eofbit | std::ios::failbit);
+            snapshot_error("truncated input");
+        }
+
+        std::istream &in_;
+        std::streambuf *buf_;
+        std::array<uint64_t, 4096> buffer_;
+        std::size_t used_ = 0;
+        std::size_t next_ = 0;
+    };
+
+    // Writes `root` as a complete snapshot.
+    template <class Root>
+    void save_snapshot(Root const &root, std::ostream &out)
+    {
+        WordWriter writer(out);
+        writer.write(SNAPSHOT_MAGIC);
+        writer.write(SNAPSHOT_VERSION);
+        writer.write(Root::SUBTREE_BITS);
+        writer.write(Root::SNAPSHOT_LAYOUT);
+        writer.write(root.size());
+        if (!root.empty()) {
+            root.save(writer);
+        }
+        writer.flush();
+    }
+
+    // Fills the empty `root` from a snapshot written by save_snapshot for
+    // the same tree width and layout.
+    template <class Root>
+    void load_snapshot(Root &root, std::istream &in)
+    {
+        WordReader reader(in);
+        if (reader.read() != SNAPSHOT_MAGIC) {
+            snapshot_error("not a snapshot");
+        }
+        if (reader.read() != SNAPSHOT_VERSION) {
+            snapshot_error("unsupported version");
+        }
+        if (reader.read() != Root::SUBTREE_BITS) {
+            snapshot_error("written for a different tree width");
+        }
+        if (reader.read() != Root::SNAPSHOT_LAYOUT) {
+            snapshot_error("written for a different node layout");
+        }
+        uint64_t count = reader.read();
+        if (count != 0) {
+            root.load(reader);
+        }
+        reader.finish();
+        if (root.size() != count) {
+            snapshot_error("key count does not match the header");
+        }
+    }
+
+} // namespace veb_detail
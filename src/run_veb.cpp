@@ -1,36 +1,96 @@
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <random>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 #include "veb24.hpp"
 #include "veb32.hpp"
 #include "veb48.hpp"
 #include "veb64.hpp"
+#include "veb_concurrent.hpp"
+#include "veb_optimistic.hpp"
 
 namespace
 {
 
+    enum class RunMode
+    {
+        Insert,
+        Batch,
+        Parallel,
+        Build,
+        Alloc,
+        Snapshot,
+        Concurrent,
+        Readers,
+        Queries
+    };
+
     struct RunOptions
     {
         std::uint64_t num_inserts = 10'000'000ULL;
         int trials = 5;
         std::uint64_t seed = 0;
         unsigned bits = 48;
+        RunMode mode = RunMode::Insert;
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        unsigned write_percent = 10;
     };
 
+    std::string_view to_string(RunMode mode)
+    {
+        switch (mode) {
+        case RunMode::Insert:
+            return "insert";
+        case RunMode::Batch:
+            return "batch";
+        case RunMode::Parallel:
+            return "parallel";
+        case RunMode::Build:
+            return "build";
+        case RunMode::Alloc:
+            return "alloc";
+        case RunMode::Snapshot:
+            return "snapshot";
+        case RunMode::Concurrent:
+            return "concurrent";
+        case RunMode::Readers:
+            return "readers";
+        case RunMode::Queries:
+            return "queries";
+        }
+        return "unknown";
+    }
+
     void print_usage()
     {
         std::cerr << "Usage: run_veb [--num_inserts=N] [--trials=T] [--seed=S] "
-                     "[--bits=24|32|48|64]\n";
+                     "[--bits=24|32|48|64] "
+                     "[--mode=insert|batch|parallel|build|alloc|snapshot|"
+                     "concurrent|readers|queries] "
+                     "[--threads=N] [--write_percent=P]\n";
     }
 
     RunOptions parse_options(int argc, char **argv)
@@ -76,6 +136,53 @@ namespace
                     throw std::invalid_argument("bits must be 48 or 64");
                 }
             }
+            else if (arg.rfind("--mode=", 0) == 0) {
+                std::string value(
+                    arg.substr(std::string_view("--mode=").size()));
+                if (value == "insert") {
+                    opts.mode = RunMode::Insert;
+                }
+                else if (value == "batch") {
+                    opts.mode = RunMode::Batch;
+                }
+                else if (value == "parallel") {
+                    opts.mode = RunMode::Parallel;
+                }
+                else if (value == "build") {
+                    opts.mode = RunMode::Build;
+                }
+                else if (value == "alloc") {
+                    opts.mode = RunMode::Alloc;
+                }
+                else if (value == "snapshot") {
+                    opts.mode = RunMode::Snapshot;
+                }
+                else if (value == "concurrent") {
+                    opts.mode = RunMode::Concurrent;
+                }
+                else if (value == "readers") {
+                    opts.mode = RunMode::Readers;
+                }
+                else if (value == "queries") {
+                    opts.mode = RunMode::Queries;
+                }
+                else {
+                    throw std::invalid_argument(
+                        "mode must be insert, batch, parallel, build, "
+                        "alloc, snapshot, concurrent, readers or queries");
+                }
+            }
+            else if (arg.rfind("--threads=", 0) == 0) {
+                std::string value(
+                    arg.substr(std::string_view("--threads=").size()));
+                opts.threads = static_cast<unsigned>(std::stoul(value));
+            }
+            else if (arg.rfind("--write_percent=", 0) == 0) {
+                std::string value(
+                    arg.substr(std::string_view("--write_percent=").size()));
+                opts.write_percent =
+                    static_cast<unsigned>(std::stoul(value));
+            }
             else {
                 throw std::invalid_argument(
                     "Unknown argument: " + std::string(arg));
@@ -96,10 +203,19 @@ namespace
             throw std::invalid_argument(
                 "num_inserts must fit in 32-bit buffer");
         }
+        if (opts.threads == 0) {
+            throw std::invalid_argument("threads must be positive");
+        }
+        if (opts.write_percent > 100) {
+            throw std::invalid_argument("write_percent must be at most 100");
+        }
         if (opts.bits != 24 && opts.bits != 32 && opts.bits != 48 &&
             opts.bits != 64) {
             throw std::invalid_argument("bits must be 24, 32, 48 or 64");
         }
+        if (opts.mode == RunMode::Readers && opts.bits > 32) {
+            throw std::invalid_argument("readers mode needs bits 24 or 32");
+        }
 
         return opts;
     }
@@ -138,6 +254,536 @@ namespace
         }
     }
 
+    template <class Tree, class KeyT>
+    void run_batch_trials(
+        Tree &&, int trials, std::vector<KeyT> const &keys, double gen_secs)
+    {
+        std::vector<typename Tree::Key> tree_keys(keys.begin(), keys.end());
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials << "\n";
+            Tree serial;
+            auto insert_start = std::chrono::steady_clock::now();
+            for (auto key : tree_keys) {
+                serial.insert(key);
+            }
+            auto insert_end = std::chrono::steady_clock::now();
+
+            Tree batched;
+            auto batch_start = std::chrono::steady_clock::now();
+            batched.batch_insert(tree_keys);
+            auto batch_end = std::chrono::steady_clock::now();
+
+            double insert_secs = seconds_between(insert_start, insert_end);
+            double batch_secs = seconds_between(batch_start, batch_end);
+
+            std::cout << "insert=" << insert_secs
+                      << "s batch_insert=" << batch_secs
+                      << "s speedup=" << insert_secs / batch_secs
+                      << "x (generate once: " << gen_secs << "s)\n";
+
+            if (serial.to_vector() != batched.to_vector()) {
+                std::cerr << "Warning: batch_insert result differs from "
+                             "per-key insert\n";
+            }
+        }
+    }
+
+    // Times parallel_insert at doubling thread counts up to `max_threads`
+    // and reports the speedup over the single-threaded run.
+    template <class Tree, class KeyT>
+    void run_parallel_trials(
+        Tree &&, int trials, unsigned max_threads,
+        std::vector<KeyT> const &keys, double gen_secs)
+    {
+        std::vector<typename Tree::Key> tree_keys(keys.begin(), keys.end());
+        std::vector<unsigned> thread_counts;
+        for (unsigned t = 1; t < max_threads; t *= 2) {
+            thread_counts.push_back(t);
+        }
+        thread_counts.push_back(max_threads);
+
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials
+                      << " (generate once: " << gen_secs << "s)\n";
+            double base_secs = 0.0;
+            std::vector<typename Tree::Key> reference;
+            for (unsigned threads : thread_counts) {
+                Tree tree;
+                auto start = std::chrono::steady_clock::now();
+                tree.parallel_insert(tree_keys, threads);
+                auto end = std::chrono::steady_clock::now();
+                double secs = seconds_between(start, end);
+                if (threads == 1) {
+                    base_secs = secs;
+                    reference = tree.to_vector();
+                }
+                else if (threads == max_threads &&
+                         tree.to_vector() != reference) {
+                    std::cerr << "Warning: parallel_insert result differs "
+                                 "from the single-threaded run\n";
+                }
+                std::cout << "threads=" << threads
+                          << " parallel_insert=" << secs
+                          << "s speedup=" << base_secs / secs << "x\n";
+            }
+        }
+    }
+
+    // Compares inserting sorted keys one at a time with from_sorted. Keys
+    // are sorted and deduplicated once, outside the timed region.
+    template <class Tree, class KeyT>
+    void run_build_trials(
+        Tree &&, int trials, std::vector<KeyT> const &keys, double gen_secs)
+    {
+        std::vector<typename Tree::Key> sorted(keys.begin(), keys.end());
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials << "\n";
+            Tree serial;
+            auto insert_start = std::chrono::steady_clock::now();
+            for (auto key : sorted) {
+                serial.insert(key);
+            }
+            auto insert_end = std::chrono::steady_clock::now();
+
+            auto build_start = std::chrono::steady_clock::now();
+            auto built = Tree::from_sorted(sorted);
+            auto build_end = std::chrono::steady_clock::now();
+
+            double insert_secs = seconds_between(insert_start, insert_end);
+            double build_secs = seconds_between(build_start, build_end);
+
+            std::cout << "sorted_insert=" << insert_secs
+                      << "s from_sorted=" << build_secs
+                      << "s speedup=" << insert_secs / build_secs
+                      << "x (generate once: " << gen_secs << "s)\n";
+
+            if (serial.to_vector() != built.to_vector()) {
+                std::cerr << "Warning: from_sorted result differs from "
+                             "per-key insert\n";
+            }
+        }
+    }
+
+    // Resident set size in bytes, or 0 where /proc is unavailable.
+    std::size_t resident_bytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::size_t pages = 0;
+        std::size_t resident = 0;
+        if (!(statm >> pages >> resident)) {
+            return 0;
+        }
+        return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    // Hands freed heap memory back to the OS so the next RSS reading is
+    // not flattered by pages the previous tree left behind.
+    void trim_heap()
+    {
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+    }
+
+    // Per-key insert into a root of type `Node`, then its destruction.
+    template <class Node, class KeyT>
+    void run_alloc_policy(
+        std::string_view name, std::vector<KeyT> const &keys)
+    {
+        trim_heap();
+        std::size_t rss_before = resident_bytes();
+        std::optional<Node> tree(std::in_place);
+        auto insert_start = std::chrono::steady_clock::now();
+        for (auto key : keys) {
+            tree->insert(static_cast<typename Node::Key>(key));
+        }
+        auto insert_end = std::chrono::steady_clock::now();
+        std::size_t rss_after = resident_bytes();
+        std::size_t size = tree->size();
+
+        auto teardown_start = std::chrono::steady_clock::now();
+        tree.reset();
+        auto teardown_end = std::chrono::steady_clock::now();
+
+        double insert_secs = seconds_between(insert_start, insert_end);
+        double rss_mib =
+            static_cast<double>(rss_after - std::min(rss_after, rss_before)) /
+            (1024.0 * 1024.0);
+        std::cout << name << ": insert=" << insert_secs << "s ("
+                  << static_cast<double>(keys.size()) / insert_secs / 1e6
+                  << " Mkeys/s) rss=" << rss_mib << "MiB ("
+                  << rss_mib * 1024.0 * 1024.0 / static_cast<double>(size)
+                  << " B/key) teardown="
+                  << seconds_between(teardown_start, teardown_end) << "s\n";
+    }
+
+    // Heap bytes in use, or 0 where the allocator cannot say.
+    std::size_t heap_in_use()
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+#else
+        return 0;
+#endif
+    }
+
+    // Heap held by a root of type `Node` holding the first `count` keys.
+    // Small trees are where a fixed per-pool slab would dominate.
+    template <class Node, class KeyT>
+    void report_small_tree(
+        std::string_view name, std::vector<KeyT> const &keys, std::size_t count)
+    {
+        std::size_t before = heap_in_use();
+        std::optional<Node> tree(std::in_place);
+        for (std::size_t i = 0; i < std::min(count, keys.size()); ++i) {
+            tree->insert(static_cast<typename Node::Key>(keys[i]));
+        }
+        std::size_t after = heap_in_use();
+        std::cout << name << ": " << tree->size()
+                  << "-key tree heap=" << after - std::min(after, before)
+                  << "B\n";
+    }
+
+    // Compares the default slab-backed node pools with one heap
+    // allocation per node.
+    template <unsigned Bits, class KeyT>
+    void run_alloc_trials(
+        int trials, std::vector<KeyT> const &keys, double gen_secs)
+    {
+        constexpr bool SPARSE = veb_detail::default_sparse_storage<Bits>();
+        using SlabTree = VebBranch<Bits, SPARSE, veb_detail::SlabNodes>;
+        using HeapTree = VebBranch<Bits, SPARSE, veb_detail::HeapNodes>;
+        for (std::size_t count : {std::size_t{10}, std::size_t{1000}}) {
+            report_small_tree<SlabTree>("slab", keys, count);
+            report_small_tree<HeapTree>("heap", keys, count);
+        }
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials
+                      << " (generate once: " << gen_secs << "s)\n";
+            run_alloc_policy<SlabTree>("slab", keys);
+            run_alloc_policy<HeapTree>("heap", keys);
+        }
+    }
+
+    // Times a save/load round trip through a file against rebuilding the
+    // same tree by per-key insert.
+    template <class Tree, class KeyT>
+    void run_snapshot_trials(
+        Tree &&, int trials, std::vector<KeyT> const &keys, double gen_secs)
+    {
+        using TreeT = std::remove_cvref_t<Tree>;
+        auto path =
+            std::filesystem::temp_directory_path() / "run_veb_snapshot.bin";
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials << "\n";
+            TreeT tree;
+            auto insert_start = std::chrono::steady_clock::now();
+            for (auto key : keys) {
+                tree.insert(static_cast<typename TreeT::Key>(key));
+            }
+            auto insert_end = std::chrono::steady_clock::now();
+
+            auto save_start = std::chrono::steady_clock::now();
+            {
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                tree.save(out);
+            }
+            auto save_end = std::chrono::steady_clock::now();
+
+            auto load_start = std::chrono::steady_clock::now();
+            std::ifstream in(path, std::ios::binary);
+            auto loaded = TreeT::load(in);
+            auto load_end = std::chrono::steady_clock::now();
+
+            double insert_secs = seconds_between(insert_start, insert_end);
+            double load_secs = seconds_between(load_start, load_end);
+            auto file_bytes = std::filesystem::file_size(path);
+
+            std::cout << "insert=" << insert_secs
+                      << "s save=" << seconds_between(save_start, save_end)
+                      << "s load=" << load_secs
+                      << "s speedup=" << insert_secs / load_secs
+                      << "x (generate once: " << gen_secs << "s)\n";
+            std::cout << "snapshot=" << file_bytes << " bytes ("
+                      << static_cast<double>(file_bytes) /
+                             static_cast<double>(tree.size())
+                      << " B/key)\n";
+
+            if (tree.to_vector() != loaded.to_vector()) {
+                std::cerr << "Warning: reloaded tree differs from the "
+                             "saved one\n";
+            }
+        }
+        std::filesystem::remove(path);
+    }
+
+    // The baseline for the concurrent mode: one tree behind one mutex.
+    template <class Tree>
+    class LockedTree
+    {
+    public:
+        using Key = typename Tree::Key;
+
+        void insert(Key key)
+        {
+            std::lock_guard lock(mutex_);
+            tree_.insert(key);
+        }
+
+        void erase(Key key)
+        {
+            std::lock_guard lock(mutex_);
+            tree_.erase(key);
+        }
+
+        std::optional<Key> successor(Key key)
+        {
+            std::lock_guard lock(mutex_);
+            return tree_.successor(key);
+        }
+
+    private:
+        std::mutex mutex_;
+        Tree tree_;
+    };
+
+    // Runs one pass over `keys` split across `threads` threads and returns
+    // throughput in Mops/s. `write_percent` of operations insert or erase;
+    // the rest are successor queries.
+    template <class Set, class KeyT>
+    double run_mixed_ops(
+        Set &set, std::vector<KeyT> const &keys, unsigned threads,
+        unsigned write_percent)
+    {
+        using Key = typename Set::Key;
+        std::atomic<std::size_t> hits{0};
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::size_t found = 0;
+                for (std::size_t i = t; i < keys.size(); i += threads) {
+                    auto key = static_cast<Key>(keys[i]);
+                    if (i % 100 < write_percent) {
+                        if (i & 1) {
+                            set.insert(key);
+                        }
+                        else {
+                            set.erase(key);
+                        }
+                    }
+                    else {
+                        found += set.successor(key).has_value();
+                    }
+                }
+                hits.fetch_add(found, std::memory_order_relaxed);
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+        return static_cast<double>(keys.size()) / seconds_between(start, end) /
+               1e6;
+    }
+
+    // Compares ConcurrentVebTree with a single mutex around a VebTreeNN on
+    // a mixed read/write workload at doubling thread counts. Both start
+    // from every other key already inserted.
+    template <class Tree, class KeyT>
+    void run_concurrent_trials(
+        Tree &&, int trials, unsigned max_threads, unsigned write_percent,
+        std::vector<KeyT> const &keys, double gen_secs)
+    {
+        using TreeT = std::remove_cvref_t<Tree>;
+        using Key = typename TreeT::Key;
+        constexpr auto BITS = static_cast<unsigned>(
+            std::bit_width(std::uint64_t{TreeT::MAX_KEY}));
+        std::vector<unsigned> thread_counts;
+        for (unsigned t = 1; t < max_threads; t *= 2) {
+            thread_counts.push_back(t);
+        }
+        thread_counts.push_back(max_threads);
+
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials
+                      << " (generate once: " << gen_secs
+                      << "s, writes=" << write_percent << "%)\n";
+            for (unsigned threads : thread_counts) {
+                ConcurrentVebTree<BITS> sharded;
+                LockedTree<TreeT> locked;
+                for (std::size_t i = 0; i < keys.size(); i += 2) {
+                    sharded.insert(static_cast<Key>(keys[i]));
+                    locked.insert(static_cast<Key>(keys[i]));
+                }
+                double sharded_mops =
+                    run_mixed_ops(sharded, keys, threads, write_percent);
+                double locked_mops =
+                    run_mixed_ops(locked, keys, threads, write_percent);
+                std::cout << "threads=" << threads
+                          << " sharded=" << sharded_mops
+                          << "Mops/s locked=" << locked_mops
+                          << "Mops/s ratio=" << sharded_mops / locked_mops
+                          << "x\n";
+            }
+        }
+    }
+
+    // Read-mostly scaling: OptimisticVebTree (readers validate versions
+    // and take no lock) against ConcurrentVebTree (readers take a shared
+    // lock) and a single mutex, at doubling thread counts.
+    template <class Tree, class KeyT>
+    void run_reader_trials(
+        Tree &&, int trials, unsigned max_threads, unsigned write_percent,
+        std::vector<KeyT> const &keys, double gen_secs)
+    {
+        using TreeT = std::remove_cvref_t<Tree>;
+        using Key = typename TreeT::Key;
+        constexpr unsigned BITS = TreeT::SUBTREE_BITS;
+        std::vector<unsigned> thread_counts;
+        for (unsigned t = 1; t < max_threads; t *= 2) {
+            thread_counts.push_back(t);
+        }
+        thread_counts.push_back(max_threads);
+
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials
+                      << " (generate once: " << gen_secs
+                      << "s, writes=" << write_percent << "%)\n";
+            for (unsigned threads : thread_counts) {
+                OptimisticVebTree<BITS> optimistic;
+                ConcurrentVebTree<BITS> sharded;
+                LockedTree<TreeT> locked;
+                for (std::size_t i = 0; i < keys.size(); i += 2) {
+                    optimistic.insert(static_cast<Key>(keys[i]));
+                    sharded.insert(static_cast<Key>(keys[i]));
+                    locked.insert(static_cast<Key>(keys[i]));
+                }
+                double optimistic_mops =
+                    run_mixed_ops(optimistic, keys, threads, write_percent);
+                double sharded_mops =
+                    run_mixed_ops(sharded, keys, threads, write_percent);
+                double locked_mops =
+                    run_mixed_ops(locked, keys, threads, write_percent);
+                std::cout << "threads=" << threads
+                          << " optimistic=" << optimistic_mops
+                          << "Mops/s sharded=" << sharded_mops
+                          << "Mops/s locked=" << locked_mops << "Mops/s\n";
+            }
+        }
+    }
+
+    // Per-operation query cost on a tree built from `keys`. Each query
+    // probes a key's neighbour, which is usually absent, so successor and
+    // predecessor end in the leaf scans at the bottom of the tree.
+    template <class Tree, class KeyT>
+    void run_query_trials(
+        Tree &&, int trials, std::vector<KeyT> const &keys, double gen_secs)
+    {
+        using TreeT = std::remove_cvref_t<Tree>;
+        using Key = typename TreeT::Key;
+        TreeT tree;
+        std::vector<Key> probes;
+        probes.reserve(keys.size());
+        for (auto key : keys) {
+            tree.insert(static_cast<Key>(key));
+            probes.push_back(static_cast<Key>((key + 1) & TreeT::MAX_KEY));
+        }
+        // Printed so the compiler cannot drop the queries.
+        std::uint64_t checksum = 0;
+        auto per_op_ns = [&](auto &&query) {
+            auto start = std::chrono::steady_clock::now();
+            for (Key probe : probes) {
+                checksum += query(probe);
+            }
+            auto end = std::chrono::steady_clock::now();
+            return seconds_between(start, end) * 1e9 /
+                   static_cast<double>(probes.size());
+        };
+        for (int trial = 1; trial <= trials; ++trial) {
+            std::cout << "\nTrial " << trial << "/" << trials
+                      << " (generate once: " << gen_secs << "s)\n";
+            double contains_ns = per_op_ns([&](Key k) -> std::uint64_t {
+                return tree.contains(k);
+            });
+            double successor_ns = per_op_ns([&](Key k) -> std::uint64_t {
+                return tree.successor(k).value_or(0);
+            });
+            double predecessor_ns = per_op_ns([&](Key k) -> std::uint64_t {
+                return tree.predecessor(k).value_or(0);
+            });
+            std::cout << "contains=" << contains_ns
+                      << "ns successor=" << successor_ns
+                      << "ns predecessor=" << predecessor_ns
+                      << "ns checksum=" << checksum << "\n";
+        }
+    }
+
+    template <class Tree, class KeyT>
+    void run_mode(
+        Tree &&tree, RunOptions const &opts, std::vector<KeyT> const &keys,
+        double gen_secs)
+    {
+        switch (opts.mode) {
+        case RunMode::Insert:
+            run_trials(std::forward<Tree>(tree), opts.trials, keys, gen_secs);
+            break;
+        case RunMode::Batch:
+            run_batch_trials(
+                std::forward<Tree>(tree), opts.trials, keys, gen_secs);
+            break;
+        case RunMode::Parallel:
+            run_parallel_trials(
+                std::forward<Tree>(tree),
+                opts.trials,
+                opts.threads,
+                keys,
+                gen_secs);
+            break;
+        case RunMode::Build:
+            run_build_trials(
+                std::forward<Tree>(tree), opts.trials, keys, gen_secs);
+            break;
+        case RunMode::Alloc: {
+            constexpr auto BITS = static_cast<unsigned>(std::bit_width(
+                std::uint64_t{std::remove_cvref_t<Tree>::MAX_KEY}));
+            run_alloc_trials<BITS>(opts.trials, keys, gen_secs);
+            break;
+        }
+        case RunMode::Snapshot:
+            run_snapshot_trials(
+                std::forward<Tree>(tree), opts.trials, keys, gen_secs);
+            break;
+        case RunMode::Concurrent:
+            run_concurrent_trials(
+                std::forward<Tree>(tree),
+                opts.trials,
+                opts.threads,
+                opts.write_percent,
+                keys,
+                gen_secs);
+            break;
+        case RunMode::Readers:
+            if constexpr (std::remove_cvref_t<Tree>::SUBTREE_BITS <= 32) {
+                run_reader_trials(
+                    std::forward<Tree>(tree),
+                    opts.trials,
+                    opts.threads,
+                    opts.write_percent,
+                    keys,
+                    gen_secs);
+            }
+            break;
+        case RunMode::Queries:
+            run_query_trials(
+                std::forward<Tree>(tree), opts.trials, keys, gen_secs);
+            break;
+        }
+    }
+
 } // namespace
 
 int main(int argc, char **argv)
@@ -158,6 +804,8 @@ int main(int argc, char **argv)
     std::cout << "seed=" << opts.seed
               << " (uniform draw reused across trials)\n";
     std::cout << "bits=" << opts.bits << "\n";
+    std::cout << "mode=" << to_string(opts.mode) << " threads=" << opts.threads
+              << "\n";
     std::cout << std::fixed << std::setprecision(3);
 
     std::mt19937_64 rng(opts.seed);
@@ -175,7 +823,7 @@ int main(int argc, char **argv)
         auto gen_end = std::chrono::steady_clock::now();
         double gen_secs = seconds_between(gen_start, gen_end);
         std::cout << "generate_uniform=" << gen_secs << "s\n";
-        run_trials(VebTree24{}, opts.trials, keys, gen_secs);
+        run_mode(VebTree24{}, opts, keys, gen_secs);
         break;
     }
     case 32: {
@@ -189,7 +837,7 @@ int main(int argc, char **argv)
         auto gen_end = std::chrono::steady_clock::now();
         double gen_secs = seconds_between(gen_start, gen_end);
         std::cout << "generate_uniform=" << gen_secs << "s\n";
-        run_trials(VebTree32{}, opts.trials, keys, gen_secs);
+        run_mode(VebTree32{}, opts, keys, gen_secs);
         break;
     }
     case 48: {
@@ -203,7 +851,7 @@ int main(int argc, char **argv)
         auto gen_end = std::chrono::steady_clock::now();
         double gen_secs = seconds_between(gen_start, gen_end);
         std::cout << "generate_uniform=" << gen_secs << "s\n";
-        run_trials(VebTree48{}, opts.trials, keys, gen_secs);
+        run_mode(VebTree48{}, opts, keys, gen_secs);
         break;
     }
     case 64: {
@@ -217,7 +865,7 @@ int main(int argc, char **argv)
         auto gen_end = std::chrono::steady_clock::now();
         double gen_secs = seconds_between(gen_start, gen_end);
         std::cout << "generate_uniform=" << gen_secs << "s\n";
-        run_trials(VebTree64{}, opts.trials, keys, gen_secs);
+        run_mode(VebTree64{}, opts, keys, gen_secs);
         break;
     }
     default:
@@ -1,6 +1,8 @@
 #include "simd_utils.hpp"
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <optional>
 #include <span>
 
@@ -23,12 +25,18 @@ namespace
     {
         Scalar,
         SSE2,
-        AVX2
+        AVX2,
+        AVX512
     };
 
     Mode detect_mode() noexcept
     {
 #if PARVEB_HAS_X86 && defined(__GNUC__)
+        if (__builtin_cpu_supports("avx512f") &&
+            __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("avx512vbmi2")) {
+            return Mode::AVX512;
+        }
         if (__builtin_cpu_supports("avx2")) {
             return Mode::AVX2;
         }
@@ -70,15 +78,147 @@ namespace
         return std::nullopt;
     }
 
+    std::size_t scalar_set_bit_positions(
+        std::span<uint64_t const> words, uint16_t *out) noexcept
+    {
+        uint16_t *start = out;
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+                *out++ = static_cast<uint16_t>(
+                    i * 64 + static_cast<unsigned>(std::countr_zero(word)));
+            }
+        }
+        return static_cast<std::size_t>(out - start);
+    }
+
 #if PARVEB_HAS_X86 && (defined(__GNUC__) || defined(__clang__))
+    #define PARVEB_TARGET_AVX512                                               \
+        __attribute__((target("avx512f,avx512bw,avx512vbmi2")))
     #define PARVEB_TARGET_AVX2 __attribute__((target("avx2")))
     #define PARVEB_TARGET_SSE2 __attribute__((target("sse2")))
 #else
+    #define PARVEB_TARGET_AVX512
     #define PARVEB_TARGET_AVX2
     #define PARVEB_TARGET_SSE2
 #endif
 
 #if PARVEB_HAS_X86
+    // Words [i, i + 8) clipped to the end of `words`; lanes past the end
+    // read as zero.
+    PARVEB_TARGET_AVX512 __mmask8
+    avx512_nonzero_lanes(std::span<uint64_t const> words, std::size_t i)
+        noexcept
+    {
+        std::size_t left = words.size() - i;
+        auto lanes = static_cast<__mmask8>(
+            left >= 8 ? 0xFF : (1u << left) - 1);
+        __m512i chunk = _mm512_maskz_loadu_epi64(lanes, words.data() + i);
+        return _mm512_test_epi64_mask(chunk, chunk);
+    }
+
+    PARVEB_TARGET_AVX512 std::optional<std::size_t>
+    avx512_find_next(std::span<uint64_t const> words, std::size_t start)
+        noexcept
+    {
+        for (std::size_t i = start; i < words.size(); i += 8) {
+            if (unsigned live = avx512_nonzero_lanes(words, i)) {
+                return i + static_cast<std::size_t>(std::countr_zero(live));
+            }
+        }
+        return std::nullopt;
+    }
+
+    PARVEB_TARGET_AVX512 std::optional<std::size_t>
+    avx512_find_prev(std::span<uint64_t const> words, std::size_t start)
+        noexcept
+    {
+        if (start >= words.size()) {
+            start = words.size() - 1;
+        }
+        // Each window ends at `end`; lanes above it are masked off.
+        for (std::size_t end = start + 1; end > 0;) {
+            std::size_t base = end >= 8 ? end - 8 : 0;
+            unsigned live = avx512_nonzero_lanes(words.first(end), base);
+            if (live) {
+                return base + static_cast<std::size_t>(std::bit_width(live)) -
+                       1;
+            }
+            end = base;
+        }
+        return std::nullopt;
+    }
+
+    // Each 32-bit half of a word is expanded with one compress-and-store
+    // of its lane positions.
+    PARVEB_TARGET_AVX512 std::size_t
+    avx512_set_bit_positions(std::span<uint64_t const> words, uint16_t *out)
+        noexcept
+    {
+        __m512i const lanes = _mm512_set_epi16(
+            31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16,
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        uint16_t *start = out;
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            uint64_t word = words[i];
+            if (!word) {
+                continue;
+            }
+            for (unsigned half = 0; half < 2; ++half) {
+                auto mask = static_cast<__mmask32>(word >> (32 * half));
+                __m512i positions = _mm512_add_epi16(
+                    lanes,
+                    _mm512_set1_epi16(static_cast<short>(i * 64 + 32 * half)));
+                _mm512_storeu_si512(
+                    out, _mm512_maskz_compress_epi16(mask, positions));
+                out += std::popcount(static_cast<uint32_t>(mask));
+            }
+        }
+        return static_cast<std::size_t>(out - start);
+    }
+
+    // Positions of the set bits of every byte value, padded to eight
+    // entries so a byte expands with one 16-byte store.
+    struct BytePositions
+    {
+        alignas(16) std::array<std::array<uint16_t, 8>, 256> positions{};
+        std::array<uint8_t, 256> counts{};
+
+        constexpr BytePositions()
+        {
+            for (unsigned byte = 0; byte < 256; ++byte) {
+                unsigned n = 0;
+                for (unsigned bit = 0; bit < 8; ++bit) {
+                    if (byte >> bit & 1) {
+                        positions[byte][n++] = static_cast<uint16_t>(bit);
+                    }
+                }
+                counts[byte] = static_cast<uint8_t>(n);
+            }
+        }
+    };
+
+    constexpr BytePositions BYTE_POSITIONS{};
+
+    PARVEB_TARGET_SSE2 std::size_t
+    sse2_set_bit_positions(std::span<uint64_t const> words, uint16_t *out)
+        noexcept
+    {
+        uint16_t *start = out;
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            uint64_t word = words[i];
+            for (unsigned b = 0; word != 0; ++b, word >>= 8) {
+                auto byte = static_cast<uint8_t>(word);
+                __m128i positions = _mm_add_epi16(
+                    _mm_load_si128(reinterpret_cast<__m128i const *>(
+                        BYTE_POSITIONS.positions[byte].data())),
+                    _mm_set1_epi16(static_cast<short>(i * 64 + b * 8)));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out), positions);
+                out += BYTE_POSITIONS.counts[byte];
+            }
+        }
+        return static_cast<std::size_t>(out - start);
+    }
+
     PARVEB_TARGET_AVX2 std::optional<std::size_t>
     avx2_find_next(std::span<uint64_t const> words, std::size_t start) noexcept
     {
@@ -231,6 +371,74 @@ namespace
     }
 #endif
 
+    enum class WordOp
+    {
+        Or,
+        And,
+        AndNot,
+        Xor
+    };
+
+    template <WordOp Op>
+    uint64_t apply_word(uint64_t dst, uint64_t src) noexcept
+    {
+        if constexpr (Op == WordOp::Or) {
+            return dst | src;
+        }
+        else if constexpr (Op == WordOp::And) {
+            return dst & src;
+        }
+        else if constexpr (Op == WordOp::AndNot) {
+            return dst & ~src;
+        }
+        else {
+            return dst ^ src;
+        }
+    }
+
+    template <WordOp Op>
+    void scalar_apply_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept
+    {
+        for (std::size_t i = 0; i < dst.size(); ++i) {
+            dst[i] = apply_word<Op>(dst[i], src[i]);
+        }
+    }
+
+#if PARVEB_HAS_X86
+    template <WordOp Op>
+    PARVEB_TARGET_AVX2 void
+    avx2_apply_words(std::span<uint64_t> dst, std::span<uint64_t const> src)
+        noexcept
+    {
+        std::size_t i = 0;
+        constexpr std::size_t kStride = 4;
+        for (; i + kStride <= dst.size(); i += kStride) {
+            auto *out = reinterpret_cast<__m256i *>(dst.data() + i);
+            __m256i a = _mm256_loadu_si256(out);
+            __m256i b = _mm256_loadu_si256(
+                reinterpret_cast<__m256i const *>(src.data() + i));
+            __m256i r;
+            if constexpr (Op == WordOp::Or) {
+                r = _mm256_or_si256(a, b);
+            }
+            else if constexpr (Op == WordOp::And) {
+                r = _mm256_and_si256(a, b);
+            }
+            else if constexpr (Op == WordOp::AndNot) {
+                r = _mm256_andnot_si256(b, a);
+            }
+            else {
+                r = _mm256_xor_si256(a, b);
+            }
+            _mm256_storeu_si256(out, r);
+        }
+        for (; i < dst.size(); ++i) {
+            dst[i] = apply_word<Op>(dst[i], src[i]);
+        }
+    }
+#endif
+
     Mode runtime_mode() noexcept
     {
 #if PARVEB_ENABLE_SIMD
@@ -241,6 +449,23 @@ namespace
 #endif
     }
 
+    template <WordOp Op>
+    void apply_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept
+    {
+        switch (runtime_mode()) {
+#if PARVEB_HAS_X86
+        case Mode::AVX512:
+        case Mode::AVX2:
+            avx2_apply_words<Op>(dst, src);
+            return;
+#endif
+        default:
+            scalar_apply_words<Op>(dst, src);
+            return;
+        }
+    }
+
 } // namespace
 
 namespace simd
@@ -254,6 +479,8 @@ namespace simd
         }
         switch (runtime_mode()) {
 #if PARVEB_HAS_X86
+        case Mode::AVX512:
+            return avx512_find_next(words, start_word);
         case Mode::AVX2:
             return avx2_find_next(words, start_word);
         case Mode::SSE2:
@@ -273,6 +500,8 @@ namespace simd
         }
         switch (runtime_mode()) {
 #if PARVEB_HAS_X86
+        case Mode::AVX512:
+            return avx512_find_prev(words, start_word);
         case Mode::AVX2:
             return avx2_find_prev(words, start_word);
         case Mode::SSE2:
@@ -284,4 +513,45 @@ namespace simd
         }
     }
 
+    std::size_t set_bit_positions(
+        std::span<uint64_t const> words, uint16_t *out) noexcept
+    {
+        switch (runtime_mode()) {
+#if PARVEB_HAS_X86
+        case Mode::AVX512:
+            return avx512_set_bit_positions(words, out);
+        case Mode::AVX2:
+        case Mode::SSE2:
+            return sse2_set_bit_positions(words, out);
+#endif
+        case Mode::Scalar:
+        default:
+            return scalar_set_bit_positions(words, out);
+        }
+    }
+
+    void or_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept
+    {
+        apply_words<WordOp::Or>(dst, src);
+    }
+
+    void and_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept
+    {
+        apply_words<WordOp::And>(dst, src);
+    }
+
+    void andnot_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept
+    {
+        apply_words<WordOp::AndNot>(dst, src);
+    }
+
+    void xor_words(
+        std::span<uint64_t> dst, std::span<uint64_t const> src) noexcept
+    {
+        apply_words<WordOp::Xor>(dst, src);
+    }
+
 } // namespace simd
@@ -1,12 +1,15 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <random>
 #include <set>
@@ -58,12 +61,26 @@ namespace
         Bits64
     };
 
+    enum class BenchMode
+    {
+        Compare,
+        BatchQuery,
+        Scan,
+        SetOps,
+        Layout,
+        Summary,
+        Sentinel,
+        Rank
+    };
+
     struct BenchmarkOptions
     {
         DistributionKind distribution = DistributionKind::Uniform;
         double skew = 1.0;
         std::size_t num_inserts = 10'000'000;
         KeyMode key_mode = KeyMode::Bits48;
+        BenchMode mode = BenchMode::Compare;
+        unsigned threads = 0;
     };
 
     template <class Key, unsigned BitCount>
@@ -127,7 +144,10 @@ namespace
         std::cerr << "Usage: veb_benchmark "
                      "[--distribution=uniform|exponential|zipfian] "
                      "[--bits=24|32|48|64] "
-                     "[--skew=value] [--num_inserts=N]\n";
+                     "[--skew=value] [--num_inserts=N] "
+                     "[--mode=compare|batch_query|scan|set_ops|layout|summary|"
+                     "sentinel|rank] "
+                     "[--threads=N]\n";
     }
 
     DistributionKind parse_distribution(std::string_view value)
@@ -161,6 +181,35 @@ namespace
         throw std::runtime_error("unknown bit width: " + std::string(value));
     }
 
+    BenchMode parse_mode(std::string_view value)
+    {
+        if (value == "compare") {
+            return BenchMode::Compare;
+        }
+        if (value == "batch_query") {
+            return BenchMode::BatchQuery;
+        }
+        if (value == "scan") {
+            return BenchMode::Scan;
+        }
+        if (value == "set_ops") {
+            return BenchMode::SetOps;
+        }
+        if (value == "layout") {
+            return BenchMode::Layout;
+        }
+        if (value == "summary") {
+            return BenchMode::Summary;
+        }
+        if (value == "sentinel") {
+            return BenchMode::Sentinel;
+        }
+        if (value == "rank") {
+            return BenchMode::Rank;
+        }
+        throw std::runtime_error("unknown mode: " + std::string(value));
+    }
+
     BenchmarkOptions parse_options(int argc, char **argv)
     {
         BenchmarkOptions opts;
@@ -200,6 +249,21 @@ namespace
                     std::exit(1);
                 }
             }
+            else if (arg.rfind("--mode=", 0) == 0) {
+                std::string value(arg.substr(std::strlen("--mode=")));
+                try {
+                    opts.mode = parse_mode(value);
+                }
+                catch (std::exception const &ex) {
+                    std::cerr << ex.what() << "\n";
+                    print_usage();
+                    std::exit(1);
+                }
+            }
+            else if (arg.rfind("--threads=", 0) == 0) {
+                std::string value(arg.substr(std::strlen("--threads=")));
+                opts.threads = static_cast<unsigned>(std::stoul(value));
+            }
             else {
                 std::cerr << "Unknown argument: " << arg << "\n";
                 print_usage();
@@ -275,40 +339,593 @@ namespace
         return results;
     }
 
+    template <class Key>
+    struct Workload
+    {
+        std::vector<Key> values;
+        std::vector<Key> successor_queries;
+        std::vector<Key> predecessor_queries;
+    };
+
+    template <class Key, unsigned BitCount>
+    Workload<Key> generate_workload(BenchmarkOptions const &options)
+    {
+        std::size_t num_inserts = options.num_inserts;
+        std::mt19937_64 rng(std::random_device{}());
+        DistributionSampler<Key, BitCount> sampler(
+            options.distribution, options.skew);
+
+        Workload<Key> workload;
+        workload.values.reserve(num_inserts);
+        workload.successor_queries.reserve(num_inserts);
+        workload.predecessor_queries.reserve(num_inserts);
+
+        Stopwatch<> data_sw("random data generation");
+        for (std::size_t i = 0; i < num_inserts; ++i) {
+            workload.values.emplace_back(sampler.sample(rng));
+            workload.successor_queries.emplace_back(sampler.sample(rng));
+            workload.predecessor_queries.emplace_back(sampler.sample(rng));
+        }
+        data_sw.stop();
+        data_sw.total_time();
+        return workload;
+    }
+
+    // Scalar query loops against the group-prefetched *_batch queries on a
+    // single vEB tree.
     template <class Tree, unsigned BitCount>
-    void run_benchmark_for_tree(BenchmarkOptions const &options)
+    void run_batch_query_benchmark(BenchmarkOptions const &options)
     {
         using Key = typename Tree::Key;
-        std::size_t num_inserts = options.num_inserts;
 
         LOG_INFO(
-            "=== vEB benchmark: {} inserts ({}-bit) ===",
-            num_inserts,
+            "=== vEB batch query benchmark: {} inserts ({}-bit) ===",
+            options.num_inserts,
+            BitCount);
+        LOG_INFO(
+            "Distribution={}, skew={}",
+            to_string(options.distribution),
+            options.skew);
+
+        auto [values, successor_queries, predecessor_queries] =
+            generate_workload<Key, BitCount>(options);
+
+        Tree tree;
+        tree.batch_insert(values);
+
+        LOG_INFO("--- scalar ---");
+        Stopwatch<> scalar_sw("scalar");
+        auto scalar_successors = collect_queries(
+            scalar_sw, "successor", successor_queries, [&](Key key) {
+                return tree.successor(key);
+            });
+        auto scalar_predecessors = collect_queries(
+            scalar_sw, "predecessor", predecessor_queries, [&](Key key) {
+                return tree.predecessor(key);
+            });
+        auto scalar_hits = collect_queries(
+            scalar_sw, "contains", values, [&](Key key) {
+                return tree.contains(key);
+            });
+        scalar_sw.total_time();
+
+        LOG_INFO("--- batch ---");
+        Stopwatch<> batch_sw("batch");
+        std::vector<std::optional<Key>> batch_successors(
+            successor_queries.size());
+        tree.successor_batch(successor_queries, batch_successors);
+        batch_sw.next("successor");
+        std::vector<std::optional<Key>> batch_predecessors(
+            predecessor_queries.size());
+        tree.predecessor_batch(predecessor_queries, batch_predecessors);
+        batch_sw.next("predecessor");
+        auto batch_hits = std::make_unique<bool[]>(values.size());
+        tree.contains_batch(values, {batch_hits.get(), values.size()});
+        batch_sw.next("contains");
+        batch_sw.total_time();
+
+        assert(batch_successors == scalar_successors);
+        assert(batch_predecessors == scalar_predecessors);
+        assert(std::equal(
+            scalar_hits.begin(), scalar_hits.end(), batch_hits.get()));
+
+        LOG_INFO("Benchmark complete");
+    }
+
+    // Sequential for_each against parallel_for_each and parallel_reduce
+    // over the same tree. --threads=0 uses one thread per hardware thread.
+    template <class Tree, unsigned BitCount>
+    void run_scan_benchmark(BenchmarkOptions const &options)
+    {
+        using Key = typename Tree::Key;
+
+        LOG_INFO(
+            "=== vEB scan benchmark: {} inserts ({}-bit), threads={} ===",
+            options.num_inserts,
+            BitCount,
+            options.threads);
+        LOG_INFO(
+            "Distribution={}, skew={}",
+            to_string(options.distribution),
+            options.skew);
+
+        auto workload = generate_workload<Key, BitCount>(options);
+        Tree tree;
+        tree.batch_insert(workload.values);
+
+        // Sums wrap on overflow, which keeps them comparable across orders.
+        Stopwatch<> scan_sw("scan");
+        uint64_t sequential_sum = 0;
+        std::size_t sequential_count = 0;
+        tree.for_each([&](Key key) {
+            sequential_sum += key;
+            ++sequential_count;
+        });
+        scan_sw.next("for_each");
+
+        std::atomic<std::size_t> parallel_count{0};
+        tree.parallel_for_each(
+            [&](Key) {
+                parallel_count.fetch_add(1, std::memory_order_relaxed);
+            },
+            options.threads);
+        scan_sw.next("parallel_for_each (shared counter)");
+
+        uint64_t parallel_sum = tree.parallel_reduce(
+            uint64_t{0},
+            [](uint64_t acc, Key key) { return acc + key; },
+            std::plus<>(),
+            options.threads);
+        scan_sw.next("parallel_reduce");
+        scan_sw.total_time();
+
+        LOG_INFO("keys={} sum={}", sequential_count, sequential_sum);
+        assert(parallel_count.load() == sequential_count);
+        assert(parallel_sum == sequential_sum);
+        (void)parallel_sum;
+
+        LOG_INFO("Benchmark complete");
+    }
+
+    // Key-by-key union and intersection (for_each plus insert/contains)
+    // against the cluster-wise set operations, on two trees drawn from the
+    // same distribution.
+    template <class Tree, unsigned BitCount>
+    void run_set_ops_benchmark(BenchmarkOptions const &options)
+    {
+        using Key = typename Tree::Key;
+
+        LOG_INFO(
+            "=== vEB set operation benchmark: {} inserts ({}-bit) ===",
+            options.num_inserts,
+            BitCount);
+        LOG_INFO(
+            "Distribution={}, skew={}",
+            to_string(options.distribution),
+            options.skew);
+
+        auto workload = generate_workload<Key, BitCount>(options);
+        Tree a;
+        Tree b;
+        a.batch_insert(workload.values);
+        b.batch_insert(workload.successor_queries);
+        LOG_INFO("|a|={} |b|={}", a.size(), b.size());
+
+        LOG_INFO("--- per key ---");
+        Stopwatch<> key_sw("per key");
+        Tree key_union = a;
+        b.for_each([&](Key key) { key_union.insert(key); });
+        key_sw.next("union");
+        Tree key_intersection;
+        b.for_each([&](Key key) {
+            if (a.contains(key)) {
+                key_intersection.insert(key);
+            }
+        });
+        key_sw.next("intersection");
+        key_sw.total_time();
+
+        // The out-of-place forms copy one operand first; the copy is timed
+        // on its own so the in-place operations can be read directly.
+        LOG_INFO("--- cluster-wise ---");
+        Stopwatch<> set_sw("cluster-wise");
+        Tree scratch = a;
+        set_sw.next("copy");
+        scratch.union_with(b);
+        set_sw.next("union_with");
+        assert(scratch.to_vector() == key_union.to_vector());
+        std::size_t union_size = scratch.size();
+        set_sw.start();
+        scratch = a;
+        set_sw.next("copy");
+        scratch.intersect_with(b);
+        set_sw.next("intersect_with");
+        assert(scratch.to_vector() == key_intersection.to_vector());
+        set_sw.start();
+        scratch = a;
+        set_sw.next("copy");
+        scratch.difference_with(b);
+        set_sw.next("difference_with");
+        std::size_t difference_size = scratch.size();
+        set_sw.start();
+        scratch = a;
+        set_sw.next("copy");
+        scratch.symmetric_difference_with(b);
+        set_sw.next("symmetric_difference_with");
+        set_sw.total_time();
+        std::size_t symmetric_size = scratch.size();
+
+        LOG_INFO(
+            "union={} intersection={} difference={} symmetric={}",
+            union_size,
+            key_intersection.size(),
+            difference_size,
+            symmetric_size);
+        assert(difference_size + key_intersection.size() == a.size());
+        assert(symmetric_size + key_intersection.size() == union_size);
+        (void)union_size;
+        (void)difference_size;
+        (void)symmetric_size;
+
+        LOG_INFO("Benchmark complete");
+    }
+
+    // Forces `value` to be computed here: without it the compiler may
+    // sink a read-only query loop past the stopwatch call that follows.
+    template <class T>
+    void keep_live(T const &value) noexcept
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Runs the same operations against one node layout and returns a
+    // checksum of the results, so layouts can be cross-checked.
+    template <class Root>
+    uint64_t time_cluster_layout(
+        std::string_view name, Workload<typename Root::Key> const &workload)
+    {
+        using Key = typename Root::Key;
+        Stopwatch<> sw(std::string{name});
+        Root tree;
+        for (Key key : workload.values) {
+            tree.insert(key);
+        }
+        sw.next("insert");
+        uint64_t checksum = 0;
+        for (Key key : workload.values) {
+            checksum += tree.contains(key) ? 1 : 0;
+        }
+        keep_live(checksum);
+        sw.next("contains");
+        for (Key key : workload.successor_queries) {
+            checksum += tree.successor(key).value_or(0);
+        }
+        keep_live(checksum);
+        sw.next("successor");
+        for (Key key : workload.predecessor_queries) {
+            checksum += tree.predecessor(key).value_or(0);
+        }
+        keep_live(checksum);
+        sw.next("predecessor");
+        tree.for_each([&](Key key) { checksum ^= key; });
+        keep_live(checksum);
+        sw.next("for_each");
+        for (std::size_t i = 0; i < workload.values.size(); i += 2) {
+            tree.erase(workload.values[i]);
+        }
+        sw.next("erase half");
+        sw.total_time();
+        return checksum + tree.size();
+    }
+
+    // Hash-map cluster storage against the rank-indexed layout on the
+    // inner sparse levels. Only 48- and 64-bit trees have sparse levels.
+    template <unsigned BitCount>
+    void run_layout_benchmark(BenchmarkOptions const &options)
+    {
+        if constexpr (BitCount < 48) {
+            LOG_INFO("layout mode needs a sparse tree: use --bits=48 or 64");
+        }
+        else {
+            using Hashed = VebBranch<BitCount>;
+            using Ranked = VebBranch<
+                BitCount,
+                true,
+                veb_detail::SlabNodes,
+                veb_detail::RankedClusters>;
+            using Key = typename Hashed::Key;
+
+            LOG_INFO(
+                "=== vEB cluster layout benchmark: {} inserts ({}-bit) ===",
+                options.num_inserts,
+                BitCount);
+            LOG_INFO(
+                "Distribution={}, skew={}",
+                to_string(options.distribution),
+                options.skew);
+
+            auto workload = generate_workload<Key, BitCount>(options);
+            uint64_t hashed = time_cluster_layout<Hashed>("hashed", workload);
+            uint64_t ranked = time_cluster_layout<Ranked>("ranked", workload);
+            assert(hashed == ranked);
+            (void)hashed;
+            (void)ranked;
+
+            LOG_INFO("Benchmark complete");
+        }
+    }
+
+    // Recursive cluster summary against the flat bitmap one on the dense
+    // root, whose fanout is 2^12 clusters at 24 bits and 2^16 at 32 bits;
+    // run both widths to see where the linear bitmap scan stops paying.
+    template <unsigned BitCount>
+    void run_summary_benchmark(BenchmarkOptions const &options)
+    {
+        if constexpr (BitCount > 32) {
+            LOG_INFO("summary mode needs a dense root: use --bits=24 or 32");
+        }
+        else {
+            using Recursive = VebBranch<BitCount, false>;
+            using Flat = VebBranch<
+                BitCount,
+                false,
+                veb_detail::SlabNodes,
+                veb_detail::FlatSummaries<BitCount / 2>>;
+            using Key = typename Recursive::Key;
+
+            LOG_INFO(
+                "=== vEB summary benchmark: {} inserts ({}-bit, fanout {}) "
+                "===",
+                options.num_inserts,
+                BitCount,
+                std::size_t{1} << (BitCount / 2));
+            LOG_INFO(
+                "Distribution={}, skew={}",
+                to_string(options.distribution),
+                options.skew);
+
+            auto workload = generate_workload<Key, BitCount>(options);
+            uint64_t recursive =
+                time_cluster_layout<Recursive>("recursive summary", workload);
+            uint64_t flat = time_cluster_layout<Flat>("flat summary", workload);
+            assert(recursive == flat);
+            (void)recursive;
+            (void)flat;
+
+            LOG_INFO("Benchmark complete");
+        }
+    }
+
+    // successor/predecessor returning std::optional against the
+    // successor_or/predecessor_or forms returning a marker key, over the
+    // same queries on one tree.
+    template <class Tree, unsigned BitCount>
+    void run_sentinel_benchmark(BenchmarkOptions const &options)
+    {
+        using Key = typename Tree::Key;
+
+        LOG_INFO(
+            "=== vEB sentinel query benchmark: {} inserts ({}-bit) ===",
+            options.num_inserts,
             BitCount);
         LOG_INFO(
             "Distribution={}, skew={}",
             to_string(options.distribution),
             options.skew);
 
+        auto [values, successor_queries, predecessor_queries] =
+            generate_workload<Key, BitCount>(options);
+
+        Tree tree;
+        tree.batch_insert(values);
+
+        LOG_INFO("--- optional ---");
+        uint64_t optional_sum = 0;
+        Stopwatch<> optional_sw("optional");
+        for (Key key : successor_queries) {
+            optional_sum += tree.successor(key).value_or(0);
+        }
+        keep_live(optional_sum);
+        optional_sw.next("successor");
+        for (Key key : predecessor_queries) {
+            optional_sum += tree.predecessor(key).value_or(Tree::MAX_KEY);
+        }
+        keep_live(optional_sum);
+        optional_sw.next("predecessor");
+        optional_sw.total_time();
+
+        LOG_INFO("--- sentinel ---");
+        uint64_t sentinel_sum = 0;
+        Stopwatch<> sentinel_sw("sentinel");
+        for (Key key : successor_queries) {
+            sentinel_sum += tree.successor_or(key, 0);
+        }
+        keep_live(sentinel_sum);
+        sentinel_sw.next("successor");
+        for (Key key : predecessor_queries) {
+            sentinel_sum += tree.predecessor_or(key, Tree::MAX_KEY);
+        }
+        keep_live(sentinel_sum);
+        sentinel_sw.next("predecessor");
+        sentinel_sw.total_time();
+
+        assert(optional_sum == sentinel_sum);
+        (void)optional_sum;
+        (void)sentinel_sum;
+
+        LOG_INFO("Benchmark complete");
+    }
+
+    template <class Tree>
+    void time_order_statistics(
+        std::string const &label, std::vector<typename Tree::Key> const &values)
+    {
+        using Key = typename Tree::Key;
+
+        Tree tree;
+        tree.batch_insert(values);
+
+        LOG_INFO("--- {}: {} keys ---", label, tree.size());
+        uint64_t sum = 0;
+        Stopwatch<> sw(label);
+        for (Key key : values) {
+            sum += tree.rank(key);
+        }
+        keep_live(sum);
+        sw.next("rank");
+        for (std::size_t k = 0; k < values.size(); ++k) {
+            sum += tree.select(k % tree.size()).value_or(0);
+        }
+        keep_live(sum);
+        sw.next("select");
+        for (Key key : values) {
+            sum += tree.successor(key).value_or(0);
+        }
+        keep_live(sum);
+        sw.next("successor");
+        sw.total_time();
+    }
+
+    // rank and select against successor, first over the chosen
+    // distribution, then over keys packed into consecutive top-level
+    // clusters, (i << BitCount / 2) | random low bits. Packed clusters put
+    // many occupied clusters below every query, which the rank index has
+    // to sum without walking them.
+    template <class Tree, unsigned BitCount>
+    void run_rank_benchmark(BenchmarkOptions const &options)
+    {
+        using Key = typename Tree::Key;
+
+        LOG_INFO(
+            "=== vEB rank benchmark: {} inserts ({}-bit) ===",
+            options.num_inserts,
+            BitCount);
+        LOG_INFO(
+            "Distribution={}, skew={}",
+            to_string(options.distribution),
+            options.skew);
+
+        auto workload = generate_workload<Key, BitCount>(options);
+        time_order_statistics<Tree>("distribution", workload.values);
+
+        constexpr unsigned HALF = BitCount / 2;
+        constexpr auto LOW_MASK =
+            static_cast<Key>((uint64_t{1} << std::min(HALF, 16u)) - 1);
         std::mt19937_64 rng(std::random_device{}());
-        DistributionSampler<Key, BitCount> sampler(
-            options.distribution, options.skew);
+        std::vector<Key> clustered;
+        clustered.reserve(options.num_inserts);
+        for (std::size_t i = 0; i < options.num_inserts; ++i) {
+            Key top = static_cast<Key>(static_cast<Key>(i) << HALF);
+            clustered.push_back(
+                static_cast<Key>((top | (rng() & LOW_MASK)) & Tree::MAX_KEY));
+        }
+        time_order_statistics<Tree>("clustered", clustered);
 
-        std::vector<Key> values;
-        values.reserve(num_inserts);
-        std::vector<Key> successor_queries;
-        successor_queries.reserve(num_inserts);
-        std::vector<Key> predecessor_queries;
-        predecessor_queries.reserve(num_inserts);
+        LOG_INFO("Benchmark complete");
+    }
 
-        Stopwatch<> data_sw("random data generation");
-        for (std::size_t i = 0; i < num_inserts; ++i) {
-            values.emplace_back(sampler.sample(rng));
-            successor_queries.emplace_back(sampler.sample(rng));
-            predecessor_queries.emplace_back(sampler.sample(rng));
+    // Allocator that keeps a running total of the bytes it hands out, so
+    // the baseline containers can report their footprint.
+    template <class T>
+    struct CountingAllocator
+    {
+        using value_type = T;
+
+        explicit CountingAllocator(std::size_t *counter) noexcept
+            : bytes(counter)
+        {
         }
-        data_sw.stop();
-        data_sw.total_time();
+
+        template <class U>
+        CountingAllocator(CountingAllocator<U> const &other) noexcept
+            : bytes(other.bytes)
+        {
+        }
+
+        T *allocate(std::size_t n)
+        {
+            *bytes += n * sizeof(T);
+            return std::allocator<T>{}.allocate(n);
+        }
+
+        void deallocate(T *ptr, std::size_t n) noexcept
+        {
+            *bytes -= n * sizeof(T);
+            std::allocator<T>{}.deallocate(ptr, n);
+        }
+
+        template <class U>
+        bool operator==(CountingAllocator<U> const &other) const noexcept
+        {
+            return bytes == other.bytes;
+        }
+
+        std::size_t *bytes;
+    };
+
+    // Bytes per distinct key of a `Set` holding `values`, counting what
+    // its allocator is asked for plus the container object itself.
+    template <class Set>
+    double set_bytes_per_key(std::vector<typename Set::key_type> const &values)
+    {
+        std::size_t bytes = 0;
+        Set set{typename Set::allocator_type(&bytes)};
+        for (auto value : values) {
+            set.insert(value);
+        }
+        return static_cast<double>(bytes + sizeof(Set)) /
+               static_cast<double>(std::max<std::size_t>(1, set.size()));
+    }
+
+    void log_memory_usage(
+        veb_detail::MemoryUsage const &usage, std::size_t size)
+    {
+        auto per_key = [&](std::size_t bytes) {
+            return static_cast<double>(bytes) /
+                   static_cast<double>(std::max<std::size_t>(1, size));
+        };
+        LOG_INFO(
+            "vEB: {:.2f} B/key ({} bytes for {} keys)",
+            per_key(usage.total_bytes()),
+            usage.total_bytes(),
+            size);
+        LOG_INFO(
+            "  leaves={:.2f} summaries={:.2f} branches={:.2f} "
+            "inline_values={:.2f} cluster_maps={:.2f} index={:.2f} "
+            "reserved={:.2f} B/key",
+            per_key(usage.leaf_bytes),
+            per_key(usage.summary_bytes),
+            per_key(usage.branch_bytes),
+            per_key(usage.inline_value_bytes),
+            per_key(usage.cluster_map_bytes),
+            per_key(usage.index_bytes),
+            per_key(usage.reserved_bytes));
+        LOG_INFO(
+            "  cluster map entries={} capacity={}",
+            usage.cluster_map_size,
+            usage.cluster_map_capacity);
+        for (std::size_t level = 0; level < usage.nodes.size(); ++level) {
+            LOG_INFO("  level {}: {} nodes", level, usage.nodes[level]);
+        }
+    }
+
+    template <class Tree, unsigned BitCount>
+    void run_benchmark_for_tree(BenchmarkOptions const &options)
+    {
+        using Key = typename Tree::Key;
+        std::size_t num_inserts = options.num_inserts;
+
+        LOG_INFO(
+            "=== vEB benchmark: {} inserts ({}-bit) ===",
+            num_inserts,
+            BitCount);
+        LOG_INFO(
+            "Distribution={}, skew={}",
+            to_string(options.distribution),
+            options.skew);
+
+        auto [values, successor_queries, predecessor_queries] =
+            generate_workload<Key, BitCount>(options);
 
         auto assert_sorted = [](std::string_view, auto const &data) {
             assert(
@@ -418,9 +1035,59 @@ namespace
         assert(boost_predecessors == expected_predecessors);
         boost_sw.total_time();
 
+        // Footprint of the same key set in each structure. The baselines
+        // count every byte they request from the allocator; the vEB figure
+        // counts its nodes plus the slab space reserved around them, under
+        // "reserved". Neither includes malloc's per-chunk headers.
+        LOG_INFO("--- memory ---");
+        log_memory_usage(tree.memory_usage(), tree.size());
+        using Counted = CountingAllocator<Key>;
+        LOG_INFO(
+            "std::set: {:.2f} B/key",
+            set_bytes_per_key<std::set<Key, std::less<Key>, Counted>>(values));
+        LOG_INFO(
+            "absl::btree_set: {:.2f} B/key",
+            set_bytes_per_key<absl::btree_set<Key, std::less<Key>, Counted>>(
+                values));
+        LOG_INFO(
+            "boost::container::set: {:.2f} B/key",
+            set_bytes_per_key<
+                boost::container::set<Key, std::less<Key>, Counted>>(values));
+
         LOG_INFO("Benchmark complete");
     }
 
+    template <class Tree, unsigned BitCount>
+    void run_for_mode(BenchmarkOptions const &options)
+    {
+        switch (options.mode) {
+        case BenchMode::Compare:
+            run_benchmark_for_tree<Tree, BitCount>(options);
+            break;
+        case BenchMode::BatchQuery:
+            run_batch_query_benchmark<Tree, BitCount>(options);
+            break;
+        case BenchMode::Scan:
+            run_scan_benchmark<Tree, BitCount>(options);
+            break;
+        case BenchMode::SetOps:
+            run_set_ops_benchmark<Tree, BitCount>(options);
+            break;
+        case BenchMode::Layout:
+            run_layout_benchmark<BitCount>(options);
+            break;
+        case BenchMode::Summary:
+            run_summary_benchmark<BitCount>(options);
+            break;
+        case BenchMode::Sentinel:
+            run_sentinel_benchmark<Tree, BitCount>(options);
+            break;
+        case BenchMode::Rank:
+            run_rank_benchmark<Tree, BitCount>(options);
+            break;
+        }
+    }
+
 } // namespace
 
 int main(int argc, char **argv)
@@ -431,16 +1098,16 @@ int main(int argc, char **argv)
 
     switch (options.key_mode) {
     case KeyMode::Bits24:
-        run_benchmark_for_tree<VebTree24, 24>(options);
+        run_for_mode<VebTree24, 24>(options);
         break;
     case KeyMode::Bits32:
-        run_benchmark_for_tree<VebTree32, 32>(options);
+        run_for_mode<VebTree32, 32>(options);
         break;
     case KeyMode::Bits48:
-        run_benchmark_for_tree<VebTree48, 48>(options);
+        run_for_mode<VebTree48, 48>(options);
         break;
     case KeyMode::Bits64:
-        run_benchmark_for_tree<VebTree64, 64>(options);
+        run_for_mode<VebTree64, 64>(options);
         break;
     }
     return 0;
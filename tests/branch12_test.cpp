@@ -1,5 +1,12 @@
+#include <atomic>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
+#include "veb_atomic.hpp"
 #include "veb_branch.hpp"
 
 using Branch = VebBranch12;
@@ -146,3 +153,144 @@ TEST(Branch12Test, PredecessorReturnsNullBeforeSmallestElement)
     EXPECT_FALSE(branch.predecessor(5).has_value());
     EXPECT_FALSE(branch.predecessor(0).has_value());
 }
+
+TEST(Branch12Test, SizeRankAndSelectTrackUpdates)
+{
+    Branch branch;
+    std::vector<uint16_t> keys = {0, 1, 63, 64, 700, 701, 4095};
+    for (auto k : keys) {
+        EXPECT_TRUE(branch.insert(k));
+    }
+    EXPECT_FALSE(branch.insert(700));
+    EXPECT_EQ(keys.size(), branch.size());
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(i, branch.rank(keys[i]));
+        EXPECT_EQ(std::optional<uint16_t>(keys[i]), branch.select(i));
+    }
+    EXPECT_EQ(4u, branch.rank(65));
+    EXPECT_FALSE(branch.select(keys.size()).has_value());
+    EXPECT_EQ(3u, branch.count_range(63, 700));
+
+    EXPECT_TRUE(branch.erase(64));
+    EXPECT_FALSE(branch.erase(64));
+    EXPECT_EQ(keys.size() - 1, branch.size());
+    EXPECT_EQ(std::optional<uint16_t>(700), branch.select(3));
+}
+
+TEST(Branch12Test, EraseRangeDropsInteriorClusters)
+{
+    Branch branch;
+    for (Branch::Key k = 0; k < 4096; k += 3) {
+        branch.insert(k);
+    }
+    std::size_t before = branch.size();
+    // Clusters 2..61 fall wholly inside the range; 1 and 62 are trimmed.
+    std::size_t removed = branch.erase_range(100, 4000);
+    EXPECT_EQ(before - removed, branch.size());
+    EXPECT_EQ(std::optional<Branch::Key>(99), branch.predecessor(4002));
+    EXPECT_EQ(std::optional<Branch::Key>(4002), branch.successor(99));
+    EXPECT_FALSE(branch.contains(3000));
+    EXPECT_EQ(34u, branch.rank(4002));
+
+    std::size_t rest = branch.size();
+    EXPECT_EQ(rest, branch.erase_range(0, 4095));
+    EXPECT_TRUE(branch.empty());
+}
+
+TEST(Branch12Test, AtomicBranchTakesConcurrentWriters)
+{
+    AtomicVebBranch12 atomic;
+    Branch serial;
+    std::mt19937 rng(12);
+    std::vector<uint16_t> keys(3000);
+    for (auto &key : keys) {
+        key = static_cast<uint16_t>(rng() & Branch::MAX_KEY);
+        serial.insert(key);
+    }
+
+    auto run = [&](auto &&op) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (std::size_t i = t; i < keys.size(); i += 4) {
+                    op(i);
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+    run([&](std::size_t i) { atomic.insert(keys[i]); });
+    EXPECT_EQ(serial.size(), atomic.size());
+    std::vector<uint16_t> seen;
+    atomic.for_each([&](uint16_t key) { seen.push_back(key); });
+    std::vector<uint16_t> expected;
+    serial.for_each([&](uint16_t key) { expected.push_back(key); });
+    EXPECT_EQ(expected, seen);
+
+    run([&](std::size_t i) {
+        if (i % 3 != 0) {
+            atomic.erase(keys[i]);
+        }
+    });
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        if (i % 3 != 0) {
+            serial.erase(keys[i]);
+        }
+    }
+    EXPECT_EQ(serial.size(), atomic.size());
+    EXPECT_EQ(serial.min(), atomic.min());
+    EXPECT_EQ(serial.max(), atomic.max());
+    for (uint16_t x = 0; x <= Branch::MAX_KEY; ++x) {
+        EXPECT_EQ(serial.contains(x), atomic.contains(x));
+        EXPECT_EQ(serial.successor(x), atomic.successor(x));
+        EXPECT_EQ(serial.predecessor(x), atomic.predecessor(x));
+    }
+}
+
+TEST(Branch12Test, AtomicBranchKeepsSummaryUnderMixedWriters)
+{
+    // Writers insert and erase the same keys next to a key that is never
+    // erased, so each leaf they touch stays non-empty and its summary bit
+    // must stay set for the readers.
+    AtomicVebBranch16 atomic;
+    std::vector<uint16_t> kept{0x0105, 0x4480, 0x44FF, 0xFF00};
+    for (uint16_t key : kept) {
+        atomic.insert(key);
+    }
+    std::atomic<bool> done{false};
+    std::atomic<int> misses{0};
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            for (int round = 0; round < 1000; ++round) {
+                for (uint16_t key : kept) {
+                    auto other = static_cast<uint16_t>(key ^ 0x21);
+                    atomic.insert(other);
+                    atomic.erase(other);
+                }
+            }
+        });
+    }
+    std::thread reader([&] {
+        while (!done.load()) {
+            misses += atomic.min() != kept.front();
+            misses += atomic.successor(0x0200) != kept[1];
+            misses += atomic.predecessor(0xFEFF) != kept[2];
+        }
+    });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(0, misses.load());
+
+    std::vector<uint16_t> seen;
+    atomic.for_each([&](uint16_t key) { seen.push_back(key); });
+    EXPECT_EQ(kept, seen);
+    EXPECT_EQ(kept.size(), atomic.size());
+    EXPECT_EQ(kept.back(), atomic.max());
+}
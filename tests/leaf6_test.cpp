@@ -1,5 +1,11 @@
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
+#include "veb_atomic.hpp"
 #include "veb_leaf6.hpp"
 
 TEST(Leaf6Test, InsertUpdatesContains)
@@ -134,3 +140,89 @@ TEST(Leaf6Test, PredecessorHandlesUpperBound)
     ASSERT_TRUE(leaf.predecessor(max_key).has_value());
     EXPECT_EQ(17u, *leaf.predecessor(max_key));
 }
+
+TEST(Leaf6Test, OrderStatistics)
+{
+    VebLeaf6 leaf;
+    EXPECT_TRUE(leaf.insert(3));
+    EXPECT_TRUE(leaf.insert(17));
+    EXPECT_TRUE(leaf.insert(63));
+    EXPECT_FALSE(leaf.insert(17));
+    EXPECT_EQ(3u, leaf.size());
+
+    EXPECT_EQ(0u, leaf.rank(3));
+    EXPECT_EQ(1u, leaf.rank(4));
+    EXPECT_EQ(2u, leaf.rank(63));
+    EXPECT_EQ(std::optional<VebLeaf6::Key>(17), leaf.select(1));
+    EXPECT_EQ(std::optional<VebLeaf6::Key>(63), leaf.select(2));
+    EXPECT_FALSE(leaf.select(3).has_value());
+    EXPECT_EQ(2u, leaf.count_range(3, 17));
+    EXPECT_EQ(3u, leaf.count_range(0, 63));
+    EXPECT_EQ(0u, leaf.count_range(18, 62));
+
+    EXPECT_TRUE(leaf.erase(3));
+    EXPECT_FALSE(leaf.erase(3));
+    EXPECT_EQ(2u, leaf.size());
+}
+
+TEST(Leaf6Test, EraseRangeClearsInclusiveSpan)
+{
+    VebLeaf6 leaf;
+    for (VebLeaf6::Key k : {0, 1, 17, 40, 62, 63}) {
+        leaf.insert(k);
+    }
+    EXPECT_EQ(0u, leaf.erase_range(18, 39));
+    EXPECT_EQ(2u, leaf.erase_range(17, 40));
+    EXPECT_FALSE(leaf.contains(17));
+    EXPECT_FALSE(leaf.contains(40));
+    EXPECT_EQ(0u, leaf.erase_range(5, 4));
+    EXPECT_EQ(4u, leaf.erase_range(0, 63));
+    EXPECT_TRUE(leaf.empty());
+}
+
+TEST(Leaf6Test, AtomicLeafReportsTransitions)
+{
+    AtomicVebLeaf6 leaf;
+    auto first = leaf.insert(5);
+    EXPECT_TRUE(first.changed);
+    EXPECT_TRUE(first.transition);
+    auto second = leaf.insert(40);
+    EXPECT_TRUE(second.changed);
+    EXPECT_FALSE(second.transition);
+    EXPECT_FALSE(leaf.insert(5).changed);
+    EXPECT_EQ(2u, leaf.size());
+    EXPECT_EQ(std::optional<AtomicVebLeaf6::Key>(5), leaf.min());
+    EXPECT_EQ(std::optional<AtomicVebLeaf6::Key>(40), leaf.successor(5));
+    EXPECT_EQ(std::optional<AtomicVebLeaf6::Key>(5), leaf.predecessor(40));
+
+    EXPECT_FALSE(leaf.erase(6).changed);
+    auto partial = leaf.erase(5);
+    EXPECT_TRUE(partial.changed);
+    EXPECT_FALSE(partial.transition);
+    EXPECT_TRUE(leaf.erase(40).transition);
+    EXPECT_TRUE(leaf.empty());
+
+    // Threads filling disjoint keys see exactly one empty -> non-empty
+    // transition between them, and emptying it exactly one back.
+    std::atomic<int> transitions{0};
+    auto run = [&](auto &&op) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (unsigned x = t; x <= AtomicVebLeaf6::MAX_KEY; x += 4) {
+                    transitions +=
+                        op(static_cast<AtomicVebLeaf6::Key>(x)).transition;
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+    run([&](AtomicVebLeaf6::Key x) { return leaf.insert(x); });
+    EXPECT_EQ(1, transitions.exchange(0));
+    EXPECT_EQ(AtomicVebLeaf6::SUBTREE_SIZE, leaf.size());
+    run([&](AtomicVebLeaf6::Key x) { return leaf.erase(x); });
+    EXPECT_EQ(1, transitions.load());
+    EXPECT_TRUE(leaf.empty());
+}
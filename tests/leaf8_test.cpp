@@ -1,7 +1,13 @@
 #include <array>
+#include <atomic>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "veb_atomic.hpp"
 #include "veb_leaf8.hpp"
 
 TEST(Leaf8Test, InsertUpdatesContains)
@@ -115,6 +121,92 @@ TEST(Leaf8Test, PredecessorHandlesUpperBound)
     EXPECT_EQ(17u, *leaf.predecessor(max_key));
 }
 
+// Exercises both the 256-bit scans and the scalar word loop, depending
+// on whether the build targets AVX2.
+TEST(Leaf8Test, ScansMatchBitByBitSearch)
+{
+    std::mt19937_64 rng(8);
+    for (int round = 0; round < 200; ++round) {
+        VebLeaf8 leaf;
+        std::array<bool, 256> present{};
+        // Vary density so some words are empty and some are full.
+        uint64_t keep = rng() % 64;
+        for (unsigned x = 0; x < 256; ++x) {
+            if (rng() % 64 < keep && (rng() >> 62) != (x >> 6)) {
+                leaf.insert(static_cast<uint16_t>(x));
+                present[x] = true;
+            }
+        }
+        std::optional<uint16_t> first;
+        std::optional<uint16_t> last;
+        for (unsigned x = 0; x < 256; ++x) {
+            if (present[x]) {
+                first = first ? first : std::optional<uint16_t>(x);
+                last = static_cast<uint16_t>(x);
+            }
+        }
+        EXPECT_EQ(first, leaf.min());
+        EXPECT_EQ(last, leaf.max());
+        for (unsigned x = 0; x < 256; ++x) {
+            std::optional<uint16_t> next;
+            for (unsigned y = x + 1; y < 256 && !next; ++y) {
+                if (present[y]) {
+                    next = static_cast<uint16_t>(y);
+                }
+            }
+            std::optional<uint16_t> prev;
+            for (unsigned y = x; y-- > 0 && !prev;) {
+                if (present[y]) {
+                    prev = static_cast<uint16_t>(y);
+                }
+            }
+            EXPECT_EQ(next, leaf.successor(static_cast<uint16_t>(x)));
+            EXPECT_EQ(prev, leaf.predecessor(static_cast<uint16_t>(x)));
+        }
+    }
+}
+
+// The 256-bit kernels are compiled into every x86-64 build, whatever it
+// targets, so they are checked against the word loop wherever the host
+// can run them.
+TEST(Leaf8Test, Avx2KernelsMatchScalarScans)
+{
+#if PARVEB_LEAF8_AVX2_KERNELS
+    if (!__builtin_cpu_supports("avx2")) {
+        GTEST_SKIP() << "host has no AVX2";
+    }
+    std::mt19937_64 rng(88);
+    for (int round = 0; round < 200; ++round) {
+        // Empty, sparse and full words in varying positions.
+        std::array<uint64_t, 4> words{};
+        for (auto &word : words) {
+            switch (rng() % 4) {
+            case 0:
+                break;
+            case 1:
+                word = uint64_t{1} << (rng() % 64);
+                break;
+            case 2:
+                word = rng();
+                break;
+            default:
+                word = ~uint64_t{0};
+            }
+        }
+        for (unsigned x = 0; x < 256; ++x) {
+            EXPECT_EQ(
+                veb_detail::leaf8_first_from_scalar(words.data(), x),
+                veb_detail::leaf8_first_from_avx2(words.data(), x));
+            EXPECT_EQ(
+                veb_detail::leaf8_last_through_scalar(words.data(), x),
+                veb_detail::leaf8_last_through_avx2(words.data(), x));
+        }
+    }
+#else
+    GTEST_SKIP() << "AVX2 kernels are not compiled for this target";
+#endif
+}
+
 TEST(Leaf8Test, BatchInsertErase)
 {
     VebLeaf8 leaf;
@@ -155,3 +247,215 @@ TEST(Leaf8Test, BatchInsertOverwritesExisting)
     EXPECT_TRUE(leaf.contains(11));
     EXPECT_TRUE(leaf.contains(200));
 }
+
+TEST(Leaf8Test, OrderStatistics)
+{
+    VebLeaf8 leaf;
+    for (VebLeaf8::Key k : {5, 63, 64, 130, 255}) {
+        EXPECT_TRUE(leaf.insert(k));
+    }
+    EXPECT_FALSE(leaf.insert(64));
+    EXPECT_EQ(5u, leaf.size());
+
+    EXPECT_EQ(0u, leaf.rank(5));
+    EXPECT_EQ(2u, leaf.rank(64));
+    EXPECT_EQ(3u, leaf.rank(65));
+    EXPECT_EQ(4u, leaf.rank(255));
+    EXPECT_EQ(std::optional<VebLeaf8::Key>(64), leaf.select(2));
+    EXPECT_EQ(std::optional<VebLeaf8::Key>(255), leaf.select(4));
+    EXPECT_FALSE(leaf.select(5).has_value());
+    EXPECT_EQ(3u, leaf.count_range(63, 130));
+    EXPECT_EQ(0u, leaf.count_range(131, 254));
+
+    EXPECT_TRUE(leaf.erase(130));
+    EXPECT_FALSE(leaf.erase(130));
+    EXPECT_EQ(4u, leaf.size());
+}
+
+TEST(Leaf8Test, EraseRangeClearsInclusiveSpan)
+{
+    VebLeaf8 leaf;
+    for (VebLeaf8::Key k : {0, 5, 63, 64, 130, 200, 255}) {
+        leaf.insert(k);
+    }
+    EXPECT_EQ(0u, leaf.erase_range(6, 62));
+    EXPECT_EQ(3u, leaf.erase_range(63, 130));
+    EXPECT_TRUE(leaf.contains(5));
+    EXPECT_FALSE(leaf.contains(64));
+    EXPECT_TRUE(leaf.contains(200));
+    EXPECT_EQ(0u, leaf.erase_range(5, 4));
+    EXPECT_EQ(4u, leaf.erase_range(0, 255));
+    EXPECT_TRUE(leaf.empty());
+}
+
+TEST(Leaf8Test, SetAlgebraCombinesWords)
+{
+    VebLeaf8 a;
+    VebLeaf8 b;
+    for (VebLeaf8::Key k : {1, 64, 130, 255}) {
+        a.insert(k);
+    }
+    for (VebLeaf8::Key k : {1, 65, 130, 200}) {
+        b.insert(k);
+    }
+    VebLeaf8 both = a;
+    both.intersect_with(b);
+    EXPECT_EQ(2u, both.size());
+    EXPECT_TRUE(both.contains(1));
+    EXPECT_TRUE(both.contains(130));
+
+    VebLeaf8 either = a;
+    either.union_with(b);
+    EXPECT_EQ(6u, either.size());
+
+    VebLeaf8 only_a = a;
+    only_a.difference_with(b);
+    EXPECT_EQ(std::optional<VebLeaf8::Key>(64), only_a.min());
+    EXPECT_EQ(std::optional<VebLeaf8::Key>(255), only_a.max());
+
+    VebLeaf8 one_side = a;
+    one_side.symmetric_difference_with(b);
+    EXPECT_EQ(4u, one_side.size());
+    EXPECT_FALSE(one_side.contains(130));
+}
+
+TEST(Leaf8Test, AtomicLeafReportsTransitions)
+{
+    AtomicVebLeaf8 leaf;
+    auto first = leaf.insert(5);
+    EXPECT_TRUE(first.changed);
+    EXPECT_TRUE(first.transition);
+    auto second = leaf.insert(200);
+    EXPECT_TRUE(second.changed);
+    EXPECT_FALSE(second.transition);
+    EXPECT_FALSE(leaf.insert(5).changed);
+    EXPECT_EQ(2u, leaf.size());
+    EXPECT_EQ(std::optional<AtomicVebLeaf8::Key>(5), leaf.min());
+    EXPECT_EQ(std::optional<AtomicVebLeaf8::Key>(200), leaf.successor(5));
+    EXPECT_EQ(std::optional<AtomicVebLeaf8::Key>(5), leaf.predecessor(200));
+
+    EXPECT_FALSE(leaf.erase(6).changed);
+    auto partial = leaf.erase(5);
+    EXPECT_TRUE(partial.changed);
+    EXPECT_FALSE(partial.transition);
+    EXPECT_TRUE(leaf.erase(200).transition);
+    EXPECT_TRUE(leaf.empty());
+
+    // Threads filling disjoint keys see exactly one empty -> non-empty
+    // transition between them, and emptying it exactly one back.
+    std::atomic<int> transitions{0};
+    auto run = [&](auto &&op) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (unsigned x = t; x <= AtomicVebLeaf8::MAX_KEY; x += 4) {
+                    transitions +=
+                        op(static_cast<AtomicVebLeaf8::Key>(x)).transition;
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+    run([&](AtomicVebLeaf8::Key x) { return leaf.insert(x); });
+    EXPECT_EQ(1, transitions.exchange(0));
+    EXPECT_EQ(AtomicVebLeaf8::SUBTREE_SIZE, leaf.size());
+    run([&](AtomicVebLeaf8::Key x) { return leaf.erase(x); });
+    EXPECT_EQ(1, transitions.load());
+    EXPECT_TRUE(leaf.empty());
+}
+
+TEST(Leaf8Test, AtomicLeafKeepsCountUnderMixedWriters)
+{
+    // Every thread inserts and erases the same keys, so inserts race
+    // erases of one key. Key 0 stays in the leaf throughout, so no call
+    // may report the leaf as emptied or refilled.
+    AtomicVebLeaf8 leaf;
+    leaf.insert(0);
+    std::atomic<int> transitions{0};
+    auto churn = [&] {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (int round = 0; round < 2000; ++round) {
+                    for (unsigned x = 60; x < 200; x += 35) {
+                        auto key = static_cast<AtomicVebLeaf8::Key>(x);
+                        transitions += leaf.insert(key).transition;
+                        transitions += leaf.erase(key).transition;
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+    churn();
+    EXPECT_EQ(0, transitions.exchange(0));
+    EXPECT_EQ(1u, leaf.size());
+    EXPECT_FALSE(leaf.empty());
+    EXPECT_EQ(std::optional<AtomicVebLeaf8::Key>(0), leaf.min());
+    EXPECT_FALSE(leaf.successor(0));
+
+    // Without it the leaf empties and refills many times, and the count
+    // must still come back to zero rather than wrap.
+    leaf.erase(0);
+    churn();
+    EXPECT_EQ(0u, leaf.size());
+    EXPECT_TRUE(leaf.empty());
+    EXPECT_FALSE(leaf.min());
+    EXPECT_TRUE(leaf.insert(7).transition);
+    EXPECT_TRUE(leaf.erase(7).transition);
+}
+
+TEST(Leaf8Test, BulkBitDecodeMatchesBitByBit)
+{
+    std::mt19937_64 rng(823);
+    for (int round = 0; round < 200; ++round) {
+        // Densities from a few bits to nearly full.
+        unsigned keep = 1 + round % 8;
+        std::vector<uint64_t> words(1 + rng() % 40);
+        for (uint64_t &word : words) {
+            word = rng();
+            for (unsigned k = 1; k < keep; ++k) {
+                word &= rng();
+            }
+        }
+        words[rng() % words.size()] = 0;
+
+        std::vector<uint16_t> want;
+        for (std::size_t i = 0; i < words.size() * 64; ++i) {
+            if (words[i / 64] >> (i % 64) & 1) {
+                want.push_back(static_cast<uint16_t>(i));
+            }
+        }
+        std::vector<uint16_t> got(words.size() * 64);
+        got.resize(simd::set_bit_positions(words, got.data()));
+        ASSERT_EQ(want, got);
+
+        for (std::size_t start = 0; start < words.size(); ++start) {
+            std::optional<std::size_t> next;
+            std::optional<std::size_t> prev;
+            for (std::size_t i = words.size(); i-- > start;) {
+                next = words[i] ? std::optional(i) : next;
+            }
+            for (std::size_t i = 0; i <= start; ++i) {
+                prev = words[i] ? std::optional(i) : prev;
+            }
+            EXPECT_EQ(next, simd::find_next_nonzero(words, start));
+            EXPECT_EQ(prev, simd::find_prev_nonzero(words, start));
+        }
+    }
+
+    VebLeaf8 leaf;
+    for (unsigned x = 3; x <= VebLeaf8::MAX_KEY; x += 7) {
+        leaf.insert(static_cast<VebLeaf8::Key>(x));
+    }
+    std::vector<uint32_t> keys;
+    leaf.for_each(uint32_t{0x500}, [&](uint32_t key) { keys.push_back(key); });
+    ASSERT_EQ(leaf.size(), keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(0x500u + 3 + 7 * i, keys[i]);
+    }
+}
@@ -1,6 +1,20 @@
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "veb24.hpp"
+#include "veb_epoch.hpp"
+#include "veb_optimistic.hpp"
 
 TEST(Veb24Test, EmptyUntilInsert)
 {
@@ -77,3 +91,325 @@ TEST(Veb24Test, PredecessorAtMax)
     ASSERT_TRUE(pred.has_value());
     EXPECT_EQ(1ull << 23, *pred);
 }
+
+TEST(Veb24Test, RangeBoundsAboveMaxKeyAreClamped)
+{
+    constexpr uint32_t past_max = 0x1000000;
+    VebTree24 tree;
+    tree.insert(5);
+    tree.insert(0x800000);
+    tree.insert(VebTree24::MAX_KEY);
+
+    std::vector<uint32_t> got;
+    auto collect = [&](uint32_t k) { got.push_back(k); };
+    tree.for_each_range(4, past_max, collect);
+    EXPECT_EQ(tree.to_vector(), got);
+    EXPECT_EQ(got.size(), tree.count_range(4, past_max));
+
+    got.clear();
+    tree.for_each_range(
+        past_max, std::numeric_limits<uint32_t>::max(), collect);
+    EXPECT_TRUE(got.empty());
+}
+
+TEST(Veb24Test, ClusterArraysAllocatedOnFirstTouch)
+{
+    // The top-level cluster arrays are paged in as clusters are used, so
+    // an empty tree stays small.
+    EXPECT_LT(sizeof(VebTree24), std::size_t{2u << 10});
+
+    std::vector<uint32_t> keys;
+    for (uint64_t key = 7; key <= VebTree24::MAX_KEY; key += 0x10001) {
+        keys.push_back(static_cast<uint32_t>(key));
+        keys.push_back(static_cast<uint32_t>(key + 1));
+    }
+    VebTree24 tree;
+    for (uint32_t key : keys) {
+        tree.insert(key);
+    }
+    VebTree24 copy = tree;
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+    EXPECT_FALSE(tree.contains(keys.front()));
+    EXPECT_EQ(keys, copy.to_vector());
+    EXPECT_EQ(keys.back(), copy.max());
+    EXPECT_EQ(keys[2], copy.successor(keys[1]));
+
+    tree.insert(keys.back());
+    EXPECT_EQ(std::vector<uint32_t>{keys.back()}, tree.to_vector());
+}
+
+TEST(Veb24Test, MemoryUsageBreaksDownByLevel)
+{
+    VebTree24 tree;
+    auto empty = tree.memory_usage();
+    EXPECT_EQ(1u, empty.nodes[0]);
+    EXPECT_EQ(0u, empty.leaf_bytes);
+    EXPECT_EQ(0u, empty.summary_bytes);
+
+    // One top-level cluster holding a single inline key and two holding
+    // a pair of keys each.
+    std::vector<uint32_t> keys{
+        5,
+        1u << 12,
+        (1u << 12) + 1,
+        2u << 12,
+        (3u << 12) - 1};
+    for (uint32_t key : keys) {
+        tree.insert(key);
+    }
+    auto usage = tree.memory_usage();
+    // Two cluster nodes and the summary.
+    EXPECT_EQ(3u, usage.nodes[1]);
+    EXPECT_GT(usage.nodes[2], 0u);
+    EXPECT_GT(usage.leaf_bytes, 0u);
+    EXPECT_GT(usage.summary_bytes, 0u);
+    EXPECT_GT(usage.total_bytes(), empty.total_bytes());
+    EXPECT_GT(usage.inline_value_bytes, empty.inline_value_bytes);
+    EXPECT_EQ(0u, usage.cluster_map_bytes);
+    EXPECT_GT(usage.reserved_bytes, 0u);
+
+    // clear() returns every slab but keeps the root's pool bookkeeping.
+    tree.clear();
+    auto cleared = tree.memory_usage();
+    EXPECT_EQ(
+        empty.total_bytes() - empty.reserved_bytes,
+        cleared.total_bytes() - cleared.reserved_bytes);
+    EXPECT_LT(cleared.reserved_bytes, usage.reserved_bytes);
+}
+
+TEST(Veb24Test, SnapshotLoadsFromUnseekableStream)
+{
+    // Serves bytes a few at a time and cannot seek, like a pipe. The
+    // block size splits words across blocks.
+    struct PipeBuf : std::streambuf
+    {
+        explicit PipeBuf(std::string bytes) : bytes_(std::move(bytes)) {}
+
+        int_type underflow() override
+        {
+            if (pos_ == bytes_.size()) {
+                return traits_type::eof();
+            }
+            std::size_t block =
+                std::min<std::size_t>(4099, bytes_.size() - pos_);
+            char *first = bytes_.data() + pos_;
+            setg(first, first, first + block);
+            pos_ += block;
+            return traits_type::to_int_type(*first);
+        }
+
+        std::string bytes_;
+        std::size_t pos_ = 0;
+    };
+
+    VebTree24 tree;
+    for (uint32_t key = 0; key < 300000; key += 7) {
+        tree.insert(key);
+    }
+    std::stringstream stream;
+    tree.save(stream);
+    VebTree24().save(stream);
+    stream << "tail";
+
+    PipeBuf pipe(stream.str());
+    std::istream in(&pipe);
+    EXPECT_EQ(tree.to_vector(), VebTree24::load(in).to_vector());
+    EXPECT_TRUE(VebTree24::load(in).empty());
+    std::string rest;
+    in >> rest;
+    EXPECT_EQ("tail", rest);
+}
+
+TEST(Veb24Test, OptimisticTreeReadsAlongsideWriters)
+{
+    OptimisticVebTree<24> optimistic;
+    VebTree24 serial;
+    std::mt19937_64 rng(424);
+    std::vector<uint32_t> keys(20000);
+    for (auto &key : keys) {
+        key = static_cast<uint32_t>(rng() & VebTree24::MAX_KEY);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), rng);
+    // Even-indexed keys are present throughout; writers add and remove
+    // the odd-indexed ones while readers query.
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        optimistic.insert(keys[i]);
+        serial.insert(keys[i]);
+    }
+    std::atomic<bool> writing{true};
+    std::atomic<std::size_t> misses{0};
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 3; ++t) {
+        readers.emplace_back([&, t] {
+            std::size_t missed = 0;
+            for (std::size_t i = t * 2; writing; i = (i + 6) % keys.size()) {
+                missed += !optimistic.contains(keys[i]);
+                auto next = optimistic.successor(keys[i]);
+                missed += next && *next <= keys[i];
+                auto prev = optimistic.predecessor(keys[i]);
+                missed += prev && *prev >= keys[i];
+            }
+            misses += missed;
+        });
+    }
+    for (int round = 0; round < 3; ++round) {
+        for (std::size_t i = 1; i < keys.size(); i += 2) {
+            optimistic.insert(keys[i]);
+        }
+        for (std::size_t i = 1; i < keys.size(); i += 2) {
+            optimistic.erase(keys[i]);
+        }
+    }
+    writing = false;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(0u, misses.load());
+    EXPECT_EQ(serial.size(), optimistic.size());
+    EXPECT_EQ(serial.min(), optimistic.min());
+    EXPECT_EQ(serial.max(), optimistic.max());
+    for (int i = 0; i < 2000; ++i) {
+        auto x = static_cast<uint32_t>(rng() & VebTree24::MAX_KEY);
+        EXPECT_EQ(serial.contains(x), optimistic.contains(x));
+        EXPECT_EQ(serial.successor(x), optimistic.successor(x));
+        EXPECT_EQ(serial.predecessor(x), optimistic.predecessor(x));
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        optimistic.erase(keys[i]);
+    }
+    EXPECT_TRUE(optimistic.empty());
+    EXPECT_FALSE(optimistic.min());
+}
+
+TEST(Veb24Test, EpochPoolWaitsForPinnedReaders)
+{
+    veb_detail::EpochDomain domain;
+    veb_detail::EpochPool<int> pool(domain);
+    int *first = pool.acquire();
+    int *second = nullptr;
+    {
+        // A reader pinned before the retire may still hold `first`.
+        veb_detail::EpochGuard pin(domain);
+        pool.retire(first);
+        second = pool.acquire();
+        EXPECT_NE(first, second);
+        EXPECT_EQ(std::make_pair(std::size_t{1}, std::size_t{0}),
+                  pool.counts());
+    }
+    // Once it unpins, the next acquire reuses the retired node.
+    EXPECT_EQ(first, pool.acquire());
+    EXPECT_EQ(std::make_pair(std::size_t{0}, std::size_t{0}), pool.counts());
+    pool.retire(first);
+    pool.retire(second);
+}
+
+TEST(Veb24Test, FlatSummaryMatchesRecursiveSummary)
+{
+    std::mt19937 rng(2422);
+    std::vector<uint32_t> keys;
+    for (int i = 0; i < 20000; ++i) {
+        // Mostly a few hundred clusters, with some spread over all 4096.
+        uint32_t key = rng() & VebTree24::MAX_KEY;
+        keys.push_back(i % 4 == 0 ? key : key & 0x3FFFFF);
+    }
+    keys.push_back(0);
+    keys.push_back(VebTree24::MAX_KEY);
+    VebTop24 recursive;
+    VebTop24Flat flat;
+    for (uint32_t key : keys) {
+        EXPECT_EQ(recursive.insert(key), flat.insert(key));
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 3) {
+        EXPECT_EQ(recursive.erase(keys[i]), flat.erase(keys[i]));
+    }
+    ASSERT_EQ(recursive.size(), flat.size());
+    EXPECT_EQ(recursive.min(), flat.min());
+    EXPECT_EQ(recursive.max(), flat.max());
+
+    std::vector<uint32_t> probes;
+    for (int i = 0; i < 4000; ++i) {
+        probes.push_back(
+            i % 2 == 0 ? keys[rng() % keys.size()] + 1
+                       : rng() & VebTree24::MAX_KEY);
+    }
+    for (uint32_t probe : probes) {
+        EXPECT_EQ(recursive.successor(probe), flat.successor(probe));
+        EXPECT_EQ(recursive.predecessor(probe), flat.predecessor(probe));
+    }
+    std::vector<std::optional<uint32_t>> want(probes.size());
+    std::vector<std::optional<uint32_t>> got(probes.size());
+    recursive.successor_batch(probes, want);
+    flat.successor_batch(probes, got);
+    EXPECT_EQ(want, got);
+    recursive.predecessor_batch(probes, want);
+    flat.predecessor_batch(probes, got);
+    EXPECT_EQ(want, got);
+
+    VebTop24Flat copy(flat);
+    VebTop24Flat other;
+    for (uint32_t probe : probes) {
+        other.insert(probe & 0x0FFFFF);
+    }
+    copy.union_with(other);
+    flat.intersect_with(other);
+    VebTop24 recursive_other;
+    other.for_each([&](uint32_t key) { recursive_other.insert(key); });
+    VebTop24 recursive_copy(recursive);
+    recursive_copy.union_with(recursive_other);
+    recursive.intersect_with(recursive_other);
+
+    auto keys_of = [](auto const &tree) {
+        std::vector<uint32_t> out;
+        tree.for_each([&](uint32_t key) { out.push_back(key); });
+        return out;
+    };
+    EXPECT_EQ(keys_of(recursive_copy), keys_of(copy));
+    EXPECT_EQ(keys_of(recursive), keys_of(flat));
+    EXPECT_EQ(
+        recursive_copy.erase_range(0x100000, 0x9FFFFF),
+        copy.erase_range(0x100000, 0x9FFFFF));
+    EXPECT_EQ(keys_of(recursive_copy), keys_of(copy));
+
+    std::stringstream snapshot;
+    veb_detail::save_snapshot(copy, snapshot);
+    VebTop24Flat loaded;
+    veb_detail::load_snapshot(loaded, snapshot);
+    EXPECT_EQ(keys_of(copy), keys_of(loaded));
+    EXPECT_EQ(copy.successor(0x100000), loaded.successor(0x100000));
+}
+
+TEST(Veb24Test, SnapshotRejectsOtherNodeLayout)
+{
+    // Same width, different summary encoding: each must refuse the
+    // other's snapshot instead of misreading it.
+    static_assert(VebTop24::SNAPSHOT_LAYOUT != VebTop24Flat::SNAPSHOT_LAYOUT);
+    VebTop24 recursive;
+    VebTop24Flat flat;
+    for (uint32_t key = 0; key < 100000; key += 37) {
+        recursive.insert(key);
+        flat.insert(key);
+    }
+
+    std::stringstream recursive_snapshot;
+    veb_detail::save_snapshot(recursive, recursive_snapshot);
+    VebTop24Flat flat_loaded;
+    EXPECT_THROW(
+        veb_detail::load_snapshot(flat_loaded, recursive_snapshot),
+        std::runtime_error);
+
+    std::stringstream flat_snapshot;
+    veb_detail::save_snapshot(flat, flat_snapshot);
+    VebTop24 recursive_loaded;
+    EXPECT_THROW(
+        veb_detail::load_snapshot(recursive_loaded, flat_snapshot),
+        std::runtime_error);
+
+    VebTop24Flat reloaded;
+    std::stringstream again;
+    veb_detail::save_snapshot(flat, again);
+    veb_detail::load_snapshot(reloaded, again);
+    EXPECT_EQ(flat.size(), reloaded.size());
+}
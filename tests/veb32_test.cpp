@@ -1,9 +1,17 @@
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <optional>
+#include <random>
+#include <set>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include "veb_branch.hpp"
+#include "veb32.hpp"
+#include "veb_optimistic.hpp"
 
 using Veb32 = VebTop32;
 
@@ -86,3 +94,245 @@ TEST(Veb32Test, MinMaxAndOrdering)
     std::sort(expected.begin(), expected.end());
     EXPECT_EQ(expected, out);
 }
+
+TEST(Veb32Test, ClusterArraysAllocatedOnFirstTouch)
+{
+    // The top-level cluster arrays are paged in as clusters are used, so
+    // an empty tree stays small.
+    EXPECT_LT(sizeof(VebTree32), std::size_t{32u << 10});
+
+    std::vector<uint32_t> keys;
+    for (uint64_t key = 7; key <= VebTree32::MAX_KEY; key += 0x1000001) {
+        keys.push_back(static_cast<uint32_t>(key));
+        keys.push_back(static_cast<uint32_t>(key + 1));
+    }
+    VebTree32 tree;
+    for (uint32_t key : keys) {
+        tree.insert(key);
+    }
+    VebTree32 copy = tree;
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+    EXPECT_FALSE(tree.contains(keys.front()));
+    EXPECT_EQ(keys, copy.to_vector());
+    EXPECT_EQ(keys.back(), copy.max());
+    EXPECT_EQ(keys[2], copy.successor(keys[1]));
+
+    tree.insert(keys.back());
+    EXPECT_EQ(std::vector<uint32_t>{keys.back()}, tree.to_vector());
+}
+
+TEST(Veb32Test, MemoryUsageBreaksDownByLevel)
+{
+    VebTree32 tree;
+    auto empty = tree.memory_usage();
+    EXPECT_EQ(1u, empty.nodes[0]);
+    EXPECT_EQ(0u, empty.leaf_bytes);
+    EXPECT_EQ(0u, empty.summary_bytes);
+
+    // One top-level cluster holding a single inline key and two holding
+    // a pair of keys each.
+    std::vector<uint32_t> keys{
+        5,
+        1u << 16,
+        (1u << 16) + 1,
+        2u << 16,
+        (3u << 16) - 1};
+    for (uint32_t key : keys) {
+        tree.insert(key);
+    }
+    auto usage = tree.memory_usage();
+    // Two cluster nodes and the summary.
+    EXPECT_EQ(3u, usage.nodes[1]);
+    EXPECT_GT(usage.nodes[2], 0u);
+    EXPECT_GT(usage.leaf_bytes, 0u);
+    EXPECT_GT(usage.summary_bytes, 0u);
+    EXPECT_GT(usage.total_bytes(), empty.total_bytes());
+    EXPECT_GT(usage.inline_value_bytes, empty.inline_value_bytes);
+    EXPECT_EQ(0u, usage.cluster_map_bytes);
+    EXPECT_GT(usage.reserved_bytes, 0u);
+
+    // clear() returns every slab but keeps the root's pool bookkeeping.
+    tree.clear();
+    auto cleared = tree.memory_usage();
+    EXPECT_EQ(
+        empty.total_bytes() - empty.reserved_bytes,
+        cleared.total_bytes() - cleared.reserved_bytes);
+    EXPECT_LT(cleared.reserved_bytes, usage.reserved_bytes);
+}
+
+TEST(Veb32Test, OptimisticTreeReadsAlongsideWriters)
+{
+    OptimisticVebTree<32> optimistic;
+    VebTree32 serial;
+    std::mt19937_64 rng(432);
+    std::vector<uint32_t> keys(20000);
+    for (auto &key : keys) {
+        key = static_cast<uint32_t>(rng() & VebTree32::MAX_KEY);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), rng);
+    // Even-indexed keys are present throughout; writers add and remove
+    // the odd-indexed ones while readers query.
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        optimistic.insert(keys[i]);
+        serial.insert(keys[i]);
+    }
+    std::atomic<bool> writing{true};
+    std::atomic<std::size_t> misses{0};
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 3; ++t) {
+        readers.emplace_back([&, t] {
+            std::size_t missed = 0;
+            for (std::size_t i = t * 2; writing; i = (i + 6) % keys.size()) {
+                missed += !optimistic.contains(keys[i]);
+                auto next = optimistic.successor(keys[i]);
+                missed += next && *next <= keys[i];
+                auto prev = optimistic.predecessor(keys[i]);
+                missed += prev && *prev >= keys[i];
+            }
+            misses += missed;
+        });
+    }
+    for (int round = 0; round < 3; ++round) {
+        for (std::size_t i = 1; i < keys.size(); i += 2) {
+            optimistic.insert(keys[i]);
+        }
+        for (std::size_t i = 1; i < keys.size(); i += 2) {
+            optimistic.erase(keys[i]);
+        }
+    }
+    writing = false;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(0u, misses.load());
+    EXPECT_EQ(serial.size(), optimistic.size());
+    EXPECT_EQ(serial.min(), optimistic.min());
+    EXPECT_EQ(serial.max(), optimistic.max());
+    for (int i = 0; i < 2000; ++i) {
+        auto x = static_cast<uint32_t>(rng() & VebTree32::MAX_KEY);
+        EXPECT_EQ(serial.contains(x), optimistic.contains(x));
+        EXPECT_EQ(serial.successor(x), optimistic.successor(x));
+        EXPECT_EQ(serial.predecessor(x), optimistic.predecessor(x));
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        optimistic.erase(keys[i]);
+    }
+    EXPECT_TRUE(optimistic.empty());
+    EXPECT_FALSE(optimistic.min());
+}
+
+TEST(Veb32Test, OptimisticTreeRecyclesEmptiedClusters)
+{
+    OptimisticVebTree<32> optimistic;
+    // Every key has its own cluster, so each erase retires one and each
+    // insert takes one back while readers walk the tree.
+    std::vector<uint32_t> keys;
+    for (uint32_t hi = 0; hi < 512; ++hi) {
+        keys.push_back((hi * 97 % 512) << 16 | (hi * 31 & 0xffff));
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        optimistic.insert(keys[i]);
+    }
+    std::atomic<bool> writing{true};
+    std::atomic<std::size_t> misses{0};
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 3; ++t) {
+        readers.emplace_back([&, t] {
+            std::size_t missed = 0;
+            for (std::size_t i = t * 2; writing; i = (i + 6) % keys.size()) {
+                missed += !optimistic.contains(keys[i]);
+                auto next = optimistic.successor(keys[i]);
+                missed += next && *next <= keys[i];
+                missed += !optimistic.min().has_value();
+            }
+            misses += missed;
+        });
+    }
+    for (int round = 0; round < 50; ++round) {
+        for (std::size_t i = 1; i < keys.size(); i += 2) {
+            EXPECT_TRUE(optimistic.insert(keys[i]));
+        }
+        for (std::size_t i = 1; i < keys.size(); i += 2) {
+            EXPECT_TRUE(optimistic.erase(keys[i]));
+        }
+    }
+    writing = false;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(0u, misses.load());
+    EXPECT_EQ(keys.size() / 2, optimistic.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(i % 2 == 0, optimistic.contains(keys[i]));
+    }
+}
+
+TEST(Veb32Test, FlatSummaryMatchesStdSet)
+{
+    // The root's 65536-cluster summary is one bitmap here instead of a
+    // VebBranch16; every query that walks it must agree with std::set.
+    std::mt19937_64 rng(3222);
+    VebTop32Flat flat;
+    std::set<uint32_t> expected;
+    auto insert = [&](uint32_t key) {
+        EXPECT_EQ(expected.insert(key).second, flat.insert(key));
+    };
+    for (int i = 0; i < 30000; ++i) {
+        // Dense runs inside a few clusters, and keys spread over all of
+        // them so that whole summary words are empty or full.
+        auto key = static_cast<uint32_t>(rng());
+        insert(i % 3 == 0 ? key : (key & 0x00FF'FFFF) | 0x4200'0000);
+    }
+    insert(0);
+    insert(std::numeric_limits<uint32_t>::max());
+    std::vector<uint32_t> erased(expected.begin(), expected.end());
+    std::shuffle(erased.begin(), erased.end(), rng);
+    erased.resize(erased.size() / 3);
+    for (uint32_t key : erased) {
+        EXPECT_EQ(expected.erase(key) == 1, flat.erase(key));
+        EXPECT_FALSE(flat.erase(key));
+    }
+    ASSERT_EQ(expected.size(), flat.size());
+    EXPECT_EQ(*expected.begin(), flat.min());
+    EXPECT_EQ(*expected.rbegin(), flat.max());
+
+    for (int i = 0; i < 5000; ++i) {
+        auto probe = static_cast<uint32_t>(rng());
+        if (i % 2 == 0) {
+            probe = (probe & 0x00FF'FFFF) | 0x4200'0000;
+        }
+        EXPECT_EQ(expected.count(probe) == 1, flat.contains(probe));
+        auto next = expected.upper_bound(probe);
+        EXPECT_EQ(
+            next == expected.end() ? std::nullopt
+                                   : std::optional<uint32_t>(*next),
+            flat.successor(probe));
+        auto prev = expected.lower_bound(probe);
+        EXPECT_EQ(
+            prev == expected.begin() ? std::nullopt
+                                     : std::optional<uint32_t>(*--prev),
+            flat.predecessor(probe));
+    }
+
+    for (int i = 0; i < 200; ++i) {
+        auto lo = static_cast<uint32_t>(rng());
+        auto hi = static_cast<uint32_t>(rng());
+        if (i % 2 == 0) {
+            lo = (lo & 0x00FF'FFFF) | 0x4200'0000;
+            hi = lo + static_cast<uint32_t>(rng() % 0x0100'0000);
+        }
+        std::vector<uint32_t> want(
+            expected.lower_bound(lo),
+            lo > hi ? expected.lower_bound(lo) : expected.upper_bound(hi));
+        std::vector<uint32_t> got;
+        flat.for_each_range(lo, hi, [&](uint32_t key) { got.push_back(key); });
+        EXPECT_EQ(want, got);
+    }
+
+    std::vector<uint32_t> all;
+    flat.for_each([&](uint32_t key) { all.push_back(key); });
+    EXPECT_EQ(std::vector<uint32_t>(expected.begin(), expected.end()), all);
+}
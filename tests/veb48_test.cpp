@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <limits>
+#include <random>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -93,3 +94,117 @@ TEST(Veb48Test, MinMaxAndOrdering)
     std::sort(expected.begin(), expected.end());
     EXPECT_EQ(expected, vec);
 }
+
+TEST(Veb48Test, RangeBoundsAboveMaxKeyAreClamped)
+{
+    constexpr uint64_t past_max = uint64_t{1} << 48;
+    VebTree48 tree;
+    tree.insert(5);
+    tree.insert(uint64_t{1} << 47);
+    tree.insert(VebTree48::MAX_KEY);
+
+    std::vector<uint64_t> got;
+    auto collect = [&](uint64_t k) { got.push_back(k); };
+    tree.for_each_range(4, past_max, collect);
+    EXPECT_EQ(tree.to_vector(), got);
+    EXPECT_EQ(got.size(), tree.count_range(4, past_max));
+
+    got.clear();
+    tree.for_each_range(
+        past_max, std::numeric_limits<uint64_t>::max(), collect);
+    EXPECT_TRUE(got.empty());
+}
+
+TEST(Veb48Test, RankedLayoutMatchesHashedLayout)
+{
+    // Keys share their upper bits in runs so the inner sparse levels,
+    // where the layouts differ, hold many clusters.
+    std::mt19937_64 rng(4812);
+    std::vector<uint64_t> keys;
+    for (int i = 0; i < 400; ++i) {
+        auto base = static_cast<uint64_t>(rng() & VebTree48::MAX_KEY);
+        for (int j = 0; j < 100; ++j) {
+            keys.push_back((base ^ (rng() & 0xFFFFFF)) & VebTree48::MAX_KEY);
+        }
+    }
+    VebTop48 hashed;
+    VebTop48Ranked ranked;
+    for (uint64_t key : keys) {
+        EXPECT_EQ(hashed.insert(key), ranked.insert(key));
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 4) {
+        EXPECT_EQ(hashed.erase(keys[i]), ranked.erase(keys[i]));
+    }
+    ASSERT_EQ(hashed.size(), ranked.size());
+
+    std::vector<uint64_t> hashed_keys;
+    std::vector<uint64_t> ranked_keys;
+    hashed.for_each([&](uint64_t key) { hashed_keys.push_back(key); });
+    ranked.for_each([&](uint64_t key) { ranked_keys.push_back(key); });
+    ASSERT_EQ(hashed_keys, ranked_keys);
+    EXPECT_TRUE(std::is_sorted(ranked_keys.begin(), ranked_keys.end()));
+
+    for (int i = 0; i < 2000; ++i) {
+        uint64_t probe = i % 2 == 0
+                             ? keys[rng() % keys.size()] + 1
+                             : static_cast<uint64_t>(
+                                   rng() & VebTree48::MAX_KEY);
+        EXPECT_EQ(hashed.contains(probe), ranked.contains(probe));
+        EXPECT_EQ(hashed.successor(probe), ranked.successor(probe));
+        EXPECT_EQ(hashed.predecessor(probe), ranked.predecessor(probe));
+        EXPECT_EQ(hashed.rank(probe), ranked.rank(probe));
+    }
+
+    uint64_t lo = hashed_keys[hashed_keys.size() / 4];
+    uint64_t hi = hashed_keys[hashed_keys.size() / 2];
+    std::vector<uint64_t> in_range;
+    ranked.for_each_range(
+        lo, hi, [&](uint64_t key) { in_range.push_back(key); });
+    EXPECT_EQ(
+        std::vector<uint64_t>(
+            hashed_keys.begin() + hashed_keys.size() / 4,
+            hashed_keys.begin() + hashed_keys.size() / 2 + 1),
+        in_range);
+    EXPECT_EQ(hashed.erase_range(lo, hi), ranked.erase_range(lo, hi));
+    EXPECT_EQ(hashed.size(), ranked.size());
+}
+
+TEST(Veb48Test, MemoryUsageBreaksDownByLevel)
+{
+    VebTree48 tree;
+    auto empty = tree.memory_usage();
+    EXPECT_EQ(1u, empty.nodes[0]);
+    // The summary is held by value, so it exists before any insert.
+    EXPECT_EQ(1u, empty.nodes[1]);
+    EXPECT_EQ(0u, empty.leaf_bytes);
+
+    // One top-level cluster holding a single inline key and two holding
+    // a pair of keys each.
+    std::vector<uint64_t> keys{
+        5,
+        uint64_t{1} << 24,
+        (uint64_t{1} << 24) + 1,
+        uint64_t{2} << 24,
+        (uint64_t{3} << 24) - 1};
+    for (uint64_t key : keys) {
+        tree.insert(key);
+    }
+    auto usage = tree.memory_usage();
+    // Two cluster nodes and the summary.
+    EXPECT_EQ(3u, usage.nodes[1]);
+    EXPECT_GT(usage.nodes[2], 0u);
+    EXPECT_GT(usage.leaf_bytes, 0u);
+    EXPECT_GT(usage.summary_bytes, 0u);
+    EXPECT_GT(usage.total_bytes(), empty.total_bytes());
+    // The root's map holds the three clusters; the maps below hold theirs.
+    EXPECT_GE(usage.cluster_map_size, 3u);
+    EXPECT_GE(usage.cluster_map_capacity, usage.cluster_map_size);
+    EXPECT_GT(usage.cluster_map_bytes, empty.cluster_map_bytes);
+
+    // Cleared maps may keep their capacity, but every node is gone.
+    tree.clear();
+    auto cleared = tree.memory_usage();
+    EXPECT_EQ(empty.nodes, cleared.nodes);
+    EXPECT_EQ(0u, cleared.leaf_bytes);
+    EXPECT_EQ(0u, cleared.cluster_map_size);
+}
@@ -1,10 +1,12 @@
 #include <algorithm>
-#include <limits>
+#include <optional>
+#include <random>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include "veb_branch.hpp"
+#include "veb64.hpp"
 
 using Veb64 = VebTop64;
 
@@ -87,3 +89,177 @@ TEST(Veb64Test, MinMaxAndOrdering)
     std::sort(expected.begin(), expected.end());
     EXPECT_EQ(expected, out);
 }
+
+TEST(Veb64Test, RankedLayoutMatchesHashedLayout)
+{
+    // Keys share their upper bits in runs so the inner sparse levels,
+    // where the layouts differ, hold many clusters.
+    std::mt19937_64 rng(6412);
+    std::vector<uint64_t> keys;
+    for (int i = 0; i < 400; ++i) {
+        auto base = static_cast<uint64_t>(rng() & VebTree64::MAX_KEY);
+        for (int j = 0; j < 100; ++j) {
+            keys.push_back((base ^ (rng() & 0xFFFFFF)) & VebTree64::MAX_KEY);
+        }
+    }
+    VebTop64 hashed;
+    VebTop64Ranked ranked;
+    for (uint64_t key : keys) {
+        EXPECT_EQ(hashed.insert(key), ranked.insert(key));
+    }
+    for (std::size_t i = 0; i < keys.size(); i += 4) {
+        EXPECT_EQ(hashed.erase(keys[i]), ranked.erase(keys[i]));
+    }
+    ASSERT_EQ(hashed.size(), ranked.size());
+
+    std::vector<uint64_t> hashed_keys;
+    std::vector<uint64_t> ranked_keys;
+    hashed.for_each([&](uint64_t key) { hashed_keys.push_back(key); });
+    ranked.for_each([&](uint64_t key) { ranked_keys.push_back(key); });
+    ASSERT_EQ(hashed_keys, ranked_keys);
+    EXPECT_TRUE(std::is_sorted(ranked_keys.begin(), ranked_keys.end()));
+
+    for (int i = 0; i < 2000; ++i) {
+        uint64_t probe = i % 2 == 0
+                             ? keys[rng() % keys.size()] + 1
+                             : static_cast<uint64_t>(
+                                   rng() & VebTree64::MAX_KEY);
+        EXPECT_EQ(hashed.contains(probe), ranked.contains(probe));
+        EXPECT_EQ(hashed.successor(probe), ranked.successor(probe));
+        EXPECT_EQ(hashed.predecessor(probe), ranked.predecessor(probe));
+        EXPECT_EQ(hashed.rank(probe), ranked.rank(probe));
+    }
+
+    uint64_t lo = hashed_keys[hashed_keys.size() / 4];
+    uint64_t hi = hashed_keys[hashed_keys.size() / 2];
+    std::vector<uint64_t> in_range;
+    ranked.for_each_range(
+        lo, hi, [&](uint64_t key) { in_range.push_back(key); });
+    EXPECT_EQ(
+        std::vector<uint64_t>(
+            hashed_keys.begin() + hashed_keys.size() / 4,
+            hashed_keys.begin() + hashed_keys.size() / 2 + 1),
+        in_range);
+    EXPECT_EQ(hashed.erase_range(lo, hi), ranked.erase_range(lo, hi));
+    EXPECT_EQ(hashed.size(), ranked.size());
+}
+
+TEST(Veb64Test, RankedLayoutFollowsBatchUpdates)
+{
+    // Batch updates and set algebra touch the summary and the cluster map
+    // at different times; ranked lookups must still land on the right
+    // entries once each update returns.
+    std::mt19937_64 rng(6413);
+    auto make_keys = [&](int runs) {
+        std::vector<uint64_t> keys;
+        for (int i = 0; i < runs; ++i) {
+            uint64_t base = rng();
+            for (int j = 0; j < 200; ++j) {
+                keys.push_back(base ^ (rng() & 0xFFFFFFF));
+            }
+        }
+        return keys;
+    };
+    std::vector<uint64_t> probes = make_keys(20);
+    auto expect_same = [&](VebTop64 const &hashed,
+                           VebTop64Ranked const &ranked) {
+        std::vector<uint64_t> hashed_keys;
+        std::vector<uint64_t> ranked_keys;
+        hashed.for_each([&](uint64_t key) { hashed_keys.push_back(key); });
+        ranked.for_each([&](uint64_t key) { ranked_keys.push_back(key); });
+        ASSERT_EQ(hashed_keys, ranked_keys);
+        for (std::size_t i = 0; i < hashed_keys.size(); i += 7) {
+            probes.push_back(hashed_keys[i]);
+            probes.push_back(hashed_keys[i] + 1);
+        }
+        std::vector<std::optional<uint64_t>> hashed_out(probes.size());
+        std::vector<std::optional<uint64_t>> ranked_out(probes.size());
+        hashed.successor_batch(probes, hashed_out);
+        ranked.successor_batch(probes, ranked_out);
+        EXPECT_EQ(hashed_out, ranked_out);
+        hashed.predecessor_batch(probes, hashed_out);
+        ranked.predecessor_batch(probes, ranked_out);
+        EXPECT_EQ(hashed_out, ranked_out);
+        for (uint64_t probe : probes) {
+            EXPECT_EQ(hashed.contains(probe), ranked.contains(probe));
+            EXPECT_EQ(hashed.rank(probe), ranked.rank(probe));
+        }
+    };
+
+    std::vector<uint64_t> keys = make_keys(60);
+    VebTop64 hashed;
+    VebTop64Ranked ranked;
+    hashed.batch_insert(keys);
+    ranked.batch_insert(keys);
+    expect_same(hashed, ranked);
+
+    std::vector<uint64_t> doomed(keys.begin(), keys.begin() + 4000);
+    hashed.batch_erase(doomed);
+    ranked.batch_erase(doomed);
+    expect_same(hashed, ranked);
+
+    std::vector<uint64_t> other_keys = make_keys(30);
+    other_keys.insert(other_keys.end(), keys.begin(), keys.begin() + 6000);
+    VebTop64 hashed_other;
+    VebTop64Ranked ranked_other;
+    hashed_other.batch_insert(other_keys);
+    ranked_other.batch_insert(other_keys);
+
+    VebTop64Ranked copy = ranked;
+    expect_same(hashed, copy);
+
+    hashed.symmetric_difference_with(hashed_other);
+    ranked.symmetric_difference_with(ranked_other);
+    expect_same(hashed, ranked);
+    hashed.union_with(hashed_other);
+    ranked.union_with(ranked_other);
+    expect_same(hashed, ranked);
+    hashed.difference_with(hashed_other);
+    ranked.difference_with(ranked_other);
+    expect_same(hashed, ranked);
+    hashed.union_with(hashed_other);
+    ranked.union_with(ranked_other);
+    hashed.intersect_with(hashed_other);
+    ranked.intersect_with(ranked_other);
+    expect_same(hashed, ranked);
+}
+
+TEST(Veb64Test, MemoryUsageBreaksDownByLevel)
+{
+    VebTree64 tree;
+    auto empty = tree.memory_usage();
+    EXPECT_EQ(1u, empty.nodes[0]);
+    // The summary is held by value, so it exists before any insert.
+    EXPECT_EQ(1u, empty.nodes[1]);
+    EXPECT_EQ(0u, empty.leaf_bytes);
+
+    // One top-level cluster holding a single inline key and two holding
+    // a pair of keys each.
+    std::vector<uint64_t> keys{
+        5,
+        uint64_t{1} << 32,
+        (uint64_t{1} << 32) + 1,
+        uint64_t{2} << 32,
+        (uint64_t{3} << 32) - 1};
+    for (uint64_t key : keys) {
+        tree.insert(key);
+    }
+    auto usage = tree.memory_usage();
+    // Two cluster nodes and the summary.
+    EXPECT_EQ(3u, usage.nodes[1]);
+    EXPECT_GT(usage.nodes[2], 0u);
+    EXPECT_GT(usage.leaf_bytes, 0u);
+    EXPECT_GT(usage.summary_bytes, 0u);
+    EXPECT_GT(usage.total_bytes(), empty.total_bytes());
+    // The root's map holds the three clusters; the maps below hold theirs.
+    EXPECT_GE(usage.cluster_map_size, 3u);
+    EXPECT_GE(usage.cluster_map_capacity, usage.cluster_map_size);
+    EXPECT_GT(usage.cluster_map_bytes, empty.cluster_map_bytes);
+
+    // Cleared maps may keep their capacity, but every node is gone.
+    tree.clear();
+    auto cleared = tree.memory_usage();
+    EXPECT_EQ(empty.nodes, cleared.nodes);
+    EXPECT_EQ(0u, cleared.leaf_bytes);
+    EXPECT_EQ(0u, cleared.cluster_map_size);
+}
@@ -0,0 +1,868 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "veb24.hpp"
+#include "veb32.hpp"
+#include "veb48.hpp"
+#include "veb64.hpp"
+#include "veb_branch.hpp"
+#include "veb_concurrent.hpp"
+#include "veb_frozen.hpp"
+
+// Tests that read the same at every width. Cases that depend on one
+// width's layout stay in that width's own test file.
+
+template <class TreeT, uint64_t NearMask>
+struct Width
+{
+    using Tree = TreeT;
+    using Key = typename Tree::Key;
+    static constexpr unsigned BITS = Tree::SUBTREE_BITS;
+    static constexpr Key MAX_KEY = Tree::MAX_KEY;
+    // A key XOR-ed with bits under NEAR_MASK usually shares its leaf or
+    // the cluster above; under WIDE_MASK, its top-level cluster.
+    static constexpr Key NEAR_MASK = NearMask;
+    static constexpr Key WIDE_MASK = MAX_KEY >> (BITS / 2);
+    // Start of a dense run well away from both ends.
+    static constexpr Key HIGH_KEY = Key(1) << (BITS - 4);
+
+    static Key random_key(std::mt19937_64 &rng)
+    {
+        return static_cast<Key>(rng() & MAX_KEY);
+    }
+};
+
+using Widths = ::testing::Types<
+    Width<VebTree24, 0x3F>, Width<VebTree32, 0xFF>, Width<VebTree48, 0xFFF>,
+    Width<VebTree64, 0xFFFF>>;
+
+struct WidthName
+{
+    template <class W>
+    static std::string GetName(int)
+    {
+        return "Veb" + std::to_string(W::BITS);
+    }
+};
+
+template <class W>
+class VebTreeTest : public ::testing::Test
+{
+};
+
+TYPED_TEST_SUITE(VebTreeTest, Widths, WidthName);
+
+TYPED_TEST(VebTreeTest, BatchInsertMatchesPerKeyInsert)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS);
+    std::vector<Key> keys;
+    for (int i = 0; i < 4096; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+    keys.push_back(keys.front());
+
+    Tree expected;
+    Tree batched;
+    for (std::size_t i = 0; i < keys.size(); i += 64) {
+        batched.insert(keys[i]);
+    }
+    for (auto k : keys) {
+        expected.insert(k);
+    }
+    batched.batch_insert(keys);
+
+    EXPECT_EQ(expected.to_vector(), batched.to_vector());
+    EXPECT_EQ(expected.min(), batched.min());
+    EXPECT_EQ(expected.max(), batched.max());
+}
+
+TYPED_TEST(VebTreeTest, BatchEraseMatchesPerKeyErase)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 1);
+    std::vector<Key> keys;
+    for (int i = 0; i < 4096; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+
+    Tree expected;
+    Tree batched;
+    for (auto k : keys) {
+        expected.insert(k);
+        batched.insert(k);
+    }
+
+    std::vector<Key> doomed;
+    for (std::size_t i = 0; i < keys.size(); i += 3) {
+        doomed.push_back(keys[i]);
+        doomed.push_back(keys[i] ^ 1);
+    }
+    for (auto k : doomed) {
+        expected.erase(k);
+    }
+    batched.batch_erase(doomed);
+
+    EXPECT_EQ(expected.to_vector(), batched.to_vector());
+    EXPECT_EQ(expected.min(), batched.min());
+    EXPECT_EQ(expected.max(), batched.max());
+
+    batched.batch_erase(keys);
+    EXPECT_TRUE(batched.empty());
+    EXPECT_FALSE(batched.min().has_value());
+}
+
+TYPED_TEST(VebTreeTest, BatchQueriesMatchScalarQueries)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 2);
+    Tree tree;
+    std::vector<Key> queries = {0, Tree::MAX_KEY};
+    for (int i = 0; i < 2048; ++i) {
+        Key key = TypeParam::random_key(rng);
+        tree.insert(key);
+        tree.insert(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+        queries.push_back(key);
+        queries.push_back(TypeParam::random_key(rng));
+    }
+
+    std::vector<std::optional<Key>> succ(queries.size());
+    std::vector<std::optional<Key>> pred(queries.size());
+    auto hits = std::make_unique<bool[]>(queries.size());
+    tree.successor_batch(queries, succ);
+    tree.predecessor_batch(queries, pred);
+    tree.contains_batch(queries, {hits.get(), queries.size()});
+
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        EXPECT_EQ(tree.successor(queries[i]), succ[i]);
+        EXPECT_EQ(tree.predecessor(queries[i]), pred[i]);
+        EXPECT_EQ(tree.contains(queries[i]), hits[i]);
+    }
+}
+
+TYPED_TEST(VebTreeTest, ParallelInsertMatchesBatchInsert)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 3);
+    std::vector<Key> keys;
+    for (int i = 0; i < 40000; ++i) {
+        keys.push_back(TypeParam::random_key(rng));
+    }
+    // One hot cluster large enough to be split across threads on its own.
+    for (Key i = 0; i < 40000; ++i) {
+        keys.push_back(TypeParam::HIGH_KEY + i * 7);
+    }
+
+    Tree expected;
+    Tree parallel;
+    expected.insert(keys[3]);
+    parallel.insert(keys[3]);
+    expected.batch_insert(keys);
+    parallel.parallel_insert(keys, 4);
+
+    EXPECT_EQ(expected.to_vector(), parallel.to_vector());
+}
+
+TYPED_TEST(VebTreeTest, FromSortedMatchesPerKeyInsert)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 4);
+    std::vector<Key> keys;
+    for (int i = 0; i < 4096; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+    // A dense run so some clusters fill whole leaves.
+    for (Key i = 0; i < 5000; ++i) {
+        keys.push_back(TypeParam::HIGH_KEY + i);
+    }
+    keys.push_back(Tree::MAX_KEY);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    Tree expected;
+    for (auto k : keys) {
+        expected.insert(k);
+    }
+    auto built = Tree::from_sorted(keys);
+
+    EXPECT_EQ(expected.to_vector(), built.to_vector());
+    EXPECT_EQ(expected.min(), built.min());
+    EXPECT_EQ(expected.max(), built.max());
+
+    // The built tree must stay consistent under further updates.
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        expected.erase(keys[i]);
+        built.erase(keys[i]);
+    }
+    expected.insert(keys[0] ^ 1);
+    built.insert(keys[0] ^ 1);
+    EXPECT_EQ(expected.to_vector(), built.to_vector());
+    EXPECT_EQ(expected.successor(keys[0]), built.successor(keys[0]));
+    EXPECT_EQ(expected.predecessor(keys[1]), built.predecessor(keys[1]));
+
+    EXPECT_TRUE(Tree::from_sorted({}).empty());
+}
+
+TYPED_TEST(VebTreeTest, ForEachReportsFullWidthKeys)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    // Two keys sharing a top-level cluster force a walk through the nested
+    // branches, whose own key type is narrower than the tree's.
+    Tree tree;
+    Key base = Tree::MAX_KEY - 0x10;
+    Key high = TypeParam::HIGH_KEY;
+    tree.insert(base);
+    tree.insert(base + 3);
+    tree.insert(high);
+    tree.insert(high + 1);
+
+    std::vector<Key> expected = {high, high + 1, base, base + 3};
+    EXPECT_EQ(expected, tree.to_vector());
+}
+
+TYPED_TEST(VebTreeTest, RangeAndParallelScansMatchForEach)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 5);
+    std::vector<Key> keys;
+    for (int i = 0; i < 20000; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+    Tree tree;
+    tree.batch_insert(keys);
+    auto all = tree.to_vector();
+
+    for (int i = 0; i < 64; ++i) {
+        Key lo = TypeParam::random_key(rng);
+        Key hi = TypeParam::random_key(rng);
+        if (i % 4 == 0) {
+            hi = lo + static_cast<Key>(rng() & TypeParam::NEAR_MASK);
+        }
+        if (lo > hi) {
+            std::swap(lo, hi);
+        }
+        std::vector<Key> got;
+        tree.for_each_range(lo, hi, [&](Key k) { got.push_back(k); });
+        std::vector<Key> want(
+            std::lower_bound(all.begin(), all.end(), lo),
+            std::upper_bound(all.begin(), all.end(), hi));
+        EXPECT_EQ(want, got);
+    }
+
+    for (unsigned threads : {1u, 3u, 8u}) {
+        std::atomic<std::size_t> visited{0};
+        std::atomic<Key> checksum{0};
+        tree.parallel_for_each(
+            [&](Key k) {
+                visited.fetch_add(1, std::memory_order_relaxed);
+                checksum.fetch_xor(k, std::memory_order_relaxed);
+            },
+            threads);
+        Key expected_checksum = 0;
+        for (auto k : all) {
+            expected_checksum ^= k;
+        }
+        EXPECT_EQ(all.size(), visited.load());
+        EXPECT_EQ(expected_checksum, checksum.load());
+
+        // Concatenating per-range vectors must reproduce sorted order.
+        auto ordered = tree.parallel_reduce(
+            std::vector<Key>{},
+            [](std::vector<Key> acc, Key k) {
+                acc.push_back(k);
+                return acc;
+            },
+            [](std::vector<Key> lhs, std::vector<Key> const &rhs) {
+                lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+                return lhs;
+            },
+            threads);
+        EXPECT_EQ(all, ordered);
+    }
+
+    Tree empty;
+    auto count = empty.parallel_reduce(
+        0u, [](unsigned acc, Key) { return acc + 1; }, std::plus<>(), 4);
+    EXPECT_EQ(0u, count);
+}
+
+TYPED_TEST(VebTreeTest, OrderStatisticsMatchSortedKeys)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 6);
+    std::vector<Key> keys;
+    for (int i = 0; i < 20000; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+    for (Key i = 0; i < 3000; ++i) {
+        keys.push_back(TypeParam::HIGH_KEY + i);
+    }
+
+    auto check = [&](Tree const &tree) {
+        auto all = tree.to_vector();
+        ASSERT_EQ(all.size(), tree.size());
+        for (int i = 0; i < 200; ++i) {
+            Key probe = TypeParam::random_key(rng);
+            auto expected = static_cast<std::size_t>(
+                std::lower_bound(all.begin(), all.end(), probe) - all.begin());
+            EXPECT_EQ(expected, tree.rank(probe));
+            if (!all.empty()) {
+                std::size_t k = rng() % all.size();
+                EXPECT_EQ(std::optional<Key>(all[k]), tree.select(k));
+                EXPECT_EQ(k, tree.rank(all[k]));
+            }
+            auto hi =
+                static_cast<Key>(probe + (rng() & TypeParam::NEAR_MASK));
+            if (hi >= probe) {
+                auto want = static_cast<std::size_t>(
+                    std::upper_bound(all.begin(), all.end(), hi) -
+                    std::lower_bound(all.begin(), all.end(), probe));
+                EXPECT_EQ(want, tree.count_range(probe, hi));
+            }
+        }
+        EXPECT_FALSE(tree.select(all.size()).has_value());
+    };
+
+    Tree tree;
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        tree.insert(keys[i]);
+    }
+    check(tree);
+    tree.batch_insert(keys);
+    check(tree);
+    for (std::size_t i = 0; i < keys.size(); i += 3) {
+        tree.erase(keys[i]);
+    }
+    check(tree);
+    std::vector<Key> doomed(keys.begin(), keys.begin() + keys.size() / 2);
+    tree.batch_erase(doomed);
+    check(tree);
+
+    Tree parallel;
+    parallel.parallel_insert(keys, 4);
+    check(parallel);
+    auto sorted = parallel.to_vector();
+    check(Tree::from_sorted(sorted));
+
+    tree.batch_erase(keys);
+    EXPECT_EQ(0u, tree.size());
+    EXPECT_EQ(0u, tree.rank(Tree::MAX_KEY));
+}
+
+TYPED_TEST(VebTreeTest, SelectOnTreesBelowTheIndexThreshold)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    // Too few clusters for a rank index, so select walks the summary.
+    std::mt19937_64 rng(TypeParam::BITS + 15);
+    Tree tree;
+    for (int i = 0; i < 60; ++i) {
+        Key key = TypeParam::random_key(rng);
+        tree.insert(key);
+        tree.insert(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+    tree.insert(Tree::MAX_KEY);
+    auto all = tree.to_vector();
+    for (std::size_t k = 0; k < all.size(); ++k) {
+        EXPECT_EQ(std::optional<Key>(all[k]), tree.select(k));
+    }
+    EXPECT_FALSE(tree.select(all.size()).has_value());
+}
+
+TYPED_TEST(VebTreeTest, IteratorsWalkKeysInOrder)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    static_assert(std::bidirectional_iterator<typename Tree::const_iterator>);
+    std::mt19937_64 rng(TypeParam::BITS + 7);
+    std::vector<Key> keys = {0, Tree::MAX_KEY};
+    for (int i = 0; i < 5000; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+        keys.push_back(key ^ 1);
+    }
+    Tree tree;
+    EXPECT_TRUE(tree.begin() == tree.end());
+    tree.batch_insert(keys);
+    auto all = tree.to_vector();
+
+    std::vector<Key> forward(tree.begin(), tree.end());
+    EXPECT_EQ(all, forward);
+
+    std::vector<Key> backward;
+    for (auto it = tree.end(); it != tree.begin();) {
+        backward.push_back(*--it);
+    }
+    std::reverse(backward.begin(), backward.end());
+    EXPECT_EQ(all, backward);
+
+    for (int i = 0; i < 500; ++i) {
+        Key probe = TypeParam::random_key(rng);
+        if (i % 2 == 0) {
+            probe = all[rng() % all.size()];
+        }
+        auto lower = std::lower_bound(all.begin(), all.end(), probe);
+        auto upper = std::upper_bound(all.begin(), all.end(), probe);
+        auto it = tree.lower_bound(probe);
+        auto jt = tree.upper_bound(probe);
+        ASSERT_EQ(lower == all.end(), it == tree.end());
+        ASSERT_EQ(upper == all.end(), jt == tree.end());
+        if (lower != all.end()) {
+            EXPECT_EQ(*lower, *it);
+            // Stepping either way from a seek matches the sorted keys.
+            if (std::next(lower) != all.end()) {
+                EXPECT_EQ(*std::next(lower), *std::next(it));
+            }
+            if (lower != all.begin()) {
+                EXPECT_EQ(*std::prev(lower), *std::prev(it));
+            }
+        }
+        if (upper != all.end()) {
+            EXPECT_EQ(*upper, *jt);
+        }
+    }
+    EXPECT_TRUE(tree.upper_bound(Tree::MAX_KEY) == tree.end());
+    EXPECT_EQ(Tree::MAX_KEY, *std::prev(tree.end()));
+}
+
+TYPED_TEST(VebTreeTest, EraseRangeMatchesSortedKeys)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 8);
+    std::vector<Key> keys;
+    for (int i = 0; i < 20000; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::NEAR_MASK));
+    }
+    for (Key i = 0; i < 3000; ++i) {
+        keys.push_back(TypeParam::HIGH_KEY + i * 7);
+    }
+    keys.push_back(0);
+    keys.push_back(Tree::MAX_KEY);
+    Tree tree;
+    tree.batch_insert(keys);
+    auto expected = tree.to_vector();
+
+    auto erase_expected = [&](Key lo, Key hi) {
+        auto first = std::lower_bound(expected.begin(), expected.end(), lo);
+        auto last = std::upper_bound(first, expected.end(), hi);
+        auto n = static_cast<std::size_t>(last - first);
+        expected.erase(first, last);
+        return n;
+    };
+    for (int i = 0; i < 200; ++i) {
+        Key lo = TypeParam::random_key(rng);
+        Key width = i % 3 == 0 ? 0xFF : TypeParam::WIDE_MASK;
+        auto hi = static_cast<Key>(lo + (rng() & width));
+        if (hi < lo || hi > Tree::MAX_KEY) {
+            hi = Tree::MAX_KEY;
+        }
+        ASSERT_EQ(erase_expected(lo, hi), tree.erase_range(lo, hi));
+    }
+    EXPECT_EQ(0u, tree.erase_range(5, 4));
+    ASSERT_EQ(expected, tree.to_vector());
+    ASSERT_EQ(expected.size(), tree.size());
+    for (int i = 0; i < 100; ++i) {
+        std::size_t k = rng() % expected.size();
+        EXPECT_EQ(k, tree.rank(expected[k]));
+    }
+
+    Key cutoff = expected[expected.size() / 2];
+    EXPECT_EQ(erase_expected(0, cutoff - 1), tree.erase_below(cutoff));
+    EXPECT_EQ(expected, tree.to_vector());
+    EXPECT_EQ(std::optional<Key>(cutoff), tree.min());
+    EXPECT_EQ(0u, tree.erase_below(0));
+
+    std::size_t rest = expected.size();
+    EXPECT_EQ(rest, tree.erase_range(0, Tree::MAX_KEY));
+    EXPECT_TRUE(tree.empty());
+    EXPECT_EQ(0u, tree.size());
+    tree.insert(42);
+    EXPECT_EQ(std::optional<Key>(42), tree.min());
+}
+
+TYPED_TEST(VebTreeTest, SetAlgebraMatchesStdAlgorithms)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    std::mt19937_64 rng(TypeParam::BITS + 9);
+    std::vector<Key> a_keys;
+    std::vector<Key> b_keys;
+    for (int i = 0; i < 10000; ++i) {
+        Key key = TypeParam::random_key(rng);
+        a_keys.push_back(key);
+        // Shared keys, keys in shared clusters and keys of b alone.
+        if (i % 3 == 0) {
+            b_keys.push_back(key);
+        }
+        b_keys.push_back(key ^ static_cast<Key>(rng() & TypeParam::WIDE_MASK));
+        b_keys.push_back(TypeParam::random_key(rng));
+    }
+    a_keys.push_back(Tree::MAX_KEY);
+    b_keys.push_back(0);
+    Tree a;
+    Tree b;
+    a.batch_insert(a_keys);
+    b.batch_insert(b_keys);
+    auto av = a.to_vector();
+    auto bv = b.to_vector();
+
+    auto expect_set = [&](Tree const &tree, auto algorithm) {
+        std::vector<Key> want;
+        algorithm(
+            av.begin(), av.end(), bv.begin(), bv.end(),
+            std::back_inserter(want));
+        ASSERT_EQ(want, tree.to_vector());
+        ASSERT_EQ(want.size(), tree.size());
+        for (std::size_t k = 0; k < want.size(); k += 97) {
+            EXPECT_EQ(k, tree.rank(want[k]));
+        }
+    };
+    auto set_union = [](auto... args) { return std::set_union(args...); };
+    auto set_intersection = [](auto... args) {
+        return std::set_intersection(args...);
+    };
+    auto set_difference = [](auto... args) {
+        return std::set_difference(args...);
+    };
+    auto symmetric_difference = [](auto... args) {
+        return std::set_symmetric_difference(args...);
+    };
+
+    expect_set(Tree::set_union(a, b), set_union);
+    expect_set(Tree::set_intersection(a, b), set_intersection);
+    expect_set(Tree::set_difference(a, b), set_difference);
+    expect_set(Tree::symmetric_difference(a, b), symmetric_difference);
+
+    Tree c = a;
+    c.union_with(b);
+    expect_set(c, set_union);
+    c = a;
+    c.intersect_with(b);
+    expect_set(c, set_intersection);
+    c = a;
+    c.difference_with(b);
+    expect_set(c, set_difference);
+    c = a;
+    c.symmetric_difference_with(b);
+    expect_set(c, symmetric_difference);
+    // The copies must not share clusters with the original.
+    EXPECT_EQ(av, a.to_vector());
+
+    c.symmetric_difference_with(c);
+    EXPECT_TRUE(c.empty());
+    c = b;
+    c.union_with(c);
+    c.intersect_with(c);
+    EXPECT_EQ(bv, c.to_vector());
+    c.intersect_with(Tree{});
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(0u, c.size());
+}
+
+TYPED_TEST(VebTreeTest, ClearReleasesNodesForReuse)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    // The default slab-backed tree and the per-node heap policy must hold
+    // the same keys through inserts, erases and a clear.
+    using HeapTree = VebBranch<
+        TypeParam::BITS, (TypeParam::BITS > 32), veb_detail::HeapNodes>;
+    std::mt19937_64 rng(TypeParam::BITS + 10);
+    std::vector<Key> keys;
+    for (int i = 0; i < 30000; ++i) {
+        Key key = TypeParam::random_key(rng);
+        keys.push_back(key);
+        keys.push_back(static_cast<Key>(key ^ (rng() & 0x3FF)));
+    }
+    Tree tree;
+    HeapTree heap;
+    for (int round = 0; round < 2; ++round) {
+        for (Key key : keys) {
+            heap.insert(key);
+            tree.insert(key);
+        }
+        for (std::size_t i = 0; i < keys.size(); i += 3) {
+            heap.erase(keys[i]);
+            tree.erase(keys[i]);
+        }
+        std::vector<Key> heap_keys;
+        heap.for_each([&](Key key) { heap_keys.push_back(key); });
+        ASSERT_EQ(heap_keys, tree.to_vector());
+        ASSERT_EQ(heap.size(), tree.size());
+
+        tree.clear();
+        heap.clear();
+        EXPECT_TRUE(tree.empty());
+        EXPECT_TRUE(heap.empty());
+        EXPECT_EQ(0u, tree.size());
+        EXPECT_FALSE(tree.contains(keys.front()));
+        EXPECT_EQ(std::nullopt, tree.min());
+    }
+    tree.insert(keys.back());
+    EXPECT_EQ(std::vector<Key>{keys.back()}, tree.to_vector());
+}
+
+TYPED_TEST(VebTreeTest, SnapshotRoundTrip)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    Tree tree;
+    std::mt19937_64 rng(TypeParam::BITS + 11);
+    // A dense run fills whole leaves; scattered keys leave single-key
+    // clusters stored inline.
+    for (Key key = 1000; key < 5000; ++key) {
+        tree.insert(key);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        tree.insert(TypeParam::random_key(rng));
+    }
+    tree.insert(Tree::MAX_KEY);
+
+    std::stringstream stream;
+    tree.save(stream);
+    auto loaded = Tree::load(stream);
+    EXPECT_EQ(tree.size(), loaded.size());
+    EXPECT_EQ(tree.to_vector(), loaded.to_vector());
+    EXPECT_EQ(tree.min(), loaded.min());
+    EXPECT_EQ(tree.max(), loaded.max());
+    EXPECT_EQ(tree.successor(5000), loaded.successor(5000));
+    EXPECT_EQ(tree.rank(Tree::MAX_KEY), loaded.rank(Tree::MAX_KEY));
+
+    // The reloaded tree is an ordinary tree.
+    loaded.erase(Tree::MAX_KEY);
+    loaded.insert(999);
+    EXPECT_FALSE(loaded.contains(Tree::MAX_KEY));
+    EXPECT_TRUE(loaded.contains(999));
+
+    std::stringstream empty_stream;
+    Tree().save(empty_stream);
+    EXPECT_TRUE(Tree::load(empty_stream).empty());
+
+    std::string bytes = stream.str();
+    std::stringstream truncated(bytes.substr(0, bytes.size() / 2));
+    EXPECT_THROW(Tree::load(truncated), std::runtime_error);
+    std::stringstream garbage("not a snapshot at all");
+    EXPECT_THROW(Tree::load(garbage), std::runtime_error);
+}
+
+TYPED_TEST(VebTreeTest, FrozenImageMatchesTree)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    using Frozen = FrozenVeb<TypeParam::BITS>;
+    Tree tree;
+    std::mt19937_64 rng(TypeParam::BITS + 12);
+    for (Key key = 70000; key < 72000; key += 3) {
+        tree.insert(key);
+    }
+    for (int i = 0; i < 3000; ++i) {
+        tree.insert(TypeParam::random_key(rng));
+    }
+    tree.insert(0);
+    tree.insert(Tree::MAX_KEY);
+
+    auto image = Frozen::freeze(tree);
+    auto path = std::filesystem::temp_directory_path() /
+                ("veb" + std::to_string(TypeParam::BITS) + "_frozen.bin");
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        image.write(out);
+    }
+    auto mapped = FrozenImage::map(path.c_str());
+    std::filesystem::remove(path);
+
+    for (Frozen frozen : {Frozen(image), Frozen(mapped)}) {
+        EXPECT_EQ(tree.size(), frozen.size());
+        EXPECT_EQ(tree.to_vector(), frozen.to_vector());
+        EXPECT_EQ(tree.min(), frozen.min());
+        EXPECT_EQ(tree.max(), frozen.max());
+        std::vector<Key> probes{0, 1, 70000, 70001, 71999, Tree::MAX_KEY};
+        for (int i = 0; i < 2000; ++i) {
+            probes.push_back(TypeParam::random_key(rng));
+        }
+        for (Key x : probes) {
+            EXPECT_EQ(tree.contains(x), frozen.contains(x));
+            EXPECT_EQ(tree.successor(x), frozen.successor(x));
+            EXPECT_EQ(tree.predecessor(x), frozen.predecessor(x));
+        }
+    }
+
+    auto empty_image = Frozen::freeze(Tree());
+    Frozen empty(empty_image);
+    EXPECT_TRUE(empty.empty());
+    EXPECT_FALSE(empty.contains(0));
+    EXPECT_FALSE(empty.successor(0));
+
+    auto bytes = image.bytes();
+    EXPECT_THROW(Frozen(bytes.first(32)), std::runtime_error);
+    EXPECT_THROW(Frozen(bytes.subspan(64)), std::runtime_error);
+}
+
+TYPED_TEST(VebTreeTest, ConcurrentTreeMatchesSerial)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    using Concurrent = ConcurrentVebTree<TypeParam::BITS>;
+    // Sparse widths get more shards than pool sets, so shards share their
+    // sets' pools.
+    Concurrent concurrent(
+        TypeParam::BITS > 32 ? 10 : Concurrent::DEFAULT_SHARD_BITS);
+    Tree serial;
+    std::mt19937_64 rng(TypeParam::BITS + 13);
+    std::vector<Key> keys(20000);
+    for (auto &key : keys) {
+        key = TypeParam::random_key(rng);
+        serial.insert(key);
+    }
+
+    unsigned const thread_count = 4;
+    auto run = [&](auto &&op) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t] {
+                for (std::size_t i = t; i < keys.size(); i += thread_count) {
+                    op(i);
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+    // Readers run alongside the writers.
+    run([&](std::size_t i) {
+        concurrent.insert(keys[i]);
+        (void)concurrent.successor(keys[i]);
+    });
+    EXPECT_EQ(serial.size(), concurrent.size());
+    EXPECT_EQ(serial.to_vector(), concurrent.to_vector());
+    EXPECT_EQ(serial.min(), concurrent.min());
+    EXPECT_EQ(serial.max(), concurrent.max());
+    for (int i = 0; i < 2000; ++i) {
+        Key x = TypeParam::random_key(rng);
+        EXPECT_EQ(serial.contains(x), concurrent.contains(x));
+        EXPECT_EQ(serial.successor(x), concurrent.successor(x));
+        EXPECT_EQ(serial.predecessor(x), concurrent.predecessor(x));
+    }
+
+    run([&](std::size_t i) {
+        if (i % 2 == 0) {
+            concurrent.erase(keys[i]);
+        }
+        (void)concurrent.predecessor(keys[i]);
+    });
+    for (std::size_t i = 0; i < keys.size(); i += 2) {
+        serial.erase(keys[i]);
+    }
+    EXPECT_EQ(serial.to_vector(), concurrent.to_vector());
+
+    concurrent.clear();
+    EXPECT_TRUE(concurrent.empty());
+    EXPECT_FALSE(concurrent.min());
+    EXPECT_FALSE(concurrent.successor(0));
+
+    // Refilling after the clear reuses the nodes the shards freed into
+    // their pools.
+    run([&](std::size_t i) { concurrent.insert(keys[i]); });
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    EXPECT_EQ(keys, concurrent.to_vector());
+}
+
+TYPED_TEST(VebTreeTest, SentinelQueriesMatchOptionalQueries)
+{
+    using Tree = typename TypeParam::Tree;
+    using Key = typename TypeParam::Key;
+    Key const max_key = Tree::MAX_KEY;
+    Tree tree;
+    EXPECT_EQ(tree.min_or(7), 7u);
+    EXPECT_EQ(tree.max_or(7), 7u);
+    EXPECT_EQ(tree.successor_or(0, 7), 7u);
+    EXPECT_EQ(tree.predecessor_or(max_key, 7), 7u);
+
+    // Runs of nearby keys fill clusters and leaves; the spread-out ones
+    // leave single-key clusters.
+    std::mt19937_64 rng(TypeParam::BITS + 14);
+    std::vector<Key> keys{0, max_key};
+    for (int i = 0; i < 300; ++i) {
+        Key base = TypeParam::random_key(rng);
+        keys.push_back(base);
+        for (int j = 0; j < 50; ++j) {
+            keys.push_back(base ^ static_cast<Key>(rng() & 0xFFF));
+        }
+    }
+    for (Key key : keys) {
+        tree.insert(key);
+    }
+    EXPECT_EQ(tree.min_or(7), 0u);
+    EXPECT_EQ(tree.max_or(7), max_key);
+
+    std::vector<Key> probes{0, 1, max_key - 1, max_key};
+    for (Key key : keys) {
+        probes.push_back(key);
+        probes.push_back(key == max_key ? key : key + 1);
+        probes.push_back(key == 0 ? key : key - 1);
+    }
+    for (Key probe : probes) {
+        EXPECT_EQ(
+            tree.successor_or(probe, 0), tree.successor(probe).value_or(0));
+        EXPECT_EQ(
+            tree.predecessor_or(probe, max_key),
+            tree.predecessor(probe).value_or(max_key));
+    }
+
+    tree.erase(0);
+    tree.erase(max_key);
+    EXPECT_EQ(tree.predecessor_or(1, 7), 7u);
+    EXPECT_EQ(tree.successor_or(max_key - 1, 7), 7u);
+    EXPECT_EQ(tree.min_or(0), *tree.min());
+    EXPECT_EQ(tree.max_or(0), *tree.max());
+
+    // Where Key has room above MAX_KEY, min_or and max_or have a marker
+    // that no stored key can collide with.
+    if constexpr (Tree::MAX_KEY < std::numeric_limits<Key>::max()) {
+        Key const none = max_key + 1;
+        EXPECT_EQ(tree.min_or(none), *tree.min());
+        EXPECT_EQ(tree.max_or(none), *tree.max());
+        tree.clear();
+        EXPECT_EQ(tree.min_or(none), none);
+        EXPECT_EQ(tree.max_or(none), none);
+    }
+}